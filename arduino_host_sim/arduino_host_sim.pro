@@ -0,0 +1,35 @@
+#-------------------------------------------------
+#
+# Host (PC) build of the autonomous keg meter firmware, for benchmarking and simulating it without
+# a board. The sketch sources are built as they are, against the shims of the Arduino core and the
+# NeoPixel library in shims/.
+#
+#-------------------------------------------------
+
+QT       -= core gui
+CONFIG   += console c++11
+CONFIG   -= qt app_bundle
+
+TARGET = keg_meter_sim
+TEMPLATE = app
+
+SKETCH_DIR = $$PWD/../autonomous_arduino_keg_meter
+
+INCLUDEPATH += $$PWD/shims $$SKETCH_DIR
+DEPENDPATH  += $$PWD/shims $$SKETCH_DIR
+
+SOURCES += keg_meter_sim.cpp \
+    autonomous_sketch.cpp \
+    shims/arduino_shims.cpp \
+    shims/adafruit_neopixel.cpp \
+    $$SKETCH_DIR/keg_load_meter.cpp \
+    $$SKETCH_DIR/keg_meter_protocol.cpp \
+    $$SKETCH_DIR/task_scheduler.cpp \
+    $$SKETCH_DIR/led_renderer.cpp
+
+HEADERS  += autonomous_sketch.h \
+    shims/Arduino.h \
+    shims/Adafruit_NeoPixel.h \
+    shims/host_sim.h
+
+OTHER_FILES += $$SKETCH_DIR/autonomous_arduino_keg_meter.ino
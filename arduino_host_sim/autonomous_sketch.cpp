@@ -0,0 +1,72 @@
+// Builds the autonomous keg meter sketch as it is, with every KegLoadMeter::tick timed.
+
+#include "autonomous_sketch.h"
+#include "host_sim.h"
+#include "keg_load_meter.h"
+
+namespace {
+  AutonomousSketch::TickHandler tickHandler = NULL;
+}
+
+class ProfiledKegLoadMeter : public KegLoadMeter {
+public:
+  ProfiledKegLoadMeter(uint8_t meterIdx, LedRenderer& leds) : KegLoadMeter(meterIdx, leds) {}
+
+  void tick(uint32_t frameDeltaMillis, float approxLoadInKg) {
+    uint64_t startCycles = HostSim::readCycles();
+    KegLoadMeter::tick(frameDeltaMillis, approxLoadInKg);
+    uint64_t numCycles = HostSim::readCycles() - startCycles;
+    if (tickHandler != NULL) {
+      tickHandler(numCycles);
+    }
+  }
+};
+
+// The Arduino IDE generates these prototypes for a sketch, we have to do it ourselves
+void sampleTask(uint32_t elapsedMicros);
+void filterTask(uint32_t elapsedMicros);
+void renderTask(uint32_t elapsedMicros);
+void telemetryTask(uint32_t elapsedMicros);
+void readSerialCommands();
+void resetSerialCommand();
+void readSerialCommandChar(char serialReadByte);
+void readSerialNumberChar(char serialReadByte);
+uint8_t getSerialNumberWidth();
+void finishSerialNumber();
+void dispatchSerialCommand();
+void doEmptyCalibrationToAllKegs();
+void getLoadSensorReading(uint8_t kegIdx, float smoothing, float* loadValueInKg);
+void setKegType(ProfiledKegLoadMeter& kegMeter, char kegType);
+void printKegTypeSetMsg(const ProfiledKegLoadMeter& kegMeter, const char* typeName);
+
+#define KegLoadMeter ProfiledKegLoadMeter
+#include "autonomous_arduino_keg_meter.ino"
+#undef KegLoadMeter
+
+int AutonomousSketch::getNumKegs() {
+  return NUM_KEGS;
+}
+
+uint8_t AutonomousSketch::getInputPin(int kegIdx) {
+  return kegInputPins[kegIdx];
+}
+
+Adafruit_NeoPixel& AutonomousSketch::getStrip() {
+  return strip;
+}
+
+const LedRenderer& AutonomousSketch::getRenderer() {
+  return leds;
+}
+
+const TaskScheduler& AutonomousSketch::getScheduler() {
+  return scheduler;
+}
+
+float AutonomousSketch::loadToAnalog(float loadInKg) {
+  return mapfloat(loadInKg, loadA, loadB, analogvalA, analogvalB);
+}
+
+void AutonomousSketch::setTickHandler(TickHandler handler) {
+  tickHandler = handler;
+}
@@ -0,0 +1,29 @@
+#ifndef ARDUINO_HOST_SIM_AUTONOMOUS_SKETCH_H_
+#define ARDUINO_HOST_SIM_AUTONOMOUS_SKETCH_H_
+
+#include <stdint.h>
+
+class Adafruit_NeoPixel;
+class TaskScheduler;
+class LedRenderer;
+
+// The autonomous keg meter sketch, built for the host (see autonomous_sketch.cpp)
+void setup();
+void loop();
+
+namespace AutonomousSketch {
+  int getNumKegs();
+  uint8_t getInputPin(int kegIdx);
+  Adafruit_NeoPixel& getStrip();
+  const LedRenderer& getRenderer();
+  const TaskScheduler& getScheduler();
+
+  // The analog reading the sketch turns into the given load, going by its calibration
+  float loadToAnalog(float loadInKg);
+
+  // Called with the CPU time (see HostSim::readCycles) of every KegLoadMeter::tick
+  typedef void (*TickHandler)(uint64_t cycles);
+  void setTickHandler(TickHandler handler);
+}
+
+#endif // ARDUINO_HOST_SIM_AUTONOMOUS_SKETCH_H_
@@ -0,0 +1,294 @@
+// Runs the autonomous keg meter sketch on the host against a synthetic or recorded load curve, and
+// reports what the firmware's hot path costs: CPU time per KegLoadMeter::tick, loop() time (in
+// virtual time, i.e. what it would take on the board), how the sketch's tasks keep up, LED frames
+// (and the ones the renderer skipped) and serial output.
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "autonomous_sketch.h"
+#include "host_sim.h"
+#include "Adafruit_NeoPixel.h"
+#include "task_scheduler.h"
+#include "led_renderer.h"
+
+namespace {
+  // The synthetic curve: the scale starts out empty, then a full corny keg goes on and, after a
+  // while, gets poured from at a steady pace until it's empty
+  const double KEG_ON_TIME_S = 20;
+  const double FIRST_POUR_TIME_S = 120;
+  const double POUR_INTERVAL_S = 30;
+  const double POUR_DURATION_S = 5;
+  const double POUR_MASS_KG = 0.4;
+  const double EMPTY_KEG_MASS_KG = 4.4;
+  const double FULL_KEG_MASS_KG = EMPTY_KEG_MASS_KG + 19.0;
+  const double KEG_STAGGER_S = 7; // So the kegs of a multi-keg sketch don't all move in lockstep
+
+  struct Options {
+    double durationS;
+    double noiseKg;
+    unsigned int seed;
+    std::string loadCurvePath;
+    bool echoSerial;
+
+    Options() : durationS(600), noiseKg(0.05), seed(1), echoSerial(false) {}
+  };
+
+  // A recorded load curve: "<time in ms>,<load in kg>[,<load in kg>...]" per line, one load for
+  // every keg. Every row holds until the next one.
+  struct LoadCurve {
+    std::vector<uint64_t> timesMs;
+    std::vector<std::vector<double> > loads;
+    size_t rowIdx;
+
+    LoadCurve() : rowIdx(0) {}
+
+    bool load(const std::string& path) {
+      std::ifstream file(path.c_str());
+      if (!file) {
+        return false;
+      }
+      std::string line;
+      while (std::getline(file, line)) {
+        if (line.empty() || line[0] == '#') {
+          continue;
+        }
+        std::istringstream fields(line);
+        std::string field;
+        std::vector<double> rowLoads;
+        if (!std::getline(fields, field, ',')) {
+          continue;
+        }
+        uint64_t timeMs = strtoull(field.c_str(), NULL, 10);
+        while (std::getline(fields, field, ',')) {
+          rowLoads.push_back(atof(field.c_str()));
+        }
+        if (!rowLoads.empty() && (this->timesMs.empty() || timeMs >= this->timesMs.back())) {
+          this->timesMs.push_back(timeMs);
+          this->loads.push_back(rowLoads);
+        }
+      }
+      return !this->timesMs.empty();
+    }
+
+    // Times only ever go forward, so this just walks along the rows
+    double getLoad(uint64_t timeMs, int kegIdx) {
+      while (this->rowIdx + 1 < this->timesMs.size() && this->timesMs[this->rowIdx + 1] <= timeMs) {
+        this->rowIdx++;
+      }
+      const std::vector<double>& rowLoads = this->loads[this->rowIdx];
+      return rowLoads[kegIdx < (int)rowLoads.size() ? kegIdx : rowLoads.size() - 1];
+    }
+  };
+
+  struct PendingCommand {
+    uint64_t timeMs;
+    std::string text;
+  };
+
+  std::vector<uint64_t> tickCycles;
+
+  void onTick(uint64_t cycles) {
+    tickCycles.push_back(cycles);
+  }
+
+  void onSerialOutput(const uint8_t* data, size_t size) {
+    // Binary frames would only make a mess of the terminal
+    for (size_t i = 0; i < size; i++) {
+      if (data[i] == '\n' || data[i] == '\r' || (data[i] >= 0x20 && data[i] < 0x7F)) {
+        putchar(data[i]);
+      }
+      else {
+        printf("\\x%02X", data[i]);
+      }
+    }
+  }
+
+  double getSyntheticLoad(double timeS, int kegIdx) {
+    timeS -= kegIdx * KEG_STAGGER_S;
+    if (timeS < KEG_ON_TIME_S) {
+      return 0;
+    }
+    if (timeS < KEG_ON_TIME_S + 1) {
+      return FULL_KEG_MASS_KG * (timeS - KEG_ON_TIME_S);
+    }
+    if (timeS < FIRST_POUR_TIME_S) {
+      return FULL_KEG_MASS_KG;
+    }
+
+    double pourTimeS = timeS - FIRST_POUR_TIME_S;
+    double numPours = floor(pourTimeS / POUR_INTERVAL_S);
+    double pourProgress = std::min(1.0, (pourTimeS - numPours * POUR_INTERVAL_S) / POUR_DURATION_S);
+    return std::max(EMPTY_KEG_MASS_KG, FULL_KEG_MASS_KG - (numPours + pourProgress) * POUR_MASS_KG);
+  }
+
+  uint64_t getPercentile(std::vector<uint64_t>& values, double percentile) {
+    if (values.empty()) {
+      return 0;
+    }
+    size_t idx = std::min(values.size() - 1, (size_t)(percentile / 100.0 * values.size()));
+    std::nth_element(values.begin(), values.begin() + idx, values.end());
+    return values[idx];
+  }
+
+  void printUsage(const char* appName) {
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  --duration <s>       Simulated time (default: 600)\n"
+            "  --load-curve <file>  Loads from a file of \"<time in ms>,<load in kg>[,...]\" lines\n"
+            "                       instead of the synthetic curve\n"
+            "  --noise <kg>         Standard deviation of the noise on the load (default: 0.05)\n"
+            "  --seed <n>           Seed for the noise (default: 1)\n"
+            "  --send <ms>:<text>   Send text to the sketch at the given time, e.g. 500:|Ea\n"
+            "  --echo-serial        Print everything the sketch writes to its serial port\n",
+            appName);
+  }
+}
+
+int main(int argc, char* argv[]) {
+  Options options;
+  std::vector<PendingCommand> commands;
+  for (int i = 1; i < argc; i++) {
+    bool hasValue = (i + 1 < argc);
+    if (strcmp(argv[i], "--duration") == 0 && hasValue) {
+      options.durationS = atof(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--load-curve") == 0 && hasValue) {
+      options.loadCurvePath = argv[++i];
+    }
+    else if (strcmp(argv[i], "--noise") == 0 && hasValue) {
+      options.noiseKg = atof(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--seed") == 0 && hasValue) {
+      options.seed = strtoul(argv[++i], NULL, 10);
+    }
+    else if (strcmp(argv[i], "--send") == 0 && hasValue) {
+      const char* arg = argv[++i];
+      const char* separator = strchr(arg, ':');
+      if (separator == NULL) {
+        printUsage(argv[0]);
+        return 1;
+      }
+      PendingCommand command;
+      command.timeMs = strtoull(arg, NULL, 10);
+      command.text = separator + 1;
+      commands.push_back(command);
+    }
+    else if (strcmp(argv[i], "--echo-serial") == 0) {
+      options.echoSerial = true;
+    }
+    else {
+      printUsage(argv[0]);
+      return 1;
+    }
+  }
+
+  LoadCurve loadCurve;
+  if (!options.loadCurvePath.empty() && !loadCurve.load(options.loadCurvePath)) {
+    fprintf(stderr, "Failed to read a load curve from %s\n", options.loadCurvePath.c_str());
+    return 1;
+  }
+
+  std::mt19937 random(options.seed);
+  std::normal_distribution<double> noise(0.0, options.noiseKg > 0 ? options.noiseKg : 1.0);
+
+  AutonomousSketch::setTickHandler(onTick);
+  if (options.echoSerial) {
+    HostSim::setSerialOutputHandler(onSerialOutput);
+  }
+
+  std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+  setup();
+
+  // Commands go out once the sketch has set up its serial port, so they arrive at its baud rate
+  for (size_t i = 0; i < commands.size(); i++) {
+    HostSim::queueSerialInput(commands[i].timeMs * 1000, (const uint8_t*)commands[i].text.data(), commands[i].text.size());
+  }
+
+  int numKegs = AutonomousSketch::getNumKegs();
+  uint64_t durationMicros = (uint64_t)(options.durationS * 1e6);
+  uint64_t numLoops = 0;
+  uint64_t totalLoopCycles = 0;
+  uint64_t totalLoopMicros = 0;
+  uint64_t maxLoopMicros = 0;
+  uint64_t loopStartMicros = HostSim::getMicros();
+  while (loopStartMicros < durationMicros) {
+    // The sensors are sampled at whatever time the loop gets to them
+    for (int kegIdx = 0; kegIdx < numKegs; kegIdx++) {
+      double loadInKg = loadCurve.timesMs.empty() ? getSyntheticLoad(loopStartMicros / 1e6, kegIdx)
+                                                  : loadCurve.getLoad(loopStartMicros / 1000, kegIdx);
+      if (options.noiseKg > 0) {
+        loadInKg += noise(random);
+      }
+      HostSim::setAnalogInput(AutonomousSketch::getInputPin(kegIdx), (int)lround(AutonomousSketch::loadToAnalog(loadInKg)));
+    }
+
+    uint64_t startCycles = HostSim::readCycles();
+    loop();
+    totalLoopCycles += HostSim::readCycles() - startCycles;
+    numLoops++;
+
+    uint64_t loopEndMicros = HostSim::getMicros();
+    totalLoopMicros += loopEndMicros - loopStartMicros;
+    maxLoopMicros = std::max(maxLoopMicros, loopEndMicros - loopStartMicros);
+
+    // The board would just keep spinning through loop() until the next task is due, we skip ahead
+    HostSim::advanceMicros(AutonomousSketch::getScheduler().getMicrosUntilDue());
+    loopStartMicros = HostSim::getMicros();
+  }
+  double hostSecs = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+
+  if (options.echoSerial) {
+    printf("\n");
+  }
+
+  const Adafruit_NeoPixel& strip = AutonomousSketch::getStrip();
+  double simulatedSecs = HostSim::getMicros() / 1e6;
+  uint64_t numTicks = tickCycles.size();
+  uint64_t totalTickCycles = 0;
+  for (size_t i = 0; i < tickCycles.size(); i++) {
+    totalTickCycles += tickCycles[i];
+  }
+  const char* cycleUnit = HostSim::getCycleUnit();
+
+  printf("Simulated %.1f s of the autonomous sketch (%d keg(s), %d LEDs) in %.2f s\n",
+         simulatedSecs, numKegs, strip.numPixels(), hostSecs);
+  printf("loop():  %llu iterations, %.3f ms mean, %.3f ms worst case (board time), %.0f %s mean, busy %.1f%% of the time\n",
+         (unsigned long long)numLoops, totalLoopMicros / 1000.0 / std::max<uint64_t>(1, numLoops), maxLoopMicros / 1000.0,
+         (double)totalLoopCycles / std::max<uint64_t>(1, numLoops), cycleUnit,
+         100.0 * totalLoopMicros / std::max<uint64_t>(1, HostSim::getMicros()));
+  const TaskScheduler& scheduler = AutonomousSketch::getScheduler();
+  for (uint8_t i = 0; i < scheduler.getNumTasks(); i++) {
+    printf("Task %-10s %llu runs, %llu overruns, %.3f ms worst case (board time)\n",
+           (std::string(scheduler.getName(i)) + ":").c_str(), (unsigned long long)scheduler.getNumRuns(i),
+           (unsigned long long)scheduler.getNumOverruns(i), scheduler.getMaxRunMicros(i) / 1000.0);
+  }
+  printf("tick():  %llu calls, %.0f %s mean, %llu p50, %llu p99, %llu max\n",
+         (unsigned long long)numTicks, (double)totalTickCycles / std::max<uint64_t>(1, numTicks), cycleUnit,
+         (unsigned long long)getPercentile(tickCycles, 50), (unsigned long long)getPercentile(tickCycles, 99),
+         (unsigned long long)getPercentile(tickCycles, 100));
+  printf("LEDs:    %u frames shown, %u of them changed, interrupts blocked for %.1f s (%.1f%% of the time)\n",
+         strip.getNumShows(), strip.getNumChangedShows(), strip.getShowMicros() / 1e6,
+         100.0 * strip.getShowMicros() / std::max<uint64_t>(1, HostSim::getMicros()));
+
+  // Every show takes as long, so each unchanged frame the renderer skipped saved one of them
+  const LedRenderer& renderer = AutonomousSketch::getRenderer();
+  uint64_t savedShowMicros = (uint64_t)renderer.getNumSkippedFrames() *
+    (strip.numPixels() * Adafruit_NeoPixel::MICROS_PER_PIXEL + Adafruit_NeoPixel::LATCH_MICROS);
+  printf("         %u of %u frames skipped as unchanged, saving %.1f ms of blocked interrupts (%.1f%% of the time)\n",
+         renderer.getNumSkippedFrames(), renderer.getNumFrames(), savedShowMicros / 1000.0,
+         100.0 * savedShowMicros / std::max<uint64_t>(1, HostSim::getMicros()));
+  printf("Serial:  %llu bytes in %llu lines out (%.1f bytes/s), %llu input byte(s) never read\n",
+         (unsigned long long)HostSim::getNumSerialBytesOut(), (unsigned long long)HostSim::getNumSerialLinesOut(),
+         HostSim::getNumSerialBytesOut() / std::max(1e-6, simulatedSecs), (unsigned long long)HostSim::getNumSerialInputPending());
+  return 0;
+}
@@ -0,0 +1,60 @@
+#ifndef ARDUINO_HOST_SIM_ADAFRUIT_NEOPIXEL_H_
+#define ARDUINO_HOST_SIM_ADAFRUIT_NEOPIXEL_H_
+
+// Stand-in for the Adafruit NeoPixel library on the host (see host_sim.h). Pixels are kept in
+// memory, show() keeps count of the frames instead of sending them, and takes as long (in virtual
+// time) as sending them to WS2812 pixels would: interrupts are off for all of it on a real board.
+
+#include "Arduino.h"
+
+typedef uint16_t neoPixelType;
+
+#define NEO_RGB    ((0 << 6) | (0 << 4) | (1 << 2) | (2))
+#define NEO_GRB    ((1 << 6) | (1 << 4) | (0 << 2) | (2))
+#define NEO_KHZ800 0x0000
+#define NEO_KHZ400 0x0100
+
+class Adafruit_NeoPixel {
+public:
+  // Every pixel takes 24 bits at 800 kHz, and the strip needs a quiet line to latch the frame
+  static const uint32_t MICROS_PER_PIXEL = 30;
+  static const uint32_t LATCH_MICROS = 50;
+
+  Adafruit_NeoPixel(uint16_t numPixels, uint8_t pin = 6, neoPixelType type = NEO_GRB + NEO_KHZ800);
+  Adafruit_NeoPixel(const Adafruit_NeoPixel& other);
+  ~Adafruit_NeoPixel();
+
+  void begin() {}
+  void show();
+  void setPin(uint8_t pin) { this->pin = pin; }
+  void setPixelColor(uint16_t idx, uint8_t r, uint8_t g, uint8_t b);
+  void setPixelColor(uint16_t idx, uint32_t colour);
+  void setBrightness(uint8_t brightness) { this->brightness = brightness; }
+  void clear() { memset(this->pixels, 0, this->numPixelsTotal * sizeof(uint32_t)); }
+
+  uint16_t numPixels() const { return this->numPixelsTotal; }
+  uint32_t getPixelColor(uint16_t idx) const { return idx < this->numPixelsTotal ? this->pixels[idx] : 0; }
+  uint8_t getBrightness() const { return this->brightness; }
+
+  static uint32_t Color(uint8_t r, uint8_t g, uint8_t b) { return ((uint32_t)r << 16) | ((uint32_t)g << 8) | b; }
+
+  // Host only: what show() has done so far
+  uint32_t getNumShows() const { return this->numShows; }
+  uint32_t getNumChangedShows() const { return this->numChangedShows; }
+  uint64_t getShowMicros() const { return this->showMicros; }
+
+private:
+  Adafruit_NeoPixel& operator=(const Adafruit_NeoPixel&);
+
+  uint16_t numPixelsTotal;
+  uint8_t pin;
+  uint8_t brightness;
+  uint32_t* pixels;
+  uint32_t* shownPixels;
+
+  uint32_t numShows;
+  uint32_t numChangedShows;
+  uint64_t showMicros;
+};
+
+#endif // ARDUINO_HOST_SIM_ADAFRUIT_NEOPIXEL_H_
@@ -0,0 +1,134 @@
+#ifndef ARDUINO_HOST_SIM_ARDUINO_H_
+#define ARDUINO_HOST_SIM_ARDUINO_H_
+
+// Just enough of the Arduino core for the keg meter sketches to build and run on the host (see
+// host_sim.h). Time is virtual: it only moves when the sketch waits for something (delay, serial
+// timeouts, strip.show) or reads the clock, so runs are repeatable and as fast as the host allows.
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <type_traits>
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+#define HIGH 0x1
+#define LOW  0x0
+
+#define INPUT        0x0
+#define OUTPUT       0x1
+#define INPUT_PULLUP 0x2
+
+#define DEC 10
+#define HEX 16
+#define OCT 8
+#define BIN 2
+
+#define PI 3.1415926535897932384626433832795
+
+// Templates rather than the AVR core's macros, so the standard headers can still be used with them
+template <typename A, typename B>
+inline typename std::common_type<A, B>::type min(A a, B b) { return (a < b) ? a : b; }
+template <typename A, typename B>
+inline typename std::common_type<A, B>::type max(A a, B b) { return (a > b) ? a : b; }
+template <typename T, typename L, typename H>
+inline T constrain(T x, L low, H high) { return (x < low) ? low : ((x > high) ? high : x); }
+template <typename T>
+inline T abs(T x) { return (x > 0) ? x : -x; }
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+void pinMode(uint8_t pin, uint8_t mode);
+int digitalRead(uint8_t pin);
+void digitalWrite(uint8_t pin, uint8_t value);
+int analogRead(uint8_t pin);
+
+class Print {
+public:
+  virtual ~Print() {}
+
+  virtual size_t write(uint8_t c) = 0;
+  virtual size_t write(const uint8_t* buffer, size_t size);
+  size_t write(const char* str) { return str == NULL ? 0 : this->write((const uint8_t*)str, strlen(str)); }
+  size_t write(const char* buffer, size_t size) { return this->write((const uint8_t*)buffer, size); }
+
+  size_t print(const char* str) { return this->write(str); }
+  size_t print(char c) { return this->write((uint8_t)c); }
+  size_t print(unsigned char n, int base = DEC) { return this->printNumber(n, base); }
+  size_t print(int n, int base = DEC) { return this->print((long)n, base); }
+  size_t print(unsigned int n, int base = DEC) { return this->printNumber(n, base); }
+  size_t print(long n, int base = DEC);
+  size_t print(unsigned long n, int base = DEC) { return this->printNumber(n, base); }
+  size_t print(double n, int digits = 2) { return this->printFloat(n, digits); }
+
+  size_t println() { return this->write("\r\n"); }
+  template <typename T>
+  size_t println(T value) { size_t n = this->print(value); return n + this->println(); }
+  template <typename T>
+  size_t println(T value, int format) { size_t n = this->print(value, format); return n + this->println(); }
+
+private:
+  size_t printNumber(unsigned long n, int base);
+  size_t printFloat(double n, int digits);
+};
+
+class Stream : public Print {
+public:
+  Stream() : timeoutMs(1000) {}
+
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int peek() = 0;
+
+  void setTimeout(unsigned long timeoutMs) { this->timeoutMs = timeoutMs; }
+  long parseInt();
+  float parseFloat();
+
+protected:
+  unsigned long timeoutMs;
+
+  // Like the real thing these block for up to the timeout, which here means virtual time passes
+  virtual int timedRead() = 0;
+  virtual int timedPeek() = 0;
+
+private:
+  int peekNextDigit(bool detectDecimal);
+};
+
+class HardwareSerial : public Stream {
+public:
+  HardwareSerial() : baudRate(0) {}
+
+  void begin(unsigned long baudRate) { this->baudRate = baudRate; }
+  void end() {}
+  void flush() {}
+  operator bool() const { return true; }
+
+  int available();
+  int read();
+  int peek();
+
+  size_t write(uint8_t c) { return this->write(&c, 1); }
+  size_t write(const uint8_t* buffer, size_t size);
+  using Print::write;
+
+  unsigned long getBaudRate() const { return this->baudRate; }
+
+protected:
+  int timedRead();
+  int timedPeek();
+
+private:
+  unsigned long baudRate;
+};
+
+extern HardwareSerial Serial;
+
+#endif // ARDUINO_HOST_SIM_ARDUINO_H_
@@ -0,0 +1,45 @@
+#include "Adafruit_NeoPixel.h"
+#include "host_sim.h"
+
+Adafruit_NeoPixel::Adafruit_NeoPixel(uint16_t numPixels, uint8_t pin, neoPixelType) :
+  numPixelsTotal(numPixels), pin(pin), brightness(0), pixels(new uint32_t[numPixels]()),
+  shownPixels(new uint32_t[numPixels]()), numShows(0), numChangedShows(0), showMicros(0) {
+}
+
+Adafruit_NeoPixel::Adafruit_NeoPixel(const Adafruit_NeoPixel& other) :
+  numPixelsTotal(other.numPixelsTotal), pin(other.pin), brightness(other.brightness),
+  pixels(new uint32_t[other.numPixelsTotal]), shownPixels(new uint32_t[other.numPixelsTotal]),
+  numShows(other.numShows), numChangedShows(other.numChangedShows), showMicros(other.showMicros) {
+
+  memcpy(this->pixels, other.pixels, this->numPixelsTotal * sizeof(uint32_t));
+  memcpy(this->shownPixels, other.shownPixels, this->numPixelsTotal * sizeof(uint32_t));
+}
+
+Adafruit_NeoPixel::~Adafruit_NeoPixel() {
+  delete[] this->pixels;
+  delete[] this->shownPixels;
+}
+
+void Adafruit_NeoPixel::show() {
+  // The whole strip goes out every time, whether anything changed or not
+  uint32_t micros = this->numPixelsTotal * MICROS_PER_PIXEL + LATCH_MICROS;
+  HostSim::advanceMicros(micros);
+  this->showMicros += micros;
+  this->numShows++;
+
+  if (memcmp(this->pixels, this->shownPixels, this->numPixelsTotal * sizeof(uint32_t)) != 0) {
+    memcpy(this->shownPixels, this->pixels, this->numPixelsTotal * sizeof(uint32_t));
+    this->numChangedShows++;
+  }
+}
+
+void Adafruit_NeoPixel::setPixelColor(uint16_t idx, uint8_t r, uint8_t g, uint8_t b) {
+  this->setPixelColor(idx, Color(r, g, b));
+}
+
+void Adafruit_NeoPixel::setPixelColor(uint16_t idx, uint32_t colour) {
+  // Like the real thing, anything past the end of the strip is ignored
+  if (idx < this->numPixelsTotal) {
+    this->pixels[idx] = colour;
+  }
+}
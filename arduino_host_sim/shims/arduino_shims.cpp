@@ -0,0 +1,311 @@
+#include <chrono>
+#include <deque>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HOST_SIM_HAS_TSC
+#endif
+
+#include "Arduino.h"
+#include "host_sim.h"
+
+#define NUM_PINS 128
+#define DEFAULT_BAUD_RATE 9600
+
+HardwareSerial Serial;
+
+namespace {
+  struct PendingByte {
+    uint64_t dueMicros;
+    uint8_t value;
+  };
+
+  uint64_t nowMicros = 0;
+  int analogInputs[NUM_PINS];
+  int digitalInputs[NUM_PINS];
+
+  std::deque<PendingByte> serialInput;
+  HostSim::SerialOutputHandler serialOutputHandler = NULL;
+  uint64_t numSerialBytesOut = 0;
+  uint64_t numSerialLinesOut = 0;
+}
+
+// Virtual clock and inputs
+
+uint64_t HostSim::getMicros() {
+  return nowMicros;
+}
+
+void HostSim::advanceMicros(uint64_t micros) {
+  nowMicros += micros;
+}
+
+void HostSim::setAnalogInput(uint8_t pin, int value) {
+  analogInputs[pin % NUM_PINS] = constrain(value, 0, 1023);
+}
+
+void HostSim::setDigitalInput(uint8_t pin, int value) {
+  digitalInputs[pin % NUM_PINS] = value;
+}
+
+void HostSim::queueSerialInput(uint64_t atMicros, const uint8_t* data, size_t size) {
+  // 8N1 takes 10 bits a byte, and a byte is only there once all of it came in
+  unsigned long baudRate = Serial.getBaudRate() > 0 ? Serial.getBaudRate() : DEFAULT_BAUD_RATE;
+  uint64_t byteMicros = max(1UL, 10000000UL / baudRate);
+  uint64_t dueMicros = serialInput.empty() ? atMicros : max(atMicros, serialInput.back().dueMicros);
+  for (size_t i = 0; i < size; i++) {
+    dueMicros += byteMicros;
+    PendingByte pendingByte = { dueMicros, data[i] };
+    serialInput.push_back(pendingByte);
+  }
+}
+
+size_t HostSim::getNumSerialInputPending() {
+  return serialInput.size();
+}
+
+void HostSim::setSerialOutputHandler(SerialOutputHandler handler) {
+  serialOutputHandler = handler;
+}
+
+uint64_t HostSim::getNumSerialBytesOut() {
+  return numSerialBytesOut;
+}
+
+uint64_t HostSim::getNumSerialLinesOut() {
+  return numSerialLinesOut;
+}
+
+uint64_t HostSim::readCycles() {
+#ifdef HOST_SIM_HAS_TSC
+  return __rdtsc();
+#else
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+const char* HostSim::getCycleUnit() {
+#ifdef HOST_SIM_HAS_TSC
+  return "cycles";
+#else
+  return "ns";
+#endif
+}
+
+// Arduino core
+
+unsigned long millis() {
+  nowMicros += HostSim::CLOCK_READ_MICROS;
+  return (uint32_t)(nowMicros / 1000); // Wraps around like the real (32-bit) thing
+}
+
+unsigned long micros() {
+  nowMicros += HostSim::CLOCK_READ_MICROS;
+  return (uint32_t)nowMicros;
+}
+
+void delay(unsigned long ms) {
+  nowMicros += (uint64_t)ms * 1000;
+}
+
+void delayMicroseconds(unsigned int us) {
+  nowMicros += us;
+}
+
+void pinMode(uint8_t, uint8_t) {
+}
+
+int digitalRead(uint8_t pin) {
+  return digitalInputs[pin % NUM_PINS];
+}
+
+void digitalWrite(uint8_t, uint8_t) {
+}
+
+int analogRead(uint8_t pin) {
+  return analogInputs[pin % NUM_PINS];
+}
+
+// Print and Stream, these behave like the ones in the Arduino core
+
+size_t Print::write(const uint8_t* buffer, size_t size) {
+  size_t n = 0;
+  while (size-- > 0) {
+    n += this->write(*buffer++);
+  }
+  return n;
+}
+
+size_t Print::print(long n, int base) {
+  if (base == DEC && n < 0) {
+    return this->print('-') + this->printNumber(-n, DEC);
+  }
+  return this->printNumber(n, base);
+}
+
+size_t Print::printNumber(unsigned long n, int base) {
+  char buf[8 * sizeof(long) + 1];
+  char* str = &buf[sizeof(buf) - 1];
+  *str = '\0';
+  if (base < 2) {
+    base = DEC;
+  }
+  do {
+    char c = n % base;
+    n /= base;
+    *--str = c < 10 ? c + '0' : c + 'A' - 10;
+  } while (n != 0);
+  return this->write(str);
+}
+
+size_t Print::printFloat(double number, int digits) {
+  if (isnan(number)) { return this->print("nan"); }
+  if (isinf(number)) { return this->print("inf"); }
+  if (number > 4294967040.0 || number < -4294967040.0) { return this->print("ovf"); }
+
+  size_t n = 0;
+  if (number < 0.0) {
+    n += this->print('-');
+    number = -number;
+  }
+
+  double rounding = 0.5;
+  for (int i = 0; i < digits; i++) {
+    rounding /= 10.0;
+  }
+  number += rounding;
+
+  unsigned long intPart = (unsigned long)number;
+  double remainder = number - (double)intPart;
+  n += this->print(intPart);
+  if (digits > 0) {
+    n += this->print('.');
+  }
+  while (digits-- > 0) {
+    remainder *= 10.0;
+    unsigned int digit = (unsigned int)remainder;
+    n += this->print(digit);
+    remainder -= digit;
+  }
+  return n;
+}
+
+int Stream::peekNextDigit(bool detectDecimal) {
+  while (true) {
+    int c = this->timedPeek();
+    if (c < 0 || c == '-' || (c >= '0' && c <= '9') || (detectDecimal && c == '.')) {
+      return c;
+    }
+    this->read();
+  }
+}
+
+long Stream::parseInt() {
+  bool isNegative = false;
+  long value = 0;
+  int c = this->peekNextDigit(false);
+  if (c < 0) {
+    return 0;
+  }
+  do {
+    if (c == '-') {
+      isNegative = true;
+    }
+    else if (c >= '0' && c <= '9') {
+      value = value * 10 + c - '0';
+    }
+    this->read();
+    c = this->timedPeek();
+  } while (c >= '0' && c <= '9');
+  return isNegative ? -value : value;
+}
+
+float Stream::parseFloat() {
+  bool isNegative = false;
+  bool isFraction = false;
+  long value = 0;
+  float fraction = 1.0;
+  int c = this->peekNextDigit(true);
+  if (c < 0) {
+    return 0;
+  }
+  do {
+    if (c == '-') {
+      isNegative = true;
+    }
+    else if (c == '.') {
+      isFraction = true;
+    }
+    else if (c >= '0' && c <= '9') {
+      value = value * 10 + c - '0';
+      if (isFraction) {
+        fraction *= 0.1;
+      }
+    }
+    this->read();
+    c = this->timedPeek();
+  } while ((c >= '0' && c <= '9') || (c == '.' && !isFraction));
+
+  if (isNegative) {
+    value = -value;
+  }
+  return isFraction ? value * fraction : value;
+}
+
+// Serial
+
+int HardwareSerial::available() {
+  int n = 0;
+  for (std::deque<PendingByte>::const_iterator iter = serialInput.begin(); iter != serialInput.end() && iter->dueMicros <= nowMicros; ++iter) {
+    n++;
+  }
+  return n;
+}
+
+int HardwareSerial::read() {
+  if (serialInput.empty() || serialInput.front().dueMicros > nowMicros) {
+    return -1;
+  }
+  int c = serialInput.front().value;
+  serialInput.pop_front();
+  return c;
+}
+
+int HardwareSerial::peek() {
+  if (serialInput.empty() || serialInput.front().dueMicros > nowMicros) {
+    return -1;
+  }
+  return serialInput.front().value;
+}
+
+int HardwareSerial::timedRead() {
+  int c = this->timedPeek();
+  if (c >= 0) {
+    serialInput.pop_front();
+  }
+  return c;
+}
+
+int HardwareSerial::timedPeek() {
+  // Waits for the next byte if it comes in before the timeout, the time spent waiting is gone
+  uint64_t timeoutMicros = (uint64_t)this->timeoutMs * 1000;
+  if (serialInput.empty() || serialInput.front().dueMicros > nowMicros + timeoutMicros) {
+    nowMicros += timeoutMicros;
+    return -1;
+  }
+  nowMicros = max(nowMicros, serialInput.front().dueMicros);
+  return serialInput.front().value;
+}
+
+size_t HardwareSerial::write(const uint8_t* buffer, size_t size) {
+  numSerialBytesOut += size;
+  for (size_t i = 0; i < size; i++) {
+    if (buffer[i] == '\n') {
+      numSerialLinesOut++;
+    }
+  }
+  if (serialOutputHandler != NULL) {
+    serialOutputHandler(buffer, size);
+  }
+  return size;
+}
@@ -0,0 +1,39 @@
+#ifndef ARDUINO_HOST_SIM_HOST_SIM_H_
+#define ARDUINO_HOST_SIM_HOST_SIM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * The host side of the Arduino shims: drives the virtual clock and the inputs of a sketch, and
+ * reports what it did.
+ *
+ * Time only moves forward when the sketch waits (delay, serial reads running into their timeout,
+ * showing the LED strip) or reads the clock, which costs CLOCK_READ_MICROS so polling loops on
+ * millis() still run out. Serial input is queued with the time it's due, and arrives one byte at a
+ * time at the baud rate the sketch has set up.
+ */
+namespace HostSim {
+  static const uint64_t CLOCK_READ_MICROS = 1;
+
+  uint64_t getMicros();
+  void advanceMicros(uint64_t micros);
+
+  void setAnalogInput(uint8_t pin, int value);
+  void setDigitalInput(uint8_t pin, int value);
+
+  // The bytes start arriving at the given time, or right after whatever was queued before them
+  void queueSerialInput(uint64_t atMicros, const uint8_t* data, size_t size);
+  size_t getNumSerialInputPending();
+
+  typedef void (*SerialOutputHandler)(const uint8_t* data, size_t size);
+  void setSerialOutputHandler(SerialOutputHandler handler);
+  uint64_t getNumSerialBytesOut();
+  uint64_t getNumSerialLinesOut();
+
+  // CPU time as precise as the host can tell it, in cycles where there's a cycle counter
+  uint64_t readCycles();
+  const char* getCycleUnit();
+}
+
+#endif // ARDUINO_HOST_SIM_HOST_SIM_H_
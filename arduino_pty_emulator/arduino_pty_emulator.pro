@@ -0,0 +1,22 @@
+#-------------------------------------------------
+#
+# Emulates keg meter hardware on a Linux pseudo-terminal, for load testing the hosts with many
+# more meters and much higher rates than a real board has. Plain C++ and POSIX, no Qt.
+#
+#-------------------------------------------------
+
+QT       -= core gui
+CONFIG   += console c++11
+CONFIG   -= qt app_bundle
+
+TARGET = keg_meter_emulator
+TEMPLATE = app
+
+COMMON_DIR = $$PWD/../keg_meter_common
+
+INCLUDEPATH += $$COMMON_DIR
+DEPENDPATH  += $$COMMON_DIR
+
+SOURCES += keg_meter_emulator.cpp
+
+HEADERS  += $$COMMON_DIR/binaryframe.h
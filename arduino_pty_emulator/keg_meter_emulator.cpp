@@ -0,0 +1,935 @@
+// Emulates keg meter hardware on a Linux pseudo-terminal. It speaks the protocol of either of the
+// sketches -- the client one ("[NN M 000.000]" loads, for KegMeterServer) or the autonomous one
+// ("[N{P:..,F:..,E:..,L:..,V:..}]" status, for KegMeterController) -- including the binary
+// protocol handshake and baud rate switches, for as many meters and at whatever rate it's told.
+// The loads come from a synthetic keg on every scale that gets poured from until it's empty and is
+// then swapped for a full one, with a choice of noise on top.
+//
+// The hosts find the emulator through their "serial_port_names" setting, point it at the pty (or
+// at the stable link made with --link). Opening the port resets the emulator like it resets a
+// real Arduino.
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "binaryframe.h"
+
+namespace {
+  typedef std::chrono::steady_clock Clock;
+
+  const int MAX_NUM_METERS = 255; // Meter indices and counts are a single byte in binary frames
+  const int MAX_BAUD_RATE_IDX = BinaryFrame::NUM_BAUD_RATES - 1;
+  const int BAUD_CONFIRM_TIMEOUT_MS = 2000;
+
+  // The autonomous protocol's commands aren't terminated, the sketch reads them with timeouts. We
+  // take a command as complete at the next '|', a line break or when nothing arrived for a while.
+  const int COMMAND_IDLE_MS = 50;
+  const size_t MAX_COMMAND_SIZE = 64;
+
+  const int DISCONNECTED_POLL_MS = 100;
+
+  // The synthetic kegs, every scale starts out empty and gets a full corny keg a little later
+  const double EMPTY_CORNY_KEG_MASS_KG = 4.4; // As in the sketches
+  const double EMPTY_50L_KEG_MASS_KG = 13.5;
+  const double BEER_MASS_KG = 19.0;
+  const double FIRST_KEG_ON_TIME_S = 5;
+  const double KEG_STAGGER_S = 3;
+  const double KEG_SWAP_TIME_S = 30;
+  const double POUR_MASS_KG = 0.4;
+  const double POUR_DURATION_S = 5;
+
+  // Noise profiles: spikes are knocks against the keg, drift is a load cell creeping
+  const double SPIKE_PROBABILITY = 0.01;
+  const double SPIKE_SCALE = 20;
+  const double DRIFT_STEP_SCALE = 0.05;
+  const double MAX_DRIFT_SCALE = 10;
+
+  enum Protocol { ClientProtocol, AutonomousProtocol };
+  enum NoiseProfile { GaussianNoise, SpikyNoise, DriftingNoise };
+
+  struct Options {
+    Protocol protocol;
+    int numMeters;
+    double rateHz;
+    NoiseProfile noiseProfile;
+    double noiseKg;
+    double pourIntervalS;
+    unsigned int seed;
+    std::string linkPath;
+    bool throttle;
+    bool echoCommands;
+    double statsIntervalS;
+    double durationS;
+
+    Options() : protocol(ClientProtocol), numMeters(8), rateHz(20), noiseProfile(GaussianNoise), noiseKg(0.05),
+                pourIntervalS(30), seed(1), throttle(false), echoCommands(false), statsIntervalS(10), durationS(0) {}
+  };
+
+  // What's on one of the scales
+  struct Scale {
+    double kegOnTimeS;
+    double emptyKegMassKg;
+    double beerMassKg;
+    double nextPourTimeS;
+    double driftKg;
+  };
+
+  // The state the firmware keeps for a meter, lost whenever the board resets
+  struct MeterState {
+    // Client protocol
+    char routine;
+    float percent;
+
+    // Autonomous protocol
+    float fullMassKg;
+    float emptyMassKg;
+    float meanLoadKg;
+    float variance;
+  };
+
+  volatile sig_atomic_t quitRequested = 0;
+
+  void onQuitSignal(int) {
+    quitRequested = 1;
+  }
+
+  void appendFormat(std::string& str, const char* format, ...) {
+    char buffer[256];
+    va_list args;
+    va_start(args, format);
+    int size = vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    if (size > 0) {
+      str.append(buffer, std::min(size, (int)sizeof(buffer) - 1));
+    }
+  }
+
+  int64_t toMs(Clock::duration duration) {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(duration).count();
+  }
+
+  class Emulator {
+  public:
+    Emulator(const Options& options) :
+      options(options), ptyFd(-1), hostConnected(false), random(options.seed), noise(0.0, 1.0), uniform(0.0, 1.0),
+      scales(options.numMeters), meters(options.numMeters), loads(options.numMeters), numTicks(0), numSkippedTicks(0),
+      numMessagesOut(0), numBytesOut(0), numBytesDropped(0), numCommands(0), numConnects(0) {
+
+      for (int i = 0; i < options.numMeters; i++) {
+        Scale& scale = this->scales[i];
+        scale.kegOnTimeS = FIRST_KEG_ON_TIME_S + i * KEG_STAGGER_S;
+        scale.emptyKegMassKg = EMPTY_CORNY_KEG_MASS_KG;
+        scale.beerMassKg = BEER_MASS_KG;
+        scale.nextPourTimeS = scale.kegOnTimeS + options.pourIntervalS * (0.5 + this->uniform(this->random));
+        scale.driftKg = 0;
+      }
+      this->resetBoard();
+    }
+
+    ~Emulator() {
+      if (!this->options.linkPath.empty()) {
+        unlink(this->options.linkPath.c_str());
+      }
+      if (this->ptyFd >= 0) {
+        close(this->ptyFd);
+      }
+    }
+
+    bool open();
+    void run();
+
+  private:
+    Options options;
+    int ptyFd;
+    std::string ptyPath;
+    bool hostConnected;
+
+    std::mt19937 random;
+    std::normal_distribution<double> noise;
+    std::uniform_real_distribution<double> uniform;
+
+    Clock::time_point startTime;
+    std::vector<Scale> scales;
+    std::vector<MeterState> meters;
+    std::vector<float> loads;
+
+    // Protocol state, as in the sketches' KegMeterProtocol
+    bool binaryMode;
+    uint16_t batchSequenceNum;
+    int baudRateIdx;
+    bool baudRateUnconfirmed;
+    Clock::time_point baudRateSwitchTime;
+    Clock::time_point bootTime;
+
+    std::string command;
+    Clock::time_point lastCommandByteTime;
+
+    double outputBudgetBytes;
+    Clock::time_point lastTickTime;
+
+    uint64_t numTicks;
+    uint64_t numSkippedTicks;
+    uint64_t numMessagesOut; // Measurements or status messages
+    uint64_t numBytesOut;
+    uint64_t numBytesDropped;
+    uint64_t numCommands;
+    uint64_t numConnects;
+
+    void resetBoard();
+    void setRawMode();
+    bool pollHostConnected();
+
+    void updateScales(double timeS, double deltaS);
+    float readLoad(int meterIdx, double timeS);
+    void tick(Clock::time_point now);
+    int appendMeasurements(std::string& out);
+    int appendStatus(std::string& out);
+
+    void readInput(Clock::time_point now);
+    void handleByte(char c, Clock::time_point now);
+    void handleCommand(const std::string& cmd);
+    void handleClientCommand(const std::string& cmd, std::string& reply);
+    void handleAutonomousCommand(const std::string& cmd, std::string& reply);
+    void setBinaryMode(int version, std::string& reply);
+    void setBaudRate(int newBaudRateIdx, std::string& reply);
+    bool parseMeterIdx(const char*& str, int numDigits, int& meterIdx);
+
+    bool write(const std::string& data);
+    void printStats(double elapsedS);
+  };
+
+  bool Emulator::open() {
+    this->ptyFd = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (this->ptyFd < 0 || grantpt(this->ptyFd) != 0 || unlockpt(this->ptyFd) != 0) {
+      perror("Failed to open a pseudo-terminal");
+      return false;
+    }
+    this->ptyPath = ptsname(this->ptyFd);
+
+    // The master only reports a hang-up once the other end has been opened and closed again, do
+    // that once so "not hung up" always means a host has the port open
+    int slaveFd = ::open(this->ptyPath.c_str(), O_RDWR | O_NOCTTY);
+    if (slaveFd < 0) {
+      perror("Failed to open the pseudo-terminal's slave end");
+      return false;
+    }
+    this->setRawMode();
+    close(slaveFd);
+
+    if (!this->options.linkPath.empty()) {
+      struct stat linkStat;
+      if (lstat(this->options.linkPath.c_str(), &linkStat) == 0) {
+        if (!S_ISLNK(linkStat.st_mode)) {
+          fprintf(stderr, "%s exists and isn't a link, not replacing it\n", this->options.linkPath.c_str());
+          return false;
+        }
+        unlink(this->options.linkPath.c_str());
+      }
+      if (symlink(this->ptyPath.c_str(), this->options.linkPath.c_str()) != 0) {
+        perror("Failed to link to the pseudo-terminal");
+        return false;
+      }
+    }
+    return true;
+  }
+
+  void Emulator::setRawMode() {
+    // No echo and no newline translation, the hosts set the same when they open the port
+    struct termios attributes;
+    if (tcgetattr(this->ptyFd, &attributes) == 0) {
+      cfmakeraw(&attributes);
+      tcsetattr(this->ptyFd, TCSANOW, &attributes);
+    }
+  }
+
+  bool Emulator::pollHostConnected() {
+    struct pollfd pollFd = { this->ptyFd, 0, 0 };
+    poll(&pollFd, 1, 0);
+    return (pollFd.revents & POLLHUP) == 0;
+  }
+
+  void Emulator::resetBoard() {
+    this->binaryMode = false;
+    this->batchSequenceNum = 0;
+    this->baudRateIdx = 0;
+    this->baudRateUnconfirmed = false;
+    this->bootTime = Clock::now();
+    this->command.clear();
+    this->outputBudgetBytes = 0;
+
+    for (size_t i = 0; i < this->meters.size(); i++) {
+      MeterState& meter = this->meters[i];
+      meter.routine = 'M';
+      meter.percent = 0;
+      meter.fullMassKg = EMPTY_CORNY_KEG_MASS_KG + BEER_MASS_KG;
+      meter.emptyMassKg = EMPTY_CORNY_KEG_MASS_KG;
+      meter.meanLoadKg = 0;
+      meter.variance = 0;
+    }
+  }
+
+  void Emulator::run() {
+    printf("Emulating %d %s keg meter(s) at %.1f Hz on %s%s%s\n", this->options.numMeters,
+           this->options.protocol == ClientProtocol ? "client" : "autonomous", this->options.rateHz,
+           this->ptyPath.c_str(), this->options.linkPath.empty() ? "" : ", linked from ",
+           this->options.linkPath.c_str());
+    printf("Add \"%s\" to the host's serial_port_names setting to connect to it\n",
+           this->options.linkPath.empty() ? this->ptyPath.c_str() : this->options.linkPath.c_str());
+    fflush(stdout);
+
+    this->startTime = Clock::now();
+    Clock::duration tickInterval = std::chrono::duration_cast<Clock::duration>(
+      std::chrono::duration<double>(1.0 / this->options.rateHz));
+    Clock::time_point nextTickTime = this->startTime;
+    Clock::time_point nextStatsTime = this->startTime + std::chrono::duration_cast<Clock::duration>(
+      std::chrono::duration<double>(this->options.statsIntervalS));
+    this->lastTickTime = this->startTime;
+
+    Clock::time_point endTime = this->startTime + std::chrono::duration_cast<Clock::duration>(
+      std::chrono::duration<double>(this->options.durationS));
+
+    while (!quitRequested) {
+      Clock::time_point now = Clock::now();
+      if (this->options.durationS > 0 && now >= endTime) {
+        break;
+      }
+      int timeoutMs = (int)std::max<int64_t>(0, toMs(nextTickTime - now));
+      if (!this->command.empty()) {
+        timeoutMs = (int)std::min<int64_t>(timeoutMs, std::max<int64_t>(0, COMMAND_IDLE_MS - toMs(now - this->lastCommandByteTime)));
+      }
+
+      bool connected = this->pollHostConnected();
+      if (connected != this->hostConnected) {
+        this->hostConnected = connected;
+        if (connected) {
+          // Like an Arduino, the board resets whenever the host opens the port
+          this->numConnects++;
+          tcflush(this->ptyFd, TCIOFLUSH);
+          this->setRawMode();
+          this->resetBoard();
+          printf("Host connected\n");
+        }
+        else {
+          printf("Host disconnected\n");
+        }
+        fflush(stdout);
+      }
+
+      if (connected) {
+        struct pollfd pollFd = { this->ptyFd, POLLIN, 0 };
+        if (poll(&pollFd, 1, timeoutMs) > 0 && (pollFd.revents & POLLIN) != 0) {
+          this->readInput(Clock::now());
+        }
+      }
+      else {
+        // A hung-up pty polls as ready all the time, so just sleep
+        usleep(std::min(timeoutMs, DISCONNECTED_POLL_MS) * 1000);
+      }
+
+      now = Clock::now();
+      if (!this->command.empty() && this->options.protocol == AutonomousProtocol &&
+          toMs(now - this->lastCommandByteTime) >= COMMAND_IDLE_MS) {
+        std::string cmd;
+        cmd.swap(this->command);
+        this->handleCommand(cmd);
+      }
+      if (this->baudRateUnconfirmed && toMs(now - this->baudRateSwitchTime) > BAUD_CONFIRM_TIMEOUT_MS) {
+        std::string ignored;
+        this->setBaudRate(0, ignored);
+      }
+      if (now >= nextTickTime) {
+        this->tick(now);
+        nextTickTime += tickInterval;
+        if (nextTickTime < now) {
+          // Fell behind (or were suspended), don't try to catch up with a burst
+          nextTickTime = now + tickInterval;
+        }
+      }
+      if (now >= nextStatsTime && this->options.statsIntervalS > 0) {
+        this->printStats(std::chrono::duration<double>(now - this->startTime).count());
+        nextStatsTime += std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(this->options.statsIntervalS));
+      }
+    }
+
+    this->printStats(std::chrono::duration<double>(Clock::now() - this->startTime).count());
+  }
+
+  void Emulator::updateScales(double timeS, double deltaS) {
+    for (size_t i = 0; i < this->scales.size(); i++) {
+      Scale& scale = this->scales[i];
+      if (timeS < scale.kegOnTimeS) {
+        continue;
+      }
+
+      if (timeS >= scale.nextPourTimeS) {
+        scale.beerMassKg -= POUR_MASS_KG * std::min(deltaS, POUR_DURATION_S) / POUR_DURATION_S;
+        if (timeS >= scale.nextPourTimeS + POUR_DURATION_S) {
+          scale.nextPourTimeS += this->options.pourIntervalS * (0.5 + this->uniform(this->random));
+        }
+      }
+      if (scale.beerMassKg <= 0) {
+        // Swap the empty keg for a full one
+        scale.kegOnTimeS = timeS + KEG_SWAP_TIME_S;
+        scale.beerMassKg = BEER_MASS_KG;
+        scale.nextPourTimeS = scale.kegOnTimeS + this->options.pourIntervalS * (0.5 + this->uniform(this->random));
+      }
+    }
+  }
+
+  float Emulator::readLoad(int meterIdx, double timeS) {
+    Scale& scale = this->scales[meterIdx];
+    double loadKg = (timeS >= scale.kegOnTimeS) ? scale.emptyKegMassKg + scale.beerMassKg : 0;
+
+    double noiseKg = this->options.noiseKg;
+    if (noiseKg > 0) {
+      loadKg += noiseKg * this->noise(this->random);
+      switch (this->options.noiseProfile) {
+        case SpikyNoise:
+          if (this->uniform(this->random) < SPIKE_PROBABILITY) {
+            loadKg += SPIKE_SCALE * noiseKg * (this->uniform(this->random) - 0.5);
+          }
+          break;
+
+        case DriftingNoise:
+          scale.driftKg += DRIFT_STEP_SCALE * noiseKg * this->noise(this->random);
+          scale.driftKg = std::max(-MAX_DRIFT_SCALE * noiseKg, std::min(MAX_DRIFT_SCALE * noiseKg, scale.driftKg));
+          loadKg += scale.driftKg;
+          break;
+
+        default:
+          break;
+      }
+    }
+
+    // The range the client sketch sends
+    return (float)std::max(0.0, std::min(999.999, loadKg));
+  }
+
+  void Emulator::tick(Clock::time_point now) {
+    double timeS = std::chrono::duration<double>(now - this->startTime).count();
+    double deltaS = std::chrono::duration<double>(now - this->lastTickTime).count();
+    this->lastTickTime = now;
+
+    // The kegs don't care whether anyone's listening
+    this->updateScales(timeS, deltaS);
+    for (int i = 0; i < this->options.numMeters; i++) {
+      this->loads[i] = this->readLoad(i, timeS);
+    }
+    if (!this->hostConnected) {
+      return;
+    }
+    this->numTicks++;
+
+    std::string out;
+    int numMessages = 0;
+    if (this->options.protocol == ClientProtocol) {
+      numMessages = this->appendMeasurements(out);
+    }
+    else {
+      numMessages = this->appendStatus(out);
+    }
+    if (out.empty()) {
+      return;
+    }
+
+    if (this->options.throttle) {
+      // A board can't send faster than its baud rate, 10 bits a byte. Whatever doesn't fit into a
+      // tick is dropped rather than queued, so a slow link shows up as a lower rate.
+      double bytesPerS = BinaryFrame::baudRate(this->baudRateIdx) / 10.0;
+      this->outputBudgetBytes = std::min(this->outputBudgetBytes + deltaS * bytesPerS, bytesPerS);
+      if (out.size() > this->outputBudgetBytes) {
+        this->numSkippedTicks++;
+        return;
+      }
+      this->outputBudgetBytes -= out.size();
+    }
+    if (this->write(out)) {
+      this->numMessagesOut += numMessages;
+    }
+  }
+
+  // As KegMeterProtocol::PrintMeasurementBatch in the client sketch, returns the number of
+  // measurements
+  int Emulator::appendMeasurements(std::string& out) {
+    uint8_t meterIdxs[BinaryFrame::MAX_BATCH_SIZE];
+    float batchLoads[BinaryFrame::MAX_BATCH_SIZE];
+    int batchSize = 0;
+    int numMeasurements = 0;
+    uint32_t deviceTimeMs = (uint32_t)toMs(this->lastTickTime - this->bootTime);
+
+    for (int i = 0; i < this->options.numMeters; i++) {
+      char routine = this->meters[i].routine;
+      if (routine == 'F' || routine == 'E') {
+        continue;
+      }
+      numMeasurements++;
+
+      if (this->binaryMode) {
+        // More meters than fit into a batch frame go out in several
+        meterIdxs[batchSize] = (uint8_t)i;
+        batchLoads[batchSize] = this->loads[i];
+        batchSize++;
+        if (batchSize == BinaryFrame::MAX_BATCH_SIZE) {
+          uint8_t frame[BinaryFrame::MAX_WIRE_SIZE];
+          int frameSize = BinaryFrame::encodeBatch(this->batchSequenceNum++, deviceTimeMs, meterIdxs, batchLoads, batchSize, frame);
+          out.append((const char*)frame, frameSize);
+          batchSize = 0;
+        }
+      }
+      else {
+        // "[NN M 000.000]", the load is zero padded to three digits before the point
+        float load = this->loads[i];
+        appendFormat(out, "[%02d M %s%s%.3f]", i, load < 10 ? "0" : "", load < 100 ? "0" : "", load);
+      }
+    }
+
+    // Nothing at all goes out without any measurements
+    if (this->binaryMode) {
+      if (batchSize > 0) {
+        uint8_t frame[BinaryFrame::MAX_WIRE_SIZE];
+        int frameSize = BinaryFrame::encodeBatch(this->batchSequenceNum++, deviceTimeMs, meterIdxs, batchLoads, batchSize, frame);
+        out.append((const char*)frame, frameSize);
+      }
+    }
+    else if (numMeasurements > 0) {
+      out += "\r\n";
+    }
+    return numMeasurements;
+  }
+
+  // As KegLoadMeter::outputStatusToSerial in the autonomous sketch, returns the number of status
+  // messages
+  int Emulator::appendStatus(std::string& out) {
+    for (int i = 0; i < this->options.numMeters; i++) {
+      MeterState& meter = this->meters[i];
+      float load = this->loads[i];
+      float deviation = load - meter.meanLoadKg;
+      meter.meanLoadKg += 0.1f * deviation;
+      meter.variance = 0.99f * meter.variance + 0.01f * deviation * deviation;
+
+      float beerMassKg = meter.fullMassKg - meter.emptyMassKg;
+      float percent = (beerMassKg > 0) ? (meter.meanLoadKg - meter.emptyMassKg) / beerMassKg : 0;
+      percent = std::max(0.0f, std::min(1.0f, percent));
+
+      if (this->binaryMode) {
+        float values[BinaryFrame::NUM_STATUS_FIELDS] = { percent, meter.fullMassKg, meter.emptyMassKg, meter.meanLoadKg, meter.variance };
+        uint8_t frame[BinaryFrame::MAX_WIRE_SIZE];
+        int frameSize = BinaryFrame::encodeStatus((uint8_t)i, (1 << BinaryFrame::NUM_STATUS_FIELDS) - 1, values, frame);
+        out.append((const char*)frame, frameSize);
+      }
+      else {
+        appendFormat(out, "[%d{P:%.2f,F:%.2f,E:%.2f,L:%.2f,V:%.5f}]\r\n", i, percent, meter.fullMassKg,
+                     meter.emptyMassKg, meter.meanLoadKg, meter.variance);
+      }
+    }
+    return this->options.numMeters;
+  }
+
+  void Emulator::readInput(Clock::time_point now) {
+    char buffer[512];
+    ssize_t size = 0;
+    while ((size = read(this->ptyFd, buffer, sizeof(buffer))) > 0) {
+      for (ssize_t i = 0; i < size; i++) {
+        this->handleByte(buffer[i], now);
+      }
+    }
+  }
+
+  void Emulator::handleByte(char c, Clock::time_point now) {
+    if (this->options.protocol == ClientProtocol) {
+      // "[NN X data]", anything outside of the brackets is skipped like the sketch does
+      if (c == '[') {
+        this->command = c;
+      }
+      else if (!this->command.empty()) {
+        this->command += c;
+        if (c == ']') {
+          std::string cmd;
+          cmd.swap(this->command);
+          this->handleCommand(cmd);
+        }
+      }
+    }
+    else {
+      // "|X...", complete at the next command, a line break or after COMMAND_IDLE_MS
+      if (c == '|' || c == '\r' || c == '\n') {
+        if (!this->command.empty()) {
+          std::string cmd;
+          cmd.swap(this->command);
+          this->handleCommand(cmd);
+        }
+        if (c == '|') {
+          this->command = c;
+        }
+      }
+      else if (!this->command.empty()) {
+        this->command += c;
+      }
+    }
+
+    if (this->command.size() > MAX_COMMAND_SIZE) {
+      this->command.clear();
+    }
+    this->lastCommandByteTime = now;
+  }
+
+  void Emulator::handleCommand(const std::string& cmd) {
+    this->numCommands++;
+    if (this->options.echoCommands) {
+      printf("< %s\n", cmd.c_str());
+    }
+
+    std::string reply;
+    if (this->options.protocol == ClientProtocol) {
+      this->handleClientCommand(cmd, reply);
+    }
+    else {
+      this->handleAutonomousCommand(cmd, reply);
+    }
+
+    if (!reply.empty()) {
+      if (this->options.echoCommands) {
+        bool isText = (reply[0] != (char)BinaryFrame::DELIMITER);
+        printf("> %s", isText ? reply.c_str() : "<binary frame>\n");
+      }
+      this->write(reply);
+    }
+    if (this->options.echoCommands) {
+      fflush(stdout);
+    }
+  }
+
+  // As KegMeterProtocol::ReadSerial in the client sketch, cmd is "[NN X data]"
+  void Emulator::handleClientCommand(const std::string& cmd, std::string& reply) {
+    const char* str = cmd.c_str() + 1;
+    int meterIdx = (int)strtol(str, (char**)&str, 10);
+    if (meterIdx < 0 || meterIdx >= this->options.numMeters) {
+      reply = "WARNING: Invalid meter index.\r\n";
+      return;
+    }
+    if (*str++ != ' ') {
+      reply = "ERROR 3\r\n";
+      return;
+    }
+    char cmdType = *str++;
+    if (cmdType == '\0' || *str++ != ' ') {
+      reply = "ERROR 4\r\n";
+      return;
+    }
+
+    MeterState& meter = this->meters[meterIdx];
+    switch (cmdType) {
+      case 'P': {
+        float percent = std::max(0.0f, std::min(1.0f, strtof(str, NULL)));
+        meter.percent = percent;
+        appendFormat(reply, "SUCCESS: Percent set to %.2f\r\n", percent);
+        break;
+      }
+
+      case 'R':
+        if (strchr("OCFME", *str) == NULL || *str == '\0') {
+          reply = "ERROR: Invalid routine type.\r\n";
+          return;
+        }
+        meter.routine = *str;
+        reply = "SUCCESS: Routine set.\r\n";
+        break;
+
+      case 'B':
+        this->setBinaryMode(*str - '0', reply);
+        break;
+
+      case 'S':
+        this->setBaudRate(*str - '0', reply);
+        break;
+
+      default:
+        reply = "ERROR: Command not found.\r\n";
+        break;
+    }
+  }
+
+  // As readSerialCommands in the autonomous sketch, cmd is "|X..."
+  void Emulator::handleAutonomousCommand(const std::string& cmd, std::string& reply) {
+    if (cmd.size() < 2) {
+      return;
+    }
+    const char* str = cmd.c_str() + 2;
+    int meterIdx = 0;
+
+    switch (cmd[1]) {
+      case 'E':
+        if (*str == 'a') {
+          reply = "Performing Empty Calibration on all meters...\r\n";
+          for (size_t i = 0; i < this->meters.size(); i++) {
+            this->meters[i].emptyMassKg = this->meters[i].meanLoadKg;
+          }
+        }
+        else if (this->parseMeterIdx(++str, 3, meterIdx)) {
+          appendFormat(reply, "Performing Empty Calibration on keg index %d...\r\n", meterIdx);
+          this->meters[meterIdx].emptyMassKg = this->meters[meterIdx].meanLoadKg;
+        }
+        else {
+          reply = "ERROR: Invalid meter index.";
+        }
+        break;
+
+      case 'T': {
+        int firstIdx = 0;
+        int lastIdx = this->options.numMeters - 1;
+        if (*str++ != 'a') {
+          if (!this->parseMeterIdx(str, 3, meterIdx)) {
+            reply = "ERROR: Invalid meter index.";
+            break;
+          }
+          firstIdx = lastIdx = meterIdx;
+        }
+        char kegType = *str;
+        for (int i = firstIdx; i <= lastIdx; i++) {
+          if (kegType == 'c' || kegType == 's') {
+            this->meters[i].emptyMassKg = (kegType == 'c') ? EMPTY_CORNY_KEG_MASS_KG : EMPTY_50L_KEG_MASS_KG;
+            appendFormat(reply, "Keg %d set to %s\r\n", i, (kegType == 'c') ? "Corny" : "Sanke 50L");
+          }
+          else {
+            reply += "Command failed, keg type not found.";
+          }
+        }
+        break;
+      }
+
+      case 'U':
+        if (*str++ != 'm') {
+          reply = "ERROR: Command option not found.\r\n";
+        }
+        else if (!this->parseMeterIdx(str, 3, meterIdx)) {
+          reply = "ERROR: Invalid meter index.\r\n";
+        }
+        else {
+          // ",p.pp,fff.ff,eee.ee"
+          float percent = 0;
+          float fullMassKg = 0;
+          float emptyMassKg = 0;
+          if (sscanf(str, ",%f,%f,%f", &percent, &fullMassKg, &emptyMassKg) == 3) {
+            MeterState& meter = this->meters[meterIdx];
+            meter.percent = percent;
+            meter.fullMassKg = fullMassKg;
+            meter.emptyMassKg = emptyMassKg;
+          }
+          appendFormat(reply, "Updated keg %d state values.\r\n", meterIdx);
+        }
+        break;
+
+      case 'R':
+        if (*str++ != 'm') {
+          reply = "ERROR: Command option not found.\r\n";
+        }
+        else if (!this->parseMeterIdx(str, 3, meterIdx)) {
+          reply = "ERROR: Invalid meter index.\r\n";
+        }
+        else {
+          MeterState& meter = this->meters[meterIdx];
+          meter.fullMassKg = EMPTY_CORNY_KEG_MASS_KG + BEER_MASS_KG;
+          meter.emptyMassKg = EMPTY_CORNY_KEG_MASS_KG;
+        }
+        break;
+
+      case 'B':
+        this->setBinaryMode(*str - '0', reply);
+        break;
+
+      case 'S':
+        this->setBaudRate(*str - '0', reply);
+        break;
+
+      default:
+        reply = "ERROR: No command found.\r\n";
+        break;
+    }
+  }
+
+  void Emulator::setBinaryMode(int version, std::string& reply) {
+    if (version != BinaryFrame::PROTOCOL_VERSION) {
+      reply = "ERROR: Unsupported binary protocol version.\r\n";
+      return;
+    }
+
+    this->binaryMode = true;
+    this->baudRateUnconfirmed = false;
+    uint8_t frame[BinaryFrame::MAX_WIRE_SIZE];
+    int frameSize = BinaryFrame::encodeHello((uint8_t)this->options.numMeters, MAX_BAUD_RATE_IDX, frame);
+    reply.assign((const char*)frame, frameSize);
+  }
+
+  void Emulator::setBaudRate(int newBaudRateIdx, std::string& reply) {
+    if (newBaudRateIdx < 0 || newBaudRateIdx > MAX_BAUD_RATE_IDX) {
+      reply = "ERROR: Unsupported baud rate.\r\n";
+      return;
+    }
+
+    // A pty doesn't have a baud rate, this only matters for --throttle
+    this->baudRateIdx = newBaudRateIdx;
+    this->baudRateUnconfirmed = (newBaudRateIdx != 0);
+    this->baudRateSwitchTime = Clock::now();
+    this->outputBudgetBytes = 0;
+  }
+
+  // Reads a zero padded meter index of numDigits digits
+  bool Emulator::parseMeterIdx(const char*& str, int numDigits, int& meterIdx) {
+    meterIdx = 0;
+    for (int i = 0; i < numDigits; i++, str++) {
+      if (*str < '0' || *str > '9') {
+        return false;
+      }
+      meterIdx = meterIdx * 10 + (*str - '0');
+    }
+    return meterIdx < this->options.numMeters;
+  }
+
+  // Returns whether all of the data went out
+  bool Emulator::write(const std::string& data) {
+    // Never block: a host that isn't reading just misses out, like it would with a real board
+    ssize_t size = ::write(this->ptyFd, data.data(), data.size());
+    size_t numWritten = (size > 0) ? (size_t)size : 0;
+    this->numBytesOut += numWritten;
+    this->numBytesDropped += data.size() - numWritten;
+    return numWritten == data.size();
+  }
+
+  void Emulator::printStats(double elapsedS) {
+    printf("%.0f s: %s, %s @ %d baud, %llu ticks (%llu skipped), %llu messages out (%.1f/s), %llu bytes out (%.0f bytes/s, %llu dropped), %llu command(s), %llu connect(s)\n",
+           elapsedS, this->hostConnected ? "connected" : "waiting for a host", this->binaryMode ? "binary" : "ASCII",
+           BinaryFrame::baudRate(this->baudRateIdx), (unsigned long long)this->numTicks,
+           (unsigned long long)this->numSkippedTicks, (unsigned long long)this->numMessagesOut,
+           this->numMessagesOut / std::max(1e-6, elapsedS), (unsigned long long)this->numBytesOut,
+           this->numBytesOut / std::max(1e-6, elapsedS), (unsigned long long)this->numBytesDropped,
+           (unsigned long long)this->numCommands, (unsigned long long)this->numConnects);
+    fflush(stdout);
+  }
+
+  bool parseNoiseProfile(const char* name, NoiseProfile& profile) {
+    if (strcmp(name, "gaussian") == 0) {
+      profile = GaussianNoise;
+    }
+    else if (strcmp(name, "spikes") == 0) {
+      profile = SpikyNoise;
+    }
+    else if (strcmp(name, "drift") == 0) {
+      profile = DriftingNoise;
+    }
+    else {
+      return false;
+    }
+    return true;
+  }
+
+  void printUsage(const char* appName) {
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  --protocol <client|autonomous>  Which sketch to emulate (default: client)\n"
+            "  --meters <n>                    Number of meters, up to %d (default: 8)\n"
+            "  --rate <hz>                     Measurements/status messages per second (default: 20)\n"
+            "  --noise <kg>                    Standard deviation of the noise on the load (default: 0.05)\n"
+            "  --noise-profile <profile>       gaussian, spikes (knocks against the keg) or drift (load\n"
+            "                                  cell creep) on top of the gaussian noise (default: gaussian)\n"
+            "  --pour-interval <s>             Mean time between pours from every keg (default: 30)\n"
+            "  --seed <n>                      Seed for the noise and the pours (default: 1)\n"
+            "  --link <path>                   Make a link to the pty at this path, e.g. /tmp/ttyKegMeter\n"
+            "  --throttle                      Limit the output to what fits through the current baud rate\n"
+            "  --echo-commands                 Print the commands from the host and the replies to them\n"
+            "  --stats-interval <s>            Print statistics this often, 0 for only at exit (default: 10)\n"
+            "  --duration <s>                  Exit after this long, 0 to run until interrupted (default: 0)\n",
+            appName, MAX_NUM_METERS);
+  }
+}
+
+int main(int argc, char* argv[]) {
+  Options options;
+  for (int i = 1; i < argc; i++) {
+    bool hasValue = (i + 1 < argc);
+    if (strcmp(argv[i], "--protocol") == 0 && hasValue) {
+      const char* protocol = argv[++i];
+      if (strcmp(protocol, "client") == 0) {
+        options.protocol = ClientProtocol;
+      }
+      else if (strcmp(protocol, "autonomous") == 0) {
+        options.protocol = AutonomousProtocol;
+      }
+      else {
+        printUsage(argv[0]);
+        return 1;
+      }
+    }
+    else if (strcmp(argv[i], "--meters") == 0 && hasValue) {
+      options.numMeters = atoi(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--rate") == 0 && hasValue) {
+      options.rateHz = atof(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--noise") == 0 && hasValue) {
+      options.noiseKg = atof(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--noise-profile") == 0 && hasValue) {
+      if (!parseNoiseProfile(argv[++i], options.noiseProfile)) {
+        printUsage(argv[0]);
+        return 1;
+      }
+    }
+    else if (strcmp(argv[i], "--pour-interval") == 0 && hasValue) {
+      options.pourIntervalS = atof(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--seed") == 0 && hasValue) {
+      options.seed = strtoul(argv[++i], NULL, 10);
+    }
+    else if (strcmp(argv[i], "--link") == 0 && hasValue) {
+      options.linkPath = argv[++i];
+    }
+    else if (strcmp(argv[i], "--throttle") == 0) {
+      options.throttle = true;
+    }
+    else if (strcmp(argv[i], "--echo-commands") == 0) {
+      options.echoCommands = true;
+    }
+    else if (strcmp(argv[i], "--stats-interval") == 0 && hasValue) {
+      options.statsIntervalS = atof(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--duration") == 0 && hasValue) {
+      options.durationS = atof(argv[++i]);
+    }
+    else {
+      printUsage(argv[0]);
+      return 1;
+    }
+  }
+
+  if (options.numMeters < 1 || options.numMeters > MAX_NUM_METERS || options.rateHz <= 0 || options.pourIntervalS <= 0) {
+    printUsage(argv[0]);
+    return 1;
+  }
+
+  struct sigaction quitAction;
+  memset(&quitAction, 0, sizeof(quitAction));
+  quitAction.sa_handler = onQuitSignal;
+  sigaction(SIGINT, &quitAction, NULL);
+  sigaction(SIGTERM, &quitAction, NULL);
+
+  Emulator emulator(options);
+  if (!emulator.open()) {
+    return 1;
+  }
+  emulator.run();
+  return 0;
+}
@@ -1,5 +1,8 @@
 #include <Adafruit_NeoPixel.h>
 #include "keg_load_meter.h"
+#include "keg_meter_protocol.h"
+#include "task_scheduler.h"
+#include "led_renderer.h"
 //#include "serial_read_helper.h"
 
 #define LED_OUTPUT_PIN 5
@@ -17,6 +20,10 @@
 //   NEO_RGB     Pixels are wired for RGB bitstream (v1 FLORA pixels, not v2)
 Adafruit_NeoPixel strip = Adafruit_NeoPixel(NUM_LEDS, LED_OUTPUT_PIN, NEO_GRB + NEO_KHZ800);
 
+// The meters draw through this, so the strip is only shown when something on it changed
+#define MAX_FRAMES_PER_SECOND 50
+LedRenderer leds(strip, MAX_FRAMES_PER_SECOND);
+
 // IMPORTANT: To reduce NeoPixel burnout risk, add 1000 uF capacitor across
 // pixel power leads, add 300 - 500 Ohm resistor on first pixel's data input
 // and minimize distance between Arduino and first pixel.  Avoid connecting
@@ -30,7 +37,7 @@ Adafruit_NeoPixel strip = Adafruit_NeoPixel(NUM_LEDS, LED_OUTPUT_PIN, NEO_GRB +
 // Each 1 integer increment in the incoming analog read value is approximately 1kg.
 // Values start around approx 12 -- this should be calibrated for though.
 
-KegLoadMeter kegMeters[] = { KegLoadMeter(0, strip) };
+KegLoadMeter kegMeters[] = { KegLoadMeter(0, leds) };
 float kegLoadsInKg[NUM_KEGS];
 int kegInputPins[] = { 0 };
 
@@ -51,8 +58,21 @@ float analogToLoad(float analogVal){
 }
 
 
-// Simulation defines
-#define DEFAULT_DELAY_TICK_MS 1
+// Task periods, and how late after they were due the tasks may finish before they count as
+// overrun (see TaskScheduler), in microseconds
+#define SAMPLE_PERIOD_US      2000
+#define SAMPLE_DEADLINE_US    4000
+#define FILTER_PERIOD_US      4000
+#define FILTER_DEADLINE_US    8000
+#define RENDER_PERIOD_US      5000 // How often there can be a frame, the renderer caps the frame rate
+#define RENDER_DEADLINE_US    20000
+#define TELEMETRY_PERIOD_US   3000000
+#define TELEMETRY_DEADLINE_US 500000
+
+// The time constant of the running average the load sensor readings are smoothed with
+#define SAMPLE_SMOOTHING_TIME_MS 350
+
+TaskScheduler scheduler;
 
 // Serial protocol defines
 #define METER_SELECT_CHAR 'm'
@@ -61,50 +81,133 @@ float analogToLoad(float analogVal){
 #define KEG_TYPE_CHANGE_CHAR 'T'
 #define UPDATE_METER_CHAR 'U'
 #define RESET_METER_CHAR 'R'
+#define BINARY_PROTOCOL_CHAR 'B'
+#define BAUD_RATE_CHAR 'S'
 #define PKG_BEGIN_CHAR '|'
+#define UPDATE_VALUE_SEPARATOR_CHAR ','
+
+// Numbers in commands are zero padded to a fixed width, but can end early with any other character
+#define METER_IDX_WIDTH 3
+#define UPDATE_PERCENT_WIDTH 4
+#define UPDATE_MASS_WIDTH 6
+#define MAX_NUMBER_WIDTH 8
+#define NUM_UPDATE_VALUES 3
+
+// A command that stops coming in for this long is finished with what there is, if that's enough
+#define COMMAND_TIMEOUT_MS 150
+
+// Commands are read a byte at a time as they come in, without ever waiting for the rest (see
+// readSerialCommands), this is where the one that's coming in is at
+enum SerialReadState {
+  ReadBegin,    // Waiting for the PKG_BEGIN_CHAR
+  ReadCommand,  // The command character
+  ReadTarget,   // ALL_METERS_CHAR or METER_SELECT_CHAR
+  ReadMeterIdx, // The meter index
+  ReadOption,   // A single character argument: the keg type, protocol version or baud rate index
+  ReadValue     // One of the UPDATE_VALUE_SEPARATOR_CHAR separated numbers of an update
+};
+
+struct SerialCommand {
+  SerialReadState state;
+  unsigned long lastReadTimeMs;
+  
+  char commandChar;
+  boolean allMeters;
+  int meterIdx;
+  char option;
+  float values[NUM_UPDATE_VALUES];
+  uint8_t numValues;
+  
+  // The digits of the number that's coming in
+  char number[MAX_NUMBER_WIDTH + 1];
+  uint8_t numberLength;
+};
+
+SerialCommand serialCommand;
 
 void setup() {
   Serial.begin(9600);
+  resetSerialCommand();
   
   pinMode(EMPTY_CAL_BUTTON_INPUT_PIN, INPUT);
   
-  strip.begin();
-  strip.show(); // Initialize all pixels to 'off'
+  leds.begin(); // Initialize all pixels to 'off'
+  
+  scheduler.addTask("sample", sampleTask, SAMPLE_PERIOD_US, SAMPLE_DEADLINE_US);
+  scheduler.addTask("filter", filterTask, FILTER_PERIOD_US, FILTER_DEADLINE_US);
+  scheduler.addTask("render", renderTask, RENDER_PERIOD_US, RENDER_DEADLINE_US);
+  scheduler.addTask("telemetry", telemetryTask, TELEMETRY_PERIOD_US, TELEMETRY_DEADLINE_US);
 }
 
-//int count = 0;
 void loop() {
   // Keg modes/calibration can be set via serial...
   readSerialCommands();
   
+  // ...everything else happens in the tasks, whenever they're due
+  scheduler.run();
+}
+
+/**
+ * Read the load sensors (and the empty calibration button).
+ */
+void sampleTask(uint32_t elapsedMicros) {
   if (digitalRead(EMPTY_CAL_BUTTON_INPUT_PIN) >= 1) {
     doEmptyCalibrationToAllKegs();
   }
   
-  // Perform sensor readings and meter updates...
+  float smoothing = elapsedMicros / (elapsedMicros + SAMPLE_SMOOTHING_TIME_MS * 1000.0);
   for (uint8_t kegIdx = 0; kegIdx < NUM_KEGS; kegIdx++) {
-    
-    // Sensor readings...
-    getLoadSensorReading(kegIdx, &kegLoadsInKg[kegIdx]);
-    
-    // Meter update...
-    kegMeters[kegIdx].tick(DEFAULT_DELAY_TICK_MS, kegLoadsInKg[kegIdx]);
+    getLoadSensorReading(kegIdx, smoothing, &kegLoadsInKg[kegIdx]);
   }
+}
+
+/**
+ * Update the meters with the latest loads: their load windows, states and animations.
+ */
+void filterTask(uint32_t elapsedMicros) {
+  // The meters count time in whole ms, whatever is left over goes to the next update
+  static uint32_t leftoverMicros = 0;
+  uint32_t frameDeltaMicros = elapsedMicros + leftoverMicros;
+  leftoverMicros = frameDeltaMicros % 1000;
   
-  // All delays and redraw (i.e., "show") of the strip is done at the end of a frame
-  strip.show();
-  delay(DEFAULT_DELAY_TICK_MS);
+  for (uint8_t kegIdx = 0; kegIdx < NUM_KEGS; kegIdx++) {
+    kegMeters[kegIdx].tick(frameDeltaMicros / 1000, kegLoadsInKg[kegIdx]);
+  }
+}
+
+/**
+ * Redraw (i.e., "show") the strip with whatever the meters have set its pixels to, if that changed.
+ */
+void renderTask(uint32_t /* elapsedMicros */) {
+  leds.render();
+}
+
+/**
+ * Send the status of every meter, and how the tasks are doing whenever any of them overran since
+ * the last time.
+ */
+void telemetryTask(uint32_t /* elapsedMicros */) {
+  for (uint8_t kegIdx = 0; kegIdx < NUM_KEGS; kegIdx++) {
+    kegMeters[kegIdx].outputStatusToSerial();
+  }
+  
+  static uint32_t lastNumOverruns = 0;
+  uint32_t numOverruns = scheduler.getTotalNumOverruns();
+  if (numOverruns != lastNumOverruns) {
+    scheduler.printStats();
+    lastNumOverruns = numOverruns;
+  }
 }
 
 /**
  * Get incoming data from the load sensor for the given keg and populate the given mass value.
  */
-void getLoadSensorReading(uint8_t kegIdx, float* loadValueInKg) {
+void getLoadSensorReading(uint8_t kegIdx, float smoothing, float* loadValueInKg) {
   
   int analogValue = analogRead(kegInputPins[kegIdx]);
   
   // Perform a running average to smooth the readings a little bit
-  *loadValueInKg  = 0.99 * (*loadValueInKg) + 0.01 * analogToLoad(analogValue);
+  *loadValueInKg  = (1 - smoothing) * (*loadValueInKg) + smoothing * analogToLoad(analogValue);
 }
 
 void doEmptyCalibrationToAllKegs() {
@@ -122,134 +225,236 @@ void doEmptyCalibrationToAllKegs() {
 // Keg type message (specific meter): '|Tmxxxy', where 'x' is the zero-based index of the meter, and 'y' is the type
 // Update a given meter '|Umxxx,p.pp,fff.ff,eee.ee', where 'x' is the zero-based index of the meter, p is the percentage, f is the full amount, e is the empty amount
 // Reset a given meter '|Rmxxx', where 'x' is the zero-based index of the meter
+// Switch to the binary protocol '|Bv', where 'v' is the protocol version (see KegMeterProtocol::SetBinaryMode)
+// Switch the baud rate '|Si', where 'i' is the baud rate index (see KegMeterProtocol::SetBaudRate)
+//
+// The loop only ever takes what has already arrived and a command is carried out once its last byte
+// is in, so commands coming in over several loops don't hold up the sampling and the LEDs. A new
+// PKG_BEGIN_CHAR always starts over.
 
 void readSerialCommands() {
-  if (Serial.available() < 2) {
+  KegMeterProtocol::CheckBaudRate();
+  
+  if (serialCommand.state != ReadBegin && millis() - serialCommand.lastReadTimeMs > COMMAND_TIMEOUT_MS) {
+    // Like a number sent without its padding, otherwise there's no more to it
+    if (serialCommand.numberLength > 0) {
+      finishSerialNumber();
+    }
+    else {
+      resetSerialCommand();
+    }
+  }
+  
+  while (Serial.available() > 0) {
+    serialCommand.lastReadTimeMs = millis();
+    readSerialCommandChar(Serial.read());
+  }
+}
+
+void resetSerialCommand() {
+  serialCommand.state = ReadBegin;
+  serialCommand.commandChar = 0;
+  serialCommand.allMeters = false;
+  serialCommand.meterIdx = -1;
+  serialCommand.option = 0;
+  serialCommand.numValues = 0;
+  serialCommand.numberLength = 0;
+}
+
+void readSerialCommandChar(char serialReadByte) {
+  if (serialReadByte == PKG_BEGIN_CHAR) {
+    resetSerialCommand();
+    serialCommand.state = ReadCommand;
+    return;
+  }
+  
+  switch (serialCommand.state) {
+    
+    case ReadBegin:
+      // Anything between commands is ignored
+      break;
+    
+    case ReadCommand:
+      serialCommand.commandChar = serialReadByte;
+      switch (serialReadByte) {
+        case EMPTY_CALIBRATE_MODE_CHAR:
+        case KEG_TYPE_CHANGE_CHAR:
+        case UPDATE_METER_CHAR:
+        case RESET_METER_CHAR:
+          serialCommand.state = ReadTarget;
+          break;
+        
+        case BINARY_PROTOCOL_CHAR:
+        case BAUD_RATE_CHAR:
+          serialCommand.state = ReadOption;
+          break;
+        
+        default:
+          Serial.println("ERROR: No command found.");
+          resetSerialCommand();
+          break;
+      }
+      break;
+    
+    case ReadTarget:
+      if (serialReadByte == METER_SELECT_CHAR) {
+        serialCommand.state = ReadMeterIdx;
+      }
+      else if (serialReadByte == ALL_METERS_CHAR && serialCommand.commandChar == EMPTY_CALIBRATE_MODE_CHAR) {
+        serialCommand.allMeters = true;
+        dispatchSerialCommand();
+      }
+      else if (serialReadByte == ALL_METERS_CHAR && serialCommand.commandChar == KEG_TYPE_CHANGE_CHAR) {
+        serialCommand.allMeters = true;
+        serialCommand.state = ReadOption;
+      }
+      else {
+        Serial.println("ERROR: Command option not found.");
+        resetSerialCommand();
+      }
+      break;
+    
+    case ReadMeterIdx:
+    case ReadValue:
+      readSerialNumberChar(serialReadByte);
+      break;
+    
+    case ReadOption:
+      serialCommand.option = serialReadByte;
+      dispatchSerialCommand();
+      break;
+  }
+}
+
+void readSerialNumberChar(char serialReadByte) {
+  boolean isNumberChar = (serialReadByte >= '0' && serialReadByte <= '9') ||
+                         (serialCommand.state == ReadValue && (serialReadByte == '.' || serialReadByte == '-'));
+  
+  if (!isNumberChar) {
+    if (serialCommand.numberLength == 0) {
+      // The separator in front of a value (after one that ended at its full width)
+      if (serialCommand.state == ReadValue && serialReadByte == UPDATE_VALUE_SEPARATOR_CHAR) {
+        return;
+      }
+      Serial.println("ERROR: Invalid number.");
+      resetSerialCommand();
+      return;
+    }
+    
+    // The number ends early, the character is the next part of the command
+    finishSerialNumber();
+    readSerialCommandChar(serialReadByte);
     return;
   }
   
-  while (Serial.available() > 0 && Serial.peek() != PKG_BEGIN_CHAR) { Serial.read(); }
+  serialCommand.number[serialCommand.numberLength++] = serialReadByte;
+  if (serialCommand.numberLength >= getSerialNumberWidth()) {
+    finishSerialNumber();
+  }
+}
+
+uint8_t getSerialNumberWidth() {
+  if (serialCommand.state == ReadMeterIdx) {
+    return METER_IDX_WIDTH;
+  }
+  return (serialCommand.numValues == 0) ? UPDATE_PERCENT_WIDTH : UPDATE_MASS_WIDTH;
+}
+
+void finishSerialNumber() {
+  serialCommand.number[serialCommand.numberLength] = '\0';
+  serialCommand.numberLength = 0;
+  
+  if (serialCommand.state == ReadMeterIdx) {
+    serialCommand.meterIdx = atoi(serialCommand.number);
+    switch (serialCommand.commandChar) {
+      case KEG_TYPE_CHANGE_CHAR:
+        serialCommand.state = ReadOption;
+        break;
+      case UPDATE_METER_CHAR:
+        serialCommand.state = ReadValue;
+        break;
+      default:
+        dispatchSerialCommand();
+        break;
+    }
+    return;
+  }
   
-  if (!waitForSerial(2)) { return; }
-  Serial.read(); // Read the PKG_BEGIN_CHAR
-  char serialReadByte = Serial.read();
+  serialCommand.values[serialCommand.numValues++] = atof(serialCommand.number);
+  if (serialCommand.numValues == NUM_UPDATE_VALUES) {
+    dispatchSerialCommand();
+  }
+}
 
-  switch (serialReadByte) {
+// Carry out the command that's just come in completely
+void dispatchSerialCommand() {
+  int meterIdx = serialCommand.meterIdx;
+  boolean validMeterIdx = (meterIdx < NUM_KEGS && meterIdx >= 0);
+  
+  switch (serialCommand.commandChar) {
     
     case EMPTY_CALIBRATE_MODE_CHAR:
-      if (!waitForSerial(1)) { return; }
-      serialReadByte = Serial.read();
-      if (serialReadByte == ALL_METERS_CHAR) {
+      if (serialCommand.allMeters) {
         // Empty calibration for all meters
         doEmptyCalibrationToAllKegs();
       }
+      else if (validMeterIdx) {
+        Serial.print("Performing Empty Calibration on keg index ");
+        Serial.print(meterIdx);
+        Serial.println("...");
+        kegMeters[meterIdx].doEmptyCalibration();
+      }
       else {
-        // Empty calibration for a specific meter...
-        // Get the meter index to calibrate for...
-        if (!waitForSerial(3)) { return; }
-        int meterIdx = Serial.parseInt();
-        if (meterIdx < NUM_KEGS && meterIdx >= 0) {
-          Serial.print("Performing Empty Calibration on keg index ");
-          Serial.print(meterIdx);
-          Serial.println("...");
-          kegMeters[meterIdx].doEmptyCalibration();
-        }
-        else {
-          Serial.print("ERROR: Invalid meter index.");
-        }
+        Serial.println("ERROR: Invalid meter index.");
       }
-
       break;
-      
+    
     case KEG_TYPE_CHANGE_CHAR:
-      if (!waitForSerial(1)) { return; }
-      serialReadByte = Serial.read();
-      if (serialReadByte == ALL_METERS_CHAR) {
-        // There should be another part of the message, wait for it
-        if (!waitForSerial(1)) { return; }
-        char kegType = Serial.read();
+      if (serialCommand.allMeters) {
         for (int i = 0; i < NUM_KEGS; i++) {
-          setKegType(kegMeters[i], kegType);
+          setKegType(kegMeters[i], serialCommand.option);
         }
       }
+      else if (validMeterIdx) {
+        setKegType(kegMeters[meterIdx], serialCommand.option);
+      }
       else {
-        // Get the meter index
-        if (!waitForSerial(3)) { return; }
-        int meterIdx = Serial.parseInt();
-        if (meterIdx < NUM_KEGS && meterIdx >= 0) {
-          // There should be another part of the message, wait for it
-          if (!waitForSerial(1)) { return; }
-          setKegType(kegMeters[meterIdx], Serial.read());
-        }
-        else {
-          Serial.print("ERROR: Invalid meter index.");
-        }
+        Serial.println("ERROR: Invalid meter index.");
       }
-
       break;
     
-    case UPDATE_METER_CHAR: {
-
-      if (!waitForSerial(1)) { return; }
-      serialReadByte = Serial.read();
-      
-      if (serialReadByte == METER_SELECT_CHAR) {
-        
-        if (!waitForSerial(3)) { return; }
-        
-        int meterIdx = Serial.parseInt();
-        if (meterIdx < NUM_KEGS && meterIdx >= 0) {
-          if (!waitForSerial(19)) { return; }
-          Serial.read();
-          
-          // Read the rest of the message...
-          float percent = Serial.parseFloat();
-          Serial.read();
-
-          float fullAmt = Serial.parseFloat();
-          Serial.read();
- 
-          float emptyAmt = Serial.parseFloat();
-          
-          kegMeters[meterIdx].setStateValues(percent, fullAmt, emptyAmt);
-          Serial.print("Updated keg "); Serial.print(meterIdx); Serial.println(" state values.");
-        }
-        else {
-          Serial.println("ERROR: Invalid meter index.");
-        }
+    case UPDATE_METER_CHAR:
+      if (validMeterIdx) {
+        kegMeters[meterIdx].setStateValues(serialCommand.values[0], serialCommand.values[1], serialCommand.values[2]);
+        Serial.print("Updated keg "); Serial.print(meterIdx); Serial.println(" state values.");
       }
       else {
-        Serial.println("ERROR: Command option not found.");
+        Serial.println("ERROR: Invalid meter index.");
       }
-      
       break;
-    }
     
-    case RESET_METER_CHAR: {
-      if (!waitForSerial(1)) { return; }
-      serialReadByte = Serial.read();
-      
-      if (serialReadByte == METER_SELECT_CHAR) {
-        if (!waitForSerial(3)) { return; }
-        int meterIdx = Serial.parseInt();
-        if (meterIdx < NUM_KEGS && meterIdx >= 0) {
-          kegMeters[meterIdx].setEmpty();
-        }
-        else {
-          Serial.println("ERROR: Invalid meter index.");
-        }
+    case RESET_METER_CHAR:
+      if (validMeterIdx) {
+        kegMeters[meterIdx].setEmpty();
       }
       else {
-        Serial.println("ERROR: Command option not found.");
+        Serial.println("ERROR: Invalid meter index.");
       }
-      break; 
-    }
+      break;
+    
+    case BINARY_PROTOCOL_CHAR:
+      KegMeterProtocol::SetBinaryMode(serialCommand.option, NUM_KEGS);
+      break;
+    
+    case BAUD_RATE_CHAR:
+      KegMeterProtocol::SetBaudRate(serialCommand.option);
+      break;
     
     default:
-      Serial.println("ERROR: No command found.");
-      break;    
+      break;
   }
- 
+  
+  resetSerialCommand();
 }
 
 #define CORNY_KEG_CHAR 'c'
@@ -280,12 +485,3 @@ void printKegTypeSetMsg(const KegLoadMeter& kegMeter, const char* typeName) {
   Serial.print(" set to ");
   Serial.println(typeName);
 }
-
-boolean waitForSerial(int numBytes) {
-  unsigned long maxWaitTime = millis() + 150;
-  while (Serial.available() < numBytes && millis() < maxWaitTime) {} 
-  
-  return Serial.available() >= numBytes;
-}
-
-
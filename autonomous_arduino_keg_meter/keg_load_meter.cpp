@@ -47,9 +47,9 @@ static float LERP(float x, float x0, float x1, float y0, float y1) {
 //#define EEPROM_CAL_FULL_AMT_ADDR   (this->meterIdx * EEPROM_NUM_ADDRS + 1);
 //#define EEPROM_EMPTY_KEG_MASS_ADDR (this->meterIdx * EEPROM_NUM_ADDRS + 2);
 
-KegLoadMeter::KegLoadMeter(uint8_t meterIdx, Adafruit_NeoPixel& strip) : 
-  meterIdx(meterIdx), startLEDIdx(meterIdx*NUM_LEDS_PER_METER), loadWindowIdx(0), 
-  calibratingAnimLEDIdx(0), calibratedAnimLEDIdx(0), currState(Empty), strip(strip), 
+KegLoadMeter::KegLoadMeter(uint8_t meterIdx, LedRenderer& leds) : 
+  meterIdx(meterIdx), startLEDIdx(meterIdx*NUM_LEDS_PER_METER), 
+  calibratingAnimLEDIdx(0), calibratedAnimLEDIdx(0), currState(Empty), leds(leds), 
   calibratedEmptyLoadAmt(0), delayCounterMillis(0), runningAvgVariance(0.1),
   dataCounter(0), detectedEmptyKegMass(AVG_EMPTY_CORNY_KEG_MASS_KG) {
   
@@ -119,7 +119,7 @@ void KegLoadMeter::tick(uint32_t frameDeltaMillis, float approxLoadInKg) {
         DEBUG_WITH_STR_INT("Current load window mean: ", this->getLoadWindowMean());
         DEBUG_WITH_STR_INT("Current load value: ", approxLoadInKg);
         DEBUG_WITH_STR_INT("Empty to calibrating minimum mass: ", this->getEmptyToCalMinMass());
-        DEBUG_WITH_STR_INT("Current load window variance: ", this->loadWindowVariance);
+        DEBUG_WITH_STR_INT("Current load window variance: ", this->getLoadWindowVariance());
         COUNTER = 0;
       }
       COUNTER++;
@@ -140,7 +140,7 @@ void KegLoadMeter::tick(uint32_t frameDeltaMillis, float approxLoadInKg) {
       static int COUNTER = 0;
       if (COUNTER % 100 == 0) {
         DEBUG_WITH_STR_INT("Current load window mean: ", this->getLoadWindowMean());
-        DEBUG_WITH_STR_INT("Current load window variance: ", this->loadWindowVariance);
+        DEBUG_WITH_STR_INT("Current load window variance: ", this->getLoadWindowVariance());
         DEBUG_WITH_STR_INT("Current load value: ", approxLoadInKg);
       }
       COUNTER++;
@@ -152,7 +152,7 @@ void KegLoadMeter::tick(uint32_t frameDeltaMillis, float approxLoadInKg) {
       }
       else {
         // Wait until the variance goes below a certain threshold...
-        float percentCalibrated = max(0.0, min(1.0, LERP(abs(this->loadWindowVariance), MINIMUM_VARIANCE_TO_FINISH_CALIBRATING, 1, 1.0, 0.0)));
+        float percentCalibrated = max(0.0, min(1.0, LERP(abs(this->getLoadWindowVariance()), MINIMUM_VARIANCE_TO_FINISH_CALIBRATING, 1, 1.0, 0.0)));
         float highestPercentCalibrated = min(percentCalibrated, LERP(this->dataCounter, 10*LOAD_WINDOW_SIZE, 1, 1.0, 0.0));
         this->showCalibratingAnimation(CALIBRATE_ANIM_DELAY_MS, highestPercentCalibrated, true);
         
@@ -201,9 +201,9 @@ void KegLoadMeter::tick(uint32_t frameDeltaMillis, float approxLoadInKg) {
       if (COUNTER % 500 == 0) {
         //DEBUG_WITH_STR_INT("Empty window value: ", this->calibratedEmptyLoadAmt);
         //DEBUG_WITH_STR_INT("Current load window mean: ", this->getLoadWindowMean());
-        //DEBUG_WITH_STR_INT("Current load window variance: ", this->loadWindowVariance);
+        //DEBUG_WITH_STR_INT("Current load window variance: ", this->getLoadWindowVariance());
         //DEBUG_WITH_STR_INT("Current load value: ", approxLoadInKg);
-        Serial.print("Variance: "); Serial.println(this->loadWindowVariance);
+        Serial.print("Variance: "); Serial.println(this->getLoadWindowVariance());
         COUNTER = 0;
       }
       COUNTER++;
@@ -231,13 +231,6 @@ void KegLoadMeter::tick(uint32_t frameDeltaMillis, float approxLoadInKg) {
       return; 
   }
   
-  static int OUTPUT_COUNTER = 0;
-  if (OUTPUT_COUNTER % 1000 == 0) {
-    this->outputStatusToSerial();
-    OUTPUT_COUNTER = 0;
-  }
-  OUTPUT_COUNTER++;
-  
   this->delayCounterMillis += frameDeltaMillis;
 }
 
@@ -318,29 +311,21 @@ void KegLoadMeter::setState(State newState) {
  * Params:
  * percent - The percentage to set [0,1].
  */
-void KegLoadMeter::setMeterPercentage(float percent, boolean drawEmptyLEDs) {
-  uint16_t idx = this->startLEDIdx;
-  uint16_t litEndIdx = idx + ceil(percent * KegLoadMeter::NUM_LEDS_PER_METER);
-  uint16_t meterEndIdx = idx + KegLoadMeter::NUM_LEDS_PER_METER;
-  
-  for (; idx <= litEndIdx; idx++) {
-    this->strip.setPixelColor(idx, getFullColour());
-  }
-  if (drawEmptyLEDs) {
-    idx = litEndIdx + 1;
-    for (; idx <= meterEndIdx; idx++) {
-      this->strip.setPixelColor(idx, getEmptyColour());
-    }
-  }
+void KegLoadMeter::setMeterPercentage(float percent) {
+  uint16_t litEndIdx = this->startLEDIdx + this->getNumLitLEDs(percent);
+  this->leds.fill(this->startLEDIdx, litEndIdx, getFullColour());
+  this->leds.fill(litEndIdx, this->startLEDIdx + KegLoadMeter::NUM_LEDS_PER_METER, getEmptyColour());
+}
+
+// There's always at least one LED lit, and never more than the meter has
+uint16_t KegLoadMeter::getNumLitLEDs(float percent) const {
+  return min(ceil(percent * KegLoadMeter::NUM_LEDS_PER_METER) + 1, KegLoadMeter::NUM_LEDS_PER_METER);
 }
 
 boolean KegLoadMeter::showEmptyAnimation(uint8_t pulseTimeInMillis, uint8_t numPulses) {
 
   uint16_t meterEndIdx = this->startLEDIdx + KegLoadMeter::NUM_LEDS_PER_METER;  
-  uint32_t deathColour = getEmptyAnimationColour(this->emptyAnimPulseCount);
-  for (uint16_t idx = this->meterIdx * KegLoadMeter::NUM_LEDS_PER_METER; idx <= meterEndIdx; idx++) {
-    this->strip.setPixelColor(idx, deathColour);
-  }
+  this->leds.fill(this->startLEDIdx, meterEndIdx, getEmptyAnimationColour(this->emptyAnimPulseCount));
   
   if (this->delayCounterMillis >= pulseTimeInMillis) {
     this->emptyAnimPulseCount++;
@@ -360,33 +345,28 @@ boolean KegLoadMeter::showEmptyAnimation(uint8_t pulseTimeInMillis, uint8_t numP
  * Params:
  * percentCalibrated - The percentage that the calibration is complete in [0,1]. 0 being 
  * not calibrated at all, 1 being fully calibrated.
+ * numLitLEDs - How many LEDs from the start of the meter are lit over the animation.
  */
-void KegLoadMeter::showCalibratingAnimation(uint8_t delayMillis, float percentCalibrated, boolean resetDelayCounter) {
+void KegLoadMeter::showCalibratingAnimation(uint8_t delayMillis, float percentCalibrated, boolean resetDelayCounter, uint16_t numLitLEDs) {
 
-  static const uint8_t OFFSET = 4;
   static const uint8_t TRAIL_SIZE = 9;
   
-  this->turnOff();
-  
-  // Draw spinning loading wheels on each of the rings...
+  // Draw spinning loading wheels on each of the rings: a bright pixel and a trail behind it, the
+  // rest is off. Every pixel is set once, so the renderer only sees the ones that really moved.
   const uint8_t mostBright = (uint8_t)max(TRAIL_SIZE, percentCalibrated * BASE_CALIBRATING_BRIGHTNESS);
+  uint16_t meterLEDIdx = 0;
   for (int ringIdx = 0; ringIdx < NUM_RINGS_PER_METER; ringIdx++) {
-    int16_t currRingStartLEDIdx = this->startLEDIdx + ringIdx * NUM_LEDS_PER_RING;
-    int16_t currRingEndLEDIdx = currRingStartLEDIdx + NUM_LEDS_PER_RING;
-    int16_t currLEDIdx = currRingStartLEDIdx + this->calibratingAnimLEDIdx;
-    
-    // Bright pixel and a trail...
-    for (uint8_t trailIdx = 0; trailIdx < TRAIL_SIZE; trailIdx++) {
-      int16_t mappedLEDIdx = currLEDIdx - trailIdx;
-      if (mappedLEDIdx < currRingStartLEDIdx) {
-        mappedLEDIdx += NUM_LEDS_PER_RING;
+    for (uint8_t ringLEDIdx = 0; ringLEDIdx < NUM_LEDS_PER_RING; ringLEDIdx++, meterLEDIdx++) {
+      uint32_t colour = 0;
+      uint8_t trailIdx = (this->calibratingAnimLEDIdx + NUM_LEDS_PER_RING - ringLEDIdx) % NUM_LEDS_PER_RING;
+      if (meterLEDIdx < numLitLEDs) {
+        colour = getFullColour();
       }
-      else if (mappedLEDIdx > currRingEndLEDIdx) {
-        mappedLEDIdx -= NUM_LEDS_PER_RING;
+      else if (trailIdx < TRAIL_SIZE) {
+        float diminishAmt = pow(((float)trailIdx) / ((float)TRAIL_SIZE), 0.6);
+        colour = this->getDiminishedWhite(1.0-diminishAmt, mostBright);
       }
-      
-      float diminishAmt = pow(((float)trailIdx) / ((float)TRAIL_SIZE), 0.6);
-      this->strip.setPixelColor(mappedLEDIdx, this->getDiminishedWhite(1.0-diminishAmt, mostBright));
+      this->leds.setPixelColor(this->startLEDIdx + meterLEDIdx, colour);
     }
   }
   
@@ -399,17 +379,16 @@ void KegLoadMeter::showCalibratingAnimation(uint8_t delayMillis, float percentCa
 }
 
 boolean KegLoadMeter::showCalibratedAnimation(uint8_t delayMillis) {
-  this->showCalibratingAnimation(delayMillis, 1.0, false);
-  
   // Start filling the meter
-  this->setMeterPercentage(((float)this->calibratedAnimLEDIdx)/((float)strip.numPixels()), false);
+  uint16_t numLitLEDs = this->getNumLitLEDs(((float)this->calibratedAnimLEDIdx)/((float)this->leds.numPixels()));
+  this->showCalibratingAnimation(delayMillis, 1.0, false, numLitLEDs);
   
   if (this->delayCounterMillis >= delayMillis) {
     this->calibratedAnimLEDIdx++;
     this->delayCounterMillis = 0;
   }
    
-  if (this->calibratedAnimLEDIdx == this->strip.numPixels()) {
+  if (this->calibratedAnimLEDIdx == this->leds.numPixels()) {
     return true;
   }
 
@@ -417,11 +396,7 @@ boolean KegLoadMeter::showCalibratedAnimation(uint8_t delayMillis) {
 }
 
 void KegLoadMeter::turnOff() {
-  uint16_t idx = this->startLEDIdx;
-  uint16_t meterEndIdx = idx + KegLoadMeter::NUM_LEDS_PER_METER;
-  for (; idx < meterEndIdx; idx++) {
-    this->strip.setPixelColor(idx, 0);
-  }
+  this->leds.fill(this->startLEDIdx, this->startLEDIdx + KegLoadMeter::NUM_LEDS_PER_METER, 0);
 }
 
 void KegLoadMeter::outputStatusToSerial() const {
@@ -431,9 +406,9 @@ void KegLoadMeter::outputStatusToSerial() const {
 
 uint32_t KegLoadMeter::getEmptyAnimationColour(uint8_t cycleIdx) const {
   if (cycleIdx % 2 == 0) {
-    return this->strip.Color(0,0,0);
+    return LedRenderer::Color(0,0,0);
   }
-  return this->strip.Color(DEATH_PULSE_BRIGHTNESS, 0, 0);
+  return LedRenderer::Color(DEATH_PULSE_BRIGHTNESS, 0, 0);
 }
 
 uint32_t KegLoadMeter::getCalibratingColour(float percentCalibrated) const {
@@ -442,44 +417,20 @@ uint32_t KegLoadMeter::getCalibratingColour(float percentCalibrated) const {
 
 uint32_t KegLoadMeter::getDiminishedWhite(float multiplier, uint8_t whiteAmt) const {
   uint8_t colourVal = multiplier*whiteAmt;
-  return this->strip.Color(colourVal,colourVal,colourVal);
+  return LedRenderer::Color(colourVal,colourVal,colourVal);
 }
 
 uint32_t KegLoadMeter::getDiminishedColour(float multiplier, uint8_t r, uint8_t g, uint8_t b) const {
-  return this->strip.Color(multiplier*r, multiplier*g, multiplier*b);
+  return LedRenderer::Color(multiplier*r, multiplier*g, multiplier*b);
 }
 
 void KegLoadMeter::fillLoadWindow(float value) {
-  for (int i = 0; i < LOAD_WINDOW_SIZE; i++) {
-    this->loadWindow[i] = value;
-  }
-  this->loadWindowSum = value * LOAD_WINDOW_SIZE;
-  this->loadWindowVariance = 0.0;
+  this->loadWindow.fill(value);
 }
 
 void KegLoadMeter::putInLoadWindow(float value) {
-  {
-    float prevVarianceValue  = (this->loadWindow[this->loadWindowIdx] - this->getLoadWindowMean());
-    prevVarianceValue *= prevVarianceValue;
-    prevVarianceValue /= (float)LOAD_WINDOW_SIZE;
-    
-    this->loadWindowVariance -= prevVarianceValue;
-  }
-  
-  this->loadWindowSum -= this->loadWindow[this->loadWindowIdx];
-  this->loadWindowSum += value;  
-  this->loadWindow[this->loadWindowIdx] = value;
-  this->loadWindowIdx = (this->loadWindowIdx + 1) % LOAD_WINDOW_SIZE;
-  
-  {
-    float newVarianceValue = (value - this->getLoadWindowMean());
-    newVarianceValue *= newVarianceValue;
-    newVarianceValue /= (float)LOAD_WINDOW_SIZE;
-    
-    this->loadWindowVariance += newVarianceValue;
-  }
-  
-  this->runningAvgVariance = 0.99*this->runningAvgVariance + 0.01*abs(this->loadWindowVariance);
+  this->loadWindow.push(value);
+  this->runningAvgVariance = 0.99*this->runningAvgVariance + 0.01*this->getLoadWindowVariance();
 }
 
 float KegLoadMeter::getEmptyToCalMinMass() const { 
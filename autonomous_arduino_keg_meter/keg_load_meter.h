@@ -1,7 +1,9 @@
 #ifndef KEG_LOAD_METER_H_
 #define KEG_LOAD_METER_H_
 
-#include <Adafruit_NeoPixel.h>
+#include "led_renderer.h"
+
+#include "load_window.h"
 
 class KegLoadMeter {
 public:
@@ -12,7 +14,7 @@ public:
 
   enum KegType { Corny, Sanke50L };
   
-  KegLoadMeter(uint8_t meterIdx, Adafruit_NeoPixel& strip);
+  KegLoadMeter(uint8_t meterIdx, LedRenderer& leds);
   ~KegLoadMeter() {}
 
   uint8_t getIndex() const { return this->meterIdx; }
@@ -43,13 +45,10 @@ private:
   float calibratedEmptyLoadAmt;  // State: EmptyCalibration, Empty, JustBecameEmpty, Measuring
   float detectedEmptyKegMass;
   
-  static const int LOAD_WINDOW_SIZE = 100; // Never make this bigger than 255!!
-  uint8_t loadWindowIdx;
-  float loadWindow[LOAD_WINDOW_SIZE];
-  float loadWindowSum;
-  float loadWindowVariance;
+  static const int LOAD_WINDOW_SIZE = 100;
+  LoadWindow<LOAD_WINDOW_SIZE> loadWindow;
   
-  Adafruit_NeoPixel& strip;  // The LED strip object
+  LedRenderer& leds;  // Draws on the LED strip
   
   static const uint8_t ALIVE_BRIGHTNESS;
   static const uint8_t DEAD_BRIGHTNESS;
@@ -68,15 +67,16 @@ private:
   void setState(State newState);
 
   boolean showEmptyAnimation(uint8_t pulseTimeInMillis, uint8_t numPulses);
-  void showCalibratingAnimation(uint8_t delayMillis, float percentCalibrated, boolean resetDelayCounter = false);
+  void showCalibratingAnimation(uint8_t delayMillis, float percentCalibrated, boolean resetDelayCounter = false, uint16_t numLitLEDs = 0);
   boolean showCalibratedAnimation(uint8_t delayMillis);
   
   void turnOff();
   
-  void setMeterPercentage(float percent, boolean drawEmptyLEDs = true);
+  void setMeterPercentage(float percent);
+  uint16_t getNumLitLEDs(float percent) const;
   
-  uint32_t getFullColour() const { return this->strip.Color(ALIVE_BRIGHTNESS, ALIVE_BRIGHTNESS, ALIVE_BRIGHTNESS); }
-  uint32_t getEmptyColour() const { return this->strip.Color(DEAD_BRIGHTNESS, DEAD_BRIGHTNESS, DEAD_BRIGHTNESS); }
+  uint32_t getFullColour() const { return LedRenderer::Color(ALIVE_BRIGHTNESS, ALIVE_BRIGHTNESS, ALIVE_BRIGHTNESS); }
+  uint32_t getEmptyColour() const { return LedRenderer::Color(DEAD_BRIGHTNESS, DEAD_BRIGHTNESS, DEAD_BRIGHTNESS); }
   uint32_t getEmptyAnimationColour(uint8_t cycleIdx) const;
   uint32_t getCalibratingColour(float percentCalibrated) const;
   uint32_t getDiminishedWhite(float multiplier, uint8_t whiteAmt) const;
@@ -85,7 +85,8 @@ private:
   void fillLoadWindow(float value);
   void putInLoadWindow(float value);
   
-  float getLoadWindowMean() const { return this->loadWindowSum / ((float)LOAD_WINDOW_SIZE); }
+  float getLoadWindowMean() const { return this->loadWindow.getMean(); }
+  float getLoadWindowVariance() const { return this->loadWindow.getVariance(); }
   float getEmptyToCalMinMass() const;
 };
 
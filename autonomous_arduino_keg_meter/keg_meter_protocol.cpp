@@ -0,0 +1,97 @@
+#include "keg_meter_protocol.h"
+#include "binary_frame.h"
+
+#define MAX_BAUD_RATE_IDX (BinaryFrame::NUM_BAUD_RATES - 1)
+#define BAUD_CONFIRM_TIMEOUT_MS 2000
+
+boolean KegMeterProtocol::binaryMode = false;
+boolean KegMeterProtocol::baudRateUnconfirmed = false;
+unsigned long KegMeterProtocol::baudRateSwitchTimeMs = 0;
+
+void KegMeterProtocol::OutputMeasuredPercentMsg(uint8_t meterIdx, float percent) { 
+  if (binaryMode) {
+    float values[BinaryFrame::NUM_STATUS_FIELDS] = { percent, 0, 0, 0, 0 };
+    OutputStatusFrame(meterIdx, (1 << BinaryFrame::PercentField), values);
+    return;
+  }
+  
+  OutputStartPkg();
+  OutputKegNumberStr(meterIdx);
+  Serial.print("{P:"); Serial.print(percent); Serial.print("}"); 
+  OutputEndPkg();
+}
+
+void KegMeterProtocol::OutputStatusMsg(uint8_t meterIdx, float fullMass, float emptyMass, float percent, float load, float variance) {
+  if (binaryMode) {
+    float values[BinaryFrame::NUM_STATUS_FIELDS] = { percent, fullMass, emptyMass, load, variance };
+    OutputStatusFrame(meterIdx, (1 << BinaryFrame::NUM_STATUS_FIELDS) - 1, values);
+    return;
+  }
+  
+  OutputStartPkg();
+  OutputKegNumberStr(meterIdx);
+  Serial.print("{P:"); Serial.print(percent, 2); 
+  Serial.print(",F:"); Serial.print(fullMass, 2);
+  Serial.print(",E:"); Serial.print(emptyMass, 2);
+  Serial.print(",L:"); Serial.print(load, 2);
+  Serial.print(",V:"); Serial.print(variance, 5);
+  Serial.print("}");
+  OutputEndPkg();
+}
+
+// Handles the binary protocol handshake '|Bv', where 'v' is the (single digit) binary protocol
+// version the host wants to switch to. If we speak that version we answer with a binary hello
+// frame and send binary frames from then on, otherwise we answer with an ERROR and the host sticks
+// to ASCII.
+boolean KegMeterProtocol::SetBinaryMode(char versionChar, uint8_t numMeters) {
+  if (versionChar - '0' != BinaryFrame::PROTOCOL_VERSION) {
+    Serial.println("ERROR: Unsupported binary protocol version.");
+    return false;
+  }
+  
+  binaryMode = true;
+  baudRateUnconfirmed = false;
+  uint8_t frame[BinaryFrame::MAX_WIRE_SIZE];
+  int frameSize = BinaryFrame::encodeHello(numMeters, MAX_BAUD_RATE_IDX, frame);
+  Serial.write(frame, frameSize);
+  return true;
+}
+
+// Handles the baud rate command '|Si', where 'i' is the (single digit) index of the baud rate to
+// switch to right away (see BinaryFrame::baudRate). Anything but index 0 has to be confirmed by a
+// binary protocol handshake at the new rate, otherwise CheckBaudRate goes back to index 0 after
+// BAUD_CONFIRM_TIMEOUT_MS.
+boolean KegMeterProtocol::SetBaudRate(char baudRateIdxChar) {
+  int baudRateIdx = baudRateIdxChar - '0';
+  if (baudRateIdx < 0 || baudRateIdx > MAX_BAUD_RATE_IDX) {
+    Serial.println("ERROR: Unsupported baud rate.");
+    return false;
+  }
+  
+  BeginSerial(baudRateIdx);
+  if (baudRateIdx != 0) {
+    baudRateUnconfirmed = true;
+    baudRateSwitchTimeMs = millis();
+  }
+  return true;
+}
+
+void KegMeterProtocol::CheckBaudRate() {
+  if (baudRateUnconfirmed && millis() - baudRateSwitchTimeMs > BAUD_CONFIRM_TIMEOUT_MS) {
+    BeginSerial(0);
+  }
+}
+
+void KegMeterProtocol::BeginSerial(uint8_t baudRateIdx) {
+  // Let whatever is still going out finish at the old rate
+  Serial.flush();
+  Serial.end();
+  Serial.begin(BinaryFrame::baudRate(baudRateIdx));
+  baudRateUnconfirmed = false;
+}
+
+void KegMeterProtocol::OutputStatusFrame(uint8_t meterIdx, uint8_t fieldMask, const float* values) {
+  uint8_t frame[BinaryFrame::MAX_WIRE_SIZE];
+  int frameSize = BinaryFrame::encodeStatus(meterIdx, fieldMask, values, frame);
+  Serial.write(frame, frameSize);
+}
@@ -7,24 +7,12 @@
 
 class KegMeterProtocol {
 public:
-  static void OutputMeasuredPercentMsg(uint8_t meterIdx, float percent) { 
-    OutputStartPkg();
-    OutputKegNumberStr(meterIdx);
-    Serial.print("{P:"); Serial.print(percent); Serial.print("}"); 
-    OutputEndPkg();
-  }
-
-  static void OutputStatusMsg(uint8_t meterIdx, float fullMass, float emptyMass, float percent, float load, float variance) {
-    OutputStartPkg();
-    OutputKegNumberStr(meterIdx);
-    Serial.print("{P:"); Serial.print(percent, 2); 
-    Serial.print(",F:"); Serial.print(fullMass, 2);
-    Serial.print(",E:"); Serial.print(emptyMass, 2);
-    Serial.print(",L:"); Serial.print(load, 2);
-    Serial.print(",V:"); Serial.print(variance, 5);
-    Serial.print("}");
-    OutputEndPkg();
-  }
+  static void OutputMeasuredPercentMsg(uint8_t meterIdx, float percent);
+  static void OutputStatusMsg(uint8_t meterIdx, float fullMass, float emptyMass, float percent, float load, float variance);
+  
+  static boolean SetBinaryMode(char versionChar, uint8_t numMeters);
+  static boolean SetBaudRate(char baudRateIdxChar);
+  static void CheckBaudRate();
   
 private:
   KegMeterProtocol() {}
@@ -34,6 +22,17 @@ private:
   static void OutputStartPkg() { Serial.print("["); }
   static void OutputEndPkg() { Serial.println("]"); }
   
+  static void OutputStatusFrame(uint8_t meterIdx, uint8_t fieldMask, const float* values);
+  static void BeginSerial(uint8_t baudRateIdx);
+  
+  // Whether status messages are sent as binary frames (see binary_frame.h), this is only switched
+  // on when the host asks for it, until then (and for older hosts) everything is sent as ASCII
+  static boolean binaryMode;
+  
+  // The host can switch us to a faster baud rate (see BinaryFrame::baudRate), we go back to the
+  // initial rate unless the host confirms the new one with a handshake within a few seconds
+  static boolean baudRateUnconfirmed;
+  static unsigned long baudRateSwitchTimeMs;
 };
 
 #endif // KEG_METER_PROTOCOL_H_
@@ -0,0 +1,56 @@
+#ifndef LED_RENDERER_H_
+#define LED_RENDERER_H_
+
+// NOTE: The autonomous and client sketches each have an identical copy of this file.
+
+#include <Adafruit_NeoPixel.h>
+
+/**
+ * Draws on the LED strip for the meters and only shows frames that changed. The whole strip has
+ * to go out every time it's shown, with interrupts off all the while (serial bytes that come in
+ * then can be lost), so that's worth skipping whenever it can be.
+ *
+ * Pixels are compared with what the strip already has as they're set, and only the ones that
+ * really change mark the frame as dirty. The strip is always shown as a whole, so it only matters
+ * whether any pixel changed, not which. That needs no copy of the frame, but a pixel should be set
+ * only once per frame, as setting it to something else and back again still counts as a change.
+ * It also relies on the strip's brightness never being set, as getPixelColor() only gives back
+ * exactly what was set at full brightness.
+ *
+ * render() puts out a frame at most maxFramesPerSecond times a second, and only if anything
+ * changed. Frames that change nothing are counted, but never shown.
+ */
+class LedRenderer {
+public:
+  LedRenderer(Adafruit_NeoPixel& strip, uint8_t maxFramesPerSecond);
+
+  // Starts the strip with every pixel off
+  void begin();
+
+  uint16_t numPixels() const { return this->strip.numPixels(); }
+  static uint32_t Color(uint8_t r, uint8_t g, uint8_t b) { return Adafruit_NeoPixel::Color(r, g, b); }
+
+  void setPixelColor(uint16_t idx, uint32_t colour);
+  void fill(uint16_t startIdx, uint16_t endIdx, uint32_t colour); // [startIdx, endIdx)
+
+  // Whether any pixel changed since the last show
+  boolean isDirty() const { return this->dirty; }
+
+  // Shows the frame if it's time for the next one and it changed, returns whether it was shown
+  boolean render();
+
+  uint32_t getNumFrames() const { return this->numFrames; }
+  uint32_t getNumShows() const { return this->numShows; }
+  uint32_t getNumSkippedFrames() const { return this->numFrames - this->numShows; }
+
+private:
+  Adafruit_NeoPixel& strip;
+  const uint32_t minFrameMicros;
+
+  boolean dirty;
+  uint32_t lastFrameMicros;
+  uint32_t numFrames;
+  uint32_t numShows;
+};
+
+#endif // LED_RENDERER_H_
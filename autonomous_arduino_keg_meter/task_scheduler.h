@@ -0,0 +1,60 @@
+#ifndef TASK_SCHEDULER_H_
+#define TASK_SCHEDULER_H_
+
+// NOTE: The autonomous and client sketches each have an identical copy of this file.
+
+#include <Arduino.h>
+
+/**
+ * Cooperative scheduler for the main loop of a sketch. Every task runs at a fixed period on the
+ * micros() clock, whenever run() finds it due, and gets how long it's really been since it last
+ * ran. Nothing ever waits: loop() keeps calling run(), which returns right away if nothing is due.
+ *
+ * A task has overrun when it finishes later than its deadline, counted from when it was due. A
+ * task that's fallen a whole period behind skips the periods it missed instead of running several
+ * times in a row to catch up.
+ */
+class TaskScheduler {
+public:
+  typedef void (*TaskFunction)(uint32_t elapsedMicros);
+
+  static const uint8_t MAX_NUM_TASKS = 6;
+
+  TaskScheduler() : numTasks(0) {}
+
+  // Tasks run in the order they're added, the first time on the next run(). Returns the index of
+  // the task, or -1 if there's no room for it.
+  int8_t addTask(const char* name, TaskFunction function, uint32_t periodMicros, uint32_t deadlineMicros);
+  void setPeriod(uint8_t taskIdx, uint32_t periodMicros) { this->tasks[taskIdx].periodMicros = periodMicros; }
+
+  void run();
+  uint32_t getMicrosUntilDue() const;
+
+  uint8_t getNumTasks() const { return this->numTasks; }
+  const char* getName(uint8_t taskIdx) const { return this->tasks[taskIdx].name; }
+  uint32_t getNumRuns(uint8_t taskIdx) const { return this->tasks[taskIdx].numRuns; }
+  uint32_t getNumOverruns(uint8_t taskIdx) const { return this->tasks[taskIdx].numOverruns; }
+  uint32_t getMaxRunMicros(uint8_t taskIdx) const { return this->tasks[taskIdx].maxRunMicros; }
+  uint32_t getTotalNumOverruns() const;
+
+  // A line per task over serial: "Task <name>: <runs> runs, <overruns> overruns, <max> us max"
+  void printStats() const;
+
+private:
+  struct Task {
+    const char* name;
+    TaskFunction function;
+    uint32_t periodMicros;
+    uint32_t deadlineMicros;
+    uint32_t dueMicros;
+    uint32_t lastRunMicros;
+    uint32_t numRuns;
+    uint32_t numOverruns;
+    uint32_t maxRunMicros;
+  };
+
+  Task tasks[MAX_NUM_TASKS];
+  uint8_t numTasks;
+};
+
+#endif // TASK_SCHEDULER_H_
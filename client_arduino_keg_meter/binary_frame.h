@@ -0,0 +1,315 @@
+#ifndef KEGMETERCOMMON_BINARYFRAME_H
+#define KEGMETERCOMMON_BINARYFRAME_H
+
+// NOTE: This header is shared with the Arduino sketches (copied as binary_frame.h into each sketch
+// that uses it), so it must stay dependency-free plain C++ -- no STL, no Qt, no Arduino headers.
+
+#include <stdint.h>
+
+/**
+ * Compact, checksummed binary frames sent from the keg meter hardware to the host once both sides
+ * have agreed on it (see the binary protocol handshake in the sketches and the hosts' SerialComm).
+ *
+ * A raw frame is laid out as
+ *   <sync/version> <meter index> <type> <payload...> <CRC-8>
+ * where the first byte carries the protocol version in its low nibble and the CRC-8 covers every
+ * byte before it. On the wire the raw frame is COBS encoded, so it never contains a zero byte, and
+ * is sent between two zero delimiters. The leading delimiter ends whatever (text) was sent before,
+ * so plain text messages and binary frames can share the same stream.
+ *
+ * Payloads hold little-endian 32-bit fixed-point values (see the *_SCALE constants), batch sequence
+ * numbers are 16-bit and device times are 32-bit milliseconds.
+ */
+class BinaryFrame {
+public:
+    static const uint8_t PROTOCOL_VERSION = 1;
+    static const uint8_t SYNC_BYTE = 0xA0 | PROTOCOL_VERSION;
+    static const uint8_t DELIMITER = 0x00;
+
+    enum Type {
+        HelloType       = 'H', // Payload: <protocol version> <number of meters> <max. baud rate index>
+        MeasurementType = 'M', // Payload: <load>
+        StatusType      = 'S', // Payload: <field mask> <percent> <full mass> <empty mass> <load> <variance>
+        BatchType       = 'B'  // Payload: <sequence number> <device time> <number of meters> and then
+                               //          <meter index> <load> for each of the meters
+    };
+
+    // Status fields, in the order they're sent (this matches PacketParser::StatusField)
+    enum StatusField { PercentField, FullMassField, EmptyMassField, LoadField, VarianceField, NUM_STATUS_FIELDS };
+
+    static const int32_t LOAD_SCALE     = 1000;   // Loads and masses are sent in grams
+    static const int32_t PERCENT_SCALE  = 10000;
+    static const int32_t VARIANCE_SCALE = 100000;
+
+    static const int MAX_BATCH_SIZE = 8;
+
+    // Baud rates the serial link can be switched to, both ends refer to them by index. The link
+    // always starts out at the first one.
+    static const int NUM_BAUD_RATES = 5;
+
+    static const int HEADER_SIZE = 3;
+    static const int STATUS_PAYLOAD_SIZE = 1 + 4*NUM_STATUS_FIELDS;
+    static const int BATCH_HEADER_SIZE = 2 + 4 + 1;
+    static const int BATCH_ENTRY_SIZE = 1 + 4;
+    static const int MAX_PAYLOAD_SIZE = BATCH_HEADER_SIZE + MAX_BATCH_SIZE*BATCH_ENTRY_SIZE;
+    static const int MAX_FRAME_SIZE = HEADER_SIZE + MAX_PAYLOAD_SIZE + 1;
+    static const int MAX_ENCODED_SIZE = MAX_FRAME_SIZE + 1; // COBS adds one byte for every 254
+    static const int MAX_WIRE_SIZE = MAX_ENCODED_SIZE + 2;  // Including both delimiters
+
+    // A decoded frame, the payload points into the buffer the frame was decoded into
+    struct Frame {
+        uint8_t meterIdx;
+        uint8_t type;
+        const uint8_t* payload;
+        int payloadSize;
+    };
+
+    /**
+     * CRC-8 with polynomial 0x07 (CRC-8/SMBUS), computed bitwise to keep the sketches small.
+     */
+    static uint8_t crc8(const uint8_t* data, int size) {
+        uint8_t crc = 0;
+        for (int i = 0; i < size; i++) {
+            crc ^= data[i];
+            for (int bit = 0; bit < 8; bit++) {
+                crc = (crc & 0x80) ? static_cast<uint8_t>((crc << 1) ^ 0x07) : static_cast<uint8_t>(crc << 1);
+            }
+        }
+        return crc;
+    }
+
+    /**
+     * COBS encode size bytes of src into dst (which must hold size + size/254 + 1 bytes). Returns
+     * the number of encoded bytes, none of which are zero.
+     */
+    static int cobsEncode(const uint8_t* src, int size, uint8_t* dst) {
+        int codeIdx = 0;
+        int dstIdx = 1;
+        uint8_t code = 1;
+        for (int i = 0; i < size; i++) {
+            if (src[i] == 0) {
+                dst[codeIdx] = code;
+                codeIdx = dstIdx++;
+                code = 1;
+            }
+            else {
+                dst[dstIdx++] = src[i];
+                code++;
+                if (code == 0xFF) {
+                    dst[codeIdx] = code;
+                    codeIdx = dstIdx++;
+                    code = 1;
+                }
+            }
+        }
+        dst[codeIdx] = code;
+        return dstIdx;
+    }
+
+    /**
+     * Decode size COBS encoded bytes of src (without delimiters) into dst, which must hold at
+     * least maxSize bytes. Returns the number of decoded bytes or -1 if the input isn't valid COBS.
+     */
+    static int cobsDecode(const uint8_t* src, int size, uint8_t* dst, int maxSize) {
+        int srcIdx = 0;
+        int dstIdx = 0;
+        while (srcIdx < size) {
+            uint8_t code = src[srcIdx++];
+            if (code == 0 || srcIdx + code - 1 > size) {
+                return -1;
+            }
+            for (int i = 1; i < code; i++) {
+                if (src[srcIdx] == 0 || dstIdx >= maxSize) {
+                    return -1;
+                }
+                dst[dstIdx++] = src[srcIdx++];
+            }
+            if (code != 0xFF && srcIdx < size) {
+                if (dstIdx >= maxSize) {
+                    return -1;
+                }
+                dst[dstIdx++] = 0;
+            }
+        }
+        return dstIdx;
+    }
+
+    /**
+     * Validate a raw (already COBS decoded) frame and split it up. Returns false if the frame is
+     * too short, for another protocol version or fails its CRC.
+     */
+    static bool parseFrame(const uint8_t* data, int size, Frame& frame) {
+        if (size < HEADER_SIZE + 1 || data[0] != SYNC_BYTE || crc8(data, size-1) != data[size-1]) {
+            return false;
+        }
+        frame.meterIdx = data[1];
+        frame.type = data[2];
+        frame.payload = data + HEADER_SIZE;
+        frame.payloadSize = size - HEADER_SIZE - 1;
+        return true;
+    }
+
+    static int32_t baudRate(int baudRateIdx) {
+        switch (baudRateIdx) {
+            case 1:  return 19200;
+            case 2:  return 38400;
+            case 3:  return 57600;
+            case 4:  return 115200;
+            default: return 9600;
+        }
+    }
+
+    // Wire encoders: fill dst (MAX_WIRE_SIZE bytes) with the frame including delimiters and
+    // return the number of bytes to send
+    static int encodeHello(uint8_t numMeters, uint8_t maxBaudRateIdx, uint8_t* dst) {
+        uint8_t payload[3] = { PROTOCOL_VERSION, numMeters, maxBaudRateIdx };
+        return encodeWire(0, HelloType, payload, 3, dst);
+    }
+
+    static int encodeMeasurement(uint8_t meterIdx, float load, uint8_t* dst) {
+        uint8_t payload[4];
+        putInt32(payload, toFixed(load, LOAD_SCALE));
+        return encodeWire(meterIdx, MeasurementType, payload, 4, dst);
+    }
+
+    static int encodeStatus(uint8_t meterIdx, uint8_t fieldMask, const float* values, uint8_t* dst) {
+        uint8_t payload[STATUS_PAYLOAD_SIZE];
+        payload[0] = fieldMask;
+        for (int i = 0; i < NUM_STATUS_FIELDS; i++) {
+            int32_t value = (fieldMask & (1 << i)) ? toFixed(values[i], fieldScale(i)) : 0;
+            putInt32(payload + 1 + 4*i, value);
+        }
+        return encodeWire(meterIdx, StatusType, payload, STATUS_PAYLOAD_SIZE, dst);
+    }
+
+    // The loads of up to MAX_BATCH_SIZE meters in a single frame, more have to be split over several
+    // frames. Returns 0 (nothing to send) for more.
+    static int encodeBatch(uint16_t sequenceNum, uint32_t deviceTimeMs, const uint8_t* meterIdxs, const float* loads,
+                           int numMeters, uint8_t* dst) {
+        if (numMeters < 0 || numMeters > MAX_BATCH_SIZE) {
+            return 0;
+        }
+
+        uint8_t payload[MAX_PAYLOAD_SIZE];
+        putUint16(payload, sequenceNum);
+        putInt32(payload + 2, static_cast<int32_t>(deviceTimeMs));
+        payload[6] = static_cast<uint8_t>(numMeters);
+        for (int i = 0; i < numMeters; i++) {
+            uint8_t* entry = payload + BATCH_HEADER_SIZE + i*BATCH_ENTRY_SIZE;
+            entry[0] = meterIdxs[i];
+            putInt32(entry + 1, toFixed(loads[i], LOAD_SCALE));
+        }
+        return encodeWire(0, BatchType, payload, BATCH_HEADER_SIZE + numMeters*BATCH_ENTRY_SIZE, dst);
+    }
+
+    // Payload decoders, these return false if the payload doesn't have the expected size
+    static bool decodeHello(const Frame& frame, uint8_t& version, uint8_t& numMeters, uint8_t& maxBaudRateIdx) {
+        if (frame.type != HelloType || frame.payloadSize < 2) {
+            return false;
+        }
+        version = frame.payload[0];
+        numMeters = frame.payload[1];
+        maxBaudRateIdx = (frame.payloadSize >= 3) ? frame.payload[2] : 0;
+        return true;
+    }
+
+    static bool decodeMeasurement(const Frame& frame, float& load) {
+        if (frame.type != MeasurementType || frame.payloadSize != 4) {
+            return false;
+        }
+        load = static_cast<float>(getInt32(frame.payload)) / static_cast<float>(LOAD_SCALE);
+        return true;
+    }
+
+    static bool decodeStatus(const Frame& frame, uint8_t& fieldMask, float* values) {
+        if (frame.type != StatusType || frame.payloadSize != STATUS_PAYLOAD_SIZE) {
+            return false;
+        }
+        fieldMask = frame.payload[0];
+        for (int i = 0; i < NUM_STATUS_FIELDS; i++) {
+            values[i] = static_cast<float>(getInt32(frame.payload + 1 + 4*i)) / static_cast<float>(fieldScale(i));
+        }
+        return true;
+    }
+
+    // The meterIdxs and loads arrays must hold MAX_BATCH_SIZE entries
+    static bool decodeBatch(const Frame& frame, uint16_t& sequenceNum, uint32_t& deviceTimeMs, uint8_t* meterIdxs,
+                            float* loads, int& numMeters) {
+        if (frame.type != BatchType || frame.payloadSize < BATCH_HEADER_SIZE) {
+            return false;
+        }
+        numMeters = frame.payload[6];
+        if (numMeters > MAX_BATCH_SIZE || frame.payloadSize != BATCH_HEADER_SIZE + numMeters*BATCH_ENTRY_SIZE) {
+            return false;
+        }
+
+        sequenceNum = getUint16(frame.payload);
+        deviceTimeMs = static_cast<uint32_t>(getInt32(frame.payload + 2));
+        for (int i = 0; i < numMeters; i++) {
+            const uint8_t* entry = frame.payload + BATCH_HEADER_SIZE + i*BATCH_ENTRY_SIZE;
+            meterIdxs[i] = entry[0];
+            loads[i] = static_cast<float>(getInt32(entry + 1)) / static_cast<float>(LOAD_SCALE);
+        }
+        return true;
+    }
+
+private:
+    BinaryFrame() {}
+    ~BinaryFrame() {}
+
+    static int32_t fieldScale(int field) {
+        switch (field) {
+            case PercentField:  return PERCENT_SCALE;
+            case VarianceField: return VARIANCE_SCALE;
+            default:            return LOAD_SCALE;
+        }
+    }
+
+    static int32_t toFixed(float value, int32_t scale) {
+        float scaled = value * static_cast<float>(scale);
+        return static_cast<int32_t>(scaled < 0 ? scaled - 0.5f : scaled + 0.5f);
+    }
+
+    static void putUint16(uint8_t* dst, uint16_t value) {
+        dst[0] = static_cast<uint8_t>(value);
+        dst[1] = static_cast<uint8_t>(value >> 8);
+    }
+
+    static uint16_t getUint16(const uint8_t* src) {
+        return static_cast<uint16_t>(src[0] | (src[1] << 8));
+    }
+
+    static void putInt32(uint8_t* dst, int32_t value) {
+        uint32_t bits = static_cast<uint32_t>(value);
+        dst[0] = static_cast<uint8_t>(bits);
+        dst[1] = static_cast<uint8_t>(bits >> 8);
+        dst[2] = static_cast<uint8_t>(bits >> 16);
+        dst[3] = static_cast<uint8_t>(bits >> 24);
+    }
+
+    static int32_t getInt32(const uint8_t* src) {
+        uint32_t bits = static_cast<uint32_t>(src[0]) | (static_cast<uint32_t>(src[1]) << 8) |
+                        (static_cast<uint32_t>(src[2]) << 16) | (static_cast<uint32_t>(src[3]) << 24);
+        return static_cast<int32_t>(bits);
+    }
+
+    static int encodeWire(uint8_t meterIdx, uint8_t type, const uint8_t* payload, int payloadSize, uint8_t* dst) {
+        uint8_t raw[MAX_FRAME_SIZE];
+        raw[0] = SYNC_BYTE;
+        raw[1] = meterIdx;
+        raw[2] = type;
+        for (int i = 0; i < payloadSize; i++) {
+            raw[HEADER_SIZE + i] = payload[i];
+        }
+        int rawSize = HEADER_SIZE + payloadSize;
+        raw[rawSize] = crc8(raw, rawSize);
+        rawSize++;
+
+        dst[0] = DELIMITER;
+        int encodedSize = cobsEncode(raw, rawSize, dst + 1);
+        dst[encodedSize + 1] = DELIMITER;
+        return encodedSize + 2;
+    }
+};
+
+#endif // KEGMETERCOMMON_BINARYFRAME_H
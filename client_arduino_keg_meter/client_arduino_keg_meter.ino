@@ -1,6 +1,8 @@
 #include <Adafruit_NeoPixel.h>
 #include "keg_load_meter.h"
 #include "keg_meter_protocol.h"
+#include "task_scheduler.h"
+#include "led_renderer.h"
 
 #define LED_OUTPUT_PIN 5
 #define EMPTY_CAL_BUTTON_INPUT_PIN 2
@@ -8,8 +10,20 @@
 #define NUM_KEGS 1
 #define NUM_LEDS (NUM_KEGS * KegLoadMeter::NUM_LEDS_PER_METER)
 
-#define DEFAULT_DELAY_TICK_MS 1
-#define NUM_LOOPS_WAIT_FOR_OUTPUT 100
+// Task periods, and how late after they were due the tasks may finish before they count as
+// overrun (see TaskScheduler), in microseconds
+#define SAMPLE_PERIOD_US      2000
+#define SAMPLE_DEADLINE_US    4000
+#define ANIMATE_PERIOD_US     4000
+#define ANIMATE_DEADLINE_US   8000
+#define RENDER_PERIOD_US      5000 // How often there can be a frame, the renderer caps the frame rate
+#define RENDER_DEADLINE_US    20000
+#define TELEMETRY_PERIOD_US   100000 // At the initial 9600 baud, we output more often at higher rates
+#define TELEMETRY_DEADLINE_US 50000
+#define MIN_TELEMETRY_PERIOD_US 20000
+
+// The time constant of the running average the load sensor readings are smoothed with
+#define SAMPLE_SMOOTHING_TIME_MS 200
 
 // Parameter 1 = number of pixels in strip
 // Parameter 2 = Arduino pin number (most are valid)
@@ -19,7 +33,11 @@
 //   NEO_GRB     Pixels are wired for GRB bitstream (most NeoPixel products)
 //   NEO_RGB     Pixels are wired for RGB bitstream (v1 FLORA pixels, not v2)
 Adafruit_NeoPixel strip = Adafruit_NeoPixel(NUM_LEDS, LED_OUTPUT_PIN, NEO_GRB + NEO_KHZ800);
-// NOTE!!!! If you add more strips you will need to render/show them at the end of the main loop!!!
+// NOTE!!!! If you add more strips you will need to render/show them in the render task!!!
+
+// The meters draw through this, so the strip is only shown when something on it changed
+#define MAX_FRAMES_PER_SECOND 50
+LedRenderer leds(strip, MAX_FRAMES_PER_SECOND);
 
 // IMPORTANT: To reduce NeoPixel burnout risk, add 1000 uF capacitor across
 // pixel power leads, add 300 - 500 Ohm resistor on first pixel's data input
@@ -34,72 +52,106 @@ Adafruit_NeoPixel strip = Adafruit_NeoPixel(NUM_LEDS, LED_OUTPUT_PIN, NEO_GRB +
 // Each 1 integer increment in the incoming analog read value is approximately 1kg.
 // Values start around approx 12 -- this should be calibrated for though.
 
-KegLoadMeter kegMeters[] = { KegLoadMeter(0, strip) };
+KegLoadMeter kegMeters[] = { KegLoadMeter(0, leds) };
 float kegLoadsInKg[NUM_KEGS];
 int kegInputPins[] = { 0 }; // Analog input pins for each of the kegs
 
+TaskScheduler scheduler;
+int8_t telemetryTaskIdx;
+
 void setup() {
   Serial.begin(9600);
 
-  strip.begin();
-  strip.show(); // Initialize all pixels to 'off'
+  leds.begin(); // Initialize all pixels to 'off'
   
   // Initialize loads to zero
   for (int kegIdx = 0; kegIdx < NUM_KEGS; kegIdx++) {
     kegLoadsInKg[kegIdx] = 0;
   }
+  
+  scheduler.addTask("sample", sampleTask, SAMPLE_PERIOD_US, SAMPLE_DEADLINE_US);
+  scheduler.addTask("animate", animateTask, ANIMATE_PERIOD_US, ANIMATE_DEADLINE_US);
+  scheduler.addTask("render", renderTask, RENDER_PERIOD_US, RENDER_DEADLINE_US);
+  telemetryTaskIdx = scheduler.addTask("telemetry", telemetryTask, TELEMETRY_PERIOD_US, TELEMETRY_DEADLINE_US);
 }
 
 void loop() {
-  // Keg meter modes are set via serial
+  // Keg meter modes are set via serial...
   KegMeterProtocol::ReadSerial(kegMeters, NUM_KEGS);
   
-  // Perform sensor readings, send them out over serial...
+  // ...everything else happens in the tasks, whenever they're due
+  scheduler.run();
+}
+
+/**
+ * Read the load sensors.
+ */
+void sampleTask(uint32_t elapsedMicros) {
+  float smoothing = elapsedMicros / (elapsedMicros + SAMPLE_SMOOTHING_TIME_MS * 1000.0);
   for (uint8_t kegIdx = 0; kegIdx < NUM_KEGS; kegIdx++) {
-    getLoadSensorReading(kegIdx, &kegLoadsInKg[kegIdx]);
+    getLoadSensorReading(kegIdx, smoothing, &kegLoadsInKg[kegIdx]);
   }
-  writeKegMeterData(kegLoadsInKg, NUM_LOOPS_WAIT_FOR_OUTPUT);
+}
+
+/**
+ * Move the meter animations along.
+ */
+void animateTask(uint32_t elapsedMicros) {
+  // The meters count time in whole ms, whatever is left over goes to the next update
+  static uint32_t leftoverMicros = 0;
+  uint32_t frameDeltaMicros = elapsedMicros + leftoverMicros;
+  leftoverMicros = frameDeltaMicros % 1000;
   
-  // Perform sensor readings and meter updates...
   for (int kegIdx = 0; kegIdx < NUM_KEGS; kegIdx++) {
-    // Meter update...
-    kegMeters[kegIdx].tick(DEFAULT_DELAY_TICK_MS);
+    kegMeters[kegIdx].tick(frameDeltaMicros / 1000);
   }
-  
-  // All delays and redraw (i.e., "show") of the strip is done at the end of a frame
-  strip.show();
-  delay(DEFAULT_DELAY_TICK_MS);
 }
 
 /**
- * Get incoming data from the load sensor for the given keg index.
+ * Redraw (i.e., "show") the strip with whatever the meters have set its pixels to, if that changed.
  */
-void getLoadSensorReading(uint8_t kegIdx, float* loadValueInKg) {
-  // Perform a running average to smooth the readings a little bit
-  *loadValueInKg  = 0.99 * (*loadValueInKg) + 0.01 * analogRead(kegInputPins[kegIdx]);
+void renderTask(uint32_t /* elapsedMicros */) {
+  leds.render();
 }
 
-void writeKegMeterData(const float* loadValueInKg, int numWaitLoops) {
-  static int countLoops = 0;
+/**
+ * Send the loads of the measuring meters out over serial, and how the tasks are doing whenever any
+ * of them overran since the last time.
+ */
+void telemetryTask(uint32_t /* elapsedMicros */) {
+  writeKegMeterData(kegLoadsInKg);
   
-  float currLoad = 0;
-  if (countLoops % numWaitLoops == 0) {
-    for (int kegIdx = 0; kegIdx < NUM_KEGS; kegIdx++) {
-      if (kegMeters[kegIdx].inOutputMeasurementRoutine()) {  
-        currLoad = max(0, min(999.999, kegLoadsInKg[kegIdx]));
-        KegMeterProtocol::PrintMeasurementMsg(kegIdx, currLoad);
-      }
-    }
-    Serial.println();
-    Serial.flush();
-    countLoops = 0;
+  static uint32_t lastNumOverruns = 0;
+  uint32_t numOverruns = scheduler.getTotalNumOverruns();
+  if (numOverruns != lastNumOverruns) {
+    scheduler.printStats();
+    lastNumOverruns = numOverruns;
   }
   
-  countLoops++;
+  // Keep up with the baud rate, which the server can change at any time, but not too often
+  uint32_t periodMicros = TELEMETRY_PERIOD_US * 9600LL / KegMeterProtocol::GetBaudRate();
+  scheduler.setPeriod(telemetryTaskIdx, max(periodMicros, (uint32_t)MIN_TELEMETRY_PERIOD_US));
 }
 
+/**
+ * Get incoming data from the load sensor for the given keg index.
+ */
+void getLoadSensorReading(uint8_t kegIdx, float smoothing, float* loadValueInKg) {
+  // Perform a running average to smooth the readings a little bit
+  *loadValueInKg  = (1 - smoothing) * (*loadValueInKg) + smoothing * analogRead(kegInputPins[kegIdx]);
+}
 
-
-
-
-
+void writeKegMeterData(const float* loadValueInKg) {
+  // Every meter that's measuring goes out in one batch (in as many frames as it takes)
+  uint8_t meterIdxs[NUM_KEGS];
+  float loads[NUM_KEGS];
+  int numLoads = 0;
+  for (int kegIdx = 0; kegIdx < NUM_KEGS; kegIdx++) {
+    if (kegMeters[kegIdx].inOutputMeasurementRoutine()) {  
+      meterIdxs[numLoads] = kegIdx;
+      loads[numLoads] = max(0, min(999.999, loadValueInKg[kegIdx]));
+      numLoads++;
+    }
+  }
+  KegMeterProtocol::PrintMeasurementBatch(meterIdxs, loads, numLoads);
+}
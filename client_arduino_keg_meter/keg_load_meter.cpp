@@ -25,10 +25,10 @@ const uint8_t KegLoadMeter::BASE_CALIBRATING_BRIGHTNESS = 70;
 #define EMPTY_ANIM_PULSE_MS 100
 #define NUM_EMPTY_PULSES 5
 
-KegLoadMeter::KegLoadMeter(uint8_t meterIdx, Adafruit_NeoPixel& strip) : 
-  meterIdx(meterIdx), startLEDIdx(0),
+KegLoadMeter::KegLoadMeter(uint8_t meterIdx, LedRenderer& leds) : 
+  meterIdx(meterIdx), startLEDIdx(meterIdx*NUM_LEDS_PER_METER),
   calibratingAnimLEDIdx(0), calibratedAnimLEDIdx(0), 
-  currRoutine(OffRoutine), strip(strip), delayCounterMillis(0) {
+  currRoutine(OffRoutine), leds(leds), delayCounterMillis(0) {
   
 }
 
@@ -111,30 +111,20 @@ void KegLoadMeter::setRoutine(Routine newRoutine) {
  * Params:
  * percent - The percentage to set [0,1].
  */
-void KegLoadMeter::showPercentage(float percent, boolean drawEmptyLEDs) {
-  uint16_t idx = this->startLEDIdx;
-  uint16_t litEndIdx = idx + ceil(percent * KegLoadMeter::NUM_LEDS_PER_METER);
-  uint16_t meterEndIdx = idx + KegLoadMeter::NUM_LEDS_PER_METER;
+void KegLoadMeter::showPercentage(float percent) {
+  uint16_t litEndIdx = this->startLEDIdx + this->getNumLitLEDs(percent);
+  this->leds.fill(this->startLEDIdx, litEndIdx, getFullColour());
+  this->leds.fill(litEndIdx, this->startLEDIdx + KegLoadMeter::NUM_LEDS_PER_METER, getEmptyColour());
+}
 
-  for (; idx < litEndIdx; idx++) {
-    this->strip.setPixelColor(idx, getFullColour());
-  }
-  
-  if (drawEmptyLEDs) {
-    idx = litEndIdx;
-    for (; idx < meterEndIdx; idx++) {
-      this->strip.setPixelColor(idx, getEmptyColour());
-    }
-  }
+uint16_t KegLoadMeter::getNumLitLEDs(float percent) const {
+  return min(ceil(percent * KegLoadMeter::NUM_LEDS_PER_METER), KegLoadMeter::NUM_LEDS_PER_METER);
 }
 
 boolean KegLoadMeter::showEmptyAnimation(uint8_t pulseTimeInMillis, uint8_t numPulses) {
 
   uint16_t meterEndIdx = this->startLEDIdx + KegLoadMeter::NUM_LEDS_PER_METER;  
-  uint32_t deathColour = getEmptyAnimationColour(this->emptyAnimPulseCount);
-  for (uint16_t idx = this->meterIdx * KegLoadMeter::NUM_LEDS_PER_METER; idx <= meterEndIdx; idx++) {
-    this->strip.setPixelColor(idx, deathColour);
-  }
+  this->leds.fill(this->startLEDIdx, meterEndIdx, getEmptyAnimationColour(this->emptyAnimPulseCount));
   
   if (this->delayCounterMillis >= pulseTimeInMillis) {
     this->emptyAnimPulseCount++;
@@ -154,33 +144,28 @@ boolean KegLoadMeter::showEmptyAnimation(uint8_t pulseTimeInMillis, uint8_t numP
  * Params:
  * percentCalibrated - The percentage that the calibration is complete in [0,1]. 0 being 
  * not calibrated at all, 1 being fully calibrated.
+ * numLitLEDs - How many LEDs from the start of the meter are lit over the animation.
  */
-void KegLoadMeter::showCalibratingAnimation(uint8_t delayMillis, float percentCalibrated, boolean resetDelayCounter) {
+void KegLoadMeter::showCalibratingAnimation(uint8_t delayMillis, float percentCalibrated, boolean resetDelayCounter, uint16_t numLitLEDs) {
 
-  static const uint8_t OFFSET = 4;
   static const uint8_t TRAIL_SIZE = 9;
   
-  this->turnOff();
-  
-  // Draw spinning loading wheels on each of the rings...
+  // Draw spinning loading wheels on each of the rings: a bright pixel and a trail behind it, the
+  // rest is off. Every pixel is set once, so the renderer only sees the ones that really moved.
   const uint8_t mostBright = (uint8_t)max(TRAIL_SIZE, percentCalibrated * BASE_CALIBRATING_BRIGHTNESS);
+  uint16_t meterLEDIdx = 0;
   for (int ringIdx = 0; ringIdx < NUM_RINGS_PER_METER; ringIdx++) {
-    int16_t currRingStartLEDIdx = this->startLEDIdx + ringIdx * NUM_LEDS_PER_RING;
-    int16_t currRingEndLEDIdx = currRingStartLEDIdx + NUM_LEDS_PER_RING;
-    int16_t currLEDIdx = currRingStartLEDIdx + this->calibratingAnimLEDIdx;
-    
-    // Bright pixel and a trail...
-    for (uint8_t trailIdx = 0; trailIdx < TRAIL_SIZE; trailIdx++) {
-      int16_t mappedLEDIdx = currLEDIdx - trailIdx;
-      if (mappedLEDIdx < currRingStartLEDIdx) {
-        mappedLEDIdx += NUM_LEDS_PER_RING;
+    for (uint8_t ringLEDIdx = 0; ringLEDIdx < NUM_LEDS_PER_RING; ringLEDIdx++, meterLEDIdx++) {
+      uint32_t colour = 0;
+      uint8_t trailIdx = (this->calibratingAnimLEDIdx + NUM_LEDS_PER_RING - ringLEDIdx) % NUM_LEDS_PER_RING;
+      if (meterLEDIdx < numLitLEDs) {
+        colour = getFullColour();
       }
-      else if (mappedLEDIdx > currRingEndLEDIdx) {
-        mappedLEDIdx -= NUM_LEDS_PER_RING;
+      else if (trailIdx < TRAIL_SIZE) {
+        float diminishAmt = pow(((float)trailIdx) / ((float)TRAIL_SIZE), 0.6);
+        colour = this->getDiminishedWhite(1.0-diminishAmt, mostBright);
       }
-      
-      float diminishAmt = pow(((float)trailIdx) / ((float)TRAIL_SIZE), 0.6);
-      this->strip.setPixelColor(mappedLEDIdx, this->getDiminishedWhite(1.0-diminishAmt, mostBright));
+      this->leds.setPixelColor(this->startLEDIdx + meterLEDIdx, colour);
     }
   }
   
@@ -193,17 +178,16 @@ void KegLoadMeter::showCalibratingAnimation(uint8_t delayMillis, float percentCa
 }
 
 boolean KegLoadMeter::showCalibratedAnimation(uint8_t delayMillis) {
-  this->showCalibratingAnimation(delayMillis, 1.0, false);
-  
   // Start filling the meter
-  this->showPercentage(((float)this->calibratedAnimLEDIdx)/((float)strip.numPixels()), false);
+  uint16_t numLitLEDs = this->getNumLitLEDs(((float)this->calibratedAnimLEDIdx)/((float)this->leds.numPixels()));
+  this->showCalibratingAnimation(delayMillis, 1.0, false, numLitLEDs);
   
   if (this->delayCounterMillis >= delayMillis) {
     this->calibratedAnimLEDIdx++;
     this->delayCounterMillis = 0;
   }
    
-  if (this->calibratedAnimLEDIdx == this->strip.numPixels()) {
+  if (this->calibratedAnimLEDIdx == this->leds.numPixels()) {
     return true;
   }
 
@@ -211,18 +195,14 @@ boolean KegLoadMeter::showCalibratedAnimation(uint8_t delayMillis) {
 }
 
 void KegLoadMeter::turnOff() {
-  uint16_t idx = this->startLEDIdx;
-  uint16_t meterEndIdx = idx + KegLoadMeter::NUM_LEDS_PER_METER;
-  for (; idx < meterEndIdx; idx++) {
-    this->strip.setPixelColor(idx, 0);
-  }
+  this->leds.fill(this->startLEDIdx, this->startLEDIdx + KegLoadMeter::NUM_LEDS_PER_METER, 0);
 }
 
 uint32_t KegLoadMeter::getEmptyAnimationColour(uint8_t cycleIdx) const {
   if (cycleIdx % 2 == 0) {
-    return this->strip.Color(0,0,0);
+    return LedRenderer::Color(0,0,0);
   }
-  return this->strip.Color(DEATH_PULSE_BRIGHTNESS, 0, 0);
+  return LedRenderer::Color(DEATH_PULSE_BRIGHTNESS, 0, 0);
 }
 
 uint32_t KegLoadMeter::getCalibratingColour(float percentCalibrated) const {
@@ -231,10 +211,10 @@ uint32_t KegLoadMeter::getCalibratingColour(float percentCalibrated) const {
 
 uint32_t KegLoadMeter::getDiminishedWhite(float multiplier, uint8_t whiteAmt) const {
   uint8_t colourVal = multiplier*whiteAmt;
-  return this->strip.Color(colourVal,colourVal,colourVal);
+  return LedRenderer::Color(colourVal,colourVal,colourVal);
 }
 
 uint32_t KegLoadMeter::getDiminishedColour(float multiplier, uint8_t r, uint8_t g, uint8_t b) const {
-  return this->strip.Color(multiplier*r, multiplier*g, multiplier*b);
+  return LedRenderer::Color(multiplier*r, multiplier*g, multiplier*b);
 }
 
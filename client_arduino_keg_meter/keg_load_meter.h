@@ -1,7 +1,7 @@
 #ifndef KEG_LOAD_METER_H_
 #define KEG_LOAD_METER_H_
 
-#include <Adafruit_NeoPixel.h>
+#include "led_renderer.h"
 
 class KegLoadMeter {
 public:
@@ -10,7 +10,7 @@ public:
   static const uint8_t HALF_NUM_LEDS_PER_RING;
   static const uint8_t NUM_LEDS_PER_METER;
 
-  KegLoadMeter(uint8_t meterIdx, Adafruit_NeoPixel& strip);
+  KegLoadMeter(uint8_t meterIdx, LedRenderer& leds);
   ~KegLoadMeter() {}
 
   uint8_t getIndex() const { return this->meterIdx; }
@@ -39,7 +39,7 @@ private:
   uint8_t emptyAnimPulseCount;   // State: BecameEmptyRoutine
   float fillPercent;             // Value in [0,1] representing how full the meter should be
 
-  Adafruit_NeoPixel& strip;  // The LED strip object
+  LedRenderer& leds;  // Draws on the LED strip
   
   static const uint8_t ALIVE_BRIGHTNESS;
   static const uint8_t DEAD_BRIGHTNESS;
@@ -57,14 +57,15 @@ private:
   void setRoutine(Routine newRoutine);
 
   boolean showEmptyAnimation(uint8_t pulseTimeInMillis, uint8_t numPulses);
-  void showCalibratingAnimation(uint8_t delayMillis, float percentCalibrated, boolean resetDelayCounter = false);
+  void showCalibratingAnimation(uint8_t delayMillis, float percentCalibrated, boolean resetDelayCounter = false, uint16_t numLitLEDs = 0);
   boolean showCalibratedAnimation(uint8_t delayMillis);
   
   void turnOff();
-  void showPercentage(float percent, boolean drawEmptyLEDs = true);
+  void showPercentage(float percent);
+  uint16_t getNumLitLEDs(float percent) const;
   
-  uint32_t getFullColour() const { return this->strip.Color(ALIVE_BRIGHTNESS, ALIVE_BRIGHTNESS, ALIVE_BRIGHTNESS); }
-  uint32_t getEmptyColour() const { return this->strip.Color(DEAD_BRIGHTNESS, DEAD_BRIGHTNESS, DEAD_BRIGHTNESS); }
+  uint32_t getFullColour() const { return LedRenderer::Color(ALIVE_BRIGHTNESS, ALIVE_BRIGHTNESS, ALIVE_BRIGHTNESS); }
+  uint32_t getEmptyColour() const { return LedRenderer::Color(DEAD_BRIGHTNESS, DEAD_BRIGHTNESS, DEAD_BRIGHTNESS); }
   uint32_t getEmptyAnimationColour(uint8_t cycleIdx) const;
   uint32_t getCalibratingColour(float percentCalibrated) const;
   uint32_t getDiminishedWhite(float multiplier, uint8_t whiteAmt) const;
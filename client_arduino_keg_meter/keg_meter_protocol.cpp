@@ -1,5 +1,6 @@
 #include "keg_meter_protocol.h"
 #include "keg_load_meter.h"
+#include "binary_frame.h"
 
 #define MEASUREMENT_MSG_TYPE_STR "M"
 
@@ -7,6 +8,11 @@
 #define SEPARATOR_CHAR ' '
 #define METER_PERCENT_CMD_CHAR 'P'
 #define METER_ROUTINE_CMD_CHAR 'R'
+#define BINARY_PROTOCOL_CMD_CHAR 'B'
+#define BAUD_RATE_CMD_CHAR 'S'
+
+#define MAX_BAUD_RATE_IDX (BinaryFrame::NUM_BAUD_RATES - 1)
+#define BAUD_CONFIRM_TIMEOUT_MS 2000
 
 #define METER_ROUTINE_OFF_CHAR 'O'
 #define METER_ROUTINE_CALBRATING_CHAR 'C'
@@ -15,8 +21,29 @@
 #define METER_ROUTINE_BECAME_EMPTY_CHAR 'E'
 
 #define PKG_BEGIN_CHAR '['
+#define PKG_END_CHAR ']'
+
+boolean KegMeterProtocol::binaryMode = false;
+uint16_t KegMeterProtocol::batchSequenceNum = 0;
+uint8_t KegMeterProtocol::baudRateIdx = 0;
+boolean KegMeterProtocol::baudRateUnconfirmed = false;
+unsigned long KegMeterProtocol::baudRateSwitchTimeMs = 0;
+char KegMeterProtocol::pkg[MAX_PKG_LENGTH + 1];
+uint8_t KegMeterProtocol::pkgLength = 0;
+boolean KegMeterProtocol::inPkg = false;
+
+long KegMeterProtocol::GetBaudRate() {
+  return BinaryFrame::baudRate(baudRateIdx);
+}
 
 void KegMeterProtocol::PrintMeasurementMsg(uint8_t meterIdx, float measurement) { 
+  if (binaryMode) {
+    uint8_t frame[BinaryFrame::MAX_WIRE_SIZE];
+    int frameSize = BinaryFrame::encodeMeasurement(meterIdx, measurement, frame);
+    Serial.write(frame, frameSize);
+    return;
+  }
+
   PrintStartPkg();
   KegMeterProtocol::PrintKegNumberStr(meterIdx);
   Serial.print(METER_ID_SEPARATOR_STR);
@@ -26,32 +53,88 @@ void KegMeterProtocol::PrintMeasurementMsg(uint8_t meterIdx, float measurement)
   PrintEndPkg();
 }
 
+// Send the measurements of several meters at once. With the binary protocol these are batch frames
+// of up to BinaryFrame::MAX_BATCH_SIZE meters each (with a sequence number, so the host can tell if
+// any got lost, and our time in ms), with ASCII it's one package per meter followed by a newline.
+// Nothing is sent without any measurements.
+void KegMeterProtocol::PrintMeasurementBatch(const uint8_t* meterIdxs, const float* measurements, int numMeasurements) {
+  if (numMeasurements <= 0) {
+    return;
+  }
+  
+  if (binaryMode) {
+    unsigned long timeMs = millis();
+    for (int firstIdx = 0; firstIdx < numMeasurements; firstIdx += BinaryFrame::MAX_BATCH_SIZE) {
+      int batchSize = numMeasurements - firstIdx;
+      if (batchSize > BinaryFrame::MAX_BATCH_SIZE) {
+        batchSize = BinaryFrame::MAX_BATCH_SIZE;
+      }
+      uint8_t frame[BinaryFrame::MAX_WIRE_SIZE];
+      int frameSize = BinaryFrame::encodeBatch(batchSequenceNum++, timeMs, meterIdxs + firstIdx, measurements + firstIdx, batchSize, frame);
+      Serial.write(frame, frameSize);
+    }
+    return;
+  }
+  
+  for (int i = 0; i < numMeasurements; i++) {
+    PrintMeasurementMsg(meterIdxs[i], measurements[i]);
+  }
+  Serial.println();
+}
+
 // Format: [<meterIdx> <cmd_char> <data>]
 // <meterIdx> is in the form "00" (e.g., meter of index 1 would be 001)
 // <cmd_char> is in the form 'X' (i.e., a single character that describes the type of command)
 // <data> depends on the type of message:
 // METER_PERCENT_CMD_CHAR: <data> == "0.00" (4 bytes defining a percentage of the meter in [0,1])
 // METER_ROUTINE_CMD_CHAR: <data> == 'X' (1 byte that defines the type of routine -- see constants)
+// BINARY_PROTOCOL_CMD_CHAR: <data> == 'V' (1 digit, the binary protocol version the host wants to
+// switch to). If we speak that version we answer with a binary hello frame and send binary frames
+// from then on, otherwise we answer with an ERROR and the host sticks to ASCII.
+// BAUD_RATE_CMD_CHAR: <data> == 'I' (1 digit, the index of the baud rate to switch to right away,
+// see BinaryFrame::baudRate). Anything but index 0 has to be confirmed by a BINARY_PROTOCOL_CMD_CHAR
+// handshake at the new rate, otherwise we go back to index 0 after BAUD_CONFIRM_TIMEOUT_MS.
+//
+// This only takes what has already arrived and never waits for the rest of a package, so packages
+// coming in over several loops don't hold up the sampling and the LEDs. A package is carried out
+// once its PKG_END_CHAR is in, a new PKG_BEGIN_CHAR always starts over.
 
 void KegMeterProtocol::ReadSerial(KegLoadMeter* kegMeters, int numMeters) {
   
+  if (baudRateUnconfirmed && millis() - baudRateSwitchTimeMs > BAUD_CONFIRM_TIMEOUT_MS) {
+    SetBaudRate(0);
+  }
   
-  // We need to find the start of the package first...
-  while (Serial.available() > 0 && Serial.peek() != PKG_BEGIN_CHAR) { Serial.read(); } 
-  if (Serial.available() < 8) { return; }
-  
-  char tempChar;
-  
-  #define ON_AVAILABLE_TIMEOUT(x) Serial.print("ERROR "); Serial.println(x); return
+  while (Serial.available() > 0) {
+    char serialReadByte = Serial.read();
+    
+    if (serialReadByte == PKG_BEGIN_CHAR) {
+      pkgLength = 0;
+      inPkg = true;
+    }
+    else if (!inPkg) {
+      // Anything between packages is ignored
+    }
+    else if (serialReadByte == PKG_END_CHAR) {
+      pkg[pkgLength] = '\0';
+      inPkg = false;
+      ExecutePkg(kegMeters, numMeters);
+    }
+    else if (pkgLength < MAX_PKG_LENGTH) {
+      pkg[pkgLength++] = serialReadByte;
+    }
+    else {
+      Serial.println("ERROR: Package too long.");
+      inPkg = false;
+    }
+  }
+}
 
-  // Read the PKG_BEGIN_CHAR
-  tempChar = Serial.read();
-  if (tempChar != PKG_BEGIN_CHAR) { Serial.print("FAILED: "); Serial.println((int)tempChar); return; }
-  
-  // We'd like to be able to read the keg index
-  if (!WaitForAvailable(2)) { ON_AVAILABLE_TIMEOUT(1); }
-  int meterIdx = Serial.parseInt();
-  if (meterIdx < 0 || meterIdx >= numMeters) {
+void KegMeterProtocol::ExecutePkg(KegLoadMeter* kegMeters, int numMeters) {
+  // Read the keg index
+  char* cmdStart;
+  long meterIdx = strtol(pkg, &cmdStart, 10);
+  if (cmdStart == pkg || meterIdx < 0 || meterIdx >= numMeters) {
     Serial.println("WARNING: Invalid meter index.");
     return; 
   }
@@ -59,26 +142,23 @@ void KegMeterProtocol::ReadSerial(KegLoadMeter* kegMeters, int numMeters) {
   KegLoadMeter& selectedMeter = kegMeters[meterIdx];
 
   // There should be a single byte separator, the type of command, and another single byte separator
-  if (!WaitForAvailable(3)) { ON_AVAILABLE_TIMEOUT(2); }
-  
-  // Read the separator
-  tempChar = Serial.read();
-  if (tempChar != SEPARATOR_CHAR) { ON_AVAILABLE_TIMEOUT(3); }
-  
-  // Read the type of message
-  char msgCmdType = Serial.read();
-  
-  // Read the separator
-  tempChar = Serial.read();
-  if (tempChar != SEPARATOR_CHAR) { ON_AVAILABLE_TIMEOUT(4); }
+  if (cmdStart[0] != SEPARATOR_CHAR || cmdStart[1] == '\0' || cmdStart[2] != SEPARATOR_CHAR) {
+    Serial.println("ERROR: Invalid package.");
+    return;
+  }
+  char msgCmdType = cmdStart[1];
+  const char* data = cmdStart + 3;
+  if (*data == '\0') {
+    Serial.println("ERROR: Missing data.");
+    return;
+  }
  
   switch (msgCmdType) {
     
     case METER_PERCENT_CMD_CHAR: {
       // This command will tell a specific meter what percentage it should be at
       // Format of the data is 0.00 (4 bytes)
-      if (!WaitForAvailable(4)) { ON_AVAILABLE_TIMEOUT(5); }
-      float percent = Serial.parseFloat();
+      float percent = atof(data);
       
       if (percent < 0) { percent = 0; }
       else if (percent > 1) { percent = 1; }
@@ -91,8 +171,7 @@ void KegMeterProtocol::ReadSerial(KegLoadMeter* kegMeters, int numMeters) {
     case METER_ROUTINE_CMD_CHAR: {
       // This command will tell a specific meter what lighting routine it should be running
       // Format of the data is a routine type character (1 byte)
-      if (!WaitForAvailable(1)) { ON_AVAILABLE_TIMEOUT(6); }
-      char routineType = Serial.read();
+      char routineType = data[0];
       switch (routineType) {
         
         case METER_ROUTINE_OFF_CHAR:
@@ -124,6 +203,36 @@ void KegMeterProtocol::ReadSerial(KegLoadMeter* kegMeters, int numMeters) {
       break;
     }
     
+    case BINARY_PROTOCOL_CMD_CHAR: {
+      int version = data[0] - '0';
+      if (version != BinaryFrame::PROTOCOL_VERSION) {
+        Serial.println("ERROR: Unsupported binary protocol version.");
+        return;
+      }
+      
+      binaryMode = true;
+      baudRateUnconfirmed = false;
+      uint8_t frame[BinaryFrame::MAX_WIRE_SIZE];
+      int frameSize = BinaryFrame::encodeHello(numMeters, MAX_BAUD_RATE_IDX, frame);
+      Serial.write(frame, frameSize);
+      break;
+    }
+    
+    case BAUD_RATE_CMD_CHAR: {
+      int newBaudRateIdx = data[0] - '0';
+      if (newBaudRateIdx < 0 || newBaudRateIdx > MAX_BAUD_RATE_IDX) {
+        Serial.println("ERROR: Unsupported baud rate.");
+        return;
+      }
+      
+      SetBaudRate(newBaudRateIdx);
+      if (newBaudRateIdx != 0) {
+        baudRateUnconfirmed = true;
+        baudRateSwitchTimeMs = millis();
+      }
+      break;
+    }
+    
     default:
       Serial.println("ERROR: Command not found.");
       return;
@@ -153,9 +262,12 @@ void KegMeterProtocol::PrintWithZeroPadding(int number, byte width) {
   Serial.print(number);
 }
 
-boolean KegMeterProtocol::WaitForAvailable(int numBytes) {
-  unsigned long maxWaitTime = millis() + 100;
-  while (Serial.available() < numBytes && millis() < maxWaitTime) {} 
+void KegMeterProtocol::SetBaudRate(uint8_t newBaudRateIdx) {
+  // Let whatever is still going out finish at the old rate
+  Serial.flush();
+  Serial.end();
+  Serial.begin(BinaryFrame::baudRate(newBaudRateIdx));
   
-  return Serial.available() >= numBytes;
+  baudRateIdx = newBaudRateIdx;
+  baudRateUnconfirmed = false;
 }
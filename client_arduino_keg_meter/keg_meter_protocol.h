@@ -7,13 +7,17 @@
 #define PKG_END_STR "]"
 #define METER_ID_SEPARATOR_STR " "
 
+#define MAX_PKG_LENGTH 16
+
 
 class KegLoadMeter;
 
 class KegMeterProtocol {
 public:
   static void PrintMeasurementMsg(uint8_t meterIdx, float measurement);
+  static void PrintMeasurementBatch(const uint8_t* meterIdxs, const float* measurements, int numMeasurements);
   static void ReadSerial(KegLoadMeter* kegMeters, int numMeters);
+  static long GetBaudRate();
 
 private:
   KegMeterProtocol() {}
@@ -26,7 +30,25 @@ private:
   static void PrintWithZeroPadding(float number, byte nonDecimalWidth, int precision);
   static void PrintWithZeroPadding(int number, byte width);
   
-  static boolean WaitForAvailable(int numBytes);
+  static void ExecutePkg(KegLoadMeter* kegMeters, int numMeters);
+  static void SetBaudRate(uint8_t baudRateIdx);
+
+  // The package that's coming in (without its begin and end characters), it's read a byte at a time
+  // as the bytes arrive and only carried out once it's complete
+  static char pkg[MAX_PKG_LENGTH + 1];
+  static uint8_t pkgLength;
+  static boolean inPkg;
+
+  // Whether measurements are sent as binary frames (see binary_frame.h), this is only switched on
+  // when the host asks for it, until then (and for older hosts) everything is sent as ASCII
+  static boolean binaryMode;
+  static uint16_t batchSequenceNum;
+
+  // The host can switch us to a faster baud rate (see BinaryFrame::baudRate), we go back to the
+  // initial rate unless the host confirms the new one with a handshake within a few seconds
+  static uint8_t baudRateIdx;
+  static boolean baudRateUnconfirmed;
+  static unsigned long baudRateSwitchTimeMs;
 };
 
 #endif // KEG_METER_PROTOCOL_H_
@@ -0,0 +1,46 @@
+#include "led_renderer.h"
+
+LedRenderer::LedRenderer(Adafruit_NeoPixel& strip, uint8_t maxFramesPerSecond) :
+  strip(strip), minFrameMicros(1000000UL / maxFramesPerSecond),
+  dirty(false), lastFrameMicros(0), numFrames(0), numShows(0) {
+}
+
+void LedRenderer::begin() {
+  this->strip.begin();
+  this->strip.clear();
+  this->strip.show();
+  this->lastFrameMicros = micros();
+}
+
+void LedRenderer::setPixelColor(uint16_t idx, uint32_t colour) {
+  if (idx >= this->strip.numPixels() || this->strip.getPixelColor(idx) == colour) {
+    return;
+  }
+  this->strip.setPixelColor(idx, colour);
+  this->dirty = true;
+}
+
+void LedRenderer::fill(uint16_t startIdx, uint16_t endIdx, uint32_t colour) {
+  for (uint16_t idx = startIdx; idx < endIdx; idx++) {
+    this->setPixelColor(idx, colour);
+  }
+}
+
+boolean LedRenderer::render() {
+  // Changes made in between frames wait for the next one
+  uint32_t nowMicros = micros();
+  if (nowMicros - this->lastFrameMicros < this->minFrameMicros) {
+    return false;
+  }
+  this->lastFrameMicros = nowMicros;
+  this->numFrames++;
+
+  if (!this->dirty) {
+    return false;
+  }
+
+  this->strip.show();
+  this->dirty = false;
+  this->numShows++;
+  return true;
+}
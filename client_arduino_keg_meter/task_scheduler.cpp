@@ -0,0 +1,89 @@
+#include "task_scheduler.h"
+
+int8_t TaskScheduler::addTask(const char* name, TaskFunction function, uint32_t periodMicros, uint32_t deadlineMicros) {
+  if (this->numTasks >= MAX_NUM_TASKS) {
+    return -1;
+  }
+  
+  uint32_t nowMicros = micros();
+  Task& task = this->tasks[this->numTasks];
+  task.name = name;
+  task.function = function;
+  task.periodMicros = periodMicros;
+  task.deadlineMicros = deadlineMicros;
+  task.dueMicros = nowMicros;
+  task.lastRunMicros = nowMicros - periodMicros;
+  task.numRuns = 0;
+  task.numOverruns = 0;
+  task.maxRunMicros = 0;
+  
+  return this->numTasks++;
+}
+
+void TaskScheduler::run() {
+  uint32_t nowMicros = micros();
+  
+  for (uint8_t i = 0; i < this->numTasks; i++) {
+    Task& task = this->tasks[i];
+    
+    // The differences are signed, so this keeps working when micros() wraps around (~70 minutes)
+    if ((int32_t)(nowMicros - task.dueMicros) < 0) {
+      continue;
+    }
+    
+    uint32_t startMicros = nowMicros;
+    task.function(startMicros - task.lastRunMicros);
+    task.lastRunMicros = startMicros;
+    nowMicros = micros();
+    
+    task.numRuns++;
+    task.maxRunMicros = max(task.maxRunMicros, nowMicros - startMicros);
+    if (nowMicros - task.dueMicros > task.deadlineMicros) {
+      task.numOverruns++;
+    }
+    
+    task.dueMicros += task.periodMicros;
+    if ((int32_t)(nowMicros - task.dueMicros) >= 0) {
+      // Skip the periods that were missed, but stay in step with the ones before
+      task.dueMicros += ((nowMicros - task.dueMicros) / task.periodMicros + 1) * task.periodMicros;
+    }
+  }
+}
+
+uint32_t TaskScheduler::getMicrosUntilDue() const {
+  uint32_t nowMicros = micros();
+  uint32_t untilDueMicros = 0xFFFFFFFFUL;
+  for (uint8_t i = 0; i < this->numTasks; i++) {
+    int32_t diffMicros = (int32_t)(this->tasks[i].dueMicros - nowMicros);
+    if (diffMicros <= 0) {
+      return 0;
+    }
+    if ((uint32_t)diffMicros < untilDueMicros) {
+      untilDueMicros = diffMicros;
+    }
+  }
+  return untilDueMicros;
+}
+
+uint32_t TaskScheduler::getTotalNumOverruns() const {
+  uint32_t numOverruns = 0;
+  for (uint8_t i = 0; i < this->numTasks; i++) {
+    numOverruns += this->tasks[i].numOverruns;
+  }
+  return numOverruns;
+}
+
+void TaskScheduler::printStats() const {
+  for (uint8_t i = 0; i < this->numTasks; i++) {
+    const Task& task = this->tasks[i];
+    Serial.print("Task ");
+    Serial.print(task.name);
+    Serial.print(": ");
+    Serial.print(task.numRuns);
+    Serial.print(" runs, ");
+    Serial.print(task.numOverruns);
+    Serial.print(" overruns, ");
+    Serial.print(task.maxRunMicros);
+    Serial.println(" us max");
+  }
+}
@@ -0,0 +1,378 @@
+// Benchmarks and checks the keg meter history (see HistoryStore). A store in a scratch directory
+// gets days of synthetic samples for a number of meters, appended in time order as the meters
+// would, and then it's scanned back:
+//
+// - The time every append takes is kept per tenth of the run, appends have to cost the same no
+//   matter how much history there already is.
+// - The store is reopened, which only reads the segment headers.
+// - The whole history of a meter is scanned at every tier. Every rollup bucket has to agree with
+//   the raw samples it covers (count, min, max and mean), and every scan has to come back at the
+//   tier its resolution asks for. The resident memory after the raw scan shows it didn't need the
+//   whole history in memory.
+//
+// The exit code is 1 when anything couldn't be stored or read back, or didn't add up.
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QMap>
+#include <QString>
+#include <QTemporaryDir>
+
+#include "historystore.h"
+#include "latencyhistogram.h"
+
+namespace {
+  const int NUM_APPEND_PHASES = 10;
+
+  // How far the mean of a rollup (kept incrementally in float) may be off the mean of its samples
+  const double MAX_MEAN_ERROR = 1e-3;
+
+  const float FULL_MASS = 50.0f;
+
+  struct Options {
+    QString dirPath; // A temporary directory if empty
+    int numMeters;
+    double days;
+    double rateHz;
+    unsigned int seed;
+
+    Options() : numMeters(4), days(30), rateHz(1.0), seed(1) {}
+  };
+
+  // A keg on a scale, poured from now and then until it's empty and swapped for a full one
+  class KegSampleGenerator {
+  public:
+    KegSampleGenerator(unsigned int seed) : mass(FULL_MASS), pourRate(0), rngState(seed) {}
+
+    void next(qint64 timeMs, HistoryRecord& record) {
+      if (this->pourRate > 0) {
+        this->mass -= this->pourRate;
+        if (this->nextRandom() % 30 == 0) {
+          this->pourRate = 0;
+        }
+      }
+      else if (this->nextRandom() % 3000 == 0) {
+        this->pourRate = 0.02f + 0.04f * (this->nextRandom() % 100) / 100.0f;
+      }
+      if (this->mass < 0) {
+        this->mass = FULL_MASS;
+        this->pourRate = 0;
+      }
+
+      float noise = ((this->nextRandom() % 2001) / 1000.0f - 1.0f) * 0.05f;
+      record.timeMs = timeMs;
+      record.load = this->mass + noise;
+      record.variance = (this->pourRate > 0) ? 0.5f : 0.001f;
+      record.percent = 100.0f * this->mass / FULL_MASS;
+      record.state = (this->pourRate > 0) ? 1 : 0;
+      record.reserved[0] = record.reserved[1] = record.reserved[2] = 0;
+    }
+
+  private:
+    float mass;
+    float pourRate;
+    quint32 rngState;
+
+    quint32 nextRandom() {
+      this->rngState = this->rngState * 1664525u + 1013904223u;
+      return this->rngState >> 8;
+    }
+  };
+
+  // The exact summary of the samples of one bucket, worked out from the raw scan
+  struct ExactBucket {
+    quint32 count;
+    float minLoad;
+    float maxLoad;
+    double sumLoad;
+    float minPercent;
+    float maxPercent;
+    double sumPercent;
+
+    ExactBucket() : count(0), minLoad(0), maxLoad(0), sumLoad(0), minPercent(0), maxPercent(0), sumPercent(0) {}
+
+    void add(const HistoryRecord& record) {
+      if (this->count == 0 || record.load < this->minLoad) {
+        this->minLoad = record.load;
+      }
+      if (this->count == 0 || record.load > this->maxLoad) {
+        this->maxLoad = record.load;
+      }
+      if (this->count == 0 || record.percent < this->minPercent) {
+        this->minPercent = record.percent;
+      }
+      if (this->count == 0 || record.percent > this->maxPercent) {
+        this->maxPercent = record.percent;
+      }
+      this->sumLoad += record.load;
+      this->sumPercent += record.percent;
+      this->count++;
+    }
+  };
+
+  bool closeEnough(double value, double expected) {
+    return std::fabs(value - expected) <= MAX_MEAN_ERROR * std::max(1.0, std::fabs(expected));
+  }
+
+  // Resident memory of the process in kB, from /proc (Linux only), -1 when it can't be read
+  long readResidentKb() {
+    QFile file("/proc/self/status");
+    if (!file.open(QIODevice::ReadOnly)) {
+      return -1;
+    }
+    while (!file.atEnd()) {
+      QByteArray line = file.readLine();
+      if (line.startsWith("VmRSS:")) {
+        return line.mid(6).trimmed().split(' ').first().toLong();
+      }
+    }
+    return -1;
+  }
+
+  void printLatencies(const char* name, const LatencyHistogram& latencies) {
+    printf("%-18s %10llu %9.0f ns %9llu ns %9llu ns %9llu ns\n", name, (unsigned long long)latencies.getCount(),
+           latencies.getMean(), (unsigned long long)latencies.getValueAtPercentile(50),
+           (unsigned long long)latencies.getValueAtPercentile(99), (unsigned long long)latencies.getMax());
+  }
+
+  bool appendHistory(HistoryStore& store, const Options& options, qint64 startMs, qint64 numSamples) {
+    std::vector<KegSampleGenerator> samples;
+    for (int meterIdx = 0; meterIdx < options.numMeters; meterIdx++) {
+      samples.push_back(KegSampleGenerator(options.seed + meterIdx));
+    }
+
+    printf("%-18s %10s %12s %12s %12s %12s\n", "Appends", "Count", "Mean", "p50", "p99", "Max");
+    double intervalMs = 1000.0 / options.rateHz;
+    qint64 phaseSize = qMax<qint64>(1, numSamples / NUM_APPEND_PHASES);
+    LatencyHistogram phaseLatencies;
+    LatencyHistogram allLatencies;
+    QElapsedTimer totalTimer;
+    totalTimer.start();
+    for (qint64 i = 0; i < numSamples; i++) {
+      qint64 timeMs = startMs + static_cast<qint64>(i * intervalMs);
+      for (int meterIdx = 0; meterIdx < options.numMeters; meterIdx++) {
+        HistoryRecord record;
+        samples[meterIdx].next(timeMs, record);
+
+        QElapsedTimer timer;
+        timer.start();
+        bool appended = store.append(meterIdx, record);
+        phaseLatencies.record(timer.nsecsElapsed());
+        if (!appended) {
+          fprintf(stderr, "Failed to append sample %lld of meter %d: %s\n", (long long)i, meterIdx,
+                  store.errorString().toLocal8Bit().constData());
+          return false;
+        }
+      }
+
+      if ((i + 1) % phaseSize == 0 || i + 1 == numSamples) {
+        char name[32];
+        snprintf(name, sizeof(name), "  %3.0f%%", 100.0 * (i + 1) / numSamples);
+        printLatencies(name, phaseLatencies);
+        allLatencies.add(phaseLatencies);
+        phaseLatencies.clear();
+      }
+    }
+    printLatencies("  All", allLatencies);
+    printf("%llu samples appended in %.2f s\n\n", (unsigned long long)allLatencies.getCount(), totalTimer.elapsed() / 1000.0);
+    return true;
+  }
+
+  // Scans the whole raw history of a meter, checks it's all there and in order, and sums it up
+  // into buckets for every rollup tier
+  bool scanRaw(const HistoryStore& store, int meterIdx, qint64 numSamples, std::vector<QMap<qint64, ExactBucket> >& buckets) {
+    long residentKbBefore = readResidentKb();
+    QElapsedTimer timer;
+    timer.start();
+
+    HistoryStore::Cursor cursor(store, meterIdx, store.getFirstTime(meterIdx), store.getLastTime(meterIdx));
+    HistoryRecord record;
+    qint64 numRecords = 0;
+    qint64 lastTimeMs = 0;
+    while (cursor.next(record)) {
+      if (numRecords > 0 && record.timeMs < lastTimeMs) {
+        fprintf(stderr, "Meter %d: raw record %lld at %lld ms comes before the one at %lld ms\n", meterIdx,
+                (long long)numRecords, (long long)record.timeMs, (long long)lastTimeMs);
+        return false;
+      }
+      lastTimeMs = record.timeMs;
+      numRecords++;
+
+      for (int tier = HistoryStore::MinuteTier; tier < HistoryStore::NUM_TIERS; tier++) {
+        qint64 resolutionMs = HistoryStore::getTierResolution(static_cast<HistoryStore::Tier>(tier));
+        buckets[tier][record.timeMs - record.timeMs % resolutionMs].add(record);
+      }
+    }
+    qint64 elapsedMs = timer.elapsed();
+    long residentKbAfter = readResidentKb();
+
+    if (numRecords != numSamples) {
+      fprintf(stderr, "Meter %d: %lld raw records scanned, %lld were appended\n", meterIdx, (long long)numRecords,
+              (long long)numSamples);
+      return false;
+    }
+
+    double historyMb = numRecords * sizeof(HistoryRecord) / (1024.0 * 1024.0);
+    printf("%-10s %12lld %12.3f %14.1f", "Raw", (long long)numRecords, elapsedMs / 1000.0,
+           numRecords / qMax(1e-3, elapsedMs / 1000.0) / 1e6);
+    if (residentKbBefore >= 0 && residentKbAfter >= 0) {
+      printf("   resident %+.1f MB for %.1f MB of history", (residentKbAfter - residentKbBefore) / 1024.0, historyMb);
+    }
+    printf("\n");
+    return true;
+  }
+
+  // Scans the whole history of a meter at the resolution of a tier, and checks every bucket
+  // against the raw samples
+  bool scanTier(const HistoryStore& store, int meterIdx, HistoryStore::Tier tier, const QMap<qint64, ExactBucket>& expected) {
+    static const char* TIER_NAMES[] = { "Raw", "Minute", "Hour", "Day" };
+    qint64 resolutionMs = HistoryStore::getTierResolution(tier);
+
+    QElapsedTimer timer;
+    timer.start();
+    HistoryStore::Cursor cursor(store, meterIdx, store.getFirstTime(meterIdx), store.getLastTime(meterIdx), resolutionMs);
+    if (cursor.getTier() != tier) {
+      fprintf(stderr, "Meter %d: a scan at %lld ms resolution came back at the %s tier, not the %s tier\n", meterIdx,
+              (long long)resolutionMs, TIER_NAMES[cursor.getTier()], TIER_NAMES[tier]);
+      return false;
+    }
+
+    RollupRecord rollup;
+    qint64 numRecords = 0;
+    while (cursor.next(rollup)) {
+      numRecords++;
+      QMap<qint64, ExactBucket>::const_iterator bucketIt = expected.constFind(rollup.timeMs);
+      if (bucketIt == expected.constEnd()) {
+        fprintf(stderr, "Meter %d: %s bucket at %lld ms has no raw samples\n", meterIdx, TIER_NAMES[tier],
+                (long long)rollup.timeMs);
+        return false;
+      }
+
+      const ExactBucket& bucket = bucketIt.value();
+      if (rollup.count != bucket.count || rollup.minLoad != bucket.minLoad || rollup.maxLoad != bucket.maxLoad ||
+          rollup.minPercent != bucket.minPercent || rollup.maxPercent != bucket.maxPercent ||
+          !closeEnough(rollup.meanLoad, bucket.sumLoad / bucket.count) ||
+          !closeEnough(rollup.meanPercent, bucket.sumPercent / bucket.count)) {
+        fprintf(stderr, "Meter %d: %s bucket at %lld ms has %u samples, load %.6g..%.6g mean %.6g, "
+                "the raw samples have %u, %.6g..%.6g mean %.6g\n", meterIdx, TIER_NAMES[tier], (long long)rollup.timeMs,
+                rollup.count, rollup.minLoad, rollup.maxLoad, rollup.meanLoad, bucket.count, bucket.minLoad,
+                bucket.maxLoad, bucket.sumLoad / bucket.count);
+        return false;
+      }
+    }
+    qint64 elapsedMs = timer.elapsed();
+
+    if (numRecords != expected.size()) {
+      fprintf(stderr, "Meter %d: %lld %s buckets scanned, the raw samples fall in %d\n", meterIdx, (long long)numRecords,
+              TIER_NAMES[tier], expected.size());
+      return false;
+    }
+    printf("%-10s %12lld %12.3f %14.1f\n", TIER_NAMES[tier], (long long)numRecords, elapsedMs / 1000.0,
+           numRecords / qMax(1e-3, elapsedMs / 1000.0) / 1e6);
+    return true;
+  }
+
+  void printUsage(const char* appName) {
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  --dir <path>     Directory for the store, must be empty (default: a temporary one)\n"
+            "  --meters <n>     Number of meters (default: 4)\n"
+            "  --days <n>       Days of history (default: 30)\n"
+            "  --rate <hz>      Samples a second of every meter (default: 1)\n"
+            "  --seed <n>       Seed for the samples (default: 1)\n",
+            appName);
+  }
+}
+
+int main(int argc, char* argv[]) {
+  Options options;
+  for (int i = 1; i < argc; i++) {
+    bool hasValue = (i + 1 < argc);
+    if (strcmp(argv[i], "--dir") == 0 && hasValue) {
+      options.dirPath = QString::fromLocal8Bit(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--meters") == 0 && hasValue) {
+      options.numMeters = atoi(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--days") == 0 && hasValue) {
+      options.days = atof(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--rate") == 0 && hasValue) {
+      options.rateHz = atof(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--seed") == 0 && hasValue) {
+      options.seed = strtoul(argv[++i], NULL, 10);
+    }
+    else {
+      printUsage(argv[0]);
+      return 1;
+    }
+  }
+
+  if (options.numMeters <= 0 || options.days <= 0 || options.rateHz <= 0) {
+    printUsage(argv[0]);
+    return 1;
+  }
+
+  QCoreApplication app(argc, argv);
+
+  QTemporaryDir tempDir;
+  if (options.dirPath.isEmpty()) {
+    if (!tempDir.isValid()) {
+      fprintf(stderr, "Failed to create a temporary directory\n");
+      return 1;
+    }
+    options.dirPath = tempDir.path();
+  }
+
+  // Days start at midnight UTC, so the day buckets line up with the start of the history
+  qint64 startMs = QDateTime(QDate(2026, 1, 1), QTime(0, 0), Qt::UTC).toMSecsSinceEpoch();
+  qint64 numSamples = static_cast<qint64>(options.days * 24 * 3600 * options.rateHz);
+  printf("History store: %d meter(s), %.0f day(s) at %.2f Hz, %lld samples each in %s\n\n", options.numMeters,
+         options.days, options.rateHz, (long long)numSamples, options.dirPath.toLocal8Bit().constData());
+
+  {
+    HistoryStore store(options.dirPath);
+    if (!store.open()) {
+      fprintf(stderr, "Failed to open the store: %s\n", store.errorString().toLocal8Bit().constData());
+      return 1;
+    }
+    if (!appendHistory(store, options, startMs, numSamples)) {
+      return 1;
+    }
+  }
+
+  QElapsedTimer openTimer;
+  openTimer.start();
+  HistoryStore store(options.dirPath);
+  if (!store.open()) {
+    fprintf(stderr, "Failed to reopen the store: %s\n", store.errorString().toLocal8Bit().constData());
+    return 1;
+  }
+  printf("Reopened in %lld ms\n\n", (long long)openTimer.elapsed());
+
+  printf("%-10s %12s %12s %14s\n", "Scan", "Records", "Time (s)", "Records/s (M)");
+  for (int meterIdx = 0; meterIdx < options.numMeters; meterIdx++) {
+    std::vector<QMap<qint64, ExactBucket> > buckets(HistoryStore::NUM_TIERS);
+    if (!scanRaw(store, meterIdx, numSamples, buckets)) {
+      return 1;
+    }
+    for (int tier = HistoryStore::MinuteTier; tier < HistoryStore::NUM_TIERS; tier++) {
+      if (!scanTier(store, meterIdx, static_cast<HistoryStore::Tier>(tier), buckets[tier])) {
+        return 1;
+      }
+    }
+  }
+  printf("\nEvery rollup bucket agrees with its raw samples\n");
+  return 0;
+}
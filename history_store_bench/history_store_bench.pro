@@ -0,0 +1,26 @@
+#-------------------------------------------------
+#
+# Benchmarks the keg meter history store: how long appends take as the history grows, and how fast
+# and in how little memory the history is scanned back at every tier. Checks every rollup bucket
+# against the raw samples.
+#
+#-------------------------------------------------
+
+QT       += core
+QT       -= gui
+CONFIG   += console c++11
+CONFIG   -= app_bundle
+
+TARGET = history_store_bench
+TEMPLATE = app
+
+COMMON_DIR = $$PWD/../keg_meter_common
+
+INCLUDEPATH += $$COMMON_DIR
+DEPENDPATH  += $$COMMON_DIR
+
+SOURCES += history_store_bench.cpp \
+    $$COMMON_DIR/historystore.cpp
+
+HEADERS  += $$COMMON_DIR/historystore.h \
+    $$COMMON_DIR/latencyhistogram.h
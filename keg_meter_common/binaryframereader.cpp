@@ -0,0 +1,57 @@
+#include "binaryframereader.h"
+
+BinaryFrameReader::BinaryFrameReader() : bufferSize(0), numCorruptFrames(0) {
+}
+
+/**
+ * Consume bytes from the given data (advancing data and size past them) until a complete chunk
+ * has been read. Returns false once all of the data has been consumed without completing one, the
+ * partial chunk is kept until more data comes in. Text that runs longer than MAX_CHUNK_SIZE
+ * without a delimiter is handed out in pieces.
+ */
+bool BinaryFrameReader::nextChunk(const char*& data, int& size, Chunk& chunk) {
+    while (size > 0) {
+        char currByte = *data++;
+        size--;
+
+        if (currByte == static_cast<char>(BinaryFrame::DELIMITER)) {
+            if (this->bufferSize == 0) {
+                continue;
+            }
+            this->classifyChunk(chunk);
+            this->bufferSize = 0;
+            return true;
+        }
+
+        this->buffer[this->bufferSize++] = currByte;
+        if (this->bufferSize == MAX_CHUNK_SIZE) {
+            chunk.type = TextChunk;
+            chunk.text = this->buffer;
+            chunk.textSize = this->bufferSize;
+            this->bufferSize = 0;
+            return true;
+        }
+    }
+    return false;
+}
+
+void BinaryFrameReader::classifyChunk(Chunk& chunk) {
+    if (this->bufferSize <= BinaryFrame::MAX_ENCODED_SIZE) {
+        int decodedSize = BinaryFrame::cobsDecode(reinterpret_cast<const quint8*>(this->buffer), this->bufferSize,
+                                                  this->decoded, BinaryFrame::MAX_FRAME_SIZE);
+        if (decodedSize > 0 && this->decoded[0] == BinaryFrame::SYNC_BYTE) {
+            if (BinaryFrame::parseFrame(this->decoded, decodedSize, chunk.frame)) {
+                chunk.type = FrameChunk;
+            }
+            else {
+                chunk.type = CorruptFrameChunk;
+                this->numCorruptFrames++;
+            }
+            return;
+        }
+    }
+
+    chunk.type = TextChunk;
+    chunk.text = this->buffer;
+    chunk.textSize = this->bufferSize;
+}
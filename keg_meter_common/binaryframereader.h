@@ -0,0 +1,45 @@
+#ifndef KEGMETERCOMMON_BINARYFRAMEREADER_H
+#define KEGMETERCOMMON_BINARYFRAMEREADER_H
+
+#include "binaryframe.h"
+
+#include <QtGlobal>
+
+/**
+ * Splits an incoming byte stream into the chunks between zero delimiters and classifies each of
+ * them as a binary frame (see BinaryFrame), a corrupted frame or plain text that the hardware
+ * printed in between frames.
+ */
+class BinaryFrameReader {
+public:
+    static const int MAX_CHUNK_SIZE = 256;
+
+    enum ChunkType { FrameChunk, CorruptFrameChunk, TextChunk };
+
+    // A chunk read from the stream. The frame payload and the text are only valid until the next
+    // call to nextChunk() or clear() on the reader that produced it.
+    struct Chunk {
+        ChunkType type;
+        BinaryFrame::Frame frame;
+        const char* text;
+        int textSize;
+    };
+
+    BinaryFrameReader();
+    ~BinaryFrameReader() {}
+
+    bool nextChunk(const char*& data, int& size, Chunk& chunk);
+    void clear() { this->bufferSize = 0; }
+
+    quint64 getNumCorruptFrames() const { return this->numCorruptFrames; }
+
+private:
+    char buffer[MAX_CHUNK_SIZE];
+    int bufferSize;
+    quint8 decoded[BinaryFrame::MAX_FRAME_SIZE];
+    quint64 numCorruptFrames;
+
+    void classifyChunk(Chunk& chunk);
+};
+
+#endif // KEGMETERCOMMON_BINARYFRAMEREADER_H
@@ -0,0 +1,593 @@
+#include "historystore.h"
+
+#include <cassert>
+#include <cstring>
+
+#include <QDir>
+#include <QStandardPaths>
+
+namespace {
+
+// Per series: every tier and then the pours. Rollup tiers and pours get a subdirectory of the
+// meter's directory, the raw samples live in the meter's directory itself
+const char* const SERIES_DIR_NAMES[HistoryStore::NUM_TIERS + 1] = { "", "1m", "1h", "1d", "pours" };
+const qint64 TIER_RESOLUTIONS_MS[HistoryStore::NUM_TIERS] = { 0, 60*1000LL, 60*60*1000LL, 24*60*60*1000LL };
+
+// A segment holds a day of raw samples at one per second, a month of minutes, a year of hours,
+// ten years of days and a good few weeks of pours
+const int SEGMENT_CAPACITIES[HistoryStore::NUM_TIERS + 1] = { 86400, 31*24*60, 366*24, 3660, 10000 };
+
+}
+
+/**
+ * Reads the records of one series of a meter in a time range, mapping one segment at a time. Every
+ * kind of record starts with the time it's ordered by.
+ */
+class HistoryStore::SeriesReader {
+public:
+    SeriesReader(const HistoryStore& store, int meterIdx, int seriesIdx, qint64 fromMs, qint64 toMs);
+    ~SeriesReader() { this->closeSegment(); }
+
+    const uchar* next();
+
+private:
+    int recordSize;
+    QStringList segmentPaths;
+    int segmentIdx;
+    qint64 fromMs;
+    qint64 toMs;
+
+    QFile file;
+    const uchar* records;
+    int numRecords;
+    int recordIdx;
+
+    bool openNextSegment();
+    void closeSegment();
+};
+
+HistoryStore::HistoryStore(const QString& dirPath) :
+    dirPath(dirPath),
+    opened(false) {
+}
+
+HistoryStore::~HistoryStore() {
+    this->close();
+}
+
+QString HistoryStore::defaultDirPath() {
+    return QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) + QString("/history");
+}
+
+qint64 HistoryStore::getTierResolution(Tier tier) {
+    assert(tier >= 0 && tier < NUM_TIERS);
+    return TIER_RESOLUTIONS_MS[tier];
+}
+
+HistoryStore::Tier HistoryStore::tierForResolution(qint64 resolutionMs) {
+    for (int tier = NUM_TIERS - 1; tier > RawTier; tier--) {
+        if (TIER_RESOLUTIONS_MS[tier] <= resolutionMs) {
+            return static_cast<Tier>(tier);
+        }
+    }
+    return RawTier;
+}
+
+int HistoryStore::getRecordSize(int seriesIdx) {
+    if (seriesIdx == RawTier) {
+        return sizeof(HistoryRecord);
+    }
+    if (seriesIdx == POUR_SERIES) {
+        return sizeof(PourRecord);
+    }
+    return sizeof(RollupRecord);
+}
+
+int HistoryStore::getSegmentCapacity(int seriesIdx) {
+    assert(seriesIdx >= 0 && seriesIdx < NUM_SERIES);
+    return SEGMENT_CAPACITIES[seriesIdx];
+}
+
+/**
+ * Find the segments of every meter that already has history, only their headers are read. The
+ * last segment of every series is mapped again so it can be appended to. Segments that aren't ours
+ * or that are damaged are left alone and skipped.
+ */
+bool HistoryStore::open() {
+    this->close();
+    this->errorStr.clear();
+
+    QDir dir(this->dirPath);
+    if (!dir.mkpath(".")) {
+        this->errorStr = QString("Could not create %1").arg(this->dirPath);
+        return false;
+    }
+
+    QStringList meterDirs = dir.entryList(QStringList() << "meter_*", QDir::Dirs | QDir::NoDotAndDotDot);
+    foreach (const QString& meterDir, meterDirs) {
+        bool isNumber = false;
+        int meterIdx = meterDir.mid(6).toInt(&isNumber);
+        if (!isNumber || meterIdx < 0) {
+            continue;
+        }
+
+        if (meterIdx >= this->meters.size()) {
+            this->meters.resize(meterIdx + 1);
+        }
+        for (int seriesIdx = 0; seriesIdx < NUM_SERIES; seriesIdx++) {
+            if (!this->loadSegments(meterIdx, seriesIdx)) {
+                this->close();
+                return false;
+            }
+        }
+    }
+
+    this->opened = true;
+    return true;
+}
+
+void HistoryStore::close() {
+    for (int i = 0; i < this->meters.size(); i++) {
+        for (int seriesIdx = 0; seriesIdx < NUM_SERIES; seriesIdx++) {
+            this->closeSegment(this->meters[i].series[seriesIdx]);
+        }
+    }
+    this->meters.clear();
+    this->opened = false;
+}
+
+bool HistoryStore::append(int meterIdx, const HistoryRecord& record) {
+    if (!this->prepareMeter(meterIdx)) {
+        return false;
+    }
+
+    // Keep the records in time order, even if the clock gets set back
+    HistoryRecord newRecord = record;
+    const QList<SegmentInfo>& segments = this->meters[meterIdx].series[RawTier].segments;
+    if (!segments.isEmpty() && newRecord.timeMs < segments.last().lastTimeMs) {
+        newRecord.timeMs = segments.last().lastTimeMs;
+    }
+
+    if (!this->appendRecord(meterIdx, RawTier, &newRecord, newRecord.timeMs)) {
+        return false;
+    }
+    return this->foldIntoRollups(meterIdx, newRecord);
+}
+
+bool HistoryStore::addToRollups(int meterIdx, const HistoryRecord& record) {
+    if (!this->prepareMeter(meterIdx)) {
+        return false;
+    }
+    return this->foldIntoRollups(meterIdx, record);
+}
+
+bool HistoryStore::appendPour(int meterIdx, const PourRecord& record) {
+    if (!this->prepareMeter(meterIdx)) {
+        return false;
+    }
+
+    PourRecord newRecord = record;
+    const QList<SegmentInfo>& segments = this->meters[meterIdx].series[POUR_SERIES].segments;
+    if (!segments.isEmpty() && newRecord.startMs < segments.last().lastTimeMs) {
+        newRecord.startMs = segments.last().lastTimeMs;
+    }
+    return this->appendRecord(meterIdx, POUR_SERIES, &newRecord, newRecord.startMs);
+}
+
+qint64 HistoryStore::getFirstTime(int meterIdx) const {
+    if (meterIdx < 0 || meterIdx >= this->meters.size()) {
+        return 0;
+    }
+    foreach (const SegmentInfo& segment, this->meters[meterIdx].series[RawTier].segments) {
+        if (segment.numRecords > 0) {
+            return segment.firstTimeMs;
+        }
+    }
+    return 0;
+}
+
+qint64 HistoryStore::getLastTime(int meterIdx) const {
+    if (meterIdx < 0 || meterIdx >= this->meters.size()) {
+        return 0;
+    }
+    const QList<SegmentInfo>& segments = this->meters[meterIdx].series[RawTier].segments;
+    for (int i = segments.size() - 1; i >= 0; i--) {
+        if (segments[i].numRecords > 0) {
+            return segments[i].lastTimeMs;
+        }
+    }
+    return 0;
+}
+
+quint64 HistoryStore::getNumRecords(int meterIdx, Tier tier) const {
+    if (meterIdx < 0 || meterIdx >= this->meters.size()) {
+        return 0;
+    }
+    quint64 numRecords = 0;
+    foreach (const SegmentInfo& segment, this->meters[meterIdx].series[tier].segments) {
+        numRecords += segment.numRecords;
+    }
+    return numRecords;
+}
+
+quint64 HistoryStore::getNumPours(int meterIdx) const {
+    if (meterIdx < 0 || meterIdx >= this->meters.size()) {
+        return 0;
+    }
+    quint64 numPours = 0;
+    foreach (const SegmentInfo& segment, this->meters[meterIdx].series[POUR_SERIES].segments) {
+        numPours += segment.numRecords;
+    }
+    return numPours;
+}
+
+bool HistoryStore::prepareMeter(int meterIdx) {
+    if (!this->opened || meterIdx < 0) {
+        return false;
+    }
+    if (meterIdx >= this->meters.size()) {
+        this->meters.resize(meterIdx + 1);
+    }
+    return true;
+}
+
+QString HistoryStore::seriesDirPath(int meterIdx, int seriesIdx) const {
+    QString path = this->dirPath + QString("/meter_%1").arg(meterIdx, 2, 10, QChar('0'));
+    if (seriesIdx != RawTier) {
+        path += QString("/") + SERIES_DIR_NAMES[seriesIdx];
+    }
+    return path;
+}
+
+bool HistoryStore::loadSegments(int meterIdx, int seriesIdx) {
+    Series& series = this->meters[meterIdx].series[seriesIdx];
+
+    // Segments are named after the time of their first record, so by name is in time order
+    QDir dir(this->seriesDirPath(meterIdx, seriesIdx));
+    QStringList segmentFiles = dir.entryList(QStringList() << "*.seg", QDir::Files, QDir::Name);
+    foreach (const QString& segmentFile, segmentFiles) {
+        QFile file(dir.filePath(segmentFile));
+        SegmentHeader header;
+        if (!file.open(QIODevice::ReadOnly) || !readHeader(file, header) ||
+            header.meterIdx != static_cast<quint32>(meterIdx) || header.series != static_cast<quint32>(seriesIdx) ||
+            header.recordSize != getRecordSize(seriesIdx) ||
+            file.size() < HEADER_SIZE + static_cast<qint64>(header.capacity) * header.recordSize) {
+            continue;
+        }
+
+        SegmentInfo segment;
+        segment.path = file.fileName();
+        segment.firstTimeMs = header.firstTimeMs;
+        segment.lastTimeMs = header.lastTimeMs;
+        segment.numRecords = header.numRecords;
+        series.segments.append(segment);
+    }
+
+    // Carry on where we left off, the rollups need the last record even if the segment is full
+    if (!series.segments.isEmpty()) {
+        series.activeFile = new QFile(series.segments.last().path);
+        if (!series.activeFile->open(QIODevice::ReadWrite) || !this->mapSegment(series)) {
+            this->errorStr = QString("Could not reopen %1: %2")
+                    .arg(series.activeFile->fileName()).arg(series.activeFile->errorString());
+            this->closeSegment(series);
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Add a record to the end of a series of the given meter. This never reads or moves existing
+ * records, it only starts (and preallocates) a new segment when the last one is full.
+ */
+bool HistoryStore::appendRecord(int meterIdx, int seriesIdx, const void* record, qint64 timeMs) {
+    Series& series = this->meters[meterIdx].series[seriesIdx];
+    if (series.activeMap == NULL ||
+        reinterpret_cast<SegmentHeader*>(series.activeMap)->numRecords >=
+        reinterpret_cast<SegmentHeader*>(series.activeMap)->capacity) {
+
+        if (!this->startSegment(meterIdx, seriesIdx, timeMs)) {
+            return false;
+        }
+    }
+
+    // The record goes in before the header counts it, so a torn append is simply not there
+    SegmentHeader* header = reinterpret_cast<SegmentHeader*>(series.activeMap);
+    std::memcpy(series.activeMap + HEADER_SIZE + static_cast<qint64>(header->numRecords) * header->recordSize,
+                record, header->recordSize);
+    if (header->numRecords == 0) {
+        header->firstTimeMs = timeMs;
+    }
+    header->lastTimeMs = timeMs;
+    header->numRecords++;
+
+    SegmentInfo& segment = series.segments.last();
+    segment.firstTimeMs = header->firstTimeMs;
+    segment.lastTimeMs = header->lastTimeMs;
+    segment.numRecords = header->numRecords;
+    return true;
+}
+
+uchar* HistoryStore::getLastRecord(Series& series) const {
+    if (series.activeMap == NULL) {
+        return NULL;
+    }
+    SegmentHeader* header = reinterpret_cast<SegmentHeader*>(series.activeMap);
+    if (header->numRecords == 0) {
+        return NULL;
+    }
+    return series.activeMap + HEADER_SIZE + static_cast<qint64>(header->numRecords - 1) * header->recordSize;
+}
+
+/**
+ * Fold a sample into the current bucket of every rollup tier. The current bucket is the last
+ * record of the tier, which is updated in place, a sample past its end starts the next bucket.
+ */
+bool HistoryStore::foldIntoRollups(int meterIdx, const HistoryRecord& record) {
+    for (int tier = MinuteTier; tier < NUM_TIERS; tier++) {
+        Series& series = this->meters[meterIdx].series[tier];
+        qint64 resolutionMs = TIER_RESOLUTIONS_MS[tier];
+        qint64 bucketTimeMs = record.timeMs - record.timeMs % resolutionMs;
+
+        uchar* lastRecord = this->getLastRecord(series);
+        RollupRecord rollup;
+        if (lastRecord != NULL) {
+            std::memcpy(&rollup, lastRecord, sizeof(rollup));
+        }
+
+        // Anything from before the current bucket (the clock was set back) goes in the current one
+        if (lastRecord != NULL && bucketTimeMs <= rollup.timeMs) {
+            rollup.count++;
+            rollup.minLoad = qMin(rollup.minLoad, record.load);
+            rollup.maxLoad = qMax(rollup.maxLoad, record.load);
+            rollup.meanLoad += (record.load - rollup.meanLoad) / rollup.count;
+            rollup.minPercent = qMin(rollup.minPercent, record.percent);
+            rollup.maxPercent = qMax(rollup.maxPercent, record.percent);
+            rollup.meanPercent += (record.percent - rollup.meanPercent) / rollup.count;
+            rollup.lastState = record.state;
+            std::memcpy(lastRecord, &rollup, sizeof(rollup));
+            continue;
+        }
+
+        rollup.timeMs = bucketTimeMs;
+        rollup.count = 1;
+        rollup.minLoad = rollup.maxLoad = rollup.meanLoad = record.load;
+        rollup.minPercent = rollup.maxPercent = rollup.meanPercent = record.percent;
+        rollup.lastState = record.state;
+        rollup.reserved[0] = rollup.reserved[1] = rollup.reserved[2] = 0;
+        if (!this->appendRecord(meterIdx, tier, &rollup, bucketTimeMs)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool HistoryStore::startSegment(int meterIdx, int seriesIdx, qint64 timeMs) {
+    Series& series = this->meters[meterIdx].series[seriesIdx];
+    this->closeSegment(series);
+
+    QDir dir(this->seriesDirPath(meterIdx, seriesIdx));
+    if (!dir.mkpath(".")) {
+        this->errorStr = QString("Could not create %1").arg(dir.path());
+        return false;
+    }
+
+    QString path = dir.filePath(QString("%1.seg").arg(timeMs, 16, 10, QChar('0')));
+    for (int i = 1; QFile::exists(path); i++) {
+        path = dir.filePath(QString("%1_%2.seg").arg(timeMs, 16, 10, QChar('0')).arg(i));
+    }
+
+    int recordSize = getRecordSize(seriesIdx);
+    int capacity = getSegmentCapacity(seriesIdx);
+    series.activeFile = new QFile(path);
+    if (!series.activeFile->open(QIODevice::ReadWrite) ||
+        !series.activeFile->resize(HEADER_SIZE + static_cast<qint64>(capacity) * recordSize) ||
+        !this->mapSegment(series)) {
+
+        this->errorStr = QString("Could not create %1: %2").arg(path).arg(series.activeFile->errorString());
+        this->closeSegment(series);
+        QFile::remove(path);
+        return false;
+    }
+
+    SegmentHeader* header = reinterpret_cast<SegmentHeader*>(series.activeMap);
+    std::memset(series.activeMap, 0, HEADER_SIZE);
+    header->magic = MAGIC;
+    header->version = FORMAT_VERSION;
+    header->recordSize = recordSize;
+    header->meterIdx = meterIdx;
+    header->capacity = capacity;
+    header->numRecords = 0;
+    header->series = seriesIdx;
+    header->firstTimeMs = timeMs;
+    header->lastTimeMs = timeMs;
+
+    SegmentInfo segment;
+    segment.path = path;
+    segment.firstTimeMs = timeMs;
+    segment.lastTimeMs = timeMs;
+    segment.numRecords = 0;
+    series.segments.append(segment);
+    return true;
+}
+
+bool HistoryStore::mapSegment(Series& series) {
+    series.activeMap = series.activeFile->map(0, series.activeFile->size());
+    return series.activeMap != NULL;
+}
+
+void HistoryStore::closeSegment(Series& series) {
+    if (series.activeFile == NULL) {
+        return;
+    }
+    if (series.activeMap != NULL) {
+        series.activeFile->unmap(series.activeMap);
+        series.activeMap = NULL;
+    }
+    delete series.activeFile;
+    series.activeFile = NULL;
+}
+
+bool HistoryStore::readHeader(QFile& file, SegmentHeader& header) {
+    if (file.read(reinterpret_cast<char*>(&header), sizeof(header)) != sizeof(header)) {
+        return false;
+    }
+    return header.magic == MAGIC && header.version == FORMAT_VERSION && header.series < NUM_SERIES &&
+           header.numRecords <= header.capacity;
+}
+
+HistoryStore::Cursor::Cursor(const HistoryStore& store, int meterIdx, qint64 fromMs, qint64 toMs, qint64 resolutionMs) :
+    tier(tierForResolution(resolutionMs)),
+    reader(NULL) {
+
+    // A bucket that starts before the range may still reach into it
+    if (this->tier != RawTier) {
+        fromMs -= TIER_RESOLUTIONS_MS[this->tier] - 1;
+    }
+    this->reader = new SeriesReader(store, meterIdx, this->tier, fromMs, toMs);
+}
+
+HistoryStore::Cursor::~Cursor() {
+    delete this->reader;
+    this->reader = NULL;
+}
+
+bool HistoryStore::Cursor::next(HistoryRecord& record) {
+    if (this->tier != RawTier) {
+        return false;
+    }
+    const uchar* data = this->reader->next();
+    if (data == NULL) {
+        return false;
+    }
+    std::memcpy(&record, data, sizeof(record));
+    return true;
+}
+
+bool HistoryStore::Cursor::next(RollupRecord& record) {
+    const uchar* data = this->reader->next();
+    if (data == NULL) {
+        return false;
+    }
+    if (this->tier != RawTier) {
+        std::memcpy(&record, data, sizeof(record));
+        return true;
+    }
+
+    HistoryRecord sample;
+    std::memcpy(&sample, data, sizeof(sample));
+    record.timeMs = sample.timeMs;
+    record.count = 1;
+    record.minLoad = record.maxLoad = record.meanLoad = sample.load;
+    record.minPercent = record.maxPercent = record.meanPercent = sample.percent;
+    record.lastState = sample.state;
+    record.reserved[0] = record.reserved[1] = record.reserved[2] = 0;
+    return true;
+}
+
+HistoryStore::PourCursor::PourCursor(const HistoryStore& store, int meterIdx, qint64 fromMs, qint64 toMs) :
+    reader(new SeriesReader(store, meterIdx, POUR_SERIES, fromMs, toMs)) {
+}
+
+HistoryStore::PourCursor::~PourCursor() {
+    delete this->reader;
+    this->reader = NULL;
+}
+
+bool HistoryStore::PourCursor::next(PourRecord& record) {
+    const uchar* data = this->reader->next();
+    if (data == NULL) {
+        return false;
+    }
+    std::memcpy(&record, data, sizeof(record));
+    return true;
+}
+
+HistoryStore::SeriesReader::SeriesReader(const HistoryStore& store, int meterIdx, int seriesIdx, qint64 fromMs, qint64 toMs) :
+    recordSize(getRecordSize(seriesIdx)),
+    segmentIdx(0),
+    fromMs(fromMs),
+    toMs(toMs),
+    records(NULL),
+    numRecords(0),
+    recordIdx(0) {
+
+    // Only the segments that overlap the range are ever opened
+    if (meterIdx >= 0 && meterIdx < store.meters.size()) {
+        foreach (const SegmentInfo& segment, store.meters[meterIdx].series[seriesIdx].segments) {
+            if (segment.numRecords > 0 && segment.lastTimeMs >= fromMs && segment.firstTimeMs <= toMs) {
+                this->segmentPaths.append(segment.path);
+            }
+        }
+    }
+}
+
+const uchar* HistoryStore::SeriesReader::next() {
+    while (this->recordIdx >= this->numRecords) {
+        if (!this->openNextSegment()) {
+            return NULL;
+        }
+    }
+
+    const uchar* data = this->records + static_cast<qint64>(this->recordIdx) * this->recordSize;
+    qint64 timeMs = 0;
+    std::memcpy(&timeMs, data, sizeof(timeMs));
+    if (timeMs > this->toMs) {
+        // Everything after this is out of range too
+        this->closeSegment();
+        this->segmentIdx = this->segmentPaths.size();
+        return NULL;
+    }
+    this->recordIdx++;
+    return data;
+}
+
+bool HistoryStore::SeriesReader::openNextSegment() {
+    this->closeSegment();
+    if (this->segmentIdx >= this->segmentPaths.size()) {
+        return false;
+    }
+
+    this->file.setFileName(this->segmentPaths[this->segmentIdx++]);
+    if (!this->file.open(QIODevice::ReadOnly) || this->file.size() < HEADER_SIZE) {
+        // A segment that went away (or never made it) just has nothing for us
+        this->closeSegment();
+        return true;
+    }
+    const uchar* map = this->file.map(0, this->file.size());
+    if (map == NULL) {
+        this->closeSegment();
+        return true;
+    }
+
+    SegmentHeader header;
+    std::memcpy(&header, map, sizeof(header));
+    this->records = map + HEADER_SIZE;
+    this->numRecords = static_cast<int>(qMin<qint64>(header.numRecords, (this->file.size() - HEADER_SIZE) / this->recordSize));
+
+    // Binary search for the first record in range, the records of a segment are in time order
+    int lo = 0;
+    int hi = this->numRecords;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        qint64 timeMs = 0;
+        std::memcpy(&timeMs, this->records + static_cast<qint64>(mid) * this->recordSize, sizeof(timeMs));
+        if (timeMs < this->fromMs) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    this->recordIdx = lo;
+    return true;
+}
+
+void HistoryStore::SeriesReader::closeSegment() {
+    if (this->file.isOpen()) {
+        this->file.close(); // Also unmaps
+    }
+    this->records = NULL;
+    this->numRecords = 0;
+    this->recordIdx = 0;
+}
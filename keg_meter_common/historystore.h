@@ -0,0 +1,219 @@
+#ifndef KEGMETERCOMMON_HISTORYSTORE_H
+#define KEGMETERCOMMON_HISTORYSTORE_H
+
+#include <QFile>
+#include <QList>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+/**
+ * A single sample in the history of a keg meter. Records are stored as-is (in native byte order),
+ * so this has a fixed size and layout and must never change without bumping FORMAT_VERSION.
+ */
+struct HistoryRecord {
+    qint64 timeMs;    // Milliseconds since the epoch
+    float load;
+    float variance;
+    float percent;
+    quint8 state;
+    quint8 reserved[3];
+};
+
+/**
+ * Summary of all of the samples of a keg meter in one bucket of a rollup tier. Stored as-is, just
+ * like HistoryRecord.
+ */
+struct RollupRecord {
+    qint64 timeMs;    // Start of the bucket, in milliseconds since the epoch (UTC)
+    quint32 count;
+    float minLoad;
+    float maxLoad;
+    float meanLoad;
+    float minPercent;
+    float maxPercent;
+    float meanPercent;
+    quint8 lastState;
+    quint8 reserved[3];
+};
+
+/**
+ * A pour detected on a keg meter (see PourDetector). Stored as-is, just like HistoryRecord.
+ */
+struct PourRecord {
+    qint64 startMs;   // Milliseconds since the epoch
+    qint64 endMs;
+    float startLoad;
+    float endLoad;
+    float litres;
+    quint32 reserved;
+};
+
+/**
+ * Append-only time-series history of every keg meter, kept in memory-mapped segment files.
+ *
+ * Every meter gets its own directory of segments, each segment is a file with a fixed-size header
+ * followed by room for a fixed number of records. Segment files are preallocated and mapped for as
+ * long as they're being appended to, so an append is a copy into the mapping and an update of the
+ * segment header, no matter how much history there already is. The OS writes the pages back in
+ * its own time, a crash loses at most the records it hadn't written back yet.
+ *
+ * Records of a meter are kept in time order (a sample from before the last one is stored with the
+ * time of the last one), and every segment header has the time of its first and last record. Only
+ * the headers are read when opening the store, a scan (see Cursor) uses them to find the segments
+ * in its time range and then maps one segment at a time, binary searching for the first record.
+ * That way scanning months of history never needs more than a segment's worth of address space and
+ * only touches the pages it actually reads.
+ *
+ * Next to the raw samples every meter has rollup tiers with the min/max/mean of its samples per
+ * minute, hour and day. Every sample is folded into the current bucket of each tier as it comes
+ * in: the last record of a tier is updated in place until a sample falls in the next bucket, which
+ * then gets a record of its own. So the rollups are always up to date (including the current,
+ * partial buckets), survive restarts and never need to be recomputed.
+ *
+ * The pours detected on every meter are kept in a series of their own, ordered by their start.
+ */
+class HistoryStore {
+public:
+    enum Tier {
+        RawTier,
+        MinuteTier,
+        HourTier,
+        DayTier,
+        NUM_TIERS
+    };
+
+    static const int HEADER_SIZE = 64;
+
+    explicit HistoryStore(const QString& dirPath);
+    ~HistoryStore();
+
+    static QString defaultDirPath();
+
+    // Width of the buckets of a tier, 0 for the raw samples
+    static qint64 getTierResolution(Tier tier);
+    // The coarsest tier with buckets no wider than the given resolution
+    static Tier tierForResolution(qint64 resolutionMs);
+
+    bool open();
+    void close();
+    bool isOpen() const { return this->opened; }
+
+    // Store a sample and fold it into the rollups
+    bool append(int meterIdx, const HistoryRecord& record);
+    // Only fold a sample into the rollups, for samples that aren't worth storing by themselves
+    bool addToRollups(int meterIdx, const HistoryRecord& record);
+    bool appendPour(int meterIdx, const PourRecord& record);
+
+    // Time range of all of the raw history of a meter, both are 0 if there is none
+    qint64 getFirstTime(int meterIdx) const;
+    qint64 getLastTime(int meterIdx) const;
+    quint64 getNumRecords(int meterIdx, Tier tier = RawTier) const;
+    quint64 getNumPours(int meterIdx) const;
+
+    QString errorString() const { return this->errorStr; }
+
+    // Does the actual reading for the cursors, only defined in the .cpp
+    class SeriesReader;
+
+    /**
+     * Forward iteration over the records of a meter in [fromMs, toMs], at the coarsest tier that
+     * still has the given resolution (raw samples by default). Rollup buckets are included if any
+     * part of them is in range. Records appended after the cursor got to their segment aren't seen.
+     * The store must outlive its cursors.
+     */
+    class Cursor {
+    public:
+        Cursor(const HistoryStore& store, int meterIdx, qint64 fromMs, qint64 toMs, qint64 resolutionMs = 0);
+        ~Cursor();
+
+        Tier getTier() const { return this->tier; }
+
+        // Raw samples only, for any other tier this returns false
+        bool next(HistoryRecord& record);
+        // Any tier, raw samples come back as buckets of a single sample
+        bool next(RollupRecord& record);
+
+    private:
+        Q_DISABLE_COPY(Cursor)
+
+        Tier tier;
+        SeriesReader* reader;
+    };
+
+    // Forward iteration over the pours of a meter that started in [fromMs, toMs], see Cursor
+    class PourCursor {
+    public:
+        PourCursor(const HistoryStore& store, int meterIdx, qint64 fromMs, qint64 toMs);
+        ~PourCursor();
+
+        bool next(PourRecord& record);
+
+    private:
+        Q_DISABLE_COPY(PourCursor)
+
+        SeriesReader* reader;
+    };
+
+private:
+    static const quint32 MAGIC = 0x4B4D4853; // "KMHS"
+    static const quint16 FORMAT_VERSION = 1;
+
+    // Every meter has a series of records for each tier, and one for its pours
+    static const int POUR_SERIES = NUM_TIERS;
+    static const int NUM_SERIES = NUM_TIERS + 1;
+
+    struct SegmentHeader {
+        quint32 magic;
+        quint16 version;
+        quint16 recordSize;
+        quint32 meterIdx;
+        quint32 capacity;
+        quint32 numRecords;
+        quint32 series;
+        qint64 firstTimeMs;
+        qint64 lastTimeMs;
+    };
+
+    struct SegmentInfo {
+        QString path;
+        qint64 firstTimeMs;
+        qint64 lastTimeMs;
+        quint32 numRecords;
+    };
+
+    // The last segment of a series stays open and mapped, until the next one is started
+    struct Series {
+        QList<SegmentInfo> segments;
+        QFile* activeFile;
+        uchar* activeMap;
+
+        Series() : activeFile(NULL), activeMap(NULL) {}
+    };
+
+    struct MeterHistory {
+        Series series[NUM_SERIES];
+    };
+
+    QString dirPath;
+    bool opened;
+    QString errorStr;
+    QVector<MeterHistory> meters;
+
+    static int getRecordSize(int seriesIdx);
+    static int getSegmentCapacity(int seriesIdx);
+
+    bool prepareMeter(int meterIdx);
+    QString seriesDirPath(int meterIdx, int seriesIdx) const;
+    bool loadSegments(int meterIdx, int seriesIdx);
+    bool appendRecord(int meterIdx, int seriesIdx, const void* record, qint64 timeMs);
+    uchar* getLastRecord(Series& series) const;
+    bool foldIntoRollups(int meterIdx, const HistoryRecord& record);
+    bool startSegment(int meterIdx, int seriesIdx, qint64 timeMs);
+    bool mapSegment(Series& series);
+    void closeSegment(Series& series);
+
+    static bool readHeader(QFile& file, SegmentHeader& header);
+};
+
+#endif // KEGMETERCOMMON_HISTORYSTORE_H
@@ -0,0 +1,35 @@
+# Sources shared between the keg meter server and controller applications
+
+INCLUDEPATH += $$PWD
+DEPENDPATH  += $$PWD
+
+SOURCES += \
+    $$PWD/binaryframereader.cpp \
+    $$PWD/historystore.cpp \
+    $$PWD/logmodel.cpp \
+    $$PWD/logview.cpp \
+    $$PWD/meterconfig.cpp \
+    $$PWD/meterstatestore.cpp \
+    $$PWD/packetframer.cpp \
+    $$PWD/packetparser.cpp \
+    $$PWD/pourdetector.cpp \
+    $$PWD/serialcapture.cpp \
+    $$PWD/serialnegotiator.cpp \
+    $$PWD/telemetryprotocol.cpp
+
+HEADERS += \
+    $$PWD/binaryframe.h \
+    $$PWD/binaryframereader.h \
+    $$PWD/historystore.h \
+    $$PWD/latencyhistogram.h \
+    $$PWD/logmodel.h \
+    $$PWD/logview.h \
+    $$PWD/meterconfig.h \
+    $$PWD/meterstatestore.h \
+    $$PWD/packetframer.h \
+    $$PWD/packetparser.h \
+    $$PWD/pourdetector.h \
+    $$PWD/serialcapture.h \
+    $$PWD/serialnegotiator.h \
+    $$PWD/spscqueue.h \
+    $$PWD/telemetryprotocol.h
@@ -0,0 +1,129 @@
+#ifndef KEGMETERCOMMON_LATENCYHISTOGRAM_H
+#define KEGMETERCOMMON_LATENCYHISTOGRAM_H
+
+#include <stdint.h>
+
+/**
+ * HDR-style histogram of latencies (or any other non-negative integer values, e.g. microseconds).
+ *
+ * Values below SUB_BUCKET_COUNT are counted exactly, above that every power of two is split into
+ * SUB_BUCKET_COUNT/2 linear sub-buckets, so every value is kept with a relative error of at most
+ * 2/SUB_BUCKET_COUNT (about 3%) in constant memory. Recording a value and merging histograms are
+ * O(1) and O(NUM_BUCKETS), percentiles are O(NUM_BUCKETS). Values above MAX_VALUE are clamped.
+ */
+class LatencyHistogram {
+public:
+    static const int SUB_BUCKET_BITS = 6;
+    static const int SUB_BUCKET_COUNT = 1 << SUB_BUCKET_BITS;
+    static const int SUB_BUCKET_HALF_COUNT = SUB_BUCKET_COUNT / 2;
+    static const int MAX_VALUE_BITS = 36; // About 19 hours in microseconds
+    static const int NUM_BUCKETS = SUB_BUCKET_COUNT + (MAX_VALUE_BITS - SUB_BUCKET_BITS) * SUB_BUCKET_HALF_COUNT;
+    static const uint64_t MAX_VALUE = (static_cast<uint64_t>(1) << MAX_VALUE_BITS) - 1;
+
+    LatencyHistogram() { this->clear(); }
+
+    void clear() {
+        for (int i = 0; i < NUM_BUCKETS; i++) {
+            this->counts[i] = 0;
+        }
+        this->totalCount = 0;
+        this->minValue = 0;
+        this->maxValue = 0;
+        this->sum = 0;
+    }
+
+    void record(uint64_t value) {
+        if (value > MAX_VALUE) {
+            value = MAX_VALUE;
+        }
+
+        this->counts[bucketIndex(value)]++;
+        if (this->totalCount == 0 || value < this->minValue) {
+            this->minValue = value;
+        }
+        if (value > this->maxValue) {
+            this->maxValue = value;
+        }
+        this->totalCount++;
+        this->sum += value;
+    }
+
+    void add(const LatencyHistogram& other) {
+        if (other.totalCount == 0) {
+            return;
+        }
+        for (int i = 0; i < NUM_BUCKETS; i++) {
+            this->counts[i] += other.counts[i];
+        }
+        if (this->totalCount == 0 || other.minValue < this->minValue) {
+            this->minValue = other.minValue;
+        }
+        if (other.maxValue > this->maxValue) {
+            this->maxValue = other.maxValue;
+        }
+        this->totalCount += other.totalCount;
+        this->sum += other.sum;
+    }
+
+    uint64_t getCount() const { return this->totalCount; }
+    uint64_t getMin() const { return this->minValue; }
+    uint64_t getMax() const { return this->maxValue; }
+    double getMean() const { return this->totalCount > 0 ? static_cast<double>(this->sum) / this->totalCount : 0.0; }
+
+    // The (highest equivalent) value at or below which the given percentage [0, 100] of the
+    // recorded values fall
+    uint64_t getValueAtPercentile(double percentile) const {
+        if (this->totalCount == 0) {
+            return 0;
+        }
+
+        uint64_t countAtPercentile = static_cast<uint64_t>(percentile / 100.0 * this->totalCount + 0.5);
+        if (countAtPercentile < 1) {
+            countAtPercentile = 1;
+        }
+
+        uint64_t runningCount = 0;
+        for (int i = 0; i < NUM_BUCKETS; i++) {
+            runningCount += this->counts[i];
+            if (runningCount >= countAtPercentile) {
+                uint64_t value = highestEquivalentValue(i);
+                return value < this->maxValue ? value : this->maxValue;
+            }
+        }
+        return this->maxValue;
+    }
+
+private:
+    uint64_t counts[NUM_BUCKETS];
+    uint64_t totalCount;
+    uint64_t minValue;
+    uint64_t maxValue;
+    uint64_t sum;
+
+    static int bucketIndex(uint64_t value) {
+        if (value < static_cast<uint64_t>(SUB_BUCKET_COUNT)) {
+            return static_cast<int>(value);
+        }
+
+        // Keep the SUB_BUCKET_BITS most significant bits of the value
+        int msb = 0;
+        for (uint64_t v = value; v > 1; v >>= 1) {
+            msb++;
+        }
+        int shift = msb - (SUB_BUCKET_BITS - 1);
+        int subBucketIdx = static_cast<int>(value >> shift) - SUB_BUCKET_HALF_COUNT;
+        return SUB_BUCKET_COUNT + (shift - 1) * SUB_BUCKET_HALF_COUNT + subBucketIdx;
+    }
+
+    static uint64_t highestEquivalentValue(int bucketIdx) {
+        if (bucketIdx < SUB_BUCKET_COUNT) {
+            return static_cast<uint64_t>(bucketIdx);
+        }
+
+        int shift = (bucketIdx - SUB_BUCKET_COUNT) / SUB_BUCKET_HALF_COUNT + 1;
+        uint64_t subBucket = (bucketIdx - SUB_BUCKET_COUNT) % SUB_BUCKET_HALF_COUNT + SUB_BUCKET_HALF_COUNT;
+        return (subBucket << shift) + ((static_cast<uint64_t>(1) << shift) - 1);
+    }
+};
+
+#endif // KEGMETERCOMMON_LATENCYHISTOGRAM_H
@@ -0,0 +1,111 @@
+#ifndef KEGMETERCOMMON_LOADWINDOW_H
+#define KEGMETERCOMMON_LOADWINDOW_H
+
+// NOTE: This header is shared with the Arduino sketches (copied as load_window.h into each sketch
+// that uses it), so it must stay dependency-free plain C++ -- no STL, no Qt, no Arduino headers.
+
+/**
+ * Fixed-size circular window of load samples with O(1) mean and (population) variance.
+ *
+ * The mean and the sum of squared differences from the mean are updated Welford-style as each
+ * sample is added and the oldest one falls out. Since floating point error accumulates with every
+ * add-and-remove update, both are periodically recomputed from scratch ("re-centred") using the
+ * exact two-pass formula. That costs O(SIZE) once every RECENTRE_INTERVAL samples, i.e. O(1)
+ * amortized per sample.
+ *
+ * The server filters with MeterFilterBank, which does the same for all its meters at once and is
+ * checked against this by meter_filter_bench (along with this against the exact result).
+ */
+template <int SIZE>
+class LoadWindow {
+public:
+    static const int RECENTRE_INTERVAL = 8 * SIZE;
+
+    LoadWindow() : count(0), nextIdx(0), mean(0), sumSqDiffs(0), numUpdatesSinceRecentre(0) {}
+
+    int getSize() const { return this->count; }
+    bool isEmpty() const { return this->count == 0; }
+    bool isFull() const { return this->count == SIZE; }
+
+    float getMean() const { return this->mean; }
+    float getVariance() const { return this->count > 0 ? this->sumSqDiffs / ((float)this->count) : 0.0f; }
+
+    void clear() {
+        this->count = 0;
+        this->nextIdx = 0;
+        this->mean = 0;
+        this->sumSqDiffs = 0;
+        this->numUpdatesSinceRecentre = 0;
+    }
+
+    // Replace every sample in the window with the given value
+    void fill(float value) {
+        for (int i = 0; i < SIZE; i++) {
+            this->values[i] = value;
+        }
+        this->count = SIZE;
+        this->nextIdx = 0;
+        this->mean = value;
+        this->sumSqDiffs = 0;
+        this->numUpdatesSinceRecentre = 0;
+    }
+
+    // Add a sample, once the window is full this replaces the oldest sample
+    void push(float value) {
+        if (this->count < SIZE) {
+            this->count++;
+            float delta = value - this->mean;
+            this->mean += delta / ((float)this->count);
+            this->sumSqDiffs += delta * (value - this->mean);
+        }
+        else {
+            float oldValue = this->values[this->nextIdx];
+            float oldMean = this->mean;
+            this->mean += (value - oldValue) / ((float)SIZE);
+            this->sumSqDiffs += (value - oldValue) * (value - this->mean + oldValue - oldMean);
+        }
+
+        this->values[this->nextIdx] = value;
+        this->nextIdx = (this->nextIdx + 1) % SIZE;
+
+        if (this->sumSqDiffs < 0) {
+            this->sumSqDiffs = 0;
+        }
+        if (++this->numUpdatesSinceRecentre >= RECENTRE_INTERVAL) {
+            this->recentre();
+        }
+    }
+
+    // Recompute the mean and variance exactly (two-pass) to get rid of any accumulated drift
+    void recentre() {
+        this->numUpdatesSinceRecentre = 0;
+        if (this->count == 0) {
+            return;
+        }
+
+        int startIdx = (this->count < SIZE) ? 0 : this->nextIdx;
+        float sum = 0;
+        for (int i = 0; i < this->count; i++) {
+            sum += this->values[(startIdx + i) % SIZE];
+        }
+        this->mean = sum / ((float)this->count);
+
+        float sqDiffs = 0;
+        for (int i = 0; i < this->count; i++) {
+            float diff = this->values[(startIdx + i) % SIZE] - this->mean;
+            sqDiffs += diff * diff;
+        }
+        this->sumSqDiffs = sqDiffs;
+    }
+
+private:
+    float values[SIZE];
+    int count;
+    int nextIdx;
+
+    float mean;
+    float sumSqDiffs;
+    int numUpdatesSinceRecentre;
+};
+
+#endif // KEGMETERCOMMON_LOADWINDOW_H
@@ -0,0 +1,160 @@
+#include "logmodel.h"
+
+#include <QDir>
+#include <QFileInfo>
+#include <QStringList>
+
+LogModel::LogModel(int maxNumLines, QObject* parent) :
+    QAbstractListModel(parent),
+    lines(qMax(1, maxNumLines)),
+    firstLineIdx(0),
+    numLines(0),
+    lastLineOpen(false),
+    numDroppedLines(0),
+    maxSpillFileSize(0),
+    maxNumSpillBackupFiles(0) {
+
+    this->flushTimer.setSingleShot(true);
+    this->flushTimer.setInterval(FLUSH_INTERVAL_MS);
+    QObject::connect(&this->flushTimer, SIGNAL(timeout()), this, SLOT(onFlushTimer()));
+}
+
+LogModel::~LogModel() {
+    // Make sure nothing is lost from the file, there's no point in updating the views anymore
+    this->pendingText.remove(QChar('\r'));
+    this->spill(this->pendingText);
+    this->spillFile.close();
+}
+
+/**
+ * Start writing everything that gets logged (from here on) to the given file as well. Once the
+ * file reaches maxFileSize bytes it's moved to <filePath>.1 (<filePath>.1 to <filePath>.2 and so
+ * on, keeping at most maxNumBackupFiles of them) and a new file is started.
+ */
+bool LogModel::setSpillFile(const QString& filePath, qint64 maxFileSize, int maxNumBackupFiles) {
+    this->spillFile.close();
+    this->maxSpillFileSize = maxFileSize;
+    this->maxNumSpillBackupFiles = qMax(0, maxNumBackupFiles);
+
+    QDir().mkpath(QFileInfo(filePath).absolutePath());
+    this->spillFile.setFileName(filePath);
+    return this->spillFile.open(QIODevice::WriteOnly | QIODevice::Append);
+}
+
+void LogModel::append(const QString& text) {
+    this->pendingText += text;
+    if (!this->flushTimer.isActive()) {
+        this->flushTimer.start();
+    }
+}
+
+/**
+ * Hand everything appended since the last flush to the views in a single batch. This is called
+ * once per frame while there's something to show, there's normally no need to call it directly.
+ */
+void LogModel::flush() {
+    this->flushTimer.stop();
+
+    QString text = this->pendingText;
+    this->pendingText.clear();
+    text.remove(QChar('\r'));
+    if (text.isEmpty()) {
+        return;
+    }
+
+    this->spill(text);
+
+    // The first piece continues the open line (if there is one), every other piece is a new line
+    QStringList pieces = text.split(QChar('\n'));
+    QStringList newLines;
+    bool openLineChanged = false;
+    for (int i = 0; i < pieces.size(); i++) {
+        const QString& piece = pieces[i];
+        if (i == 0 && this->lastLineOpen && this->numLines > 0) {
+            QString& openLine = this->lineAt(this->numLines-1);
+            openLine += piece.left(MAX_LINE_LENGTH - openLine.size());
+            openLineChanged = true;
+        }
+        else if (i < pieces.size()-1 || !piece.isEmpty()) {
+            newLines.append(piece.left(MAX_LINE_LENGTH));
+        }
+    }
+
+    if (openLineChanged) {
+        QModelIndex openLineIndex = this->index(this->numLines-1);
+        emit dataChanged(openLineIndex, openLineIndex);
+    }
+
+    int capacity = this->lines.size();
+    if (newLines.size() > capacity) {
+        this->numDroppedLines += newLines.size() - capacity;
+        newLines = newLines.mid(newLines.size() - capacity);
+    }
+
+    // Make room by dropping the oldest lines first...
+    int numToRemove = this->numLines + newLines.size() - capacity;
+    if (numToRemove > 0) {
+        this->beginRemoveRows(QModelIndex(), 0, numToRemove-1);
+        this->firstLineIdx = (this->firstLineIdx + numToRemove) % capacity;
+        this->numLines -= numToRemove;
+        this->numDroppedLines += numToRemove;
+        this->endRemoveRows();
+    }
+
+    // ... then insert all of the new lines in one go
+    if (!newLines.isEmpty()) {
+        this->beginInsertRows(QModelIndex(), this->numLines, this->numLines + newLines.size() - 1);
+        foreach (const QString& line, newLines) {
+            this->lineAt(this->numLines++) = line;
+        }
+        this->endInsertRows();
+    }
+
+    // Don't let a stream without any newlines grow a single line forever
+    this->lastLineOpen = !text.endsWith(QChar('\n')) && this->numLines > 0 &&
+                         this->lineAt(this->numLines-1).size() < MAX_LINE_LENGTH;
+}
+
+int LogModel::rowCount(const QModelIndex& parent) const {
+    return parent.isValid() ? 0 : this->numLines;
+}
+
+QVariant LogModel::data(const QModelIndex& index, int role) const {
+    if (role != Qt::DisplayRole || !index.isValid() || index.row() >= this->numLines) {
+        return QVariant();
+    }
+    return this->lines[(this->firstLineIdx + index.row()) % this->lines.size()];
+}
+
+void LogModel::onFlushTimer() {
+    this->flush();
+}
+
+void LogModel::spill(const QString& text) {
+    if (!this->spillFile.isOpen() || text.isEmpty()) {
+        return;
+    }
+
+    this->spillFile.write(text.toUtf8());
+    if (this->maxSpillFileSize > 0 && this->spillFile.size() >= this->maxSpillFileSize) {
+        this->rotateSpillFile();
+    }
+}
+
+void LogModel::rotateSpillFile() {
+    QString filePath = this->spillFile.fileName();
+    this->spillFile.close();
+
+    if (this->maxNumSpillBackupFiles > 0) {
+        QFile::remove(filePath + QString(".%1").arg(this->maxNumSpillBackupFiles));
+        for (int i = this->maxNumSpillBackupFiles-1; i >= 1; i--) {
+            QFile::rename(filePath + QString(".%1").arg(i), filePath + QString(".%1").arg(i+1));
+        }
+        QFile::rename(filePath, filePath + QString(".1"));
+    }
+    else {
+        QFile::remove(filePath);
+    }
+
+    this->spillFile.open(QIODevice::WriteOnly | QIODevice::Append);
+}
@@ -0,0 +1,61 @@
+#ifndef KEGMETERCOMMON_LOGMODEL_H
+#define KEGMETERCOMMON_LOGMODEL_H
+
+#include <QAbstractListModel>
+#include <QVector>
+#include <QString>
+#include <QFile>
+#include <QTimer>
+
+/**
+ * Bounded log sink, meant to be shown in a (virtualized) list view, see LogView.
+ *
+ * Text appended to the log is only buffered, once per frame the buffered text is split into lines
+ * and handed to the view in a single batch. The model keeps at most the given number of lines in a
+ * ring, the oldest lines are dropped as new ones come in, so memory use and the cost of an update
+ * stay constant no matter how long the log runs. Optionally everything is also written to a file
+ * on disk, which is rotated once it reaches a given size.
+ */
+class LogModel : public QAbstractListModel {
+    Q_OBJECT
+public:
+    LogModel(int maxNumLines, QObject* parent = NULL);
+    ~LogModel();
+
+    bool setSpillFile(const QString& filePath, qint64 maxFileSize, int maxNumBackupFiles);
+
+    void append(const QString& text);
+    void flush();
+
+    int rowCount(const QModelIndex& parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex& index, int role = Qt::DisplayRole) const override;
+
+    quint64 getNumDroppedLines() const { return this->numDroppedLines; }
+
+private slots:
+    void onFlushTimer();
+
+private:
+    static const int FLUSH_INTERVAL_MS = 33;
+    static const int MAX_LINE_LENGTH = 1024;
+
+    // Ring of lines, the last line stays open (i.e., gets appended to) until a newline comes in
+    QVector<QString> lines;
+    int firstLineIdx;
+    int numLines;
+    bool lastLineOpen;
+    quint64 numDroppedLines;
+
+    QString pendingText;
+    QTimer flushTimer;
+
+    QFile spillFile;
+    qint64 maxSpillFileSize;
+    int maxNumSpillBackupFiles;
+
+    QString& lineAt(int row) { return this->lines[(this->firstLineIdx + row) % this->lines.size()]; }
+    void spill(const QString& text);
+    void rotateSpillFile();
+};
+
+#endif // KEGMETERCOMMON_LOGMODEL_H
@@ -0,0 +1,28 @@
+#include "logview.h"
+
+#include <QScrollBar>
+#include <QTimer>
+
+LogView::LogView(QWidget* parent) : QListView(parent), scrollToBottomPending(false) {
+    this->setUniformItemSizes(true);
+    this->setEditTriggers(QAbstractItemView::NoEditTriggers);
+    this->setSelectionMode(QAbstractItemView::ExtendedSelection);
+    this->setWordWrap(false);
+}
+
+void LogView::rowsInserted(const QModelIndex& parent, int start, int end) {
+    // Only stick to the bottom if the user hasn't scrolled up to read something
+    bool atBottom = this->verticalScrollBar()->value() == this->verticalScrollBar()->maximum();
+    QListView::rowsInserted(parent, start, end);
+
+    // The scroll range is only updated once the view has laid out the new rows
+    if (atBottom && !this->scrollToBottomPending) {
+        this->scrollToBottomPending = true;
+        QTimer::singleShot(0, this, SLOT(onScrollToBottom()));
+    }
+}
+
+void LogView::onScrollToBottom() {
+    this->scrollToBottomPending = false;
+    this->scrollToBottom();
+}
@@ -0,0 +1,27 @@
+#ifndef KEGMETERCOMMON_LOGVIEW_H
+#define KEGMETERCOMMON_LOGVIEW_H
+
+#include <QListView>
+
+/**
+ * Read-only list view for a LogModel. Every row is assumed to have the same height so only the
+ * visible lines are ever laid out, and the view follows the end of the log as long as it's
+ * scrolled all the way down.
+ */
+class LogView : public QListView {
+    Q_OBJECT
+public:
+    explicit LogView(QWidget* parent = NULL);
+    ~LogView() {}
+
+protected:
+    void rowsInserted(const QModelIndex& parent, int start, int end) override;
+
+private:
+    bool scrollToBottomPending;
+
+private slots:
+    void onScrollToBottom();
+};
+
+#endif // KEGMETERCOMMON_LOGVIEW_H
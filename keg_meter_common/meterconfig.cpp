@@ -0,0 +1,58 @@
+#include "meterconfig.h"
+#include "logmodel.h"
+#include "meterstatestore.h"
+
+#include <QSettings>
+#include <QStringList>
+#include <QStandardPaths>
+
+const char* MeterConfig::NUM_KEG_METERS = "num_keg_meters";
+const char* MeterConfig::KEG_METER_IDS  = "keg_meter_ids";
+const char* MeterConfig::LOG_TO_FILE    = "log_to_file";
+
+QVector<int> MeterConfig::readMeterIds() {
+    QSettings settings;
+    QVector<int> meterIds;
+
+    QStringList idStrs = settings.value(KEG_METER_IDS).toStringList();
+    if (!idStrs.isEmpty()) {
+        int numMeters = qMin(idStrs.size(), static_cast<int>(MAX_NUM_KEG_METERS));
+        for (int i = 0; i < numMeters; i++) {
+            bool ok = false;
+            int id = idStrs[i].trimmed().toInt(&ok);
+            meterIds.push_back(ok ? id : i+1);
+        }
+        return meterIds;
+    }
+
+    int numMeters = qBound(1, settings.value(NUM_KEG_METERS, static_cast<int>(DEFAULT_NUM_KEG_METERS)).toInt(),
+                           static_cast<int>(MAX_NUM_KEG_METERS));
+    for (int i = 0; i < numMeters; i++) {
+        meterIds.push_back(i+1);
+    }
+    return meterIds;
+}
+
+bool MeterConfig::setupLogFiles(LogModel* appLogModel, LogModel* serialLogModel, QString& logDirPath) {
+    QSettings settings;
+    if (!settings.value(LOG_TO_FILE, false).toBool()) {
+        return true;
+    }
+
+    logDirPath = QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) + QString("/logs");
+    return appLogModel->setSpillFile(logDirPath + QString("/app.log"), MAX_LOG_FILE_SIZE, NUM_LOG_BACKUP_FILES) &&
+           serialLogModel->setSpillFile(logDirPath + QString("/serial.log"), MAX_LOG_FILE_SIZE, NUM_LOG_BACKUP_FILES);
+}
+
+void MeterConfig::migrateLegacySettings(MeterStateStore* stateStore, int numMeters,
+                                        const char* const* keys, int numKeys, LegacyKeyBuilder buildLegacyKey) {
+    QSettings settings;
+    for (int i = 0; i < numMeters; i++) {
+        for (int j = 0; j < numKeys; j++) {
+            QVariant value = settings.value(buildLegacyKey(i, keys[j]));
+            if (!value.isNull()) {
+                stateStore->setValue(i, keys[j], value);
+            }
+        }
+    }
+}
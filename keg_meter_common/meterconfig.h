@@ -0,0 +1,44 @@
+#ifndef KEGMETERCOMMON_METERCONFIG_H
+#define KEGMETERCOMMON_METERCONFIG_H
+
+#include <QVector>
+#include <QString>
+
+class LogModel;
+class MeterStateStore;
+
+/**
+ * The configuration both the server and the controller read from their settings at startup: which
+ * meters there are, whether the logs are kept on disk and the meter state older versions kept in
+ * the settings.
+ */
+class MeterConfig {
+public:
+    // Meter indices are a single byte on the wire (see BinaryFrame)
+    static const int MAX_NUM_KEG_METERS = 256;
+    static const int DEFAULT_NUM_KEG_METERS = 8;
+
+    static const qint64 MAX_LOG_FILE_SIZE = 4*1024*1024;
+    static const int NUM_LOG_BACKUP_FILES = 3;
+
+    static const char* NUM_KEG_METERS;
+    static const char* KEG_METER_IDS;
+    static const char* LOG_TO_FILE;
+
+    // The meter ids (i.e., the labels shown for the meters) by meter index, from the
+    // "keg_meter_ids" setting if it's set, otherwise ids 1 to "num_keg_meters"
+    static QVector<int> readMeterIds();
+
+    // Spills both logs to files in logDirPath if the "log_to_file" setting is on. Returns false if
+    // the files couldn't be opened.
+    static bool setupLogFiles(LogModel* appLogModel, LogModel* serialLogModel, QString& logDirPath);
+
+    // Builds the settings key a meter's value was kept under by older versions
+    typedef QString (*LegacyKeyBuilder)(int meterIdx, const char* key);
+
+    // Carries the given keys of every meter over from the settings into the state store
+    static void migrateLegacySettings(MeterStateStore* stateStore, int numMeters,
+                                      const char* const* keys, int numKeys, LegacyKeyBuilder buildLegacyKey);
+};
+
+#endif // KEGMETERCOMMON_METERCONFIG_H
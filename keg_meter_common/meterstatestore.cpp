@@ -0,0 +1,154 @@
+#include "meterstatestore.h"
+
+#include <QDataStream>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QStandardPaths>
+
+MeterStateStore::MeterStateStore(const QString& filePath, QObject* parent) :
+    QObject(parent),
+    filePath(filePath),
+    dirty(false),
+    numUpdatesSinceFlush(0),
+    numFlushes(0),
+    numCoalescedUpdates(0) {
+
+    this->flushTimer.setSingleShot(true);
+    QObject::connect(&this->flushTimer, SIGNAL(timeout()), this, SLOT(onFlushTimer()));
+}
+
+MeterStateStore::~MeterStateStore() {
+    this->flushTimer.stop();
+    if (this->dirty) {
+        this->flush();
+    }
+}
+
+QString MeterStateStore::defaultFilePath() {
+    return QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) + QString("/meterstate.dat");
+}
+
+/**
+ * Replace the in-memory state with whatever is in the store's file. Returns false if there is no
+ * (valid) file, in which case the store is left empty.
+ */
+bool MeterStateStore::load() {
+    this->meterStates.clear();
+    this->dirty = false;
+    this->numUpdatesSinceFlush = 0;
+
+    QFile file(this->filePath);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+
+    QDataStream in(&file);
+    in.setVersion(QDataStream::Qt_5_0);
+
+    quint32 magic = 0;
+    quint32 version = 0;
+    in >> magic >> version;
+    if (magic != FILE_MAGIC || version != FILE_VERSION) {
+        return false;
+    }
+
+    QMap<int, QVariantMap> loadedStates;
+    in >> loadedStates;
+    if (in.status() != QDataStream::Ok) {
+        return false;
+    }
+
+    this->meterStates = loadedStates;
+    return true;
+}
+
+/**
+ * Write the full state of every meter out to disk right away, replacing the previous file in a
+ * single atomic rename.
+ */
+bool MeterStateStore::flush() {
+    this->flushTimer.stop();
+
+    QDir().mkpath(QFileInfo(this->filePath).absolutePath());
+
+    QSaveFile file(this->filePath);
+    if (!file.open(QIODevice::WriteOnly)) {
+        emit flushFailed(file.errorString());
+        return false;
+    }
+
+    QDataStream out(&file);
+    out.setVersion(QDataStream::Qt_5_0);
+    out << FILE_MAGIC << FILE_VERSION;
+    out << this->meterStates;
+
+    if (out.status() != QDataStream::Ok || !file.commit()) {
+        emit flushFailed(file.errorString());
+        return false;
+    }
+
+    int numUpdates = this->numUpdatesSinceFlush;
+    this->numFlushes++;
+    if (numUpdates > 1) {
+        this->numCoalescedUpdates += numUpdates - 1;
+    }
+
+    this->dirty = false;
+    this->numUpdatesSinceFlush = 0;
+
+    emit flushed(numUpdates);
+    return true;
+}
+
+bool MeterStateStore::contains(int meterIdx, const QString& key) const {
+    auto iter = this->meterStates.constFind(meterIdx);
+    return iter != this->meterStates.constEnd() && iter->contains(key);
+}
+
+QVariant MeterStateStore::value(int meterIdx, const QString& key, const QVariant& defaultValue) const {
+    auto iter = this->meterStates.constFind(meterIdx);
+    if (iter == this->meterStates.constEnd()) {
+        return defaultValue;
+    }
+    return iter->value(key, defaultValue);
+}
+
+void MeterStateStore::setValue(int meterIdx, const QString& key, const QVariant& value) {
+    QVariantMap& state = this->meterStates[meterIdx];
+    auto iter = state.find(key);
+    if (iter != state.end() && *iter == value) {
+        return;
+    }
+
+    state.insert(key, value);
+    this->markDirty();
+}
+
+void MeterStateStore::remove(int meterIdx, const QString& key) {
+    auto iter = this->meterStates.find(meterIdx);
+    if (iter == this->meterStates.end() || iter->remove(key) == 0) {
+        return;
+    }
+    this->markDirty();
+}
+
+void MeterStateStore::onFlushTimer() {
+    if (this->dirty) {
+        this->flush();
+    }
+}
+
+void MeterStateStore::markDirty() {
+    this->numUpdatesSinceFlush++;
+
+    if (!this->dirty) {
+        this->dirty = true;
+        this->dirtyTimer.start();
+    }
+
+    // Push the flush back while updates keep coming, but never past the maximum delay
+    int msUntilMaxDelay = MAX_FLUSH_DELAY_MS - static_cast<int>(this->dirtyTimer.elapsed());
+    this->flushTimer.start(qMax(0, qMin(static_cast<int>(FLUSH_DEBOUNCE_MS), msUntilMaxDelay)));
+}
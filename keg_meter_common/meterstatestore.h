@@ -0,0 +1,70 @@
+#ifndef KEGMETERCOMMON_METERSTATESTORE_H
+#define KEGMETERCOMMON_METERSTATESTORE_H
+
+#include <QObject>
+#include <QMap>
+#include <QVariant>
+#include <QString>
+#include <QTimer>
+#include <QElapsedTimer>
+
+/**
+ * Write-behind store for the persistent state of every keg meter.
+ *
+ * All reads and writes are served from memory. Changes only mark the store as dirty, the whole
+ * store is then written out once things have been quiet for FLUSH_DEBOUNCE_MS (or at the latest
+ * MAX_FLUSH_DELAY_MS after the first unflushed change) and when the store is destroyed. Every
+ * flush writes all of the meters to a single file which is atomically replaced, so a crash or
+ * power loss can never leave a half-written state behind.
+ */
+class MeterStateStore : public QObject {
+    Q_OBJECT
+public:
+    explicit MeterStateStore(const QString& filePath, QObject* parent = NULL);
+    ~MeterStateStore();
+
+    static QString defaultFilePath();
+
+    bool load();
+    bool flush();
+
+    bool isDirty() const { return this->dirty; }
+    bool contains(int meterIdx) const { return this->meterStates.contains(meterIdx); }
+    bool contains(int meterIdx, const QString& key) const;
+    QVariant value(int meterIdx, const QString& key, const QVariant& defaultValue = QVariant()) const;
+    void setValue(int meterIdx, const QString& key, const QVariant& value);
+    void remove(int meterIdx, const QString& key);
+
+    quint64 getNumFlushes() const { return this->numFlushes; }
+    quint64 getNumCoalescedUpdates() const { return this->numCoalescedUpdates; }
+
+signals:
+    // Emitted after every successful flush with the number of updates that were folded into it
+    void flushed(int numUpdates);
+    void flushFailed(const QString& errorStr);
+
+private slots:
+    void onFlushTimer();
+
+private:
+    static const quint32 FILE_MAGIC = 0x4B4D5353; // "KMSS"
+    static const quint32 FILE_VERSION = 1;
+
+    static const int FLUSH_DEBOUNCE_MS = 2000;
+    static const int MAX_FLUSH_DELAY_MS = 30000;
+
+    QString filePath;
+    QMap<int, QVariantMap> meterStates;
+
+    bool dirty;
+    int numUpdatesSinceFlush;
+    QElapsedTimer dirtyTimer;
+    QTimer flushTimer;
+
+    quint64 numFlushes;
+    quint64 numCoalescedUpdates;
+
+    void markDirty();
+};
+
+#endif // KEGMETERCOMMON_METERSTATESTORE_H
@@ -0,0 +1,93 @@
+#include "packetframer.h"
+
+#include <cassert>
+#include <cstring>
+
+PacketFramer::PacketFramer(char startToken, char endToken) :
+    startToken(startToken),
+    endToken(endToken),
+    readPos(0),
+    scanPos(0),
+    writePos(0),
+    packetStartPos(0),
+    inPacket(false),
+    numDroppedPackets(0) {
+
+    assert((CAPACITY & (CAPACITY - 1)) == 0);
+    assert(MAX_PACKET_SIZE < CAPACITY);
+}
+
+/**
+ * Copy as many of the given bytes as will fit into the ring buffer. Returns the number of bytes
+ * that were accepted -- when this is less than numBytes, drain the framer with nextPacket() and
+ * append the remainder.
+ */
+int PacketFramer::append(const char* bytes, int numBytes) {
+    int numToCopy = qMin(numBytes, this->freeSpace());
+    int copied = 0;
+
+    while (copied < numToCopy) {
+        quint32 idx = this->writePos & INDEX_MASK;
+        int chunkSize = qMin(numToCopy - copied, static_cast<int>(CAPACITY - idx));
+        memcpy(this->buffer + idx, bytes + copied, chunkSize);
+
+        // Keep the mirrored region past the end of the ring up to date so that packages which
+        // wrap around are still contiguous
+        if (idx < static_cast<quint32>(MAX_PACKET_SIZE)) {
+            int mirrorSize = qMin(chunkSize, static_cast<int>(MAX_PACKET_SIZE - idx));
+            memcpy(this->buffer + CAPACITY + idx, bytes + copied, mirrorSize);
+        }
+
+        copied += chunkSize;
+        this->writePos += chunkSize;
+    }
+
+    return copied;
+}
+
+/**
+ * Scan any unscanned bytes for the next complete package. Returns true and fills in the given
+ * view when one is found, false when more data is needed.
+ */
+bool PacketFramer::nextPacket(PacketView& packet) {
+    while (this->scanPos != this->writePos) {
+        char currByte = this->buffer[this->scanPos & INDEX_MASK];
+
+        if (currByte == this->startToken) {
+            // A start token always (re)synchronizes us, even in the middle of a package
+            if (this->inPacket) {
+                this->numDroppedPackets++;
+            }
+            this->inPacket = true;
+            this->packetStartPos = this->scanPos;
+        }
+        else if (this->inPacket) {
+            if (currByte == this->endToken) {
+                packet.data = this->buffer + ((this->packetStartPos + 1) & INDEX_MASK);
+                packet.size = static_cast<int>(this->scanPos - this->packetStartPos - 1);
+
+                this->inPacket = false;
+                this->scanPos++;
+                this->readPos = this->scanPos;
+                return true;
+            }
+            if (static_cast<int>(this->scanPos - this->packetStartPos) + 1 >= MAX_PACKET_SIZE) {
+                // Too long to be a real package, go back to hunting for a start token
+                this->inPacket = false;
+                this->numDroppedPackets++;
+            }
+        }
+
+        this->scanPos++;
+    }
+
+    // Only a partially received package needs to be kept around
+    this->readPos = this->inPacket ? this->packetStartPos : this->scanPos;
+    return false;
+}
+
+void PacketFramer::clear() {
+    this->readPos  = this->writePos;
+    this->scanPos  = this->writePos;
+    this->inPacket = false;
+}
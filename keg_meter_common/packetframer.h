@@ -0,0 +1,56 @@
+#ifndef KEGMETERCOMMON_PACKETFRAMER_H
+#define KEGMETERCOMMON_PACKETFRAMER_H
+
+#include <QtGlobal>
+
+/**
+ * Incremental framer for packages of the form <start><contents><end> arriving over a byte stream.
+ *
+ * Incoming bytes are kept in a fixed-capacity ring buffer and scanned exactly once: the scan
+ * cursor resumes where the previous call left off, so framing is linear in the number of bytes
+ * received no matter how they are split up across reads. The first MAX_PACKET_SIZE bytes of the
+ * ring are mirrored past its end, which means any package (bounded by MAX_PACKET_SIZE) is always
+ * contiguous in memory and can be handed out as a view without copying it.
+ */
+class PacketFramer {
+public:
+    static const int CAPACITY = 4096; // Must be a power of two
+    static const int MAX_PACKET_SIZE = 256;
+
+    // A view onto the contents of a package (start and end tokens excluded). The view is only
+    // valid until the next call to append() or clear() on the framer that produced it.
+    struct PacketView {
+        PacketView() : data(NULL), size(0) {}
+        const char* data;
+        int size;
+    };
+
+    PacketFramer(char startToken, char endToken);
+    ~PacketFramer() {}
+
+    int append(const char* bytes, int numBytes);
+    bool nextPacket(PacketView& packet);
+    void clear();
+
+    int freeSpace() const { return CAPACITY - static_cast<int>(this->writePos - this->readPos); }
+    quint64 getNumDroppedPackets() const { return this->numDroppedPackets; }
+
+private:
+    static const quint32 INDEX_MASK = CAPACITY - 1;
+
+    const char startToken;
+    const char endToken;
+
+    char buffer[CAPACITY + MAX_PACKET_SIZE];
+
+    // Absolute stream positions, these are allowed to wrap around
+    quint32 readPos;   // Everything before this has been consumed
+    quint32 scanPos;   // Everything before this has been scanned
+    quint32 writePos;  // Everything before this has been received
+    quint32 packetStartPos;
+    bool inPacket;
+
+    quint64 numDroppedPackets;
+};
+
+#endif // KEGMETERCOMMON_PACKETFRAMER_H
@@ -0,0 +1,256 @@
+#include "packetparser.h"
+
+#include <cassert>
+
+namespace {
+
+const char MEASUREMENT_SEPARATOR_CHAR = ' ';
+
+const char STATUS_BEGIN_CHAR = '{';
+const char STATUS_END_CHAR = '}';
+const char STATUS_KEY_VALUE_CHAR = ':';
+const char STATUS_FIELD_SEPARATOR_CHAR = ',';
+
+// Maps the key character of each status field to the field it fills in
+struct StatusFieldEntry {
+    char key;
+    PacketParser::StatusField field;
+};
+
+const StatusFieldEntry STATUS_FIELD_TABLE[] = {
+    { 'P', PacketParser::PercentField   },
+    { 'F', PacketParser::FullMassField  },
+    { 'E', PacketParser::EmptyMassField },
+    { 'L', PacketParser::LoadField      },
+    { 'V', PacketParser::VarianceField  }
+};
+const int STATUS_FIELD_TABLE_SIZE = sizeof(STATUS_FIELD_TABLE) / sizeof(STATUS_FIELD_TABLE[0]);
+
+const double POW10_TABLE[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,
+    1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18
+};
+
+// Beyond this many digits the mantissa could overflow, any further digits are insignificant for a float
+const int MAX_SIGNIFICANT_DIGITS = 18;
+
+inline bool isDigit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+} // namespace
+
+PacketParser::Result PacketParser::parseMeasurement(const char* data, int size, MeasurementPacket& packet) {
+    const char* first = data;
+    const char* last = data + size;
+    const char* curr = first;
+
+    curr = parseInt(curr, last, packet.meterIdx);
+    if (curr == NULL) {
+        return Result(BadMeterIndex, 0);
+    }
+
+    if (curr == last || *curr != MEASUREMENT_SEPARATOR_CHAR) {
+        return Result(BadSeparator, curr - first);
+    }
+    curr++;
+
+    if (curr == last || *curr != MEASUREMENT_MSG_TYPE) {
+        return Result(UnknownMessageType, curr - first);
+    }
+    packet.msgType = *curr++;
+
+    if (curr == last || *curr != MEASUREMENT_SEPARATOR_CHAR) {
+        return Result(BadSeparator, curr - first);
+    }
+    curr++;
+
+    const char* numEnd = parseFloat(curr, last, packet.measurement);
+    if (numEnd == NULL) {
+        return Result(BadNumber, curr - first, packet.msgType);
+    }
+    if (numEnd != last) {
+        return Result(TrailingData, numEnd - first);
+    }
+
+    return Result();
+}
+
+PacketParser::Result PacketParser::parseStatus(const char* data, int size, StatusPacket& packet) {
+    const char* first = data;
+    const char* last = data + size;
+    const char* curr = first;
+
+    packet.fieldMask = 0;
+
+    curr = parseInt(curr, last, packet.meterIdx);
+    if (curr == NULL) {
+        return Result(BadMeterIndex, 0);
+    }
+
+    if (curr == last || *curr != STATUS_BEGIN_CHAR) {
+        return Result(BadSeparator, curr - first);
+    }
+    curr++;
+
+    while (curr != last && *curr != STATUS_END_CHAR) {
+        char key = *curr;
+
+        int tableIdx = 0;
+        while (tableIdx < STATUS_FIELD_TABLE_SIZE && STATUS_FIELD_TABLE[tableIdx].key != key) {
+            tableIdx++;
+        }
+        if (tableIdx == STATUS_FIELD_TABLE_SIZE) {
+            return Result(UnknownField, curr - first, key);
+        }
+
+        StatusField field = STATUS_FIELD_TABLE[tableIdx].field;
+        if (packet.hasField(field)) {
+            return Result(DuplicateField, curr - first, key);
+        }
+        curr++;
+
+        if (curr == last || *curr != STATUS_KEY_VALUE_CHAR) {
+            return Result(BadSeparator, curr - first, key);
+        }
+        curr++;
+
+        const char* numEnd = parseFloat(curr, last, packet.values[field]);
+        if (numEnd == NULL) {
+            return Result(BadNumber, curr - first, key);
+        }
+        curr = numEnd;
+        packet.fieldMask |= (1 << field);
+
+        if (curr != last && *curr == STATUS_FIELD_SEPARATOR_CHAR) {
+            curr++;
+        }
+        else if (curr == last || *curr != STATUS_END_CHAR) {
+            return Result(BadSeparator, curr - first, key);
+        }
+    }
+
+    if (curr == last) {
+        return Result(BadSeparator, curr - first);
+    }
+    curr++;
+
+    if (curr != last) {
+        return Result(TrailingData, curr - first);
+    }
+
+    return Result();
+}
+
+const char* PacketParser::parseInt(const char* first, const char* last, int& value) {
+    const char* curr = first;
+    bool negative = false;
+    if (curr != last && *curr == '-') {
+        negative = true;
+        curr++;
+    }
+
+    const char* digitsStart = curr;
+    qint64 result = 0;
+    while (curr != last && isDigit(*curr)) {
+        result = result * 10 + (*curr - '0');
+        if (result > 0x7FFFFFFF) {
+            return NULL;
+        }
+        curr++;
+    }
+    if (curr == digitsStart) {
+        return NULL;
+    }
+
+    value = static_cast<int>(negative ? -result : result);
+    return curr;
+}
+
+const char* PacketParser::parseFloat(const char* first, const char* last, float& value) {
+    const char* curr = first;
+    bool negative = false;
+    if (curr != last && (*curr == '-' || *curr == '+')) {
+        negative = (*curr == '-');
+        curr++;
+    }
+
+    quint64 mantissa = 0;
+    int numSignificantDigits = 0;
+    int exponent = 0;
+    bool hasDigits = false;
+
+    // Integer part
+    while (curr != last && isDigit(*curr)) {
+        hasDigits = true;
+        if (numSignificantDigits < MAX_SIGNIFICANT_DIGITS) {
+            mantissa = mantissa * 10 + (*curr - '0');
+            if (mantissa != 0) {
+                numSignificantDigits++;
+            }
+        }
+        else {
+            exponent++;
+        }
+        curr++;
+    }
+
+    // Fractional part
+    if (curr != last && *curr == '.') {
+        curr++;
+        while (curr != last && isDigit(*curr)) {
+            hasDigits = true;
+            if (numSignificantDigits < MAX_SIGNIFICANT_DIGITS) {
+                mantissa = mantissa * 10 + (*curr - '0');
+                if (mantissa != 0) {
+                    numSignificantDigits++;
+                }
+                exponent--;
+            }
+            curr++;
+        }
+    }
+
+    if (!hasDigits) {
+        return NULL;
+    }
+
+    double result = static_cast<double>(mantissa);
+    while (exponent < 0) {
+        int step = qMin(-exponent, MAX_SIGNIFICANT_DIGITS);
+        result /= POW10_TABLE[step];
+        exponent += step;
+    }
+    while (exponent > 0) {
+        int step = qMin(exponent, MAX_SIGNIFICANT_DIGITS);
+        result *= POW10_TABLE[step];
+        exponent -= step;
+    }
+
+    value = static_cast<float>(negative ? -result : result);
+    return curr;
+}
+
+const char* PacketParser::errorString(Error error) {
+    switch (error) {
+    case NoError:
+        return "No error";
+    case BadMeterIndex:
+        return "Invalid meter index";
+    case BadSeparator:
+        return "Missing separator";
+    case UnknownMessageType:
+        return "Unknown message type";
+    case UnknownField:
+        return "Unknown field";
+    case DuplicateField:
+        return "Duplicate field";
+    case BadNumber:
+        return "Invalid number";
+    case TrailingData:
+        return "Unexpected trailing data";
+    default:
+        assert(false);
+        return "Unknown error";
+    }
+}
@@ -0,0 +1,78 @@
+#ifndef KEGMETERCOMMON_PACKETPARSER_H
+#define KEGMETERCOMMON_PACKETPARSER_H
+
+#include <QtGlobal>
+
+/**
+ * Allocation-free parsers for the contents of the serial packages sent by the keg meter sketches
+ * (i.e., the bytes between the start and end tokens, see PacketFramer). Everything works directly
+ * on the received bytes, no intermediate strings or streams are built.
+ */
+class PacketParser {
+public:
+    enum Error {
+        NoError,
+        BadMeterIndex,      // The package didn't start with a meter index
+        BadSeparator,       // An expected separator/delimiter character was missing
+        UnknownMessageType, // The message type character isn't one we know how to parse
+        UnknownField,       // A field key isn't one we know how to parse
+        DuplicateField,     // The same field showed up more than once
+        BadNumber,          // A field value couldn't be parsed as a number
+        TrailingData        // There was data left over after a complete message
+    };
+
+    struct Result {
+        Result() : error(NoError), offset(0), fieldKey('\0') {}
+        Result(Error error, int offset, char fieldKey = '\0') : error(error), offset(offset), fieldKey(fieldKey) {}
+
+        bool isOk() const { return this->error == NoError; }
+
+        Error error;
+        int offset;    // Offset into the package where parsing failed
+        char fieldKey; // The key of the field that failed to parse (if any)
+    };
+
+    // Measurement messages (server <- client sketch): "NN M xxx.xxx"
+    static const char MEASUREMENT_MSG_TYPE = 'M';
+
+    struct MeasurementPacket {
+        int meterIdx;
+        char msgType;
+        float measurement;
+    };
+
+    // Status messages (controller <- autonomous sketch): "N{P:p.pp,F:fff.ff,E:eee.ee,L:lll.ll,V:v.vvvvv}"
+    // Every field is optional, fields may show up in any order
+    enum StatusField {
+        PercentField,
+        FullMassField,
+        EmptyMassField,
+        LoadField,
+        VarianceField,
+        NUM_STATUS_FIELDS
+    };
+
+    struct StatusPacket {
+        bool hasField(StatusField field) const { return (this->fieldMask & (1 << field)) != 0; }
+
+        int meterIdx;
+        quint32 fieldMask;
+        float values[NUM_STATUS_FIELDS];
+    };
+
+    static Result parseMeasurement(const char* data, int size, MeasurementPacket& packet);
+    static Result parseStatus(const char* data, int size, StatusPacket& packet);
+
+    // std::from_chars-style number parsing: returns a pointer one past the last character consumed,
+    // or NULL if no number could be parsed starting at first
+    static const char* parseInt(const char* first, const char* last, int& value);
+    static const char* parseFloat(const char* first, const char* last, float& value);
+
+    static const char* errorString(Error error);
+
+private:
+    PacketParser() {}
+    ~PacketParser() {}
+};
+
+#endif // KEGMETERCOMMON_PACKETPARSER_H
@@ -0,0 +1,122 @@
+#include "pourdetector.h"
+
+#include <algorithm>
+#include <cmath>
+
+// Drops within the allowance are noise, the threshold is about 80 ml of beer. Both grow with the
+// noise of the load when that's higher than expected.
+static const float MIN_DROP_ALLOWANCE_KG = 0.005f;
+static const float MIN_DROP_THRESHOLD_KG = 0.08f;
+static const float NOISE_TO_ALLOWANCE = 1.5f;
+static const float NOISE_TO_THRESHOLD = 10.0f;
+static const float NOISE_TO_MIN_POUR = 6.0f;
+static const float REFERENCE_SMOOTHING = 0.05f;
+static const float NOISE_SMOOTHING = 0.01f;
+
+static const float MIN_POUR_LITRES = 0.05f;
+static const float BEER_KG_PER_LITRE = 1.005f;
+
+void PourDetector::reset() {
+    this->state = Idle;
+    this->hasReference = false;
+    this->reference = 0;
+    this->noise = 0;
+    this->dropSum = 0;
+    this->dropStartMs = 0;
+    this->raised = false;
+    this->raisedSinceMs = 0;
+    this->pourStartMs = 0;
+    this->lowestLoad = 0;
+    this->lowestLoadMs = 0;
+}
+
+bool PourDetector::update(int64_t timeMs, float load, Event& event) {
+    if (!this->hasReference) {
+        this->restartAt(timeMs, load);
+        return false;
+    }
+
+    float allowance = std::max(MIN_DROP_ALLOWANCE_KG, NOISE_TO_ALLOWANCE * this->noise);
+    float threshold = std::max(MIN_DROP_THRESHOLD_KG, NOISE_TO_THRESHOLD * this->noise);
+
+    switch (this->state) {
+    case Idle: {
+        // Whatever went on top of the keg isn't beer, it only becomes the reference if it stays
+        if (load > this->reference + threshold) {
+            if (!this->raised) {
+                this->raised = true;
+                this->raisedSinceMs = timeMs;
+            }
+            else if (timeMs - this->raisedSinceMs >= RAISED_SETTLE_MS) {
+                this->restartAt(timeMs, load);
+                return false;
+            }
+            this->dropSum = 0;
+            this->dropStartMs = timeMs;
+            return false;
+        }
+        this->raised = false;
+
+        float sum = this->dropSum + (this->reference - load) - allowance;
+        if (sum <= 0) {
+            // Settled, so this is a good time to learn how much the load wanders by itself
+            this->noise += NOISE_SMOOTHING * (std::fabs(load - this->reference) - this->noise);
+            this->reference += REFERENCE_SMOOTHING * (load - this->reference);
+            this->dropSum = 0;
+            this->dropStartMs = timeMs;
+        }
+        else {
+            this->dropSum = sum;
+            if (this->dropSum > threshold) {
+                this->state = Pouring;
+                this->pourStartMs = this->dropStartMs;
+                this->lowestLoad = load;
+                this->lowestLoadMs = timeMs;
+            }
+        }
+        return false;
+    }
+
+    case Pouring: {
+        // Called off, whatever went on top of the keg is dealt with while idle
+        if (load > this->reference + threshold) {
+            this->state = Idle;
+            this->dropSum = 0;
+            this->dropStartMs = timeMs;
+            return false;
+        }
+
+        if (load < this->lowestLoad - allowance) {
+            this->lowestLoad = load;
+            this->lowestLoadMs = timeMs;
+        }
+        if (timeMs - this->lowestLoadMs < POUR_END_QUIET_MS &&
+            timeMs - this->pourStartMs < MAX_POUR_DURATION_MS) {
+            return false;
+        }
+
+        // The volume is what's actually gone once the load settled, a dip that came back up is noise
+        event.startMs = this->pourStartMs;
+        event.endMs = this->lowestLoadMs;
+        event.startLoad = this->reference;
+        event.endLoad = load;
+        event.litres = (this->reference - load) / BEER_KG_PER_LITRE;
+
+        // Whatever the keg settled at is the reference for the next pour
+        this->restartAt(timeMs, load);
+        return event.litres >= std::max(MIN_POUR_LITRES, NOISE_TO_MIN_POUR * this->noise / BEER_KG_PER_LITRE);
+    }
+
+    default:
+        return false;
+    }
+}
+
+void PourDetector::restartAt(int64_t timeMs, float load) {
+    this->state = Idle;
+    this->hasReference = true;
+    this->reference = load;
+    this->dropSum = 0;
+    this->dropStartMs = timeMs;
+    this->raised = false;
+}
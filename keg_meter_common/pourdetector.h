@@ -0,0 +1,63 @@
+#ifndef KEGMETERCOMMON_POURDETECTOR_H
+#define KEGMETERCOMMON_POURDETECTOR_H
+
+#include <stdint.h>
+
+/**
+ * Turns the (filtered) load of a keg into discrete pours, in O(1) time and state per sample.
+ *
+ * While idle, a one-sided CUSUM accumulates how far the load sits below a reference level (the
+ * settled load of the keg), less an allowance for noise. Whenever the sum is back at zero the
+ * reference slowly follows the load and the detector learns how noisy the load is, which scales the
+ * allowance, the detection threshold and the smallest pour. Once the sum passes the threshold a pour
+ * started at the last sample the sum was still zero. The pour lasts for as long as the load keeps
+ * making new lows, it's over once there hasn't been one for POUR_END_QUIET_MS. Its volume is the
+ * drop from the reference to the load the keg settled at, so a dip that comes back up (someone
+ * lifting the keg a little) doesn't count. A load that goes up past the reference (a keg being
+ * swapped or something put on top of it) calls the pour off. While idle, the reference only follows
+ * a load like that once it stayed up for RAISED_SETTLE_MS, so someone leaning on the keg for a bit
+ * doesn't look like a pour when they let go.
+ *
+ * Loads are in kg, times in ms since the epoch.
+ */
+class PourDetector {
+public:
+    static const int64_t POUR_END_QUIET_MS = 3000;
+    static const int64_t MAX_POUR_DURATION_MS = 5 * 60 * 1000;
+    static const int64_t RAISED_SETTLE_MS = 30000;
+
+    struct Event {
+        int64_t startMs;
+        int64_t endMs;
+        float startLoad;
+        float endLoad;
+        float litres;
+    };
+
+    PourDetector() { this->reset(); }
+
+    void reset();
+    bool isPouring() const { return this->state == Pouring; }
+
+    // Returns true if this sample finished a pour, which is then described by event
+    bool update(int64_t timeMs, float load, Event& event);
+
+private:
+    enum State { Idle, Pouring } state;
+
+    bool hasReference;
+    float reference;
+    float noise;         // Mean absolute deviation of the load from the reference while settled
+    float dropSum;
+    int64_t dropStartMs; // The last time the drop sum was zero
+    bool raised;         // The load went up past the reference, at raisedSinceMs
+    int64_t raisedSinceMs;
+
+    int64_t pourStartMs;
+    float lowestLoad;
+    int64_t lowestLoadMs;
+
+    void restartAt(int64_t timeMs, float load);
+};
+
+#endif // KEGMETERCOMMON_POURDETECTOR_H
@@ -0,0 +1,108 @@
+#include "serialcapture.h"
+
+#include <QObject>
+
+SerialCapture::SerialCapture() : startTimeMs(0) {
+    this->stream.setByteOrder(QDataStream::BigEndian);
+}
+
+SerialCapture::~SerialCapture() {
+    this->close();
+}
+
+bool SerialCapture::openForWriting(const QString& filePath, qint64 startTimeMs) {
+    this->close();
+    this->file.setFileName(filePath);
+    if (!this->file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        this->errorStr = QObject::tr("Failed to create %1: %2").arg(filePath).arg(this->file.errorString());
+        return false;
+    }
+
+    this->stream.setDevice(&this->file);
+    this->startTimeMs = startTimeMs;
+    this->stream << MAGIC << FORMAT_VERSION << this->startTimeMs;
+    this->clock.start();
+    if (this->stream.status() != QDataStream::Ok) {
+        this->errorStr = QObject::tr("Failed to write to %1: %2").arg(filePath).arg(this->file.errorString());
+        this->close();
+        return false;
+    }
+    return true;
+}
+
+bool SerialCapture::openForReading(const QString& filePath) {
+    this->close();
+    this->file.setFileName(filePath);
+    if (!this->file.open(QIODevice::ReadOnly)) {
+        this->errorStr = QObject::tr("Failed to open %1: %2").arg(filePath).arg(this->file.errorString());
+        return false;
+    }
+
+    this->stream.setDevice(&this->file);
+    quint32 magic = 0;
+    quint16 version = 0;
+    this->stream >> magic >> version >> this->startTimeMs;
+    if (this->stream.status() != QDataStream::Ok || magic != MAGIC) {
+        this->errorStr = QObject::tr("%1 is not a serial capture").arg(filePath);
+        this->close();
+        return false;
+    }
+    if (version != FORMAT_VERSION) {
+        this->errorStr = QObject::tr("%1 is a v%2 serial capture, only v%3 is supported").arg(filePath).arg(version).arg(FORMAT_VERSION);
+        this->close();
+        return false;
+    }
+    return true;
+}
+
+void SerialCapture::close() {
+    this->stream.setDevice(NULL);
+    this->stream.resetStatus();
+    if (this->file.isOpen()) {
+        this->file.close();
+    }
+}
+
+bool SerialCapture::write(Direction direction, const QByteArray& data) {
+    return this->write(this->clock.nsecsElapsed() / 1000, direction, data);
+}
+
+bool SerialCapture::write(qint64 timeUs, Direction direction, const QByteArray& data) {
+    if (!this->file.isOpen() || data.isEmpty()) {
+        return false;
+    }
+
+    this->stream << timeUs << static_cast<quint8>(direction) << static_cast<quint32>(data.size());
+    this->stream.writeRawData(data.constData(), data.size());
+    if (this->stream.status() != QDataStream::Ok) {
+        this->errorStr = QObject::tr("Failed to write to %1: %2").arg(this->file.fileName()).arg(this->file.errorString());
+        return false;
+    }
+    return true;
+}
+
+bool SerialCapture::read(Record& record) {
+    if (!this->file.isOpen() || this->stream.atEnd()) {
+        return false;
+    }
+
+    quint8 direction = 0;
+    quint32 size = 0;
+    this->stream >> record.timeUs >> direction >> size;
+    if (this->stream.status() != QDataStream::Ok) {
+        this->errorStr = QObject::tr("Incomplete record at the end of %1").arg(this->file.fileName());
+        return false;
+    }
+    if ((direction != ReadDirection && direction != WriteDirection) || size > MAX_RECORD_SIZE) {
+        this->errorStr = QObject::tr("Corrupt record at offset %1 of %2").arg(this->file.pos()).arg(this->file.fileName());
+        return false;
+    }
+
+    record.direction = static_cast<Direction>(direction);
+    record.data.resize(size);
+    if (this->stream.readRawData(record.data.data(), size) != static_cast<int>(size)) {
+        this->errorStr = QObject::tr("Incomplete record at the end of %1").arg(this->file.fileName());
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,72 @@
+#ifndef KEGMETERCOMMON_SERIALCAPTURE_H
+#define KEGMETERCOMMON_SERIALCAPTURE_H
+
+#include <QByteArray>
+#include <QDataStream>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QString>
+
+/**
+ * A recording of the traffic on a serial link, so it can be played back later (see ReplayComm).
+ *
+ * A capture file starts with a header that has the wall clock time the capture was started at,
+ * followed by one record for every chunk of bytes read from or written to the link:
+ *
+ *   header: "KMSC" | version (u16) | start time (i64, ms since the epoch)
+ *   record: time (i64, us since the start) | direction (u8, 'R' or 'W') | size (u32) | bytes
+ *
+ * Everything is big endian. Records are in time order, the reader stops at the first record that
+ * isn't complete (i.e. the tail of a capture that was cut short).
+ */
+class SerialCapture {
+public:
+    enum Direction {
+        ReadDirection  = 'R', // From the hardware
+        WriteDirection = 'W'  // To the hardware
+    };
+
+    struct Record {
+        qint64 timeUs;
+        Direction direction;
+        QByteArray data;
+    };
+
+    SerialCapture();
+    ~SerialCapture();
+
+    // Starts a new capture, the times of the records are measured from here
+    bool openForWriting(const QString& filePath, qint64 startTimeMs);
+    bool openForReading(const QString& filePath);
+    void close();
+    bool isOpen() const { return this->file.isOpen(); }
+
+    QString getFilePath() const { return this->file.fileName(); }
+    qint64 getStartTime() const { return this->startTimeMs; }
+    qint64 getFileSize() const { return this->file.size(); }
+    qint64 getFilePos() const { return this->file.pos(); }
+
+    // Timestamped with the time since the capture was opened
+    bool write(Direction direction, const QByteArray& data);
+    bool write(qint64 timeUs, Direction direction, const QByteArray& data);
+
+    // Returns false at the end of the capture or when it's corrupt (see errorString)
+    bool read(Record& record);
+
+    QString errorString() const { return this->errorStr; }
+
+private:
+    Q_DISABLE_COPY(SerialCapture)
+
+    static const quint32 MAGIC = 0x4B4D5343; // "KMSC"
+    static const quint16 FORMAT_VERSION = 1;
+    static const quint32 MAX_RECORD_SIZE = 16*1024*1024;
+
+    QFile file;
+    QDataStream stream;
+    QElapsedTimer clock;
+    qint64 startTimeMs;
+    QString errorStr;
+};
+
+#endif // KEGMETERCOMMON_SERIALCAPTURE_H
@@ -0,0 +1,300 @@
+#include "serialnegotiator.h"
+
+#include <QSerialPort>
+
+SerialNegotiator::SerialNegotiator(const QString& handshakeCmdFormat, const QString& baudRateCmdFormat, QObject* parent) :
+    QObject(parent),
+    serialPort(NULL),
+    handshakeCmdFormat(handshakeCmdFormat),
+    baudRateCmdFormat(baudRateCmdFormat),
+    mode(AsciiMode),
+    numHandshakeAttempts(0),
+    handshakeTimer(this),
+    baudState(InitialBaud),
+    initialBaudRate(0),
+    maxBaudRate(0),
+    targetBaudRate(0),
+    baudUpgradeFailed(false),
+    baudCmdDraining(false),
+    numConsecutiveCorruptPackets(0),
+    baudRateTimer(this),
+    numBytesRead(0),
+    numPacketsRead(0),
+    throughputTimer(this) {
+
+    this->handshakeTimer.setSingleShot(true);
+    this->baudRateTimer.setSingleShot(true);
+    this->throughputTimer.setSingleShot(true);
+
+    this->connect(&this->handshakeTimer, SIGNAL(timeout()), this, SLOT(onHandshakeTimer()));
+    this->connect(&this->baudRateTimer, SIGNAL(timeout()), this, SLOT(onBaudRateTimer()));
+    this->connect(&this->throughputTimer, SIGNAL(timeout()), this, SLOT(onThroughputTimer()));
+}
+
+/**
+ * Start negotiating on a port that was just opened, at the baud rate the hardware boots up with.
+ * The link won't be switched to anything faster than maxBaudRate.
+ */
+void SerialNegotiator::start(QSerialPort* serialPort, qint32 maxBaudRate) {
+    this->baudRateTimer.stop();
+    this->throughputTimer.stop();
+
+    this->serialPort = serialPort;
+    this->initialBaudRate = serialPort->baudRate();
+    this->maxBaudRate = maxBaudRate;
+    this->baudState = InitialBaud;
+    this->baudUpgradeFailed = false;
+
+    // Give the hardware time to boot before asking it to switch over to the binary protocol
+    this->mode = NegotiatingMode;
+    this->numHandshakeAttempts = 0;
+    this->handshakeTimer.start(HANDSHAKE_DELAY_MS);
+}
+
+/**
+ * Follow the negotiation in recorded traffic instead: nothing is ever written, and whatever hello
+ * frame comes along first switches us to the binary protocol. ASCII packets are decoded until then.
+ */
+void SerialNegotiator::startPassive() {
+    this->stop();
+    this->mode = NegotiatingMode;
+    this->numHandshakeAttempts = 0;
+}
+
+void SerialNegotiator::stop() {
+    this->handshakeTimer.stop();
+    this->baudRateTimer.stop();
+    this->throughputTimer.stop();
+
+    // The hardware boots at the initial rate again, so the port must be reopened at that rate too
+    if (this->serialPort != NULL && this->baudState != InitialBaud) {
+        this->serialPort->setBaudRate(this->initialBaudRate);
+    }
+    this->serialPort = NULL;
+    this->baudState = InitialBaud;
+    this->baudCmdDraining = false;
+    this->mode = AsciiMode;
+}
+
+/**
+ * Report an ERROR reply from the hardware. Returns true when the reply was meant for us, i.e. the
+ * owner must not treat it as a reply to its own last command.
+ */
+bool SerialNegotiator::handleErrorReply() {
+    if (this->mode != NegotiatingMode) {
+        return false;
+    }
+
+    // Resending the handshake won't change the hardware's mind. While the baud rate is changing
+    // though, errors are just the hardware choking on bytes sent at the wrong rate.
+    if (this->baudState == InitialBaud) {
+        this->fallBackToAscii(tr("the hardware rejected the binary protocol"));
+    }
+    return true;
+}
+
+void SerialNegotiator::handleHello(const BinaryFrame::Frame& frame) {
+    quint8 version = 0;
+    quint8 numMeters = 0;
+    quint8 maxBaudRateIdx = 0;
+    if (this->mode != NegotiatingMode || !BinaryFrame::decodeHello(frame, version, numMeters, maxBaudRateIdx)) {
+        return;
+    }
+    if (!this->isPortOpen()) {
+        if (this->serialPort == NULL) {
+            // Passive, the recording has the rest of the negotiation (if there was any)
+            this->mode = BinaryMode;
+            emit logMessage(tr("Using the binary serial protocol v%1 (%2 meter(s))").arg(version).arg(numMeters));
+        }
+        return;
+    }
+
+    this->handshakeTimer.stop();
+    this->mode = BinaryMode;
+    this->numConsecutiveCorruptPackets = 0;
+
+    switch (this->baudState) {
+    case InitialBaud: {
+        emit logMessage(tr("Using the binary serial protocol v%1 (%2 meter(s))").arg(version).arg(numMeters));
+
+        // Go for the fastest rate both ends support
+        int baudRateIdx = -1;
+        for (int i = qMin<int>(maxBaudRateIdx, BinaryFrame::NUM_BAUD_RATES-1); i > 0; i--) {
+            if (BinaryFrame::baudRate(i) <= this->maxBaudRate) {
+                baudRateIdx = i;
+                break;
+            }
+        }
+        if (!this->baudUpgradeFailed && baudRateIdx > 0 &&
+            BinaryFrame::baudRate(baudRateIdx) > this->serialPort->baudRate()) {
+            this->switchBaudRate(baudRateIdx);
+            return;
+        }
+        break;
+    }
+
+    case SwitchingBaud:
+        this->baudState = UpgradedBaud;
+        emit logMessage(tr("Serial link switched to %1 baud").arg(this->serialPort->baudRate()));
+        break;
+
+    case RevertingBaud:
+        this->baudState = InitialBaud;
+        emit logMessage(tr("Serial link back at %1 baud").arg(this->serialPort->baudRate()));
+        break;
+
+    case UpgradedBaud:
+        break;
+    }
+
+    this->finishNegotiating();
+}
+
+/**
+ * Report every package (binary frame or ASCII packet) read from the port, and whether it had to be
+ * discarded as corrupt.
+ */
+void SerialNegotiator::handlePacket(bool corrupt) {
+    if (!corrupt) {
+        this->numPacketsRead++;
+        this->numConsecutiveCorruptPackets = 0;
+        return;
+    }
+
+    // A run of corrupt frames right after a speed upgrade means the link can't take the new rate
+    if (this->mode == BinaryMode && this->baudState == UpgradedBaud &&
+        ++this->numConsecutiveCorruptPackets >= MAX_CONSECUTIVE_CORRUPT_PACKETS) {
+        this->revertBaudRate(tr("%1 corrupt frames in a row").arg(this->numConsecutiveCorruptPackets));
+    }
+}
+
+void SerialNegotiator::onHandshakeTimer() {
+    if (this->mode != NegotiatingMode || !this->isPortOpen()) {
+        return;
+    }
+    if (this->numHandshakeAttempts >= MAX_HANDSHAKE_ATTEMPTS) {
+        switch (this->baudState) {
+        case SwitchingBaud:
+            this->revertBaudRate(tr("no answer from the hardware at %1 baud").arg(this->targetBaudRate));
+            break;
+        case RevertingBaud:
+            this->fallBackToAscii(tr("no answer from the hardware after going back to %1 baud").arg(this->initialBaudRate));
+            break;
+        default:
+            this->fallBackToAscii(tr("no answer from the hardware"));
+            break;
+        }
+        return;
+    }
+
+    this->numHandshakeAttempts++;
+    this->writeCommand(this->handshakeCmdFormat.arg(BinaryFrame::PROTOCOL_VERSION));
+    this->handshakeTimer.start((this->baudState == SwitchingBaud) ? SWITCHED_HANDSHAKE_TIMEOUT_MS : HANDSHAKE_TIMEOUT_MS);
+}
+
+void SerialNegotiator::onBaudRateTimer() {
+    if (!this->isPortOpen()) {
+        return;
+    }
+
+    // The hardware can't act on the command before all of it went out
+    if (this->baudCmdDraining) {
+        if (this->serialPort->bytesToWrite() > 0) {
+            this->baudRateTimer.start(BAUD_DRAIN_POLL_MS);
+            return;
+        }
+        this->baudCmdDraining = false;
+        this->baudRateTimer.start(BAUD_SWITCH_DELAY_MS);
+        return;
+    }
+
+    // The hardware should have switched by now, follow it and say hello again at the new rate
+    qint32 baudRate = (this->baudState == SwitchingBaud) ? this->targetBaudRate : this->initialBaudRate;
+    this->serialPort->clear(QSerialPort::Input);
+    this->serialPort->setBaudRate(baudRate);
+    emit linkReset();
+
+    this->numHandshakeAttempts = 0;
+    this->handshakeTimer.start(0);
+}
+
+void SerialNegotiator::onThroughputTimer() {
+    if (!this->isPortOpen()) {
+        return;
+    }
+
+    double elapsedSecs = qMax<qint64>(1, this->throughputClock.elapsed()) / 1000.0;
+    double bytesPerSec = this->numBytesRead / elapsedSecs;
+    double packetsPerSec = this->numPacketsRead / elapsedSecs;
+    double lineBytesPerSec = this->serialPort->baudRate() / 10.0; // 8N1 takes 10 bits a byte
+
+    emit logMessage(tr("Serial link at %1 baud: %2 bytes/s, %3 packages/s (%4% of the line rate)")
+                    .arg(this->serialPort->baudRate()).arg(bytesPerSec, 0, 'f', 0)
+                    .arg(packetsPerSec, 0, 'f', 1).arg(100.0 * bytesPerSec / lineBytesPerSec, 0, 'f', 1));
+}
+
+bool SerialNegotiator::isPortOpen() const {
+    return this->serialPort != NULL && this->serialPort->isOpen();
+}
+
+void SerialNegotiator::writeCommand(const QString& command) {
+    QByteArray data = command.toLatin1();
+    if (this->serialPort->write(data) != data.size()) {
+        emit logMessage(tr("Failed to write the data to port %1, error: %2").arg(this->serialPort->portName()).arg(this->serialPort->errorString()));
+    }
+    this->serialPort->flush();
+}
+
+void SerialNegotiator::switchBaudRate(int baudRateIdx) {
+    this->targetBaudRate = BinaryFrame::baudRate(baudRateIdx);
+    emit logMessage(tr("Switching the serial link to %1 baud").arg(this->targetBaudRate));
+
+    this->writeCommand(this->baudRateCmdFormat.arg(baudRateIdx));
+    this->throughputTimer.stop();
+    this->mode = NegotiatingMode;
+    this->baudState = SwitchingBaud;
+    this->followBaudRateCmd();
+}
+
+void SerialNegotiator::revertBaudRate(const QString& reason) {
+    emit logMessage(tr("Going back to %1 baud (%2)").arg(this->initialBaudRate).arg(reason));
+
+    // The hardware goes back on its own when the new rate isn't confirmed in time, but it may have
+    // gotten our handshake and only its answer got lost, so tell it explicitly as well
+    this->writeCommand(this->baudRateCmdFormat.arg(0));
+    this->handshakeTimer.stop();
+    this->throughputTimer.stop();
+    this->mode = NegotiatingMode;
+    this->baudState = RevertingBaud;
+    this->baudUpgradeFailed = true;
+    this->followBaudRateCmd();
+}
+
+// Switches the port over to the rate of the baud rate command just written, once the hardware had
+// time to act on it (see onBaudRateTimer)
+void SerialNegotiator::followBaudRateCmd() {
+    this->baudCmdDraining = true;
+    this->baudRateTimer.start(0);
+}
+
+void SerialNegotiator::fallBackToAscii(const QString& reason) {
+    this->handshakeTimer.stop();
+    this->baudRateTimer.stop();
+    this->mode = AsciiMode;
+    if (this->baudState != InitialBaud && this->isPortOpen()) {
+        this->serialPort->setBaudRate(this->initialBaudRate);
+        emit linkReset();
+    }
+    this->baudState = InitialBaud;
+    emit logMessage(tr("Using the ASCII serial protocol (%1)").arg(reason));
+    this->finishNegotiating();
+}
+
+void SerialNegotiator::finishNegotiating() {
+    this->numBytesRead = 0;
+    this->numPacketsRead = 0;
+    this->throughputClock.start();
+    this->throughputTimer.start(THROUGHPUT_LOG_DELAY_MS);
+
+    emit negotiated();
+}
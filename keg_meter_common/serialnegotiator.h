@@ -0,0 +1,118 @@
+#ifndef KEGMETERCOMMON_SERIALNEGOTIATOR_H
+#define KEGMETERCOMMON_SERIALNEGOTIATOR_H
+
+#include "binaryframe.h"
+
+#include <QObject>
+#include <QString>
+#include <QTimer>
+#include <QElapsedTimer>
+
+class QSerialPort;
+
+/**
+ * Negotiates the protocol and the speed of a freshly opened serial link to the keg meter hardware.
+ *
+ * Once the hardware had time to boot it's asked to switch to the binary protocol (see BinaryFrame).
+ * Until it answers with a hello frame the ASCII protocol is used, and it's kept if the hardware
+ * rejects the request (older firmware) or never answers. The hello frame tells us the highest baud
+ * rate the hardware supports, if both ends can go faster than the rate the link was opened at we
+ * ask the hardware to switch, follow it and repeat the handshake at the new rate. When that
+ * handshake fails, or the upgraded link turns out to be unreliable, both ends go back to the
+ * original rate and we don't try again until the port is reopened.
+ *
+ * The owner reads the port itself and reports what it sees through the handle*() functions, the
+ * negotiator only ever writes its own commands to the port. While negotiating (which includes the
+ * boot delay) the owner must hold back its own writes: the hardware would take them for garbage
+ * halfway through a baud rate switch, or at the wrong rate. negotiated() tells it when they can go
+ * out. Without a port (see startPassive) it just follows a negotiation that happened earlier, e.g.
+ * in a recording of the link.
+ */
+class SerialNegotiator : public QObject {
+    Q_OBJECT
+public:
+    enum Mode { NegotiatingMode, AsciiMode, BinaryMode };
+
+    // The commands are formatted with the protocol version and the baud rate index respectively
+    SerialNegotiator(const QString& handshakeCmdFormat, const QString& baudRateCmdFormat, QObject* parent = NULL);
+
+    void start(QSerialPort* serialPort, qint32 maxBaudRate);
+    void startPassive();
+    void stop();
+
+    Mode getMode() const { return this->mode; }
+
+    bool handleErrorReply();
+    void handleHello(const BinaryFrame::Frame& frame);
+    void handlePacket(bool corrupt);
+    void handleBytesRead(int numBytes) { this->numBytesRead += numBytes; }
+
+signals:
+    void logMessage(const QString& message);
+    void linkReset(); // The port changed speed, anything buffered from before is garbage
+    void negotiated(); // Done negotiating (for now), held back writes can go out
+
+private slots:
+    void onHandshakeTimer();
+    void onBaudRateTimer();
+    void onThroughputTimer();
+
+private:
+    static const int HANDSHAKE_DELAY_MS = 2000; // Opening the port resets most Arduinos
+    static const int HANDSHAKE_TIMEOUT_MS = 1000;
+    static const int MAX_HANDSHAKE_ATTEMPTS = 3;
+
+    // Time for the hardware to act on a baud rate command before we follow it, counted from when
+    // the port has nothing left to write. Until then we check back every BAUD_DRAIN_POLL_MS.
+    static const int BAUD_SWITCH_DELAY_MS = 100;
+    static const int BAUD_DRAIN_POLL_MS = 10;
+
+    // The hardware goes back to its initial rate when the new one isn't confirmed within
+    // BAUD_CONFIRM_TIMEOUT_MS of the baud rate command (see keg_meter_protocol in the sketches), so
+    // every handshake attempt at the new rate must be answered well within that
+    static const int FIRMWARE_BAUD_CONFIRM_TIMEOUT_MS = 2000;
+    static const int SWITCHED_HANDSHAKE_TIMEOUT_MS = 500;
+
+    static const int MAX_CONSECUTIVE_CORRUPT_PACKETS = 5;
+
+    static const int THROUGHPUT_LOG_DELAY_MS = 10000;
+
+    // With time to spare for the baud rate command going out and the last answer coming back
+    static_assert(BAUD_SWITCH_DELAY_MS + MAX_HANDSHAKE_ATTEMPTS*SWITCHED_HANDSHAKE_TIMEOUT_MS <=
+                  FIRMWARE_BAUD_CONFIRM_TIMEOUT_MS - 250,
+                  "The handshakes after a baud rate switch must fit in the hardware's confirm window");
+
+    enum BaudState { InitialBaud, SwitchingBaud, RevertingBaud, UpgradedBaud };
+
+    QSerialPort* serialPort; // Not owned by this
+    QString handshakeCmdFormat;
+    QString baudRateCmdFormat;
+
+    Mode mode;
+    int numHandshakeAttempts;
+    QTimer handshakeTimer;
+
+    BaudState baudState;
+    qint32 initialBaudRate;
+    qint32 maxBaudRate;
+    qint32 targetBaudRate;
+    bool baudUpgradeFailed;
+    bool baudCmdDraining;
+    int numConsecutiveCorruptPackets;
+    QTimer baudRateTimer;
+
+    quint64 numBytesRead;
+    quint64 numPacketsRead;
+    QElapsedTimer throughputClock;
+    QTimer throughputTimer;
+
+    bool isPortOpen() const;
+    void writeCommand(const QString& command);
+    void switchBaudRate(int baudRateIdx);
+    void revertBaudRate(const QString& reason);
+    void followBaudRateCmd();
+    void fallBackToAscii(const QString& reason);
+    void finishNegotiating();
+};
+
+#endif // KEGMETERCOMMON_SERIALNEGOTIATOR_H
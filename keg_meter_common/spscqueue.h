@@ -0,0 +1,72 @@
+#ifndef KEGMETERCOMMON_SPSCQUEUE_H
+#define KEGMETERCOMMON_SPSCQUEUE_H
+
+#include <atomic>
+#include <cstddef>
+
+/**
+ * Bounded, lock-free, single-producer/single-consumer queue.
+ *
+ * Exactly one thread may push() and exactly one (other) thread may pop(); neither side ever
+ * blocks. When the queue is full push() fails and the caller decides what to drop.
+ */
+template <typename T, int CAPACITY>
+class SpscQueue {
+public:
+    SpscQueue() : head(0), tail(0) {
+        static_assert((CAPACITY & (CAPACITY - 1)) == 0, "SpscQueue capacity must be a power of two");
+    }
+    ~SpscQueue() {}
+
+    // Producer side
+    bool push(const T& item) {
+        std::size_t currTail = this->tail.load(std::memory_order_relaxed);
+        if (currTail - this->head.load(std::memory_order_acquire) == static_cast<std::size_t>(CAPACITY)) {
+            return false;
+        }
+        this->items[currTail & INDEX_MASK] = item;
+        this->tail.store(currTail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side
+    bool pop(T& item) {
+        std::size_t currHead = this->head.load(std::memory_order_relaxed);
+        if (currHead == this->tail.load(std::memory_order_acquire)) {
+            return false;
+        }
+        item = this->items[currHead & INDEX_MASK];
+        this->head.store(currHead + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side: pop up to maxItems in one go, returns the number of items popped
+    int popBatch(T* outItems, int maxItems) {
+        std::size_t currHead = this->head.load(std::memory_order_relaxed);
+        std::size_t available = this->tail.load(std::memory_order_acquire) - currHead;
+        int numToPop = available < static_cast<std::size_t>(maxItems) ? static_cast<int>(available) : maxItems;
+        for (int i = 0; i < numToPop; i++) {
+            outItems[i] = this->items[(currHead + i) & INDEX_MASK];
+        }
+        this->head.store(currHead + numToPop, std::memory_order_release);
+        return numToPop;
+    }
+
+    bool isEmpty() const {
+        return this->head.load(std::memory_order_acquire) == this->tail.load(std::memory_order_acquire);
+    }
+
+private:
+    static const std::size_t INDEX_MASK = CAPACITY - 1;
+
+    T items[CAPACITY];
+
+    // Keep the producer and consumer indices on separate cache lines
+    alignas(64) std::atomic<std::size_t> head;
+    alignas(64) std::atomic<std::size_t> tail;
+
+    SpscQueue(const SpscQueue&);
+    SpscQueue& operator=(const SpscQueue&);
+};
+
+#endif // KEGMETERCOMMON_SPSCQUEUE_H
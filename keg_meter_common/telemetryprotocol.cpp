@@ -0,0 +1,238 @@
+#include "telemetryprotocol.h"
+
+#include <QDataStream>
+
+namespace {
+
+void setupStream(QDataStream& stream) {
+    stream.setVersion(QDataStream::Qt_5_0);
+    stream.setByteOrder(QDataStream::BigEndian);
+    stream.setFloatingPointPrecision(QDataStream::SinglePrecision);
+}
+
+// Messages are written with a zero size first, which is patched once the payload is complete
+void finishMessage(QByteArray& message) {
+    quint32 size = message.size() - 4;
+    message[0] = static_cast<char>((size >> 24) & 0xFF);
+    message[1] = static_cast<char>((size >> 16) & 0xFF);
+    message[2] = static_cast<char>((size >> 8) & 0xFF);
+    message[3] = static_cast<char>(size & 0xFF);
+}
+
+void writeString(QDataStream& stream, const QString& str) {
+    QByteArray utf8 = str.toUtf8().left(0xFFFF);
+    stream << static_cast<quint16>(utf8.size());
+    stream.writeRawData(utf8.constData(), utf8.size());
+}
+
+bool readString(QDataStream& stream, QString& str) {
+    quint16 size = 0;
+    stream >> size;
+    QByteArray utf8(size, '\0');
+    if (stream.readRawData(utf8.data(), size) != size) {
+        return false;
+    }
+    str = QString::fromUtf8(utf8);
+    return true;
+}
+
+}
+
+QByteArray TelemetryProtocol::encodeGreeting(const QString& name, quint16 numMeters) {
+    QByteArray message;
+    QDataStream out(&message, QIODevice::WriteOnly);
+    setupStream(out);
+    out << static_cast<quint32>(0) << static_cast<quint8>(GreetingMessage);
+
+    out << PROTOCOL_VERSION;
+    writeString(out, name);
+    out << numMeters;
+
+    finishMessage(message);
+    return message;
+}
+
+QByteArray TelemetryProtocol::encodeSubscribe(const QVector<quint16>& meterIdxs) {
+    QByteArray message;
+    QDataStream out(&message, QIODevice::WriteOnly);
+    setupStream(out);
+    out << static_cast<quint32>(0) << static_cast<quint8>(SubscribeMessage);
+
+    out << static_cast<quint16>(meterIdxs.size());
+    foreach (quint16 meterIdx, meterIdxs) {
+        out << meterIdx;
+    }
+
+    finishMessage(message);
+    return message;
+}
+
+QByteArray TelemetryProtocol::encodeSnapshot(quint32 version, qint64 timeMs, const QVector<MeterState>& states) {
+    QByteArray message;
+    QDataStream out(&message, QIODevice::WriteOnly);
+    setupStream(out);
+    out << static_cast<quint32>(0) << static_cast<quint8>(SnapshotMessage);
+
+    out << version << timeMs << static_cast<quint16>(states.size());
+    foreach (const MeterState& state, states) {
+        out << state.meterIdx << state.status << state.percent << state.load << state.variance;
+    }
+
+    finishMessage(message);
+    return message;
+}
+
+QByteArray TelemetryProtocol::encodeDelta(quint32 baseVersion, quint32 version, qint64 timeMs, const QVector<MeterDelta>& deltas) {
+    QByteArray message;
+    QDataStream out(&message, QIODevice::WriteOnly);
+    setupStream(out);
+    out << static_cast<quint32>(0) << static_cast<quint8>(DeltaMessage);
+
+    out << baseVersion << version << timeMs << static_cast<quint16>(deltas.size());
+    foreach (const MeterDelta& delta, deltas) {
+        out << delta.state.meterIdx << delta.fieldMask;
+        if (delta.fieldMask & (1 << StatusField))   { out << delta.state.status; }
+        if (delta.fieldMask & (1 << PercentField))  { out << delta.state.percent; }
+        if (delta.fieldMask & (1 << LoadField))     { out << delta.state.load; }
+        if (delta.fieldMask & (1 << VarianceField)) { out << delta.state.variance; }
+    }
+
+    finishMessage(message);
+    return message;
+}
+
+QByteArray TelemetryProtocol::encodeToken(MessageType type, quint32 token) {
+    QByteArray message;
+    QDataStream out(&message, QIODevice::WriteOnly);
+    setupStream(out);
+    out << static_cast<quint32>(0) << static_cast<quint8>(type) << token;
+
+    finishMessage(message);
+    return message;
+}
+
+QByteArray TelemetryProtocol::encodeHeartbeat(MessageType type, quint32 token, qint64 timeUs) {
+    QByteArray message;
+    QDataStream out(&message, QIODevice::WriteOnly);
+    setupStream(out);
+    out << static_cast<quint32>(0) << static_cast<quint8>(type) << token << timeUs;
+
+    finishMessage(message);
+    return message;
+}
+
+QByteArray TelemetryProtocol::encodePour(const Pour& pour) {
+    QByteArray message;
+    QDataStream out(&message, QIODevice::WriteOnly);
+    setupStream(out);
+    out << static_cast<quint32>(0) << static_cast<quint8>(PourMessage);
+
+    out << pour.meterIdx << pour.startMs << pour.endMs << pour.litres;
+
+    finishMessage(message);
+    return message;
+}
+
+TelemetryProtocol::ReadResult TelemetryProtocol::readMessage(const QByteArray& buffer, int& readOffset,
+                                                             MessageType& type, QByteArray& payload) {
+    if (buffer.size() - readOffset < HEADER_SIZE) {
+        return NeedMoreData;
+    }
+
+    const uchar* header = reinterpret_cast<const uchar*>(buffer.constData() + readOffset);
+    quint32 size = (static_cast<quint32>(header[0]) << 24) | (static_cast<quint32>(header[1]) << 16) |
+                   (static_cast<quint32>(header[2]) << 8) | static_cast<quint32>(header[3]);
+    if (size < 1 || size > MAX_MESSAGE_SIZE) {
+        return InvalidMessage;
+    }
+    if (static_cast<quint32>(buffer.size() - readOffset - 4) < size) {
+        return NeedMoreData;
+    }
+
+    type = static_cast<MessageType>(header[4]);
+    payload = buffer.mid(readOffset + HEADER_SIZE, size - 1);
+    readOffset += 4 + size;
+    return MessageRead;
+}
+
+bool TelemetryProtocol::decodeGreeting(const QByteArray& payload, quint16& version, QString& name, quint16& numMeters) {
+    QDataStream in(payload);
+    setupStream(in);
+
+    in >> version;
+    if (!readString(in, name)) {
+        return false;
+    }
+    in >> numMeters;
+    return in.status() == QDataStream::Ok;
+}
+
+bool TelemetryProtocol::decodeSubscribe(const QByteArray& payload, QVector<quint16>& meterIdxs) {
+    QDataStream in(payload);
+    setupStream(in);
+
+    quint16 numMeters = 0;
+    in >> numMeters;
+    meterIdxs.resize(numMeters);
+    for (int i = 0; i < numMeters && in.status() == QDataStream::Ok; i++) {
+        in >> meterIdxs[i];
+    }
+    return in.status() == QDataStream::Ok;
+}
+
+bool TelemetryProtocol::decodeSnapshot(const QByteArray& payload, quint32& version, qint64& timeMs, QVector<MeterState>& states) {
+    QDataStream in(payload);
+    setupStream(in);
+
+    quint16 numMeters = 0;
+    in >> version >> timeMs >> numMeters;
+    states.resize(numMeters);
+    for (int i = 0; i < numMeters && in.status() == QDataStream::Ok; i++) {
+        MeterState& state = states[i];
+        in >> state.meterIdx >> state.status >> state.percent >> state.load >> state.variance;
+    }
+    return in.status() == QDataStream::Ok;
+}
+
+bool TelemetryProtocol::decodeDelta(const QByteArray& payload, quint32& baseVersion, quint32& version, qint64& timeMs,
+                                    QVector<MeterDelta>& deltas) {
+    QDataStream in(payload);
+    setupStream(in);
+
+    quint16 numMeters = 0;
+    in >> baseVersion >> version >> timeMs >> numMeters;
+    deltas.resize(numMeters);
+    for (int i = 0; i < numMeters && in.status() == QDataStream::Ok; i++) {
+        MeterDelta& delta = deltas[i];
+        in >> delta.state.meterIdx >> delta.fieldMask;
+        if (delta.fieldMask & (1 << StatusField))   { in >> delta.state.status; }
+        if (delta.fieldMask & (1 << PercentField))  { in >> delta.state.percent; }
+        if (delta.fieldMask & (1 << LoadField))     { in >> delta.state.load; }
+        if (delta.fieldMask & (1 << VarianceField)) { in >> delta.state.variance; }
+    }
+    return in.status() == QDataStream::Ok;
+}
+
+bool TelemetryProtocol::decodeToken(const QByteArray& payload, quint32& token) {
+    QDataStream in(payload);
+    setupStream(in);
+
+    in >> token;
+    return in.status() == QDataStream::Ok;
+}
+
+bool TelemetryProtocol::decodeHeartbeat(const QByteArray& payload, quint32& token, qint64& timeUs) {
+    QDataStream in(payload);
+    setupStream(in);
+
+    in >> token >> timeUs;
+    return in.status() == QDataStream::Ok;
+}
+
+bool TelemetryProtocol::decodePour(const QByteArray& payload, Pour& pour) {
+    QDataStream in(payload);
+    setupStream(in);
+
+    in >> pour.meterIdx >> pour.startMs >> pour.endMs >> pour.litres;
+    return in.status() == QDataStream::Ok;
+}
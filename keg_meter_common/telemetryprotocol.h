@@ -0,0 +1,125 @@
+#ifndef KEGMETERCOMMON_TELEMETRYPROTOCOL_H
+#define KEGMETERCOMMON_TELEMETRYPROTOCOL_H
+
+#include <QByteArray>
+#include <QString>
+#include <QVector>
+
+/**
+ * Messages of the TCP telemetry protocol, used to stream keg meter state to remote dashboards.
+ *
+ * Every message is length-prefixed: <size: quint32> <type: quint8> <payload>, where size counts
+ * the type byte and the payload. All numbers are big-endian, floats are IEEE 754 single precision
+ * and strings are <length: quint16> followed by that many bytes of UTF-8, so clients don't need Qt
+ * to speak the protocol.
+ *
+ * Both ends start by sending a greeting, nothing else is accepted before it. A client then
+ * subscribes to the meters it wants to follow and gets a snapshot of their full state. From then
+ * on it gets deltas with only the fields that changed. Every state the server publishes has a
+ * version, a delta applies to any state at or after its base version, and clients acknowledge the
+ * versions they've applied. A client that falls too far behind only gets a snapshot every so often
+ * until it catches up again. Snapshots and deltas came with version 2, they replaced the
+ * unversioned state updates of version 1 (with the same 'U' type). Since version 3 pings carry
+ * the sender's time and pongs echo it, so every pong is a round-trip time.
+ *
+ * Since version 4 the server also sends every pour it detects on a meter the client follows. Either
+ * end may speak any version from MIN_PROTOCOL_VERSION up, the server only sends clients what their
+ * version has. Versions 1 and 2 are refused: their snapshots and pings are laid out differently
+ * and the server only speaks today's layout.
+ */
+class TelemetryProtocol {
+public:
+    static const quint16 PROTOCOL_VERSION = 4;
+    static const quint16 MIN_PROTOCOL_VERSION = 3;
+    static const quint16 POUR_MESSAGE_VERSION = 4;
+
+    static const int HEADER_SIZE = 5;
+    static const int MAX_MESSAGE_SIZE = 64*1024;
+
+    enum MessageType {
+        GreetingMessage    = 'G', // Payload: <protocol version: quint16> <name: string> <number of meters: quint16>
+        SubscribeMessage   = 'S', // Payload: <number of meters: quint16> <meter index: quint16>..., none means all meters
+        SnapshotMessage    = 'U', // Payload: <version: quint32> <server time in ms since the epoch: qint64>
+                                  //          <number of meters: quint16> and then per meter:
+                                  //          <meter index: quint16> <status: quint8> <percent: float>
+                                  //          <load: float> <variance: float>
+        DeltaMessage       = 'D', // Payload: <base version: quint32> <version: quint32> <server time: qint64>
+                                  //          <number of meters: quint16> and then per meter:
+                                  //          <meter index: quint16> <field mask: quint8> and the fields
+                                  //          in the mask, in the same order as in a snapshot
+        AckMessage         = 'A', // Payload: <version: quint32>, the latest version the client applied
+        PingMessage        = 'P', // Payload: <token: quint32> <sender's time in us: qint64>, the time since version 3
+        PongMessage        = 'O', // Payload: <token: quint32> <time in us: qint64>, both echoed from the ping
+        PourMessage        = 'E'  // Payload: <meter index: quint16> <start time in ms since the epoch: qint64>
+                                  //          <end time: qint64> <litres: float>, since version 4
+    };
+
+    enum StateField {
+        StatusField   = 0,
+        PercentField  = 1,
+        LoadField     = 2,
+        VarianceField = 3,
+        NUM_STATE_FIELDS
+    };
+    static const quint8 ALL_FIELDS_MASK = (1 << NUM_STATE_FIELDS) - 1;
+
+    enum MeterStatus {
+        SensorCalibrationStatus = 0, // The load sensor itself is being calibrated
+        EmptyStatus             = 1, // No keg (or an empty one) on the meter
+        KegCalibrationStatus    = 2, // A keg was just put on the meter
+        MeasuringStatus         = 3
+    };
+
+    struct MeterState {
+        quint16 meterIdx;
+        quint8 status;
+        float percent;
+        float load;
+        float variance;
+    };
+
+    struct MeterDelta {
+        quint8 fieldMask;
+        MeterState state; // Only the fields in the mask are valid
+    };
+
+    struct Pour {
+        quint16 meterIdx;
+        qint64 startMs;
+        qint64 endMs;
+        float litres;
+    };
+
+    enum ReadResult { NeedMoreData, MessageRead, InvalidMessage };
+
+    static QByteArray encodeGreeting(const QString& name, quint16 numMeters);
+    static QByteArray encodeSubscribe(const QVector<quint16>& meterIdxs);
+    static QByteArray encodeSnapshot(quint32 version, qint64 timeMs, const QVector<MeterState>& states);
+    static QByteArray encodeDelta(quint32 baseVersion, quint32 version, qint64 timeMs, const QVector<MeterDelta>& deltas);
+    static QByteArray encodeAck(quint32 version) { return encodeToken(AckMessage, version); }
+    static QByteArray encodePing(quint32 token, qint64 timeUs) { return encodeHeartbeat(PingMessage, token, timeUs); }
+    static QByteArray encodePong(quint32 token, qint64 timeUs) { return encodeHeartbeat(PongMessage, token, timeUs); }
+    static QByteArray encodePour(const Pour& pour);
+
+    // Take the next message (if it's complete) out of buffer, starting at readOffset. On success
+    // readOffset is moved past the message.
+    static ReadResult readMessage(const QByteArray& buffer, int& readOffset, MessageType& type, QByteArray& payload);
+
+    // Payload decoders, these return false if the payload is malformed
+    static bool decodeGreeting(const QByteArray& payload, quint16& version, QString& name, quint16& numMeters);
+    static bool decodeSubscribe(const QByteArray& payload, QVector<quint16>& meterIdxs);
+    static bool decodeSnapshot(const QByteArray& payload, quint32& version, qint64& timeMs, QVector<MeterState>& states);
+    static bool decodeDelta(const QByteArray& payload, quint32& baseVersion, quint32& version, qint64& timeMs,
+                            QVector<MeterDelta>& deltas);
+    static bool decodeToken(const QByteArray& payload, quint32& token);
+    static bool decodeHeartbeat(const QByteArray& payload, quint32& token, qint64& timeUs);
+    static bool decodePour(const QByteArray& payload, Pour& pour);
+
+private:
+    TelemetryProtocol() {}
+
+    static QByteArray encodeToken(MessageType type, quint32 token);
+    static QByteArray encodeHeartbeat(MessageType type, quint32 token, qint64 timeUs);
+};
+
+#endif // KEGMETERCOMMON_TELEMETRYPROTOCOL_H
@@ -35,3 +35,5 @@ HEADERS  += mainwindow.h \
 FORMS    += mainwindow.ui \
     kegmeter.ui \
     serialsearchandconnectdialog.ui
+
+include(../../keg_meter_common/keg_meter_common.pri)
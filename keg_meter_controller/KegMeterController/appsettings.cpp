@@ -1,4 +1,11 @@
 #include "appsettings.h"
 
-const char* AppSettings::KEG_DATA_KEY = "keg_meter_data";
+const char* AppSettings::KEG_DATA_KEY      = "keg_meter_data";
+const char* AppSettings::MAX_BAUD_RATE     = "max_baud_rate";
+const char* AppSettings::SERIAL_PORT_NAMES = "serial_port_names";
+
+// Older versions kept the data of every meter in the settings, under the key and the meter index
+QString AppSettings::buildLegacyKegDataKey(int meterIdx, const char* key) {
+    return QString(key) + QString("/") + QString::number(meterIdx);
+}
 
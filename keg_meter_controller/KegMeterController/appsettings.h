@@ -1,9 +1,15 @@
 #ifndef KEGMETERCONTROLLER_APPSETTINGS_H
 #define KEGMETERCONTROLLER_APPSETTINGS_H
 
+#include <QString>
+
 class AppSettings {
 public:
     static const char* KEG_DATA_KEY;
+    static const char* MAX_BAUD_RATE;
+    static const char* SERIAL_PORT_NAMES;
+
+    static QString buildLegacyKegDataKey(int meterIdx, const char* key);
 
 };
 
@@ -2,7 +2,6 @@
 #define KEGMETERCONTROLLER_KEGMETER_H
 
 #include <QWidget>
-#include <QTimer>
 
 #include "kegmeterdata.h"
 
@@ -12,32 +11,33 @@ class KegMeter;
 
 class AbstractComm;
 
+/**
+ * Shows the data of a keg meter. The data itself is kept by the main window, which also takes care
+ * of timing out meters that have stopped sending, there may be dozens of these.
+ */
 class KegMeter : public QWidget {
     Q_OBJECT
 public:
-    explicit KegMeter(int id, AbstractComm* comm, QWidget* parent);
+    // The index is the meter's index on the wire, the id is only what it's known as to people
+    KegMeter(int index, int id, AbstractComm* comm, QWidget* parent);
     ~KegMeter();
 
     int getId() const { return this->id; }
-    int getIndex() const { return this->id-1; }
+    int getIndex() const { return this->index; }
 
     void setData(const KegMeterData& data);
-    const KegMeterData& getData() const { return this->currData; }
+    void clearData();
 
 private slots:
     void onEmptyCalibration();
     void onReset();
-    void onDataTimeout();
 
 private:
     AbstractComm* comm; // Not owned by this
 
     Ui::KegMeter* ui;
+    int index;
     int id;
-    KegMeterData currData;
-
-    static const int DATA_TIMEOUT_MS = 10000;
-    QTimer timer;
 };
 
 #endif // KEGMETERCONTROLLER_KEGMETER_H
@@ -18,6 +18,24 @@ KegMeterData::KegMeterData(const KegMeterData& copy) {
     *this = copy;
 }
 
+void KegMeterData::merge(const KegMeterData& data) {
+    if (data.hasPercent) {
+        this->setPercent(data.percent);
+    }
+    if (data.hasEmptyMass) {
+        this->setEmptyMass(data.emptyMass);
+    }
+    if (data.hasFullMass) {
+        this->setFullMass(data.fullMass);
+    }
+    if (data.hasLoad) {
+        this->setLoad(data.load);
+    }
+    if (data.hasVariance) {
+        this->setVariance(data.variance);
+    }
+}
+
 QString KegMeterData::buildUpdateSerialStr(int meterIdx) const {
     assert(meterIdx >= 0);
 
@@ -65,6 +65,9 @@ public:
         return this->variance;
     }
 
+    // Take on whatever data has, leaving everything else as it is
+    void merge(const KegMeterData& data);
+
     QString buildUpdateSerialStr(int meterIdx) const;
 
     KegMeterData& operator=(const KegMeterData& copy);
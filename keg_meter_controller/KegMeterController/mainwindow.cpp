@@ -5,6 +5,9 @@
 #include "kegmeterdata.h"
 #include "serialcomm.h"
 #include "appsettings.h"
+#include "meterstatestore.h"
+#include "meterconfig.h"
+#include "logmodel.h"
 
 #include <cassert>
 #include <cmath>
@@ -15,33 +18,48 @@
 #include <QSerialPortInfo>
 #include <QLabel>
 #include <QScrollArea>
-#include <QScrollBar>
 #include <QTextStream>
-#include <QSettings>
 #include <QMessageBox>
+#include <QDateTime>
 
 MainWindow::MainWindow(QWidget *parent) :
     QMainWindow(parent),
     ui(new Ui::MainWindow()) {
 
     this->ui->setupUi(this);
+    this->setupLogs();
+
+    QVector<int> kegMeterIds = MeterConfig::readMeterIds();
+    int numKegMeters = kegMeterIds.size();
+
+    this->stateStore = new MeterStateStore(MeterStateStore::defaultFilePath(), this);
+    if (!this->stateStore->load()) {
+        this->migrateLegacySettings(numKegMeters);
+    }
+    this->connect(this->stateStore, SIGNAL(flushed(int)), this, SLOT(onStateStoreFlushed(int)));
+    this->connect(this->stateStore, SIGNAL(flushFailed(const QString&)), this, SLOT(onStateStoreFlushFailed(const QString&)));
 
     this->comm = new SerialComm(this);
 
+    for (int i = 0; i < numKegMeters; i++) {
+        this->kegMeterData.push_back(KegMeterData(i));
+    }
+    this->lastDataTimeMs.fill(0, numKegMeters);
+
     QHBoxLayout* mainLayout = new QHBoxLayout();
 
     const int KEG_METERS_PER_COL = 3;
-    int numLoops = ceil(static_cast<float>(NUM_KEG_METERS) / static_cast<float>(KEG_METERS_PER_COL));
+    int numLoops = ceil(static_cast<float>(numKegMeters) / static_cast<float>(KEG_METERS_PER_COL));
     for (int i = 0; i < numLoops; i++) {
         QVBoxLayout* vLayout = new QVBoxLayout();
         for (int j = i*KEG_METERS_PER_COL; j < i*KEG_METERS_PER_COL+KEG_METERS_PER_COL; j++) {
 
-            if (j >= NUM_KEG_METERS) {
+            if (j >= numKegMeters) {
                 vLayout->addItem(new QSpacerItem(20, 40, QSizePolicy::Minimum, QSizePolicy::Expanding));
                 break;
             }
             else {
-                KegMeter* meter = new KegMeter(j+1, this->comm, this);
+                KegMeter* meter = new KegMeter(j, kegMeterIds[j], this->comm, this);
                 this->kegMeters.push_back(meter);
                 vLayout->addWidget(meter);
             }
@@ -49,7 +67,18 @@ MainWindow::MainWindow(QWidget *parent) :
         mainLayout->addLayout(vLayout);
     }
 
-    this->ui->centralWidget->setLayout(mainLayout);
+    // There can be more meters than fit on the screen, scroll through them
+    QWidget* metersWidget = new QWidget();
+    metersWidget->setLayout(mainLayout);
+    QScrollArea* metersScrollArea = new QScrollArea();
+    metersScrollArea->setWidget(metersWidget);
+    metersScrollArea->setWidgetResizable(true);
+    metersScrollArea->setFrameShape(QFrame::NoFrame);
+
+    QVBoxLayout* centralLayout = new QVBoxLayout();
+    centralLayout->setContentsMargins(0, 0, 0, 0);
+    centralLayout->addWidget(metersScrollArea);
+    this->ui->centralWidget->setLayout(centralLayout);
     this->setWindowTitle("Halo Keg Meter Control Panel");
 
     this->connect(this->comm, SIGNAL(kegMeterDataAvailable(const KegMeterData&)), this, SLOT(onKegMeterData(const KegMeterData&)));
@@ -62,12 +91,20 @@ MainWindow::MainWindow(QWidget *parent) :
     this->serialInfoDialog = new QDialog(this);
     this->serialInfoDialog->setFixedSize(375, 400);
     this->serialInfoDialog->setWindowTitle("Serial Port Info");
+
+    this->connect(&this->dataTimeoutTimer, SIGNAL(timeout()), this, SLOT(onDataTimeoutTimer()));
+    this->dataTimeoutTimer.start(DATA_TIMEOUT_CHECK_INTERVAL_MS);
 }
 
 MainWindow::~MainWindow() {
+    for (int i = 0; i < this->kegMeterData.size(); i++) {
+        this->writeKegMeterDataToStore(i);
+    }
 
-
-    this->writeKegMeterDataToSettings();
+    // Write out any state that hasn't been flushed yet
+    this->stateStore->disconnect(this);
+    delete this->stateStore;
+    this->stateStore = NULL;
 
     delete this->serialInfoDialog;
     this->serialInfoDialog = NULL;
@@ -80,13 +117,11 @@ MainWindow::~MainWindow() {
 }
 
 void MainWindow::log(const QString& logStr, bool newLine) {
-    this->ui->appLogTextEdit->insertPlainText(logStr + (newLine ? tr("\n") : tr("")));
-    this->ui->appLogTextEdit->verticalScrollBar()->setValue(this->ui->appLogTextEdit->verticalScrollBar()->maximum());
+    this->appLogModel->append(logStr + (newLine ? tr("\n") : tr("")));
 }
 
 void MainWindow::commLog(const QString& logStr) {
-    this->ui->serialLogTextEdit->insertPlainText(logStr);
-    this->ui->serialLogTextEdit->verticalScrollBar()->setValue(this->ui->serialLogTextEdit->verticalScrollBar()->maximum());   
+    this->serialLogModel->append(logStr);
 }
 
 void MainWindow::onCommClosed() {
@@ -94,13 +129,38 @@ void MainWindow::onCommClosed() {
     foreach (KegMeter* meter, this->kegMeters) {
         meter->setEnabled(false);
     }
+    this->lastDataTimeMs.fill(0);
 }
 
 void MainWindow::onKegMeterData(const KegMeterData& data) {
-    KegMeter* meter = this->kegMeters.at(data.getIndex());
-    assert(meter != NULL);
-    meter->setData(data);
-    this->writeKegMeterDataToSettings();
+    int meterIdx = data.getIndex();
+    if (meterIdx < 0 || meterIdx >= this->kegMeterData.size()) {
+        return;
+    }
+
+    this->kegMeterData[meterIdx].merge(data);
+    this->lastDataTimeMs[meterIdx] = QDateTime::currentMSecsSinceEpoch();
+    this->kegMeters.at(meterIdx)->setData(data);
+    this->writeKegMeterDataToStore(meterIdx);
+}
+
+void MainWindow::onDataTimeoutTimer() {
+    qint64 timeoutMs = QDateTime::currentMSecsSinceEpoch() - DATA_TIMEOUT_MS;
+    for (int i = 0; i < this->lastDataTimeMs.size(); i++) {
+        if (this->lastDataTimeMs[i] != 0 && this->lastDataTimeMs[i] < timeoutMs) {
+            this->lastDataTimeMs[i] = 0;
+            this->kegMeters.at(i)->clearData();
+        }
+    }
+}
+
+void MainWindow::onStateStoreFlushed(int numUpdates) {
+    this->log(tr("Saved keg meter state (%1 update(s) in one write, %2 coalesced in total)")
+              .arg(numUpdates).arg(this->stateStore->getNumCoalescedUpdates()));
+}
+
+void MainWindow::onStateStoreFlushFailed(const QString& errorStr) {
+    this->log(tr("Failed to save keg meter state: %1").arg(errorStr));
 }
 
 void MainWindow::onSerialSearchAndConnectDialogActionTriggered() {
@@ -138,23 +198,41 @@ void MainWindow::onSerialInfoActionTriggered() {
     this->serialInfoDialog->show();
 }
 
-void MainWindow::writeKegMeterDataToSettings() const {
-    QSettings settings;
+void MainWindow::writeKegMeterDataToStore(int meterIdx) {
+    // This only updates the in-memory state, the store takes care of (lazily) writing it to disk
     bool temp;
-    for (auto iter = this->kegMeters.cbegin(); iter != this->kegMeters.cend(); ++iter) {
-        const KegMeter* meter = *iter;
-
-        // Check to see if there's any actual data... if there isn't then don't overwrite it!
-        QVariant existingData = settings.value(QString(AppSettings::KEG_DATA_KEY) + QString("/") + QString::number(meter->getIndex()));
-        if (!existingData.isNull()) {
-            KegMeterData existingMeterData = existingData.value<KegMeterData>();
-            if ((meter->getData().buildUpdateSerialStr(meter->getIndex()).isEmpty() ||
-                 meter->getData().getPercent(temp) <= 0.0) &&
-                !existingMeterData.buildUpdateSerialStr(meter->getIndex()).isEmpty()) {
-                continue;
-            }
+    const KegMeterData& data = this->kegMeterData.at(meterIdx);
+
+    // Check to see if there's any actual data... if there isn't then don't overwrite it!
+    QVariant existingData = this->stateStore->value(meterIdx, AppSettings::KEG_DATA_KEY);
+    if (!existingData.isNull()) {
+        KegMeterData existingMeterData = existingData.value<KegMeterData>();
+        if ((data.buildUpdateSerialStr(meterIdx).isEmpty() ||
+             data.getPercent(temp) <= 0.0) &&
+            !existingMeterData.buildUpdateSerialStr(meterIdx).isEmpty()) {
+            return;
         }
+    }
+
+    this->stateStore->setValue(meterIdx, AppSettings::KEG_DATA_KEY, QVariant::fromValue(data));
+}
 
-        settings.setValue(QString(AppSettings::KEG_DATA_KEY) + QString("/") + QString::number(meter->getIndex()), QVariant::fromValue(meter->getData()));
+void MainWindow::setupLogs() {
+    this->appLogModel = new LogModel(MAX_NUM_APP_LOG_LINES, this);
+    this->serialLogModel = new LogModel(MAX_NUM_SERIAL_LOG_LINES, this);
+    this->ui->appLogView->setModel(this->appLogModel);
+    this->ui->serialLogView->setModel(this->serialLogModel);
+
+    // Optionally keep a full record of both logs on disk as well
+    QString logDirPath;
+    if (!MeterConfig::setupLogFiles(this->appLogModel, this->serialLogModel, logDirPath)) {
+        this->log(tr("Failed to open the log files in %1").arg(logDirPath));
     }
 }
+
+void MainWindow::migrateLegacySettings(int numKegMeters) {
+    // Older versions kept the meter state in QSettings, carry it over the first time we run
+    const char* LEGACY_KEYS[] = { AppSettings::KEG_DATA_KEY };
+    MeterConfig::migrateLegacySettings(this->stateStore, numKegMeters, LEGACY_KEYS,
+                                       sizeof(LEGACY_KEYS) / sizeof(LEGACY_KEYS[0]), AppSettings::buildLegacyKegDataKey);
+}
@@ -2,10 +2,15 @@
 #define KEGMETERCONTROLLER_MAINWINDOW_H
 
 #include <QMainWindow>
+#include <QTimer>
+#include <QVector>
+
+#include "kegmeterdata.h"
 
 class AbstractComm;
 class KegMeter;
-class KegMeterData;
+class MeterStateStore;
+class LogModel;
 
 namespace Ui {
 class MainWindow;
@@ -20,10 +25,12 @@ public:
 
     int getNumKegMeters() const { return this->kegMeters.size(); }
 
+    MeterStateStore* getStateStore() const { return this->stateStore; }
+
     void log(const QString& logStr, bool newLine = true);
     void commLog(const QString& logStr);
 
-    void writeKegMeterDataToSettings() const;
+    void writeKegMeterDataToStore(int meterIdx);
 
 public slots:
     void onKegMeterData(const KegMeterData& data);
@@ -32,15 +39,36 @@ public slots:
 private slots:
     void onSerialSearchAndConnectDialogActionTriggered();
     void onSerialInfoActionTriggered();
+    void onStateStoreFlushed(int numUpdates);
+    void onStateStoreFlushFailed(const QString& errorStr);
+    void onDataTimeoutTimer();
 
 private:
     Ui::MainWindow* ui;
 
     AbstractComm* comm;
+    MeterStateStore* stateStore;
+    LogModel* appLogModel;
+    LogModel* serialLogModel;
     QDialog* serialInfoDialog;
 
-    static const int NUM_KEG_METERS = 8;
+    static const int MAX_NUM_APP_LOG_LINES = 5000;
+    static const int MAX_NUM_SERIAL_LOG_LINES = 5000;
+
     QList<KegMeter*> kegMeters;
+
+    // The last known data of every meter and when it came in, by meter index
+    QVector<KegMeterData> kegMeterData;
+    QVector<qint64> lastDataTimeMs;
+
+    // One timer for all of the meters, a meter that hasn't sent anything in DATA_TIMEOUT_MS is
+    // shown as disconnected
+    static const int DATA_TIMEOUT_MS = 10000;
+    static const int DATA_TIMEOUT_CHECK_INTERVAL_MS = 1000;
+    QTimer dataTimeoutTimer;
+
+    void setupLogs();
+    void migrateLegacySettings(int numKegMeters);
 };
 
 #endif // KEGMETERCONTROLLER_MAINWINDOW_H
@@ -4,15 +4,23 @@
 #include "kegmeter.h"
 #include "appsettings.h"
 #include "serialsearchandconnectdialog.h"
+#include "meterstatestore.h"
 
+#include <QFile>
 #include <QSettings>
 #include <QSerialPortInfo>
 
 SerialComm::SerialComm(MainWindow* mainWindow) :
     AbstractComm(mainWindow),
     serialPort(new QSerialPort()),
+    framer('[', ']'),
+    negotiator("|B%1", "|S%1"),
+    maxBaudRate(DEFAULT_MAX_BAUD_RATE),
     bytesWritten(0) {
 
+    QSettings settings;
+    this->maxBaudRate = settings.value(AppSettings::MAX_BAUD_RATE, static_cast<int>(DEFAULT_MAX_BAUD_RATE)).toInt();
+
     this->serialPort->setBaudRate(QSerialPort::Baud9600);
     this->serialPort->setParity(QSerialPort::NoParity);
     this->serialPort->setStopBits(QSerialPort::OneStop);
@@ -29,6 +37,9 @@ SerialComm::SerialComm(MainWindow* mainWindow) :
 
     this->connect(&this->trySerialTimer, SIGNAL(timeout()), this, SLOT(onTrySerialTimer()));
     this->connect(&this->delayedSendTimer, SIGNAL(timeout()), this, SLOT(onDelayedSendTimer()));
+    this->connect(&this->negotiator, SIGNAL(logMessage(QString)), this, SLOT(onNegotiatorLogMessage(QString)));
+    this->connect(&this->negotiator, SIGNAL(linkReset()), this, SLOT(onLinkReset()));
+    this->connect(&this->negotiator, SIGNAL(negotiated()), this, SLOT(onNegotiated()));
 
     this->trySerialTimer.setSingleShot(true);
     this->trySerialTimer.start(TRY_SERIAL_TIMEOUT_MS);
@@ -37,6 +48,7 @@ SerialComm::SerialComm(MainWindow* mainWindow) :
 
 SerialComm::~SerialComm() {
     this->trySerialTimer.stop();
+    this->negotiator.stop();
 
     delete this->serialConnDialog;
     this->serialConnDialog = NULL;
@@ -49,20 +61,31 @@ SerialComm::~SerialComm() {
 }
 
 void SerialComm::write(const QByteArray &data) {
+    // Nothing gets in the way of the negotiation, see SerialNegotiator
+    if (this->negotiator.getMode() == SerialNegotiator::NegotiatingMode) {
+        this->heldBackWrites.append(data);
+        return;
+    }
+
     this->commWriteData = data;
+    if (this->writeData(data)) {
+        this->mainWindow->log(tr("Wrote serial data: ") + QString(data.toStdString().c_str()));
+    }
+}
 
+bool SerialComm::writeData(const QByteArray& data) {
     qint64 bytesWritten = this->serialPort->write(data);
+    this->serialPort->flush();
+
     if (bytesWritten == -1) {
         this->mainWindow->log(tr("Failed to write the data to port %1, error: %2").arg(this->serialPort->portName()).arg(this->serialPort->errorString()));
+        return false;
     }
     else if (bytesWritten != data.size()) {
        this->mainWindow->log(tr("Failed to write all the data to port %1, error: %2").arg(this->serialPort->portName()).arg(this->serialPort->errorString()));
+       return false;
     }
-    else {
-        this->mainWindow->log(tr("Wrote serial data: ") + QString(data.toStdString().c_str()));
-    }
-
-    this->serialPort->flush();
+    return true;
 }
 
 void SerialComm::executeSettingsDialog() {
@@ -74,7 +97,7 @@ void SerialComm::executeSettingsDialog() {
 }
 
 void SerialComm::onTrySerialTimer() {
-    if (this->serialPort->isOpen()) {
+    if (this->serialPort->isOpen() || this->openConfiguredSerialPort()) {
         return;
     }
 
@@ -122,6 +145,8 @@ void SerialComm::onSerialPortError(const QSerialPort::SerialPortError&) {
 }
 
 void SerialComm::onSerialPortClose() {
+    this->negotiator.stop();
+    this->heldBackWrites.clear();
     emit commClosed();
 
     if (!this->trySerialTimer.isActive()) {
@@ -135,169 +160,196 @@ void SerialComm::onSerialPortBytesWritten(qint64 bytes) {
 
 void SerialComm::onSerialPortReadyRead() {
     QByteArray readBytes = this->serialPort->readAll();
-    this->mainWindow->commLog(readBytes);
+    this->negotiator.handleBytesRead(readBytes.size());
 
-    // We remember the full string coming in over serial, if an error is
-    // detected we resend the last serial message!
+    // We remember the full string coming in over serial, if an error is detected we resend the
+    // last serial message! Errors while negotiating are meant for the negotiator though.
     QString readStr = QString(readBytes.toStdString().c_str());
     this->tempRememberBuf += readStr;
     if (this->tempRememberBuf.contains("ERROR")) {
         this->tempRememberBuf.clear();
-        this->write(this->commWriteData);
+        if (!this->negotiator.handleErrorReply() && !this->commWriteData.isEmpty()) {
+            this->write(this->commWriteData);
+        }
     }
     else if (this->tempRememberBuf.size() > 2048){
         this->tempRememberBuf.clear();
     }
 
-    this->commReadData.append(readBytes);
+    switch (this->negotiator.getMode()) {
+    case SerialNegotiator::NegotiatingMode:
+        // Until the hardware answers it keeps talking ASCII, we only need to watch for its hello
+        this->mainWindow->commLog(readBytes);
+        this->readAscii(readBytes);
+        this->readBinary(readBytes);
+        break;
+    case SerialNegotiator::AsciiMode:
+        this->mainWindow->commLog(readBytes);
+        this->readAscii(readBytes);
+        break;
+    case SerialNegotiator::BinaryMode:
+        this->readBinary(readBytes);
+        break;
+    }
+}
+
+void SerialComm::onNegotiatorLogMessage(const QString& message) {
+    this->mainWindow->log(message);
+}
+
+void SerialComm::onNegotiated() {
+    QList<QByteArray> writes;
+    writes.swap(this->heldBackWrites);
+    foreach (const QByteArray& data, writes) {
+        this->write(data);
+    }
+}
 
-    // Look through the read data for full packages
+void SerialComm::onLinkReset() {
+    this->framer.clear();
+    this->binaryReader.clear();
+    this->tempRememberBuf.clear();
+}
+
+void SerialComm::readAscii(const QByteArray& readBytes) {
+    // Feed the framer, draining any complete packages whenever its ring buffer fills up
+    const char* readPtr = readBytes.constData();
+    int numBytesLeft = readBytes.size();
     while (true) {
-        int startIdx = this->commReadData.indexOf('[');
-        int endIdx   = this->commReadData.indexOf(']');
+        int numAppended = this->framer.append(readPtr, numBytesLeft);
+        readPtr += numAppended;
+        numBytesLeft -= numAppended;
 
-        if (startIdx == -1) {
-            // No package fragments were found at all
-            this->commReadData.clear();
-            break;
+        PacketFramer::PacketView packet;
+        while (this->framer.nextPacket(packet)) {
+            this->processPacket(packet);
         }
-        if (endIdx == -1) {
-            // Only part of a fragment was found, skim to the beginning and wait for the rest
-            this->commReadData.remove(0, startIdx);
+
+        if (numBytesLeft <= 0) {
             break;
         }
+    }
+}
 
-        this->commReadData.remove(0, startIdx);
-        if (endIdx < startIdx) {
-            continue;
+void SerialComm::readBinary(const QByteArray& readBytes) {
+    // Text the hardware prints in between frames and a readable version of every frame go to the
+    // serial log, the raw frames would only show up as garbage there
+    QString logStr;
+
+    const char* readPtr = readBytes.constData();
+    int numBytesLeft = readBytes.size();
+    BinaryFrameReader::Chunk chunk;
+    while (this->binaryReader.nextChunk(readPtr, numBytesLeft, chunk)) {
+        switch (chunk.type) {
+        case BinaryFrameReader::FrameChunk:
+            this->processFrame(chunk.frame, logStr);
+            break;
+        case BinaryFrameReader::CorruptFrameChunk:
+            if (this->negotiator.getMode() == SerialNegotiator::BinaryMode) {
+                this->mainWindow->log(tr("Discarded corrupt binary frame (%1 so far)").arg(this->binaryReader.getNumCorruptFrames()));
+                this->negotiator.handlePacket(true);
+            }
+            break;
+        case BinaryFrameReader::TextChunk:
+            if (this->negotiator.getMode() == SerialNegotiator::BinaryMode) {
+                logStr += QString::fromLatin1(chunk.text, chunk.textSize);
+            }
+            break;
         }
+    }
 
-        // We've removed everything up to the package in the serialReadData,
-        // remap start and end indexes
-        endIdx -= startIdx;
-        startIdx = 0;
+    if (!logStr.isEmpty()) {
+        this->mainWindow->commLog(logStr);
+    }
+}
 
-        // Make sure it's a valid package...
-        int pkgLen = endIdx;
-        if (pkgLen < 8) {
-            this->commReadData.remove(0,1);
-            continue;
+void SerialComm::processPacket(const PacketFramer::PacketView& packet) {
+    PacketParser::StatusPacket statusPkg;
+    PacketParser::Result result = PacketParser::parseStatus(packet.data, packet.size, statusPkg);
+    if (!result.isOk()) {
+        QString errorStr = tr("Discarded serial package: %1 at offset %2")
+                .arg(PacketParser::errorString(result.error)).arg(result.offset);
+        if (result.fieldKey != '\0') {
+            errorStr += tr(" (field '%1')").arg(QChar(result.fieldKey));
         }
+        this->mainWindow->log(errorStr);
+        this->negotiator.handlePacket(true);
+        return;
+    }
+    this->negotiator.handlePacket(false);
+    this->processStatus(statusPkg);
+}
 
-        QString pkgStr;
-        for (int i = 1; i < pkgLen; i++) {
-            pkgStr += this->commReadData.at(i);
+void SerialComm::processFrame(const BinaryFrame::Frame& frame, QString& logStr) {
+    this->negotiator.handlePacket(false);
+    switch (frame.type) {
+    case BinaryFrame::HelloType:
+        this->negotiator.handleHello(frame);
+        if (this->negotiator.getMode() == SerialNegotiator::BinaryMode) {
+            this->framer.clear();
         }
+        break;
 
-        QTextStream pkgTextStream(&pkgStr);
-
-        int id;
-        pkgTextStream >> id;
-        if (pkgTextStream.status() != QTextStream::Ok || id >= this->mainWindow->getNumKegMeters() || id < 0) {
-            this->commReadData.remove(0,1);
-            continue;
+    case BinaryFrame::StatusType: {
+        quint8 fieldMask = 0;
+        float values[BinaryFrame::NUM_STATUS_FIELDS];
+        if (!BinaryFrame::decodeStatus(frame, fieldMask, values)) {
+            this->mainWindow->log(tr("Discarded binary frame with a bad status payload"));
+            break;
         }
 
-        KegMeterData data(id);
-
-        char temp;
-        pkgTextStream >> temp; // '{'
-        if (pkgTextStream.status() != QTextStream::Ok || temp != '{') {
-            this->commReadData.remove(0,1);
-            continue;
+        // The binary status fields are laid out just like the ASCII ones
+        PacketParser::StatusPacket statusPkg;
+        statusPkg.meterIdx = frame.meterIdx;
+        statusPkg.fieldMask = fieldMask;
+        for (int i = 0; i < PacketParser::NUM_STATUS_FIELDS; i++) {
+            statusPkg.values[i] = values[i];
         }
 
-        bool exitLoop = false;
-        bool success = false;
-        while (!exitLoop && !success) {
-
-            pkgTextStream >> temp;
-            if (pkgTextStream.status() != QTextStream::Ok) { exitLoop = true; break; }
-
-            switch (temp) {
-            case 'P': {
-                pkgTextStream >> temp; // ':'
-                if (temp != ':' || pkgTextStream.status() != QTextStream::Ok) { exitLoop = true; break; }
-                float percent = 0;
-                pkgTextStream >> percent;
-                data.setPercent(percent);
-                break;
-            }
-
-            case 'F': {
-                pkgTextStream >> temp; // ':'
-                if (temp != ':' || pkgTextStream.status() != QTextStream::Ok) { exitLoop = true; break; }
-
-                float fullMass = 0;
-                pkgTextStream >> fullMass;
-                data.setFullMass(fullMass);
-
-                break;
-            }
-
-            case 'E': {
-                pkgTextStream >> temp; // ':'
-                if (temp != ':' || pkgTextStream.status() != QTextStream::Ok) { exitLoop = true; break; }
-
-                float emptyMass = 0;
-                pkgTextStream >> emptyMass;
-                data.setEmptyMass(emptyMass);
-
-                break;
-            }
-
-            case 'L': {
-                pkgTextStream >> temp; // ':'
-                if (temp != ':' || pkgTextStream.status() != QTextStream::Ok) { exitLoop = true; break; }
-
-                float load = 0;
-                pkgTextStream >> load;
-                data.setLoad(load);
-
-                break;
-            }
-
-            case 'V': {
-                pkgTextStream >> temp; // ':'
-                if (temp != ':' || pkgTextStream.status() != QTextStream::Ok) { exitLoop = true; break; }
-
-                float variance = 0;
-                pkgTextStream >> variance;
-                data.setVariance(variance);
-
-                break;
-            }
-
-            case ',':
-                // Ignore commas, they separate the parameters
-                break;
-
-            case '}':
-                success  = true;
-                exitLoop = true;
-                break;
-
-            default:
-                exitLoop = true;
-                break;
-            }
-        }
+        logStr += QString("[%1{P:%2,F:%3,E:%4,L:%5,V:%6}]\n").arg(frame.meterIdx)
+                .arg(values[BinaryFrame::PercentField], 0, 'f', 2).arg(values[BinaryFrame::FullMassField], 0, 'f', 2)
+                .arg(values[BinaryFrame::EmptyMassField], 0, 'f', 2).arg(values[BinaryFrame::LoadField], 0, 'f', 2)
+                .arg(values[BinaryFrame::VarianceField], 0, 'f', 5);
+        this->processStatus(statusPkg);
+        break;
+    }
 
-        // Remove the package from the serialReadData -- we do this by just removing the start character
-        this->commReadData.remove(0,1);
+    default:
+        this->mainWindow->log(tr("Discarded binary frame of unknown type %1").arg(frame.type));
+        break;
+    }
+}
 
-        if (success) {
-            emit kegMeterDataAvailable(data);
+void SerialComm::processStatus(const PacketParser::StatusPacket& statusPkg) {
+    if (statusPkg.meterIdx < 0 || statusPkg.meterIdx >= this->mainWindow->getNumKegMeters()) {
+        return;
+    }
 
-        }
+    KegMeterData data(statusPkg.meterIdx);
+    if (statusPkg.hasField(PacketParser::PercentField)) {
+        data.setPercent(statusPkg.values[PacketParser::PercentField]);
+    }
+    if (statusPkg.hasField(PacketParser::FullMassField)) {
+        data.setFullMass(statusPkg.values[PacketParser::FullMassField]);
+    }
+    if (statusPkg.hasField(PacketParser::EmptyMassField)) {
+        data.setEmptyMass(statusPkg.values[PacketParser::EmptyMassField]);
+    }
+    if (statusPkg.hasField(PacketParser::LoadField)) {
+        data.setLoad(statusPkg.values[PacketParser::LoadField]);
     }
+    if (statusPkg.hasField(PacketParser::VarianceField)) {
+        data.setVariance(statusPkg.values[PacketParser::VarianceField]);
+    }
+
+    emit kegMeterDataAvailable(data);
 }
 
 void SerialComm::onDelayedSendTimer() {
-    QSettings settings;
+    const MeterStateStore* store = this->mainWindow->getStateStore();
     for (int i = 0; i < this->mainWindow->getNumKegMeters(); i++) {
         // Restore settings for each of the kegs
-        QVariant data = settings.value(QString(AppSettings::KEG_DATA_KEY) + QString("/") + QString::number(i, 10));
+        QVariant data = store->value(i, AppSettings::KEG_DATA_KEY);
         if (!data.isNull()) {
             assert(data.canConvert<KegMeterData>());
             KegMeterData restoreData = data.value<KegMeterData>();
@@ -316,23 +368,31 @@ void SerialComm::onDelayedSendTimer() {
 }
 
 void SerialComm::openSerialPort(const QSerialPortInfo& portInfo) {
+    this->openSerialPort(portInfo.portName());
+}
+
+void SerialComm::openSerialPort(const QString& portName) {
     if (this->serialPort->isOpen()) {
         return;
     }
 
-    this->serialPort->setPort(portInfo);
+    this->serialPort->setPortName(portName);
     if (this->serialPort->open(QIODevice::ReadWrite)) {
         this->mainWindow->log(tr("Connected to %1 @ %2 baud")
                   .arg(this->serialPort->portName())
                   .arg(this->serialPort->baudRate()));
 
+        this->framer.clear();
+        this->binaryReader.clear();
+        this->heldBackWrites.clear();
+        this->negotiator.start(this->serialPort, this->maxBaudRate);
+
         // Check to see if there are any previous settings...
-        QSettings settings;
+        const MeterStateStore* store = this->mainWindow->getStateStore();
         bool previousSettingsExist = false;
         for (int i = 0; i < this->mainWindow->getNumKegMeters(); i++) {
             // Restore settings for each of the kegs
-            QVariant data = settings.value(QString(AppSettings::KEG_DATA_KEY) +
-                                           QString("/") + QString::number(i, 10));
+            QVariant data = store->value(i, AppSettings::KEG_DATA_KEY);
             if (!data.isNull()) {
                 assert(data.canConvert<KegMeterData>());
                 KegMeterData restoreData = data.value<KegMeterData>();
@@ -348,10 +408,26 @@ void SerialComm::openSerialPort(const QSerialPortInfo& portInfo) {
         }
 
         // Now that the serial port is open, offer the user the ability to restore any previous
-        // known state for the keg meters
+        // known state for the keg meters (what's sent is held back until the link is negotiated)
         this->delayedSendTimer.start(2000);
     }
     else {
-        this->mainWindow->log(tr("Failed to connect to serial port %1").arg(portInfo.portName()));
+        this->mainWindow->log(tr("Failed to connect to serial port %1").arg(portName));
+    }
+}
+
+bool SerialComm::openConfiguredSerialPort() {
+    // Ports named in the settings go first, they may be links to pseudo-terminals (see
+    // arduino_pty_emulator) that QSerialPortInfo doesn't list
+    QSettings settings;
+    QStringList portNames = settings.value(AppSettings::SERIAL_PORT_NAMES).toStringList();
+    foreach (const QString& portName, portNames) {
+        if (QFile::exists(portName)) {
+            this->openSerialPort(portName);
+            if (this->serialPort->isOpen()) {
+                return true;
+            }
+        }
     }
+    return false;
 }
@@ -2,11 +2,24 @@
 #define KEGMETERCONTROLLER_SERIALCOMM_H
 
 #include "abstractcomm.h"
+#include "packetframer.h"
+#include "packetparser.h"
+#include "binaryframereader.h"
+#include "serialnegotiator.h"
+
+#include <QByteArray>
+#include <QList>
 #include <QSerialPort>
 #include <QTimer>
 
 class SerialSearchAndConnectDialog;
 
+/**
+ * Serial connection to the autonomous keg meter hardware. Every time the port is opened the
+ * protocol and the speed of the link are negotiated with the hardware (see SerialNegotiator), the
+ * link is upgraded to at most the "max_baud_rate" setting. Ports listed in the "serial_port_names"
+ * setting are tried before looking for an Arduino.
+ */
 class SerialComm : public AbstractComm {
     Q_OBJECT
 public:
@@ -15,6 +28,7 @@ public:
 
     QSerialPort* getSerialPort() const { return this->serialPort; }
     void openSerialPort(const QSerialPortInfo& portInfo);
+    void openSerialPort(const QString& portName);
 
     void write(const QByteArray &data) override;
     void executeSettingsDialog() override;
@@ -27,12 +41,23 @@ private slots:
     void onSerialPortClose();
     void onSerialPortReadyRead();
     void onSerialPortBytesWritten(qint64 bytes);
+    void onNegotiatorLogMessage(const QString& message);
+    void onNegotiated();
+    void onLinkReset();
 
 private:
     QSerialPort* serialPort;
+    PacketFramer framer;
+    BinaryFrameReader binaryReader;
+
+    static const qint32 DEFAULT_MAX_BAUD_RATE = 115200;
+    SerialNegotiator negotiator;
+    qint32 maxBaudRate;
+
+    // Writes held back while negotiating
+    QList<QByteArray> heldBackWrites;
 
     // Cached read/write data
-    QByteArray commReadData;
     QByteArray commWriteData;
     qint64 bytesWritten;
     QString tempRememberBuf;
@@ -42,6 +67,14 @@ private:
     QTimer delayedSendTimer;
 
     SerialSearchAndConnectDialog* serialConnDialog;
+
+    bool openConfiguredSerialPort();
+    bool writeData(const QByteArray& data);
+    void readAscii(const QByteArray& readBytes);
+    void readBinary(const QByteArray& readBytes);
+    void processPacket(const PacketFramer::PacketView& packet);
+    void processFrame(const BinaryFrame::Frame& frame, QString& logStr);
+    void processStatus(const PacketParser::StatusPacket& statusPkg);
 };
 
 #endif // KEGMETERCONTROLLER_SERIALCOMM_H
@@ -15,8 +15,16 @@ TEMPLATE = app
 SOURCES += main.cpp\
         mainwindow.cpp \
     kegmeter.cpp \
+    kegmetermodel.cpp \
+    kegmetercore.cpp \
+    kegmeterbank.cpp \
+    kegmeterbenchmark.cpp \
+    meterfilterbank.cpp \
+    processstats.cpp \
     serialsearchandconnectdialog.cpp \
     serialcomm.cpp \
+    serialworker.cpp \
+    replaycomm.cpp \
     appsettings.cpp \
     kegmeterserver.cpp \
     kegmeterconnection.cpp \
@@ -24,8 +32,16 @@ SOURCES += main.cpp\
 
 HEADERS  += mainwindow.h \
     kegmeter.h \
+    kegmetermodel.h \
+    kegmetercore.h \
+    kegmeterbank.h \
+    kegmeterbenchmark.h \
+    meterfilterbank.h \
+    processstats.h \
     serialsearchandconnectdialog.h \
     serialcomm.h \
+    serialworker.h \
+    replaycomm.h \
     abstractcomm.h \
     appsettings.h \
     kegmeterserver.h \
@@ -36,3 +52,5 @@ FORMS    += mainwindow.ui \
     kegmeter.ui \
     serialsearchandconnectdialog.ui \
     calibratekegmeterdialog.ui
+
+include(../../keg_meter_common/keg_meter_common.pri)
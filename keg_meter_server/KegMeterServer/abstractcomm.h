@@ -5,22 +5,29 @@
 #include <QObject>
 #include <QString>
 #include <QByteArray>
+#include <QDateTime>
 
-class MainWindow;
+class KegMeterCore;
+class QWidget;
 
 class AbstractComm : public QObject {
     Q_OBJECT
 public:
-    AbstractComm(MainWindow* mainWindow) : mainWindow(mainWindow) { assert(mainWindow != NULL); }
+    AbstractComm(KegMeterCore* core) : core(core) { assert(core != NULL); }
     virtual ~AbstractComm() {}
 
+    KegMeterCore* getCore() const { return this->core; }
+
     void writeString(const QString &data) { this->write(QByteArray(data.toStdString().c_str())); }
 
     virtual void write(const QByteArray &data) = 0;
-    virtual void executeSettingsDialog() = 0;
+    virtual void executeSettingsDialog(QWidget* parent) = 0;
+
+    // Time at which the samples being delivered right now were taken, in ms since the epoch
+    virtual qint64 currentTimeMs() const { return QDateTime::currentMSecsSinceEpoch(); }
 
 protected:
-    MainWindow* mainWindow;
+    KegMeterCore* core;
 };
 
 #endif // KEGMETERCONTROLLER_ABSTRACTCOMM_H
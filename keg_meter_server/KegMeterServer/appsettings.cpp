@@ -1,5 +1,11 @@
 #include "appsettings.h"
 
+const char* AppSettings::UI_REFRESH_RATE_HZ  = "ui_refresh_rate_hz";
+const char* AppSettings::MAX_BAUD_RATE       = "max_baud_rate";
+const char* AppSettings::TELEMETRY_PORT      = "telemetry_port";
+const char* AppSettings::SERIAL_CAPTURE_FILE = "serial_capture_file";
+const char* AppSettings::SERIAL_PORT_NAMES   = "serial_port_names";
+
 const char* AppSettings::KEG_METER_DIR = "keg_meter_data";
 
 const char* AppSettings::KEG_METER_KEGTYPE      = "kegtype";
@@ -5,6 +5,12 @@
 
 class AppSettings {
 public:
+    static const char* UI_REFRESH_RATE_HZ;
+    static const char* MAX_BAUD_RATE;
+    static const char* TELEMETRY_PORT;
+    static const char* SERIAL_CAPTURE_FILE;
+    static const char* SERIAL_PORT_NAMES;
+
     static const char* KEG_METER_DIR;
 
     static const char* KEG_METER_KEGTYPE;
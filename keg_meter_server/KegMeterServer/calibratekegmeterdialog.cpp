@@ -1,10 +1,10 @@
 #include "calibratekegmeterdialog.h"
 #include "ui_calibratekegmeterdialog.h"
-#include "kegmeter.h"
+#include "kegmeterbank.h"
 
-CalibrateKegMeterDialog::CalibrateKegMeterDialog(KegMeter* kegMeter) :
-    QDialog(kegMeter),
-    kegMeter(kegMeter),
+CalibrateKegMeterDialog::CalibrateKegMeterDialog(KegMeterBank* bank, int meterIdx, QWidget* parent) :
+    QDialog(parent),
+    kegMeter(bank->at(meterIdx)),
     ui(new Ui::CalibrateKegMeterDialog) {
 
     this->ui->setupUi(this);
@@ -12,8 +12,8 @@ CalibrateKegMeterDialog::CalibrateKegMeterDialog(KegMeter* kegMeter) :
     QObject::connect(this->ui->emptyCalBtn, SIGNAL(clicked()), this, SLOT(onEmptyCalibrate()));
     QObject::connect(this->ui->nonEmptyCalBtn, SIGNAL(clicked()), this, SLOT(onNonEmptyCalibrate()));
 
-    QObject::connect(this->kegMeter, SIGNAL(finishedEmptyCalibration()), this, SLOT(onFinishedEmptyCalibration()));
-    QObject::connect(this->kegMeter, SIGNAL(finishedNonEmptyCalibration()), this, SLOT(onFinishedNonEmptyCalibration()));
+    QObject::connect(bank, SIGNAL(finishedEmptyCalibration(int)), this, SLOT(onFinishedEmptyCalibration(int)));
+    QObject::connect(bank, SIGNAL(finishedNonEmptyCalibration(int)), this, SLOT(onFinishedNonEmptyCalibration(int)));
 }
 
 CalibrateKegMeterDialog::~CalibrateKegMeterDialog() {
@@ -31,12 +31,16 @@ void CalibrateKegMeterDialog::onNonEmptyCalibrate() {
     this->kegMeter->performNonEmptyCalibration(this->ui->nonEmptyCalSpinBox->value());
 }
 
-void CalibrateKegMeterDialog::onFinishedEmptyCalibration() {
-    this->updateEmptyCalibrateView();
+void CalibrateKegMeterDialog::onFinishedEmptyCalibration(int meterIdx) {
+    if (meterIdx == this->kegMeter->getIndex()) {
+        this->updateEmptyCalibrateView();
+    }
 }
 
-void CalibrateKegMeterDialog::onFinishedNonEmptyCalibration() {
-    this->updateNonEmptyCalibrateView();
+void CalibrateKegMeterDialog::onFinishedNonEmptyCalibration(int meterIdx) {
+    if (meterIdx == this->kegMeter->getIndex()) {
+        this->updateNonEmptyCalibrateView();
+    }
 }
 
 void CalibrateKegMeterDialog::updateEmptyCalibrateView() {
@@ -7,23 +7,24 @@ namespace Ui {
 class CalibrateKegMeterDialog;
 }
 
-class KegMeter;
+class KegMeterBank;
+class KegMeterModel;
 
 class CalibrateKegMeterDialog : public QDialog {
     Q_OBJECT
 
 public:
-    explicit CalibrateKegMeterDialog(KegMeter *kegMeter);
+    CalibrateKegMeterDialog(KegMeterBank* bank, int meterIdx, QWidget* parent = NULL);
     ~CalibrateKegMeterDialog();
 
 private slots:
     void onEmptyCalibrate();
     void onNonEmptyCalibrate();
-    void onFinishedEmptyCalibration();
-    void onFinishedNonEmptyCalibration();
+    void onFinishedEmptyCalibration(int meterIdx);
+    void onFinishedNonEmptyCalibration(int meterIdx);
 
 private:
-    KegMeter* kegMeter;
+    KegMeterModel* kegMeter;
     Ui::CalibrateKegMeterDialog *ui;
 
     void updateEmptyCalibrateView();
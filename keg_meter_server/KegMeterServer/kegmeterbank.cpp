@@ -0,0 +1,94 @@
+#include "kegmeterbank.h"
+#include "kegmetercore.h"
+#include "serialworker.h"
+#include "meterconfig.h"
+
+#include <cassert>
+
+KegMeterBank::KegMeterBank(KegMeterCore* core, const QVector<int>& meterIds, QObject* parent) :
+    QObject(parent),
+    core(core),
+    filters(meterIds.size(),
+            KegMeterModel::MIN_LOAD_WINDOW_VARIANCE_CALIBRATION,
+            KegMeterModel::MIN_TRUSTWORTHY_VARIANCE_WHILE_MEASURING,
+            KegMeterModel::EMPTY_TO_CALIBRATING_MASS),
+    runLoads(meterIds.size(), 0.0f),
+    runPending(meterIds.size(), 0) {
+
+    assert(core != NULL);
+    assert(meterIds.size() <= MeterConfig::MAX_NUM_KEG_METERS);
+
+    this->runMeterIdxs.reserve(meterIds.size());
+    this->meters.reserve(meterIds.size());
+    for (int i = 0; i < meterIds.size(); i++) {
+        this->meters.emplace_back(this, i, meterIds[i]);
+    }
+}
+
+KegMeterBank::~KegMeterBank() {
+    for (KegMeterModel& meter : this->meters) {
+        meter.writeToStore();
+    }
+}
+
+void KegMeterBank::updateLoadMeasurements(const LoadSample* samples, int numSamples) {
+    int numMeters = this->size();
+    for (int i = 0; i < numSamples; i++) {
+        int meterIdx = samples[i].meterIdx;
+        if (meterIdx < 0 || meterIdx >= numMeters) {
+            continue;
+        }
+        if (this->runPending[meterIdx]) {
+            this->flushRun();
+        }
+        this->runLoads[meterIdx] = samples[i].load;
+        this->runPending[meterIdx] = 1;
+        this->runMeterIdxs.push_back(meterIdx);
+    }
+    this->flushRun();
+}
+
+void KegMeterBank::updateLoadMeasurementsPerMeter(const LoadSample* samples, int numSamples) {
+    int numMeters = this->size();
+    for (int i = 0; i < numSamples; i++) {
+        if (samples[i].meterIdx < 0 || samples[i].meterIdx >= numMeters) {
+            continue;
+        }
+        this->meters[samples[i].meterIdx].updateLoadMeasurement(samples[i].load);
+    }
+}
+
+void KegMeterBank::flushRun() {
+    if (this->runMeterIdxs.empty()) {
+        return;
+    }
+
+    // A meter only touches its own load window and calibration while it acts on its sample, so it
+    // doesn't matter that the others have been filtered already
+    this->filters.pushBatch(this->runLoads.data(), this->runPending.data());
+    for (int meterIdx : this->runMeterIdxs) {
+        this->runPending[meterIdx] = 0;
+        this->meters[meterIdx].processFilteredLoad();
+    }
+    this->runMeterIdxs.clear();
+}
+
+void KegMeterBank::outputSync() {
+    for (KegMeterModel& meter : this->meters) {
+        meter.outputSync();
+    }
+}
+
+void KegMeterBank::setDisconnected() {
+    for (KegMeterModel& meter : this->meters) {
+        meter.setDisconnected();
+    }
+}
+
+quint64 KegMeterBank::getNumUpdates() const {
+    quint64 numUpdates = 0;
+    for (const KegMeterModel& meter : this->meters) {
+        numUpdates += meter.getNumUpdates();
+    }
+    return numUpdates;
+}
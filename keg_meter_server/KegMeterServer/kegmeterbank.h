@@ -0,0 +1,70 @@
+#ifndef KEGMETERCONTROLLER_KEGMETERBANK_H
+#define KEGMETERCONTROLLER_KEGMETERBANK_H
+
+#include "kegmetermodel.h"
+#include "meterfilterbank.h"
+
+#include <QObject>
+#include <QVector>
+
+#include <vector>
+
+class KegMeterCore;
+struct LoadSample;
+
+/**
+ * All of the keg meters of the core, however many there are configured (see MeterConfig::readMeterIds). The
+ * meters are held by value in one contiguous array, indexed by their index on the wire, so a
+ * sample costs the same no matter how many meters there are. The meters aren't QObjects
+ * themselves, the bank signals on their behalf.
+ *
+ * The load windows of all of the meters are kept together in a MeterFilterBank, so a batch of
+ * samples is filtered for every meter in it at once before each meter acts on its own sample.
+ */
+class KegMeterBank : public QObject {
+    Q_OBJECT
+public:
+    KegMeterBank(KegMeterCore* core, const QVector<int>& meterIds, QObject* parent = NULL);
+    ~KegMeterBank();
+
+    KegMeterCore* getCore() const { return this->core; }
+    MeterFilterBank* getFilters() { return &this->filters; }
+
+    int size() const { return static_cast<int>(this->meters.size()); }
+    KegMeterModel* at(int meterIdx) { return &this->meters[meterIdx]; }
+    const KegMeterModel* at(int meterIdx) const { return &this->meters[meterIdx]; }
+
+    // The samples are split into runs with at most one sample per meter, each run is filtered in
+    // one go and then the meters act on their samples, in the order they came in
+    void updateLoadMeasurements(const LoadSample* samples, int numSamples);
+    // Same result, one sample at a time start to finish (see KegMeterBenchmark)
+    void updateLoadMeasurementsPerMeter(const LoadSample* samples, int numSamples);
+
+    void outputSync();
+    void setDisconnected();
+
+    quint64 getNumUpdates() const;
+
+signals:
+    void finishedEmptyCalibration(int meterIdx);
+    void finishedNonEmptyCalibration(int meterIdx);
+    void kegTypeChanged(int meterIdx);
+
+private:
+    KegMeterCore* core; // Not owned by this
+
+    // Constructed before the meters, they use it from the start
+    MeterFilterBank filters;
+
+    // Never resized after construction, so pointers to the meters stay valid
+    std::vector<KegMeterModel> meters;
+
+    // The run of samples updateLoadMeasurements is putting together, by meter index
+    std::vector<float> runLoads;
+    std::vector<uint8_t> runPending;
+    std::vector<int> runMeterIdxs;
+
+    void flushRun();
+};
+
+#endif // KEGMETERCONTROLLER_KEGMETERBANK_H
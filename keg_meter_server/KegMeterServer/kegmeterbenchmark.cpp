@@ -0,0 +1,136 @@
+#include "kegmeterbenchmark.h"
+#include "kegmetercore.h"
+#include "kegmeterbank.h"
+#include "meterconfig.h"
+#include "meterfilterbank.h"
+#include "replaycomm.h"
+#include "serialcapture.h"
+
+#include <ctime>
+
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QTemporaryDir>
+#include <QTextStream>
+
+QVector<int> KegMeterBenchmark::defaultMeterCounts() {
+    QVector<int> meterCounts;
+    meterCounts << 8 << 64 << static_cast<int>(MeterConfig::MAX_NUM_KEG_METERS);
+    return meterCounts;
+}
+
+int KegMeterBenchmark::run(const QVector<int>& meterCounts, int numSamples, QTextStream& out) {
+    QString separator = QString("-").repeated(60) + QString("\n");
+    out << QString("Load filtering batched with %1, %2 lane(s)\n")
+           .arg(MeterFilterBank::getInstructionSetName()).arg(MeterFilterBank::getNumLanes());
+    out << separator;
+    out << QString("%1 %2 %3 %4\n").arg("Benchmark", -16).arg("Time", 14).arg("CPU", 14).arg("Iterations", 12);
+    out << separator;
+    out.flush();
+
+    foreach (int numMeters, meterCounts) {
+        if (numMeters < 1 || numMeters > MeterConfig::MAX_NUM_KEG_METERS) {
+            out << QString("Can't have %1 meters, only 1 to %2\n").arg(numMeters).arg(MeterConfig::MAX_NUM_KEG_METERS);
+            return 1;
+        }
+
+        // Every meter sits at its own load, give or take some noise from a fixed seed
+        QVector<LoadSample> samples(numSamples);
+        quint32 seed = 12345;
+        for (int i = 0; i < numSamples; i++) {
+            seed = seed * 1664525u + 1013904223u;
+            int meterIdx = i % numMeters;
+            samples[i].meterIdx = meterIdx;
+            samples[i].load = 20.0f + (meterIdx % 16) + ((seed >> 8) / 16777216.0f - 0.5f) * 0.2f;
+        }
+
+        Result perMeterResult;
+        if (!runCore(samples, numMeters, false, perMeterResult, out)) {
+            return 1;
+        }
+        printResult(QString("PerMeter/%1").arg(numMeters), perMeterResult, numSamples, out);
+
+        Result batchedResult;
+        if (!runCore(samples, numMeters, true, batchedResult, out)) {
+            return 1;
+        }
+        printResult(QString("Batched/%1").arg(numMeters), batchedResult, numSamples, out);
+
+        // Both ways have to come to the same thing
+        if (perMeterResult.loads != batchedResult.loads || perMeterResult.variances != batchedResult.variances) {
+            out << QString("The batched filtering of %1 meters came out different from filtering them one at a time\n").arg(numMeters);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+bool KegMeterBenchmark::runCore(const QVector<LoadSample>& samples, int numMeters, bool batched, Result& result, QTextStream& out) {
+    QTemporaryDir tempDir;
+    if (!tempDir.isValid()) {
+        out << QString("Failed to create a temporary directory\n");
+        return false;
+    }
+
+    // An empty capture, so the core is set up like it is for a replay but never gets any samples
+    // other than ours
+    ReplayOptions options;
+    options.captureFilePath = tempDir.path() + QString("/empty.kmsc");
+    options.dataDirPath = tempDir.path() + QString("/data");
+    options.seedWithLiveState = false;
+    SerialCapture capture;
+    if (!capture.openForWriting(options.captureFilePath, QDateTime::currentMSecsSinceEpoch())) {
+        out << QString("Failed to create %1: %2\n").arg(options.captureFilePath).arg(capture.errorString());
+        return false;
+    }
+    capture.close();
+
+    QVector<int> meterIds;
+    for (int i = 0; i < numMeters; i++) {
+        meterIds.push_back(i+1);
+    }
+    KegMeterCore core(&options, false, meterIds);
+    KegMeterBank* bank = core.getKegMeterBank();
+
+    // Twice through, once to settle the meters (and fault in the history) before timing anything
+    int numSamples = samples.size();
+    qint64 wallNs = 0;
+    std::clock_t cpuTicks = 0;
+    for (int pass = 0; pass < 2; pass++) {
+        QElapsedTimer timer;
+        timer.start();
+        std::clock_t startTicks = std::clock();
+        for (int i = 0; i < numSamples; i += BATCH_SIZE) {
+            int numBatchSamples = qMin(static_cast<int>(BATCH_SIZE), numSamples - i);
+            if (batched) {
+                bank->updateLoadMeasurements(samples.constData() + i, numBatchSamples);
+            }
+            else {
+                bank->updateLoadMeasurementsPerMeter(samples.constData() + i, numBatchSamples);
+            }
+        }
+        cpuTicks = std::clock() - startTicks;
+        wallNs = timer.nsecsElapsed();
+    }
+
+    result.wallNsPerSample = static_cast<double>(qMax<qint64>(1, wallNs)) / qMax(1, numSamples);
+    result.cpuNsPerSample = qMax(1.0, cpuTicks * (1e9 / CLOCKS_PER_SEC)) / qMax(1, numSamples);
+
+    result.loads.clear();
+    result.variances.clear();
+    for (int i = 0; i < bank->size(); i++) {
+        result.loads.push_back(bank->at(i)->getLoad());
+        result.variances.push_back(bank->at(i)->getVariance());
+    }
+    return true;
+}
+
+void KegMeterBenchmark::printResult(const QString& name, const Result& result, int numSamples, QTextStream& out) {
+    out << QString("%1 %2 ns %3 ns %4 items_per_second=%5M/s\n")
+           .arg(name, -16)
+           .arg(result.wallNsPerSample, 11, 'f', 1)
+           .arg(result.cpuNsPerSample, 11, 'f', 1)
+           .arg(numSamples, 12)
+           .arg(1e3 / result.cpuNsPerSample, 0, 'f', 3);
+    out.flush();
+}
@@ -0,0 +1,51 @@
+#ifndef KEGMETERCONTROLLER_KEGMETERBENCHMARK_H
+#define KEGMETERCONTROLLER_KEGMETERBENCHMARK_H
+
+#include "serialworker.h"
+
+#include <QVector>
+
+class QTextStream;
+
+/**
+ * Times how long the core takes to process a load sample with different numbers of meters (see
+ * KegMeterBank), the --benchmark option of the server.
+ *
+ * Each run sets up a core of its own in a temporary directory, the same way a replay does, and
+ * starts out from an empty meter state, so neither the hardware nor the live meter state and
+ * history are used and the results don't depend on how the live meters happen to be calibrated
+ * (only the app log goes wherever the settings say). Synthetic samples of settled
+ * kegs with a little noise go round the meters in batches, as SerialComm delivers them, through
+ * everything a real sample goes through: the state machine, the filtering, the history and pour
+ * detection.
+ *
+ * Every meter count is run twice, once with the samples filtered a meter at a time and once with
+ * them filtered in batches across the meters (see MeterFilterBank), and both have to leave the
+ * meters in the same state. The results are laid out like Google Benchmark's.
+ */
+class KegMeterBenchmark {
+public:
+    static const int DEFAULT_NUM_SAMPLES = 1000000;
+
+    static QVector<int> defaultMeterCounts();
+
+    // Returns the process exit code
+    static int run(const QVector<int>& meterCounts, int numSamples, QTextStream& out);
+
+private:
+    KegMeterBenchmark() {}
+
+    static const int BATCH_SIZE = 256;
+
+    struct Result {
+        double wallNsPerSample;
+        double cpuNsPerSample;
+        QVector<float> loads;     // Of every meter at the end
+        QVector<float> variances; // Of every meter at the end
+    };
+
+    static bool runCore(const QVector<LoadSample>& samples, int numMeters, bool batched, Result& result, QTextStream& out);
+    static void printResult(const QString& name, const Result& result, int numSamples, QTextStream& out);
+};
+
+#endif // KEGMETERCONTROLLER_KEGMETERBENCHMARK_H
@@ -1,16 +1,22 @@
 #include "kegmeterconnection.h"
-#include "mainwindow.h"
+#include "kegmetercore.h"
 
 #include <cassert>
 
-const char KegMeterConnection::PKG_START_TOKEN = '[';
-const char KegMeterConnection::PKG_END_TOKEN   = ']';
-
-KegMeterConnection::KegMeterConnection(MainWindow* mainWindow, QObject* parent) :
+KegMeterConnection::KegMeterConnection(KegMeterCore* core, QObject* parent) :
     QTcpSocket(parent),
-    mainWindow(mainWindow) {
+    core(core),
+    connectionState(WaitingForGreeting),
+    greetingSent(false),
+    peerVersion(0),
+    subscribedToAll(false),
+    ackedVersion(0),
+    pingToken(0),
+    lastRoundTripTime(0) {
+
+    assert(core != NULL);
 
-    assert(mainWindow != NULL);
+    this->pingTimer.setInterval(PING_INTERVAL_MS);
 
     QObject::connect(this, SIGNAL(readyRead()), this, SLOT(processReadyRead()));
     QObject::connect(this, SIGNAL(disconnected()), &this->pingTimer, SLOT(stop()));
@@ -21,77 +27,159 @@ KegMeterConnection::KegMeterConnection(MainWindow* mainWindow, QObject* parent)
 KegMeterConnection::~KegMeterConnection() {
 }
 
+QString KegMeterConnection::name() const {
+    QString address = this->peerAddressStr;
+    if (address.isEmpty()) {
+        address = this->peerAddress().toString() + ':' + QString::number(this->peerPort());
+    }
+    return this->peerName.isEmpty() ? address : this->peerName + '@' + address;
+}
+
+bool KegMeterConnection::isSubscribedTo(int meterIdx) const {
+    if (this->subscribedToAll) {
+        return true;
+    }
+    return meterIdx >= 0 && meterIdx < this->subscribedMeters.size() && this->subscribedMeters[meterIdx];
+}
+
+void KegMeterConnection::sendGreeting() {
+    if (this->greetingSent) {
+        return;
+    }
+    this->greetingSent = true;
+    this->peerAddressStr = this->peerAddress().toString() + ':' + QString::number(this->peerPort());
+    this->startHeartbeat();
+    this->sendMessage(TelemetryProtocol::encodeGreeting(this->core->getName(), this->core->getNumKegMeters()));
+}
+
+bool KegMeterConnection::sendMessage(const QByteArray& message) {
+    if (this->state() != QAbstractSocket::ConnectedState ||
+        this->bytesToWrite() + message.size() > MAX_BUFFER_SIZE) {
+        return false;
+    }
+    return this->write(message) == message.size();
+}
+
 void KegMeterConnection::processReadyRead() {
-    // TODO
-    //EXAMPLE:
-    /*
-     if (state == WaitingForGreeting) {
-        if (!readProtocolHeader())
-            return;
-        if (currentDataType != Greeting) {
-            abort();
+    this->buffer.append(this->readAll());
+    if (this->buffer.size() > MAX_BUFFER_SIZE) {
+        this->core->log(tr("Telemetry client %1 sent too much data, disconnecting").arg(this->name()));
+        this->abort();
+        return;
+    }
+
+    // Handle every complete message, then drop them from the buffer in one go
+    int readOffset = 0;
+    TelemetryProtocol::MessageType type;
+    QByteArray payload;
+    while (true) {
+        TelemetryProtocol::ReadResult result = TelemetryProtocol::readMessage(this->buffer, readOffset, type, payload);
+        if (result == TelemetryProtocol::NeedMoreData) {
+            break;
+        }
+        if (result == TelemetryProtocol::InvalidMessage || !this->processMessage(type, payload)) {
+            this->core->log(tr("Invalid message from telemetry client %1, disconnecting").arg(this->name()));
+            this->abort();
             return;
         }
-        state = ReadingGreeting;
     }
+    this->buffer.remove(0, readOffset);
+}
 
-    if (state == ReadingGreeting) {
-        if (!hasEnoughData())
-            return;
+bool KegMeterConnection::processMessage(TelemetryProtocol::MessageType type, const QByteArray& payload) {
+    this->timeSinceLastResponse.start();
 
-        buffer = read(numBytesForCurrentDataType);
-        if (buffer.size() != numBytesForCurrentDataType) {
-            abort();
-            return;
+    if (this->connectionState == WaitingForGreeting) {
+        quint16 numMeters = 0;
+        if (type != TelemetryProtocol::GreetingMessage ||
+            !TelemetryProtocol::decodeGreeting(payload, this->peerVersion, this->peerName, numMeters)) {
+            return false;
+        }
+        if (this->peerVersion < TelemetryProtocol::MIN_PROTOCOL_VERSION) {
+            this->core->log(tr("Telemetry client %1 speaks protocol v%2, we need at least v%3")
+                            .arg(this->name()).arg(this->peerVersion).arg(TelemetryProtocol::MIN_PROTOCOL_VERSION));
+            return false;
         }
 
-        username = QString(buffer) + '@' + peerAddress().toString() + ':'
-                   + QString::number(peerPort());
-        currentDataType = Undefined;
-        numBytesForCurrentDataType = 0;
-        buffer.clear();
+        this->sendGreeting();
+        this->connectionState = ReadyForUse;
+        emit readyForUse();
+        return true;
+    }
 
-        if (!isValid()) {
-            abort();
-            return;
+    switch (type) {
+    case TelemetryProtocol::SubscribeMessage: {
+        QVector<quint16> meterIdxs;
+        if (!TelemetryProtocol::decodeSubscribe(payload, meterIdxs)) {
+            return false;
         }
 
-        if (!isGreetingMessageSent) {
-            sendGreetingMessage();
+        this->subscribedToAll = meterIdxs.isEmpty();
+        this->subscribedMeters.fill(false, this->core->getNumKegMeters());
+        foreach (quint16 meterIdx, meterIdxs) {
+            if (meterIdx < this->subscribedMeters.size()) {
+                this->subscribedMeters[meterIdx] = true;
+            }
         }
+        emit subscriptionChanged();
+        return true;
+    }
 
-        pingTimer.start();
-        pongTime.start();
-        state = ReadyForUse;
-        emit readyForUse();
+    case TelemetryProtocol::AckMessage:
+        return TelemetryProtocol::decodeToken(payload, this->ackedVersion);
+
+    case TelemetryProtocol::PingMessage: {
+        quint32 token = 0;
+        qint64 timeUs = 0;
+        if (!TelemetryProtocol::decodeHeartbeat(payload, token, timeUs)) {
+            return false;
+        }
+        this->sendMessage(TelemetryProtocol::encodePong(token, timeUs));
+        return true;
     }
 
-    do {
-        if (currentDataType == Undefined) {
-            if (!readProtocolHeader()) {
-                return;
-            }
+    case TelemetryProtocol::PongMessage: {
+        quint32 token = 0;
+        qint64 timeUs = 0;
+        if (!TelemetryProtocol::decodeHeartbeat(payload, token, timeUs)) {
+            return false;
         }
-        if (!hasEnoughData()) {
-            return;
+
+        // The timestamp is our own, anything from the future (or from before we connected) is bogus
+        qint64 roundTripTime = this->heartbeatClock.nsecsElapsed() / 1000 - timeUs;
+        if (token <= this->pingToken && timeUs >= 0 && roundTripTime >= 0) {
+            this->lastRoundTripTime = roundTripTime;
+            this->roundTripTimes.record(roundTripTime);
         }
+        return true;
+    }
 
-        processData();
+    default:
+        // Anything else is only ever sent by the server
+        return false;
     }
-    while (bytesAvailable() > 0);
-    */
+}
+
+void KegMeterConnection::startHeartbeat() {
+    this->heartbeatClock.start();
+    this->timeSinceLastResponse.start();
+    this->pingTimer.start();
 }
 
 void KegMeterConnection::sendPing() {
+    // Don't let dead or idle connections hold on to their socket buffers
     if (this->timeSinceLastResponse.elapsed() > RESPONSE_TIMEOUT_MS) {
-        this->mainWindow->log("TCP Socket timeout while waiting for keg meter response.");
+        this->core->log(tr("Telemetry client %1 timed out").arg(this->name()));
         this->abort();
         return;
     }
 
-    //this->write("PING 1 p");
+    if (this->connectionState == ReadyForUse) {
+        this->sendMessage(TelemetryProtocol::encodePing(++this->pingToken, this->heartbeatClock.nsecsElapsed() / 1000));
+    }
 }
 
 void KegMeterConnection::onConnected() {
-
+    // We made the connection, so we're the first to say hello
+    this->sendGreeting();
 }
@@ -1,22 +1,52 @@
 #ifndef KEGMETERCONNECTION_H
 #define KEGMETERCONNECTION_H
 
+#include "telemetryprotocol.h"
+#include "latencyhistogram.h"
+
 #include <QTcpSocket>
 #include <QHostAddress>
 #include <QString>
-#include <QTime>
+#include <QElapsedTimer>
 #include <QTimer>
+#include <QVector>
 
-class MainWindow;
+class KegMeterCore;
 
+/**
+ * A single telemetry client (see TelemetryProtocol). Incoming data is buffered until complete
+ * messages are available, outgoing messages are only queued on the socket, so nothing here ever
+ * waits on the network. Neither buffer may grow past MAX_BUFFER_SIZE, messages that don't fit in
+ * the outgoing one are refused.
+ *
+ * Once connected both ends send a timestamped ping every PING_INTERVAL_MS, the other end echoes
+ * the timestamp in its pong so every pong gives us a round-trip time. Those are kept in a
+ * histogram for the lifetime of the connection. A connection we haven't heard anything from in
+ * RESPONSE_TIMEOUT_MS (including one that never greets us) is aborted.
+ */
 class KegMeterConnection : public QTcpSocket {
     Q_OBJECT
 public:
-    KegMeterConnection(MainWindow* mainWindow, QObject* parent = NULL);
+    KegMeterConnection(KegMeterCore* core, QObject* parent = NULL);
     ~KegMeterConnection();
 
     QString name() const;
-    bool sendMessage(const QString &message);
+    bool isReadyForUse() const { return this->connectionState == ReadyForUse; }
+    bool isSubscribedTo(int meterIdx) const;
+    bool isSubscribedToAll() const { return this->subscribedToAll; }
+    quint32 getAckedVersion() const { return this->ackedVersion; }
+    quint16 getPeerVersion() const { return this->peerVersion; }
+
+    // Round-trip times in microseconds
+    const LatencyHistogram& getRoundTripTimes() const { return this->roundTripTimes; }
+    qint64 getLastRoundTripTime() const { return this->lastRoundTripTime; }
+
+    void sendGreeting();
+    bool sendMessage(const QByteArray& message);
+
+signals:
+    void readyForUse();
+    void subscriptionChanged();
 
 private slots:
     void processReadyRead();
@@ -24,16 +54,34 @@ private slots:
     void onConnected();
 
 private:
-    static const int RESPONSE_TIMEOUT_MS = 10000;
+    static const int PING_INTERVAL_MS = 1000;
+    static const int RESPONSE_TIMEOUT_MS = 3000;
     static const int MAX_BUFFER_SIZE = 1024000;
-    static const char PKG_START_TOKEN;
-    static const char PKG_END_TOKEN;
 
-    MainWindow* mainWindow;
+    KegMeterCore* core;
+
+    enum ConnectionState { WaitingForGreeting, ReadyForUse } connectionState;
+    bool greetingSent;
+    QString peerName;
+    quint16 peerVersion;
+    QString peerAddressStr; // Remembered, the socket forgets it once disconnected
+
+    // Clients get nothing until they subscribe, subscribing to no meters in particular means all
+    bool subscribedToAll;
+    QVector<bool> subscribedMeters;
+    quint32 ackedVersion;
 
     QTimer pingTimer;
-    QTime timeSinceLastResponse;
+    quint32 pingToken;
+    QElapsedTimer heartbeatClock;
+    QElapsedTimer timeSinceLastResponse;
+    LatencyHistogram roundTripTimes;
+    qint64 lastRoundTripTime;
     QByteArray buffer;
+
+    void startHeartbeat();
+
+    bool processMessage(TelemetryProtocol::MessageType type, const QByteArray& payload);
 };
 
 #endif // KEGMETERCONNECTION_H
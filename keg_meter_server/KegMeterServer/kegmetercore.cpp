@@ -0,0 +1,175 @@
+#include "kegmetercore.h"
+#include "kegmeterbank.h"
+#include "meterconfig.h"
+#include "serialcomm.h"
+#include "replaycomm.h"
+#include "appsettings.h"
+#include "meterstatestore.h"
+#include "historystore.h"
+#include "logmodel.h"
+#include "kegmeterserver.h"
+#include "processstats.h"
+
+#include <cstdio>
+
+#include <QSettings>
+#include <QDir>
+#include <QFile>
+
+KegMeterCore::KegMeterCore(const ReplayOptions* replayOptions, bool logToConsole,
+                           const QVector<int>& meterIds, QObject* parent) :
+    QObject(parent),
+    comm(NULL),
+    telemetryServer(NULL),
+    logToConsole(logToConsole),
+    kegMeterBank(NULL) {
+
+    this->setupLogs();
+
+    QVector<int> kegMeterIds = meterIds.isEmpty() ? MeterConfig::readMeterIds() : meterIds;
+
+    // Replays keep their own state and history, starting out with the calibration of the live meters
+    // unless they're meant to start from scratch
+    QString stateFilePath = MeterStateStore::defaultFilePath();
+    QString historyDirPath = HistoryStore::defaultDirPath();
+    if (replayOptions != NULL) {
+        stateFilePath = replayOptions->dataDirPath + QString("/meterstate.dat");
+        historyDirPath = replayOptions->dataDirPath + QString("/history");
+        if (!QDir().mkpath(replayOptions->dataDirPath)) {
+            this->log(tr("Failed to create the replay data directory %1").arg(replayOptions->dataDirPath));
+        }
+        if (replayOptions->seedWithLiveState && !QFile::exists(stateFilePath)) {
+            QFile::copy(MeterStateStore::defaultFilePath(), stateFilePath);
+        }
+    }
+
+    this->stateStore = new MeterStateStore(stateFilePath, this);
+    if (!this->stateStore->load() && (replayOptions == NULL || replayOptions->seedWithLiveState)) {
+        this->migrateLegacySettings(kegMeterIds.size());
+    }
+    this->connect(this->stateStore, SIGNAL(flushed(int)), this, SLOT(onStateStoreFlushed(int)));
+    this->connect(this->stateStore, SIGNAL(flushFailed(const QString&)), this, SLOT(onStateStoreFlushFailed(const QString&)));
+
+    // The meters append their samples to the history as they come in
+    this->historyStore = new HistoryStore(historyDirPath);
+    if (!this->historyStore->open()) {
+        this->log(tr("Failed to open the keg meter history, no history will be kept: %1")
+                  .arg(this->historyStore->errorString()));
+    }
+
+    if (replayOptions != NULL) {
+        this->comm = new ReplayComm(this, *replayOptions);
+    }
+    else {
+        this->comm = new SerialComm(this);
+    }
+
+    this->kegMeterBank = new KegMeterBank(this, kegMeterIds);
+
+    // Remote dashboards follow the meters over TCP, the state goes out with every refresh
+    this->telemetryServer = new KegMeterServer(this, this);
+
+    QSettings settings;
+    this->refreshRateHz = qBound(static_cast<int>(MIN_REFRESH_RATE_HZ),
+                                 settings.value(AppSettings::UI_REFRESH_RATE_HZ, DEFAULT_REFRESH_RATE_HZ).toInt(),
+                                 static_cast<int>(MAX_REFRESH_RATE_HZ));
+    this->connect(&this->refreshTimer, SIGNAL(timeout()), this, SLOT(onRefreshTimer()));
+    this->refreshTimer.start(1000 / this->refreshRateHz);
+}
+
+KegMeterCore::~KegMeterCore() {
+    this->refreshTimer.stop();
+
+    delete this->telemetryServer;
+    this->telemetryServer = NULL;
+
+    delete this->comm;
+    this->comm = NULL;
+
+    delete this->kegMeterBank;
+    this->kegMeterBank = NULL;
+
+    // Write out any state that hasn't been flushed yet, now that the meters are all gone
+    this->stateStore->disconnect(this);
+    delete this->stateStore;
+    this->stateStore = NULL;
+
+    delete this->historyStore;
+    this->historyStore = NULL;
+}
+
+int KegMeterCore::getNumKegMeters() const {
+    return this->kegMeterBank->size();
+}
+
+QString KegMeterCore::getName() const {
+    return QString("Halo Keg Meter Control Panel");
+}
+
+void KegMeterCore::log(const QString& logStr, bool newLine) {
+    QString text = logStr + (newLine ? tr("\n") : tr(""));
+    this->appLogModel->append(text);
+    if (this->logToConsole) {
+        fputs(text.toLocal8Bit().constData(), stderr);
+    }
+}
+
+void KegMeterCore::commLog(const QString& logStr) {
+    this->serialLogModel->append(logStr);
+}
+
+void KegMeterCore::updateLoadMeasurements(const LoadSample* samples, int numSamples) {
+    this->kegMeterBank->updateLoadMeasurements(samples, numSamples);
+}
+
+/**
+ * Log how long it took to get going and what it costs to keep running, meant to be called once the
+ * event loop is up (and, with a GUI, the main window is showing).
+ */
+void KegMeterCore::logStartupStats() {
+    qint64 residentMemory = ProcessStats::getResidentMemory();
+    qint64 peakResidentMemory = ProcessStats::getPeakResidentMemory();
+    QString memoryStr = (residentMemory < 0) ? tr("unknown") :
+        tr("%1 MiB resident (%2 MiB peak)").arg(residentMemory / (1024.0*1024.0), 0, 'f', 1)
+                                             .arg(peakResidentMemory / (1024.0*1024.0), 0, 'f', 1);
+    this->log(tr("Started in %1 ms, memory use: %2").arg(ProcessStats::getUptimeMs()).arg(memoryStr));
+}
+
+void KegMeterCore::onStateStoreFlushed(int numUpdates) {
+    this->log(tr("Saved keg meter state (%1 update(s) in one write, %2 coalesced in total)")
+              .arg(numUpdates).arg(this->stateStore->getNumCoalescedUpdates()));
+}
+
+void KegMeterCore::onStateStoreFlushFailed(const QString& errorStr) {
+    this->log(tr("Failed to save keg meter state: %1").arg(errorStr));
+}
+
+void KegMeterCore::onRefreshTimer() {
+    this->telemetryServer->broadcastState();
+    emit this->refreshed();
+}
+
+void KegMeterCore::setupLogs() {
+    this->appLogModel = new LogModel(MAX_NUM_APP_LOG_LINES, this);
+    this->serialLogModel = new LogModel(MAX_NUM_SERIAL_LOG_LINES, this);
+
+    // Optionally keep a full record of both logs on disk as well
+    QString logDirPath;
+    if (!MeterConfig::setupLogFiles(this->appLogModel, this->serialLogModel, logDirPath)) {
+        this->log(tr("Failed to open the log files in %1").arg(logDirPath));
+    }
+}
+
+void KegMeterCore::migrateLegacySettings(int numKegMeters) {
+    // Older versions kept the meter state in QSettings, carry it over the first time we run
+    static const char* LEGACY_KEYS[] = {
+        AppSettings::KEG_METER_KEGTYPE,
+        AppSettings::KEG_METER_PERCENT,
+        AppSettings::KEG_METER_CAL_EMPTY_SENSOR_VAL,
+        AppSettings::KEG_METER_CAL_NONEMPTY_SENSOR_VAL,
+        AppSettings::KEG_METER_CAL_NONEMPTY_MASS_VAL
+    };
+
+    MeterConfig::migrateLegacySettings(this->stateStore, numKegMeters, LEGACY_KEYS,
+                                       sizeof(LEGACY_KEYS) / sizeof(LEGACY_KEYS[0]), AppSettings::buildKegMeterKey);
+}
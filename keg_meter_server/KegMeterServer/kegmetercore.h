@@ -0,0 +1,90 @@
+#ifndef KEGMETERCONTROLLER_KEGMETERCORE_H
+#define KEGMETERCONTROLLER_KEGMETERCORE_H
+
+#include <QObject>
+#include <QTimer>
+#include <QVector>
+
+class AbstractComm;
+class KegMeterBank;
+class MeterStateStore;
+class HistoryStore;
+class LogModel;
+class KegMeterServer;
+struct LoadSample;
+struct ReplayOptions;
+
+/**
+ * Everything the server does without a GUI: the keg meters (see KegMeterBank), the connection to
+ * the hardware, the meter state and history on disk, the telemetry server and the logs. The server
+ * runs headless on just this, the main window is an optional client of it, much like the remote
+ * dashboards that follow it over the telemetry server.
+ *
+ * The meters are refreshed at the "ui_refresh_rate_hz" setting, no matter how fast samples come in.
+ * Every refresh publishes the state to the telemetry clients and then signals refreshed().
+ */
+class KegMeterCore : public QObject {
+    Q_OBJECT
+public:
+    // Plays back a serial capture instead of talking to the hardware if replayOptions is given.
+    // Without a GUI to show it, the app log can go to stderr as well. The meters are configured in
+    // the settings (see MeterConfig::readMeterIds), unless their ids are given.
+    KegMeterCore(const ReplayOptions* replayOptions = NULL, bool logToConsole = false,
+                 const QVector<int>& meterIds = QVector<int>(), QObject* parent = NULL);
+    ~KegMeterCore();
+
+    QString getName() const;
+
+    KegMeterBank* getKegMeterBank() const { return this->kegMeterBank; }
+    int getNumKegMeters() const;
+
+    AbstractComm* getComm() const { return this->comm; }
+    MeterStateStore* getStateStore() const { return this->stateStore; }
+    HistoryStore* getHistoryStore() const { return this->historyStore; }
+    KegMeterServer* getTelemetryServer() const { return this->telemetryServer; }
+    LogModel* getAppLogModel() const { return this->appLogModel; }
+    LogModel* getSerialLogModel() const { return this->serialLogModel; }
+
+    int getRefreshRateHz() const { return this->refreshRateHz; }
+
+    void updateLoadMeasurements(const LoadSample* samples, int numSamples);
+
+    void log(const QString& logStr, bool newLine = true);
+    void commLog(const QString& logStr);
+
+signals:
+    void refreshed();
+
+public slots:
+    void logStartupStats();
+
+private slots:
+    void onStateStoreFlushed(int numUpdates);
+    void onStateStoreFlushFailed(const QString& errorStr);
+    void onRefreshTimer();
+
+private:
+    AbstractComm* comm;
+    MeterStateStore* stateStore;
+    HistoryStore* historyStore;
+    KegMeterServer* telemetryServer;
+    LogModel* appLogModel;
+    LogModel* serialLogModel;
+    bool logToConsole;
+
+    static const int MAX_NUM_APP_LOG_LINES = 5000;
+    static const int MAX_NUM_SERIAL_LOG_LINES = 5000;
+
+    KegMeterBank* kegMeterBank;
+
+    static const int MIN_REFRESH_RATE_HZ = 10;
+    static const int MAX_REFRESH_RATE_HZ = 30;
+    static const int DEFAULT_REFRESH_RATE_HZ = 20;
+    QTimer refreshTimer;
+    int refreshRateHz;
+
+    void setupLogs();
+    void migrateLegacySettings(int numKegMeters);
+};
+
+#endif // KEGMETERCONTROLLER_KEGMETERCORE_H
@@ -0,0 +1,542 @@
+#include "kegmetermodel.h"
+#include "kegmetercore.h"
+#include "kegmeterbank.h"
+#include "abstractcomm.h"
+#include "appsettings.h"
+#include "meterstatestore.h"
+#include "historystore.h"
+#include "kegmeterserver.h"
+
+#include <cassert>
+#include <cmath>
+
+static const float AVG_EMPTY_CORNY_KEG_MASS_KG = 4.0;
+static const float AVG_FULL_CORNY_KEG_MASS_KG  = (18 * 1.005) + AVG_EMPTY_CORNY_KEG_MASS_KG;
+
+static const float AVG_EMPTY_50L_KEG_MASS_KG = 13.5;
+static const float AVG_FULL_50L_KEG_MASS_KG  = (48 * 1.005) + AVG_EMPTY_50L_KEG_MASS_KG;
+
+static const float MAX_FULL_CORNY_KEG_MASS_KG = (19 * 1.035) + AVG_EMPTY_CORNY_KEG_MASS_KG;
+static const float MAX_FULL_50L_KEG_MASS_KG   = (50 * 1.035) + AVG_EMPTY_50L_KEG_MASS_KG;
+
+const float KegMeterModel::MIN_LOAD_WINDOW_VARIANCE_CALIBRATION = 0.05;
+const float KegMeterModel::MIN_TRUSTWORTHY_VARIANCE_WHILE_MEASURING = 0.5;
+
+// This needs to be a bit lighter than the lightest empty keg in use
+const float KegMeterModel::EMPTY_TO_CALIBRATING_MASS = (AVG_EMPTY_CORNY_KEG_MASS_KG + 5);
+
+static float linearInterpolation(float x, float x0, float x1, float y0, float y1) {
+  return (y0 + (y1-y0)*(x-x0)/(x1-x0));
+}
+
+KegMeterModel::KegMeterModel(KegMeterBank* bank, int index, int id) :
+    bank(bank),
+    core(bank->getCore()),
+    filters(bank->getFilters()),
+    index(index),
+    id(id),
+    currKegType(Corny19LKeg),
+    currState(Empty),
+    dataCounter(0),
+    lastPercentAmt(0),
+    connected(false),
+    emptyCalComplete(false),
+    nonEmptyCalComplete(false),
+    load(0),
+    variance(0),
+    numUpdates(0),
+    lastHistoryTimeMs(0),
+    lastHistoryStatus(0),
+    historyAppendFailed(false) {
+
+    assert(this->core != NULL);
+    this->readFromStore();
+}
+
+void KegMeterModel::updateLoadMeasurement(float sensorLoadValue) {
+    this->filters->push(this->index, sensorLoadValue);
+    this->processFilteredLoad();
+}
+
+void KegMeterModel::processFilteredLoad() {
+    this->connected = true;
+    qint64 timeMs = this->core->getComm()->currentTimeMs();
+
+    this->updateLoad();
+
+    switch (this->currState) {
+    case NonEmptyCalibration: {
+        this->dataCounter++;
+
+        // We fill the load window and find the average sensor value
+        if (this->loadWindowHasFlags(MeterFilterBank::SettledFlag) && this->dataCounter >= LOAD_WINDOW_SIZE) {
+            this->nonEmptyCalSensorValue = this->getLoadWindowMean();
+            this->fillLoadWindow(this->nonEmptyCalMass);
+
+            this->core->log(QString("Keg meter %1: Non-Empty Calibration Complete. Calibrated Amount: %2 -> %3")
+                            .arg(this->id)
+                            .arg(this->nonEmptyCalSensorValue)
+                            .arg(this->nonEmptyCalMass));
+
+            this->nonEmptyCalComplete = true;
+            emit this->bank->finishedNonEmptyCalibration(this->index);
+            this->setState(Empty);
+        }
+        break;
+    }
+
+    case EmptyCalibration: {
+        this->dataCounter++;
+
+        // We fill the load window and find the average sensor value
+        if (this->loadWindowHasFlags(MeterFilterBank::SettledFlag) && this->dataCounter >= LOAD_WINDOW_SIZE) {
+
+            this->setCalEmptySensorValue(this->getLoadWindowMean());
+            this->fillLoadWindow(0);
+
+            this->core->log(QString("Keg meter %1: Empty Calibration Complete. Calibrated Empty Amount: %2 -> 0")
+                            .arg(this->id)
+                            .arg(this->emptyCalSensorValue));
+
+            this->emptyCalComplete = true;
+            emit this->bank->finishedEmptyCalibration(this->index);
+            this->setState(Empty);
+        }
+        break;
+    }
+
+    case Empty: {
+        // Waiting until someone puts a new full/partially-full keg on the sensor...
+        if (this->loadWindowHasFlags(MeterFilterBank::SettledFlag | MeterFilterBank::LoadedFlag)) {
+            this->setState(Calibrating);
+        }
+        break;
+    }
+
+    case Calibrating: {
+        this->dataCounter++;
+
+        // Check to see if the load goes back below the "empty" threshold
+        if (!this->loadWindowHasFlags(MeterFilterBank::LoadedFlag)) {
+            this->setState(Empty);
+        }
+        else {
+            // Wait until the variance goes below a certain threshold and wait until we've filled the
+            // load window enough...
+            static const int CALIBRATE_COLLECTION_SIZE = LOAD_WINDOW_SIZE;
+
+            float percentCalibrated =
+                    linearInterpolation(std::min<float>(CALIBRATE_COLLECTION_SIZE, this->dataCounter),
+                                        0, CALIBRATE_COLLECTION_SIZE, 0.0, 1.0);
+            assert(percentCalibrated >= 0 && percentCalibrated <= 1);
+
+            // We want the calibrating display to show a little bit of something no matter what
+            percentCalibrated = std::max<float>(0.1, percentCalibrated);
+
+            this->lastPercentAmt = percentCalibrated;
+            this->outputPercent();
+
+            if (this->loadWindowHasFlags(MeterFilterBank::SettledFlag) && percentCalibrated >= 1.0) {
+                this->lastPercentAmt = 1.0;
+                this->setState(Measuring);
+            }
+        }
+        break;
+    }
+
+    case Measuring: {
+
+        if (this->loadWindowHasFlags(MeterFilterBank::SteadyFlag)) {
+
+            // The meter is  set by the current load amount based on a linear interpolation between
+            // the initial calibrated full load and a reasonable "zero" load
+            float currPercentAmt = this->calcCurrMeanPercentage();
+
+            // Don't measure backwards, the meter can only wind down, not up
+            if (currPercentAmt < this->lastPercentAmt) {
+                this->lastPercentAmt = currPercentAmt;
+                this->outputPercent();
+            }
+        }
+
+        if (this->lastPercentAmt < 0.01) {
+            this->setState(JustBecameEmpty);
+        }
+        break;
+    }
+
+    case JustBecameEmpty:
+        this->dataCounter++;
+        if (this->dataCounter >= LOAD_WINDOW_SIZE) {
+            this->setState(Empty);
+        }
+        break;
+
+    default:
+        break;
+    }
+
+    this->detectPours(timeMs);
+    this->appendToHistory(timeMs);
+}
+
+void KegMeterModel::outputSync(State prevState) {
+    this->outputPercent();
+
+    switch (this->currState) {
+
+    case NonEmptyCalibration:
+        this->outputRoutine('O');
+        break;
+
+    case EmptyCalibration:
+        this->outputRoutine('O');
+        break;
+
+    case Empty:
+        if (prevState != JustBecameEmpty) {
+            this->outputRoutine('O');
+        }
+        break;
+
+    case Calibrating:
+        this->outputRoutine('C');
+        break;
+
+    case Measuring:
+        if (prevState == Calibrating) {
+            this->outputRoutine('F');
+        }
+        else {
+            this->outputRoutine('M');
+        }
+        break;
+
+    case JustBecameEmpty:
+        this->outputRoutine('E');
+        break;
+
+    default:
+        assert(false);
+        break;
+    }
+}
+
+void KegMeterModel::performEmptyCalibration() {
+    this->setState(EmptyCalibration);
+}
+
+void KegMeterModel::performNonEmptyCalibration(float actualMass) {
+    this->nonEmptyCalComplete = false;
+    this->nonEmptyCalMass = actualMass;
+    this->setState(NonEmptyCalibration);
+}
+
+void KegMeterModel::reset() {
+    this->emptyCalComplete = false;
+    this->nonEmptyCalComplete = false;
+    this->setState(Empty);
+}
+
+void KegMeterModel::setState(State newState) {
+
+    switch (newState) {
+
+    case NonEmptyCalibration:
+        this->core->log(QString("Keg Meter %1: Entering Non-Empty Calibration State").arg(this->id));
+        this->dataCounter = 0;
+        this->lastPercentAmt = 0;
+        break;
+
+    case EmptyCalibration:
+        this->core->log(QString("Keg Meter %1: Entering Empty Calibration State").arg(this->id));
+        this->dataCounter = 0;
+        this->lastPercentAmt = 0;
+        break;
+
+    case Empty:
+        this->core->log(QString("Keg Meter %1: Entering Empty State").arg(this->id));
+        this->dataCounter = 0;
+        this->lastPercentAmt = 0;
+        break;
+
+    case Calibrating:
+        this->core->log(QString("Keg Meter %1: Entering Calibrating State").arg(this->id));
+        this->dataCounter = 0;
+        break;
+
+    case Measuring:
+        this->core->log(QString("Keg Meter %1: Entering Measuring State").arg(this->id));
+        this->dataCounter = 0;
+        break;
+
+    case JustBecameEmpty:
+        this->core->log(QString("Keg Meter %1: Entering Just Became Empty State").arg(this->id));
+        this->dataCounter = 0;
+        this->lastPercentAmt = 0;
+        break;
+
+    default:
+        assert(false);
+        return;
+    }
+
+    this->pourDetector.reset();
+
+    State prevState = this->currState;
+    this->currState = newState;
+    this->updateCalibration();
+    this->outputSync(prevState);
+}
+
+void KegMeterModel::setKegType(KegType kegType) {
+    this->currKegType = kegType;
+
+    // Re-calculate the last percentage amount
+    this->lastPercentAmt = this->calcCurrMeanPercentage();
+    emit this->bank->kegTypeChanged(this->index);
+}
+
+void KegMeterModel::setCalEmptySensorValue(float emptyAmt) {
+    this->emptyCalSensorValue = emptyAmt;
+}
+
+TelemetryProtocol::MeterState KegMeterModel::getTelemetryState() const {
+    TelemetryProtocol::MeterState state;
+    state.meterIdx = this->getIndex();
+    state.percent = this->lastPercentAmt;
+    state.load = this->load;
+    state.variance = this->variance;
+
+    switch (this->currState) {
+    case NonEmptyCalibration:
+    case EmptyCalibration:
+        state.status = TelemetryProtocol::SensorCalibrationStatus;
+        break;
+    case Calibrating:
+        state.status = TelemetryProtocol::KegCalibrationStatus;
+        break;
+    case Measuring:
+        state.status = TelemetryProtocol::MeasuringStatus;
+        break;
+    default:
+        state.status = TelemetryProtocol::EmptyStatus;
+        break;
+    }
+    return state;
+}
+
+/**
+ * Fold the current state of the meter into the history rollups, and store it as a sample of its
+ * own unless it's been less than HISTORY_INTERVAL_MS since the last one and the status hasn't
+ * changed since.
+ */
+void KegMeterModel::appendToHistory(qint64 timeMs) {
+    HistoryStore* store = this->core->getHistoryStore();
+    if (!store->isOpen()) {
+        return;
+    }
+
+    TelemetryProtocol::MeterState state = this->getTelemetryState();
+    HistoryRecord record;
+    record.timeMs = timeMs;
+    record.load = state.load;
+    record.variance = state.variance;
+    record.percent = state.percent;
+    record.state = state.status;
+    record.reserved[0] = record.reserved[1] = record.reserved[2] = 0;
+
+    bool appended = false;
+    if (timeMs >= this->lastHistoryTimeMs && timeMs - this->lastHistoryTimeMs < HISTORY_INTERVAL_MS &&
+        state.status == this->lastHistoryStatus) {
+        appended = store->addToRollups(this->getIndex(), record);
+    }
+    else {
+        this->lastHistoryTimeMs = timeMs;
+        this->lastHistoryStatus = state.status;
+        appended = store->append(this->getIndex(), record);
+    }
+
+    // Only complain once until it works again, this happens for every sample
+    if (!appended && !this->historyAppendFailed) {
+        this->core->log(tr("Keg meter %1: Failed to add to the history: %2").arg(this->id).arg(store->errorString()));
+    }
+    this->historyAppendFailed = !appended;
+}
+
+/**
+ * Feed the filtered load to the pour detector and report every pour it finds to the log, the
+ * history and the telemetry clients.
+ */
+void KegMeterModel::detectPours(qint64 timeMs) {
+    PourDetector::Event event;
+    if (this->currState != Measuring || !this->pourDetector.update(timeMs, this->getLoadWindowMean(), event)) {
+        return;
+    }
+
+    this->core->log(tr("Keg meter %1: Poured %2 L in %3 s")
+                    .arg(this->id)
+                    .arg(event.litres, 0, 'f', 2)
+                    .arg((event.endMs - event.startMs) / 1000.0, 0, 'f', 1));
+
+    HistoryStore* store = this->core->getHistoryStore();
+    if (store->isOpen()) {
+        PourRecord record;
+        record.startMs = event.startMs;
+        record.endMs = event.endMs;
+        record.startLoad = event.startLoad;
+        record.endLoad = event.endLoad;
+        record.litres = event.litres;
+        record.reserved = 0;
+        if (!store->appendPour(this->getIndex(), record)) {
+            this->core->log(tr("Keg meter %1: Failed to add the pour to the history: %2").arg(this->id).arg(store->errorString()));
+        }
+    }
+
+    KegMeterServer* server = this->core->getTelemetryServer();
+    if (server != NULL) {
+        TelemetryProtocol::Pour pour;
+        pour.meterIdx = this->getIndex();
+        pour.startMs = event.startMs;
+        pour.endMs = event.endMs;
+        pour.litres = event.litres;
+        server->broadcastPour(pour);
+    }
+}
+
+void KegMeterModel::fillLoadWindow(float value) {
+    this->filters->fill(this->index, value);
+    this->updateLoad();
+}
+
+void KegMeterModel::updateLoad() {
+    this->load = this->getLoadWindowMean();
+    this->variance = this->getLoadWindowVariance();
+    this->numUpdates++;
+}
+
+float KegMeterModel::getEmptyKegMass() const {
+    switch (this->currKegType) {
+
+    case Corny19LKeg:
+        return AVG_EMPTY_CORNY_KEG_MASS_KG;
+    case Sankey50LKeg:
+        return AVG_EMPTY_50L_KEG_MASS_KG;
+
+    default:
+        assert(false);
+        return AVG_EMPTY_50L_KEG_MASS_KG;
+    }
+}
+
+float KegMeterModel::getAvgFullKegMass() const {
+    switch (this->currKegType) {
+
+    case Corny19LKeg:
+        return AVG_FULL_CORNY_KEG_MASS_KG;
+    case Sankey50LKeg:
+        return AVG_FULL_50L_KEG_MASS_KG;
+
+    default:
+        assert(false);
+        return AVG_FULL_50L_KEG_MASS_KG;
+    }
+}
+
+float KegMeterModel::calcCurrMeanPercentage() const {
+    return std::max<float>(0.0, std::min<float>(1.0,
+        linearInterpolation(this->getLoadWindowMean(), this->getEmptyKegMass(),
+                            this->getAvgFullKegMass(), 0.0, 1.0)));
+}
+
+/**
+ * Tell the filters how to calibrate the samples of the meter for its current state and calibration,
+ * see MeterFilterBank::setCalibration. Everything that goes into this changes along with the state.
+ */
+void KegMeterModel::updateCalibration() {
+    float offset = 0;
+    float scale = 1;
+    float divisor = 1;
+
+    // Don't adjust the sensor value when we're calibrating!
+    if (this->currState != NonEmptyCalibration &&
+        this->currState != EmptyCalibration &&
+        this->emptyCalComplete) {
+
+        if (this->nonEmptyCalComplete) {
+            float denom = (this->nonEmptyCalSensorValue - this->emptyCalSensorValue);
+            if (denom > 0) {
+                offset = this->emptyCalSensorValue;
+                scale = (this->nonEmptyCalMass - 0);
+                divisor = denom;
+            }
+        }
+        else {
+            offset = this->emptyCalSensorValue;
+        }
+    }
+
+    this->filters->setCalibration(this->index, offset, scale, divisor);
+}
+
+void KegMeterModel::outputPercent() {
+    QString serialStr = QString("[%1 %2 %3]")
+            .arg(this->getIndex(), 2, 10, QChar('0'))
+            .arg(QChar('P'))
+            .arg(this->lastPercentAmt, 4, 'f', 2, QChar('0'));
+
+    this->core->getComm()->writeString(serialStr);
+    this->writeToStore();
+}
+
+void KegMeterModel::outputRoutine(char routineType) {
+    QString serialStr = QString("[%1 %2 %3]")
+            .arg(this->getIndex(), 2, 10, QChar('0'))
+            .arg(QChar('R'))
+            .arg(QChar(routineType));
+
+    this->core->getComm()->writeString(serialStr);
+    this->writeToStore();
+}
+
+void KegMeterModel::readFromStore() {
+    const MeterStateStore* store = this->core->getStateStore();
+    int meterIdx = this->getIndex();
+
+    KegType kegType = static_cast<KegType>(
+                store->value(meterIdx, AppSettings::KEG_METER_KEGTYPE, Corny19LKeg).toInt());
+    this->lastPercentAmt = store->value(meterIdx, AppSettings::KEG_METER_PERCENT, 0.0).toFloat();
+
+    this->setCalEmptySensorValue(store->value(meterIdx, AppSettings::KEG_METER_CAL_EMPTY_SENSOR_VAL, 0.0).toFloat());
+    this->nonEmptyCalSensorValue = store->value(meterIdx, AppSettings::KEG_METER_CAL_NONEMPTY_SENSOR_VAL, 0.0).toFloat();
+    this->nonEmptyCalMass = store->value(meterIdx, AppSettings::KEG_METER_CAL_NONEMPTY_MASS_VAL, 0.0).toFloat();
+
+    this->emptyCalComplete = store->contains(meterIdx, AppSettings::KEG_METER_CAL_EMPTY_SENSOR_VAL);
+    this->nonEmptyCalComplete = store->contains(meterIdx, AppSettings::KEG_METER_CAL_NONEMPTY_SENSOR_VAL);
+
+    this->setKegType(kegType);
+    if (this->lastPercentAmt <= 0) {
+        this->lastPercentAmt = 0;
+        this->setState(Empty);
+    }
+    else {
+        this->setState(Measuring);
+    }
+}
+
+void KegMeterModel::writeToStore() {
+    // This only updates the in-memory state, the store takes care of (lazily) writing it to disk
+    MeterStateStore* store = this->core->getStateStore();
+    int meterIdx = this->getIndex();
+
+    store->setValue(meterIdx, AppSettings::KEG_METER_KEGTYPE, this->currKegType);
+    store->setValue(meterIdx, AppSettings::KEG_METER_PERCENT, this->lastPercentAmt);
+
+    if (this->emptyCalComplete) {
+        store->setValue(meterIdx, AppSettings::KEG_METER_CAL_EMPTY_SENSOR_VAL, this->emptyCalSensorValue);
+    }
+    if (this->nonEmptyCalComplete) {
+        store->setValue(meterIdx, AppSettings::KEG_METER_CAL_NONEMPTY_SENSOR_VAL, this->nonEmptyCalSensorValue);
+        store->setValue(meterIdx, AppSettings::KEG_METER_CAL_NONEMPTY_MASS_VAL, this->nonEmptyCalMass);
+    }
+}
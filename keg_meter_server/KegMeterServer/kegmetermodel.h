@@ -0,0 +1,145 @@
+#ifndef KEGMETERCONTROLLER_KEGMETERMODEL_H
+#define KEGMETERCONTROLLER_KEGMETERMODEL_H
+
+#include "meterfilterbank.h"
+#include "telemetryprotocol.h"
+#include "pourdetector.h"
+
+#include <QCoreApplication>
+
+class KegMeterCore;
+class KegMeterBank;
+
+/**
+ * Everything there is to a keg meter short of showing it: the state machine that follows the keg
+ * on the load sensor, the load filtering, calibration, persistence (see MeterStateStore), history
+ * and pours. It tells the hardware what to show over the core's comm, and KegMeter shows it in the
+ * GUI, if there is one.
+ *
+ * Meters live in a KegMeterBank, which signals on their behalf and keeps their load windows (see
+ * MeterFilterBank), so the filtering can be done for many meters at once.
+ */
+class KegMeterModel {
+    Q_DECLARE_TR_FUNCTIONS(KegMeterModel)
+public:
+    enum KegType { Corny19LKeg, Sankey50LKeg };
+
+    // What the state machine tests the load window against, see MeterFilterBank::Flags
+    static const float MIN_LOAD_WINDOW_VARIANCE_CALIBRATION;
+    static const float MIN_TRUSTWORTHY_VARIANCE_WHILE_MEASURING;
+    static const float EMPTY_TO_CALIBRATING_MASS;
+
+    // The index is the meter's index on the wire, the id is only what it's known as to people
+    KegMeterModel(KegMeterBank* bank, int index, int id);
+
+    int getId() const { return this->id; }
+    int getIndex() const { return this->index; }
+
+    bool isEmptyCalComplete() const { return this->emptyCalComplete; }
+    bool isNonEmptyCalComplete() const { return this->nonEmptyCalComplete; }
+
+    // Whether samples are coming in for the meter, until the hardware goes away
+    bool isConnected() const { return this->connected; }
+    void setDisconnected() { this->connected = false; }
+
+    KegType getKegType() const { return this->currKegType; }
+    void setKegType(KegType kegType);
+    float getAvgFullKegMass() const;
+
+    // The filtered load and its variance, and how many times they've been updated so far
+    float getLoad() const { return this->load; }
+    float getVariance() const { return this->variance; }
+    quint64 getNumUpdates() const { return this->numUpdates; }
+
+    void updateLoadMeasurement(float sensorLoadValue);
+
+    // The rest of updateLoadMeasurement, for a sample the bank has already put in the load window
+    void processFilteredLoad();
+
+    void outputSync() { this->outputSync(this->currState); }
+
+    TelemetryProtocol::MeterState getTelemetryState() const;
+
+    void performEmptyCalibration();
+    void performNonEmptyCalibration(float actualMass);
+    void reset();
+
+    void writeToStore();
+
+private:
+    KegMeterBank* bank; // Not owned by this
+    KegMeterCore* core; // Not owned by this
+    MeterFilterBank* filters; // Not owned by this
+    int index;
+    int id;
+
+    KegType currKegType;
+
+    enum State {
+      NonEmptyCalibration, // Calibration of the load sensor for this meter when a known mass has been placed on it
+      EmptyCalibration,    // Calibration of the load sensor for this meter when nothing has been placed on it
+      Empty,               // State to rest in when the keg is empty or there is no keg on the sensor for this meter
+      Calibrating,         // A keg (or something with mass) has been detected on the sensor and it needs to calibrate for it
+      Measuring,           // This is the "typical" state for showing the current status of the keg as people drink from it 100%->0% on the meter
+      JustBecameEmpty      // The keg JUST became empty
+    } currState;
+
+    // Stateful members: keep track of information in various states
+    int dataCounter;
+    float lastPercentAmt;
+    bool connected;
+
+    bool emptyCalComplete;
+    bool nonEmptyCalComplete;
+
+    // Mass-ful calibration values
+    float emptyCalSensorValue;
+    float nonEmptyCalMass;
+    float nonEmptyCalSensorValue;
+
+    // Filter window members
+    static const int LOAD_WINDOW_SIZE = MeterFilterBank::WINDOW_SIZE;
+
+    // The mean and variance of the load window as of the last sample. Views only pick these up
+    // when they refresh, however fast the samples come in.
+    float load;
+    float variance;
+    quint64 numUpdates;
+
+    // Every sample goes into the history rollups, but samples are only stored by themselves at
+    // most this often, and whenever the status changes
+    static const int HISTORY_INTERVAL_MS = 1000;
+    qint64 lastHistoryTimeMs;
+    quint8 lastHistoryStatus;
+    bool historyAppendFailed;
+
+    // Only looks for pours while measuring, starts over with every change of state
+    PourDetector pourDetector;
+
+    void outputSync(State prevState);
+
+    void setState(State newState);
+
+    void setCalEmptySensorValue(float emptyAmt);
+
+    void fillLoadWindow(float value);
+    void updateLoad();
+    void appendToHistory(qint64 timeMs);
+    void detectPours(qint64 timeMs);
+
+    float getLoadWindowMean() const { return this->filters->getMean(this->index); }
+    float getLoadWindowVariance() const { return this->filters->getVariance(this->index); }
+    bool loadWindowHasFlags(uint8_t flags) const { return this->filters->hasFlags(this->index, flags); }
+
+    float getEmptyKegMass() const;
+
+    void updateCalibration();
+    float calcCurrMeanPercentage() const;
+
+    void outputPercent();
+    void outputRoutine(char routineType);
+
+    void readFromStore();
+};
+
+#endif // KEGMETERCONTROLLER_KEGMETERMODEL_H
@@ -1,21 +1,305 @@
 #include "kegmeterserver.h"
 #include "kegmeterconnection.h"
+#include "kegmetercore.h"
+#include "kegmeterbank.h"
+#include "appsettings.h"
 
 #include <cassert>
+#include <cmath>
 
-KegMeterServer::KegMeterServer(MainWindow* mainWindow, QObject* parent) :
+#include <QDateTime>
+#include <QSettings>
+
+const float KegMeterServer::PERCENT_RESOLUTION  = 0.001f;
+const float KegMeterServer::LOAD_RESOLUTION     = 0.01f;
+const float KegMeterServer::VARIANCE_RESOLUTION = 0.0001f;
+
+KegMeterServer::KegMeterServer(KegMeterCore* core, QObject* parent) :
     QTcpServer(parent),
-    mainWindow(mainWindow) {
+    core(core),
+    stateVersion(0) {
+
+    assert(core != NULL);
 
-    assert(mainWindow != NULL);
-    this->listen(QHostAddress::Any);
+    QSettings settings;
+    quint16 port = settings.value(AppSettings::TELEMETRY_PORT, static_cast<int>(DEFAULT_PORT)).toUInt();
+    if (this->listen(QHostAddress::Any, port)) {
+        this->core->log(tr("Telemetry server listening on port %1").arg(this->serverPort()));
+    }
+    else {
+        this->core->log(tr("Telemetry server failed to listen on port %1: %2").arg(port).arg(this->errorString()));
+    }
 }
 
 KegMeterServer::~KegMeterServer() {
+    foreach (KegMeterConnection* connection, this->clients.keys()) {
+        connection->disconnect(this);
+        connection->abort();
+    }
+}
+
+int KegMeterServer::getNumLaggingConnections() const {
+    int numLagging = 0;
+    foreach (const ClientState& clientState, this->clients) {
+        if (clientState.lagging) {
+            numLagging++;
+        }
+    }
+    return numLagging;
+}
+
+// Merge the round-trip times (in microseconds) of all of the current connections into histogram
+void KegMeterServer::getRoundTripTimes(LatencyHistogram& histogram) const {
+    foreach (KegMeterConnection* connection, this->clients.keys()) {
+        histogram.add(connection->getRoundTripTimes());
+    }
+}
+
+/**
+ * Publish the current state of the meters and send it out to every subscribed client. Writes are
+ * only queued on the sockets, so this never waits on a slow client.
+ */
+void KegMeterServer::broadcastState() {
+    QVector<TelemetryProtocol::MeterDelta> deltas;
+    bool changed = this->publishState(deltas);
+    if (this->clients.isEmpty()) {
+        return;
+    }
+
+    qint64 timeMs = QDateTime::currentMSecsSinceEpoch();
+    QByteArray sharedDelta;
+    if (changed) {
+        sharedDelta = TelemetryProtocol::encodeDelta(this->stateVersion-1, this->stateVersion, timeMs, deltas);
+    }
+
+    for (QHash<KegMeterConnection*, ClientState>::iterator iter = this->clients.begin(); iter != this->clients.end(); ++iter) {
+        KegMeterConnection* connection = iter.key();
+        ClientState& clientState = iter.value();
+        if (!connection->isReadyForUse() || !clientState.subscribed) {
+            continue;
+        }
+
+        if (clientState.needsSnapshot) {
+            this->sendSnapshot(connection, clientState, timeMs);
+            continue;
+        }
+
+        bool behind = this->isBehind(connection);
+        if (behind && !clientState.lagging) {
+            clientState.lagging = true;
+            this->core->log(tr("Telemetry client %1 is falling behind, only sending it snapshots").arg(connection->name()));
+        }
+        else if (!behind && clientState.lagging && connection->bytesToWrite() == 0 &&
+                 connection->getAckedVersion() == clientState.sentVersion) {
+            clientState.lagging = false;
+            this->core->log(tr("Telemetry client %1 caught up").arg(connection->name()));
+        }
+
+        if (clientState.lagging) {
+            if (timeMs - clientState.lastSnapshotMs >= SNAPSHOT_INTERVAL_MS) {
+                this->sendSnapshot(connection, clientState, timeMs);
+            }
+        }
+        else if (clientState.sentVersion != this->stateVersion) {
+            this->sendDelta(connection, clientState, timeMs, sharedDelta);
+        }
+    }
+}
+
+/**
+ * Send a pour to every client that follows its meter. Pours are rare enough that they're encoded
+ * once and go straight out, ahead of the next state broadcast.
+ */
+void KegMeterServer::broadcastPour(const TelemetryProtocol::Pour& pour) {
+    QByteArray message;
+    foreach (KegMeterConnection* connection, this->clients.keys()) {
+        if (!connection->isReadyForUse() || !this->clients[connection].subscribed ||
+            !connection->isSubscribedTo(pour.meterIdx) || connection->getPeerVersion() < TelemetryProtocol::POUR_MESSAGE_VERSION) {
+            continue;
+        }
+
+        if (message.isEmpty()) {
+            message = TelemetryProtocol::encodePour(pour);
+        }
+        connection->sendMessage(message);
+    }
 }
 
 void KegMeterServer::incomingConnection(qintptr socketDescriptor) {
-    KegMeterConnection *connection = new KegMeterConnection(this->mainWindow, this);
-    connection->setSocketDescriptor(socketDescriptor);
+    KegMeterConnection *connection = new KegMeterConnection(this->core, this);
+    if (!connection->setSocketDescriptor(socketDescriptor)) {
+        delete connection;
+        return;
+    }
+
+    this->connect(connection, SIGNAL(readyForUse()), this, SLOT(onConnectionReadyForUse()));
+    this->connect(connection, SIGNAL(subscriptionChanged()), this, SLOT(onConnectionSubscriptionChanged()));
+    this->connect(connection, SIGNAL(disconnected()), this, SLOT(onConnectionDisconnected()));
+
+    ClientState clientState;
+    clientState.subscribed = false;
+    clientState.needsSnapshot = false;
+    clientState.lagging = false;
+    clientState.sentVersion = 0;
+    clientState.lastSnapshotMs = 0;
+    this->clients.insert(connection, clientState);
+
+    connection->sendGreeting();
     emit newConnection(connection);
 }
+
+void KegMeterServer::onConnectionReadyForUse() {
+    KegMeterConnection* connection = qobject_cast<KegMeterConnection*>(this->sender());
+    assert(connection != NULL);
+    this->core->log(tr("Telemetry client %1 connected (%2 client(s))").arg(connection->name()).arg(this->clients.size()));
+}
+
+void KegMeterServer::onConnectionSubscriptionChanged() {
+    // The client may not know anything about the meters it just subscribed to, so it gets a full
+    // snapshot with the next broadcast
+    KegMeterConnection* connection = qobject_cast<KegMeterConnection*>(this->sender());
+    assert(connection != NULL && this->clients.contains(connection));
+
+    ClientState& clientState = this->clients[connection];
+    clientState.subscribed = true;
+    clientState.needsSnapshot = true;
+}
+
+void KegMeterServer::onConnectionDisconnected() {
+    KegMeterConnection* connection = qobject_cast<KegMeterConnection*>(this->sender());
+    assert(connection != NULL);
+
+    this->clients.remove(connection);
+    connection->deleteLater();
+
+    const LatencyHistogram& roundTripTimes = connection->getRoundTripTimes();
+    this->core->log(tr("Telemetry client %1 disconnected (%2 client(s)), round-trip time p50 %3 ms, p99 %4 ms, max %5 ms over %6 ping(s)")
+                    .arg(connection->name()).arg(this->clients.size())
+                    .arg(roundTripTimes.getValueAtPercentile(50) / 1000.0, 0, 'f', 1)
+                    .arg(roundTripTimes.getValueAtPercentile(99) / 1000.0, 0, 'f', 1)
+                    .arg(roundTripTimes.getMax() / 1000.0, 0, 'f', 1)
+                    .arg(roundTripTimes.getCount()));
+}
+
+/**
+ * Compare the current state of the meters with the last published one. If anything changed the
+ * state gets a new version and deltas holds the changed fields.
+ */
+bool KegMeterServer::publishState(QVector<TelemetryProtocol::MeterDelta>& deltas) {
+    const KegMeterBank* kegMeters = this->core->getKegMeterBank();
+    int numMeters = kegMeters->size();
+    bool resized = (this->publishedStates.size() != numMeters);
+    if (resized) {
+        this->publishedStates.resize(numMeters);
+        this->fieldVersions.fill(0, numMeters * TelemetryProtocol::NUM_STATE_FIELDS);
+    }
+
+    deltas.clear();
+    for (int i = 0; i < numMeters; i++) {
+        TelemetryProtocol::MeterState newState = kegMeters->at(i)->getTelemetryState();
+        quint8 fieldMask = resized ? TelemetryProtocol::ALL_FIELDS_MASK : changedFields(this->publishedStates[i], newState);
+        if (fieldMask == 0) {
+            continue;
+        }
+
+        TelemetryProtocol::MeterDelta delta;
+        delta.fieldMask = fieldMask;
+        delta.state = newState;
+        deltas.append(delta);
+        this->publishedStates[i] = newState;
+    }
+
+    if (deltas.isEmpty()) {
+        return false;
+    }
+
+    this->stateVersion++;
+    foreach (const TelemetryProtocol::MeterDelta& delta, deltas) {
+        for (int field = 0; field < TelemetryProtocol::NUM_STATE_FIELDS; field++) {
+            if (delta.fieldMask & (1 << field)) {
+                this->fieldVersions[delta.state.meterIdx * TelemetryProtocol::NUM_STATE_FIELDS + field] = this->stateVersion;
+            }
+        }
+    }
+    return true;
+}
+
+quint8 KegMeterServer::changedFields(const TelemetryProtocol::MeterState& oldState, const TelemetryProtocol::MeterState& newState) {
+    quint8 fieldMask = 0;
+    if (oldState.status != newState.status) {
+        fieldMask |= (1 << TelemetryProtocol::StatusField);
+    }
+    if (qRound(oldState.percent / PERCENT_RESOLUTION) != qRound(newState.percent / PERCENT_RESOLUTION)) {
+        fieldMask |= (1 << TelemetryProtocol::PercentField);
+    }
+    if (qRound(oldState.load / LOAD_RESOLUTION) != qRound(newState.load / LOAD_RESOLUTION)) {
+        fieldMask |= (1 << TelemetryProtocol::LoadField);
+    }
+    if (qRound(oldState.variance / VARIANCE_RESOLUTION) != qRound(newState.variance / VARIANCE_RESOLUTION)) {
+        fieldMask |= (1 << TelemetryProtocol::VarianceField);
+    }
+    return fieldMask;
+}
+
+bool KegMeterServer::isBehind(KegMeterConnection* connection) const {
+    return this->stateVersion - connection->getAckedVersion() > MAX_UNACKED_VERSIONS ||
+           connection->bytesToWrite() > LAGGING_WRITE_SIZE;
+}
+
+bool KegMeterServer::sendSnapshot(KegMeterConnection* connection, ClientState& clientState, qint64 timeMs) {
+    QVector<TelemetryProtocol::MeterState> states;
+    foreach (const TelemetryProtocol::MeterState& state, this->publishedStates) {
+        if (connection->isSubscribedTo(state.meterIdx)) {
+            states.append(state);
+        }
+    }
+
+    clientState.lastSnapshotMs = timeMs;
+    if (!connection->sendMessage(TelemetryProtocol::encodeSnapshot(this->stateVersion, timeMs, states))) {
+        return false;
+    }
+    clientState.needsSnapshot = false;
+    clientState.sentVersion = this->stateVersion;
+    return true;
+}
+
+bool KegMeterServer::sendDelta(KegMeterConnection* connection, ClientState& clientState, qint64 timeMs, const QByteArray& sharedDelta) {
+    QByteArray message;
+    if (clientState.sentVersion == this->stateVersion-1 && connection->isSubscribedToAll()) {
+        message = sharedDelta;
+    }
+    else {
+        // Everything that changed since the last version this client got, for its meters only
+        QVector<TelemetryProtocol::MeterDelta> deltas;
+        for (int i = 0; i < this->publishedStates.size(); i++) {
+            if (!connection->isSubscribedTo(i)) {
+                continue;
+            }
+
+            TelemetryProtocol::MeterDelta delta;
+            delta.fieldMask = 0;
+            delta.state = this->publishedStates[i];
+            for (int field = 0; field < TelemetryProtocol::NUM_STATE_FIELDS; field++) {
+                if (this->fieldVersions[i * TelemetryProtocol::NUM_STATE_FIELDS + field] > clientState.sentVersion) {
+                    delta.fieldMask |= (1 << field);
+                }
+            }
+            if (delta.fieldMask != 0) {
+                deltas.append(delta);
+            }
+        }
+
+        if (deltas.isEmpty()) {
+            clientState.sentVersion = this->stateVersion;
+            return true;
+        }
+        message = TelemetryProtocol::encodeDelta(clientState.sentVersion, this->stateVersion, timeMs, deltas);
+    }
+
+    // The socket buffer is full, the next broadcast will find the client behind
+    if (!connection->sendMessage(message)) {
+        return false;
+    }
+    clientState.sentVersion = this->stateVersion;
+    return true;
+}
@@ -1,24 +1,88 @@
 #ifndef KEGMETERCONTROLLER_KEGMETERSERVER_H
 #define KEGMETERCONTROLLER_KEGMETERSERVER_H
 
+#include "telemetryprotocol.h"
+#include "latencyhistogram.h"
+
 #include <QTcpServer>
+#include <QHash>
+#include <QVector>
 
-class MainWindow;
+class KegMeterCore;
 class KegMeterConnection;
 
+/**
+ * Streams the state of the keg meters to any number of remote telemetry clients (see
+ * TelemetryProtocol).
+ *
+ * Whenever the core refreshes (see KegMeterCore::refreshed) the server publishes a new version of the meter
+ * state, if anything changed. The changed fields are encoded into a single delta message once and
+ * that same (implicitly shared) buffer is queued on every client that's up to date and follows all
+ * meters. Other clients get a delta with just the fields that changed since the last version sent
+ * to them. Clients that fall behind, i.e. stop acknowledging versions or let their socket buffer
+ * fill up, are downgraded to a full snapshot every SNAPSHOT_INTERVAL_MS until they've caught up.
+ */
 class KegMeterServer : public QTcpServer {
     Q_OBJECT
 public:
-    KegMeterServer(MainWindow* mainWindow, QObject* parent = NULL);
+    KegMeterServer(KegMeterCore* core, QObject* parent = NULL);
     ~KegMeterServer();
 
+    int getNumConnections() const { return this->clients.size(); }
+    int getNumLaggingConnections() const;
+    void getRoundTripTimes(LatencyHistogram& histogram) const;
+
+    void broadcastState();
+    void broadcastPour(const TelemetryProtocol::Pour& pour);
+
 signals:
     void newConnection(KegMeterConnection* conn);
 
+private slots:
+    void onConnectionReadyForUse();
+    void onConnectionSubscriptionChanged();
+    void onConnectionDisconnected();
+
 private:
-    MainWindow* mainWindow;
+    static const quint16 DEFAULT_PORT = 47474;
+
+    // A client is behind when it hasn't acknowledged any of the last MAX_UNACKED_VERSIONS versions
+    // (about 2 s worth at the default refresh rate) or has more than LAGGING_WRITE_SIZE bytes
+    // waiting to be sent. It's back on deltas once it's acknowledged its last snapshot and its
+    // socket buffer drained.
+    static const quint32 MAX_UNACKED_VERSIONS = 40;
+    static const qint64 LAGGING_WRITE_SIZE = 32*1024;
+    static const qint64 SNAPSHOT_INTERVAL_MS = 1000;
+
+    // The resolution of each field, smaller changes aren't worth sending
+    static const float PERCENT_RESOLUTION;
+    static const float LOAD_RESOLUTION;
+    static const float VARIANCE_RESOLUTION;
+
+    struct ClientState {
+        bool subscribed;
+        bool needsSnapshot;
+        bool lagging;
+        quint32 sentVersion;
+        qint64 lastSnapshotMs;
+    };
+
+    KegMeterCore* core;
+    QHash<KegMeterConnection*, ClientState> clients;
+
+    // The last published state and, for every field of every meter, the version it last changed in
+    quint32 stateVersion;
+    QVector<TelemetryProtocol::MeterState> publishedStates;
+    QVector<quint32> fieldVersions;
 
     void incomingConnection(qintptr socketDescriptor) Q_DECL_OVERRIDE;
+
+    bool publishState(QVector<TelemetryProtocol::MeterDelta>& deltas);
+    static quint8 changedFields(const TelemetryProtocol::MeterState& oldState, const TelemetryProtocol::MeterState& newState);
+
+    bool isBehind(KegMeterConnection* connection) const;
+    bool sendSnapshot(KegMeterConnection* connection, ClientState& clientState, qint64 timeMs);
+    bool sendDelta(KegMeterConnection* connection, ClientState& clientState, qint64 timeMs, const QByteArray& sharedDelta);
 };
 
 #endif // KEGMETERCONTROLLER_KEGMETERSERVER_H
@@ -1,25 +1,169 @@
 #include "mainwindow.h"
+#include "kegmetercore.h"
+#include "kegmeterbenchmark.h"
+#include "replaycomm.h"
 
 #include <QApplication>
 #include <QStyle>
 #include <QDesktopWidget>
+#include <QCommandLineParser>
+#include <QDateTime>
+#include <QScopedPointer>
+#include <QSocketNotifier>
+#include <QTimer>
+#include <QTextStream>
+
+#include <cstring>
+
+#ifdef Q_OS_UNIX
+#include <csignal>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+
+// Signals are turned into a write on this socket pair so they're handled on the event loop
+static int signalFds[2] = { -1, -1 };
+
+static void onQuitSignal(int) {
+    char c = 1;
+    ssize_t result = ::write(signalFds[0], &c, sizeof(c));
+    Q_UNUSED(result);
+}
+
+/**
+ * Quit the event loop on SIGTERM and SIGINT instead of dying on the spot, so the meter state and
+ * history still get written out on the way down. Mostly for the headless mode, run as a service.
+ */
+static void setupQuitSignals(QCoreApplication* app) {
+    if (::socketpair(AF_UNIX, SOCK_STREAM, 0, signalFds) != 0) {
+        return;
+    }
+    QSocketNotifier* notifier = new QSocketNotifier(signalFds[1], QSocketNotifier::Read, app);
+    QObject::connect(notifier, SIGNAL(activated(int)), app, SLOT(quit()));
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = onQuitSignal;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+    sigaction(SIGTERM, &action, NULL);
+    sigaction(SIGINT, &action, NULL);
+}
+
+/**
+ * Every meter keeps a few history segments open (see HistoryStore), with a few hundred meters that's
+ * more than the usual soft limit on open files, so go up to the hard limit.
+ */
+static void raiseOpenFileLimit() {
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+}
+#endif
 
 int main(int argc, char *argv[]) {
-    QApplication a(argc, argv);
+    // The application has to exist before the command line can be parsed, and without a GUI there's
+    // no need for the widget machinery (or a display) at all
+    bool headless = false;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--headless") == 0 || strcmp(argv[i], "--benchmark") == 0) {
+            headless = true;
+        }
+    }
+    QScopedPointer<QCoreApplication> a(headless ? new QCoreApplication(argc, argv) : new QApplication(argc, argv));
 
     QCoreApplication::setOrganizationName("Halo Brewery");
     QCoreApplication::setOrganizationDomain("halobrewery.com");
     QCoreApplication::setApplicationName("Keg Meter Server");
 
-    MainWindow w;
-    w.show();
-    w.setGeometry(
-        QStyle::alignedRect(
-            Qt::LeftToRight,
-            Qt::AlignCenter,
-            w.size(),
-            qApp->desktop()->availableGeometry()
-        ));
-
-    return a.exec();
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    QCommandLineOption headlessOption("headless", "Run without a GUI, logging to stderr. Remote clients follow the meters over telemetry.");
+    QCommandLineOption benchmarkOption("benchmark", "Time the processing of a load sample with 8, 64 and 256 meters, filtered one meter at a time and batched, then quit.");
+    QCommandLineOption replayOption("replay", "Play back a serial capture instead of using the hardware.", "capture");
+    QCommandLineOption replaySpeedOption("replay-speed", "Playback speed, 1 is real time, 0 is as fast as possible (default: 1).", "factor", "1");
+    QCommandLineOption replayOutputOption("replay-output", "Capture everything written to the hardware during the replay.", "capture");
+    QCommandLineOption replayExpectedOutputOption("replay-expected-output", "Fail unless the replay writes the same as this earlier --replay-output capture (implies --quit-after-replay).", "capture");
+    QCommandLineOption replayDataDirOption("replay-data-dir", "Meter state and history of the replay (default: next to the capture).", "dir");
+    QCommandLineOption quitAfterReplayOption("quit-after-replay", "Quit once the replay is finished.");
+    parser.addOption(headlessOption);
+    parser.addOption(benchmarkOption);
+    parser.addOption(replayOption);
+    parser.addOption(replaySpeedOption);
+    parser.addOption(replayOutputOption);
+    parser.addOption(replayExpectedOutputOption);
+    parser.addOption(replayDataDirOption);
+    parser.addOption(quitAfterReplayOption);
+    parser.process(*a);
+
+#ifdef Q_OS_UNIX
+    raiseOpenFileLimit();
+#endif
+
+    if (parser.isSet(benchmarkOption)) {
+        QTextStream out(stdout);
+        return KegMeterBenchmark::run(KegMeterBenchmark::defaultMeterCounts(), KegMeterBenchmark::DEFAULT_NUM_SAMPLES, out);
+    }
+
+    ReplayOptions replayOptions;
+    if (parser.isSet(replayOption)) {
+        bool speedOk = false;
+        replayOptions.captureFilePath = parser.value(replayOption);
+        replayOptions.outputFilePath = parser.value(replayOutputOption);
+        replayOptions.speed = parser.value(replaySpeedOption).toDouble(&speedOk);
+        replayOptions.quitWhenDone = parser.isSet(quitAfterReplayOption);
+        if (!speedOk || replayOptions.speed < 0) {
+            parser.showHelp(1);
+        }
+
+        // Every replay starts from scratch, unless told otherwise
+        replayOptions.dataDirPath = parser.value(replayDataDirOption);
+        if (replayOptions.dataDirPath.isEmpty()) {
+            replayOptions.dataDirPath = replayOptions.captureFilePath +
+                QDateTime::currentDateTime().toString(".'replay'-yyyyMMdd-hhmmss");
+        }
+
+        // A regression check has to start out exactly like the run that produced the expected output,
+        // the calibration of the live meters may have changed since
+        replayOptions.expectedOutputFilePath = parser.value(replayExpectedOutputOption);
+        if (!replayOptions.expectedOutputFilePath.isEmpty()) {
+            replayOptions.seedWithLiveState = false;
+            replayOptions.quitWhenDone = true;
+            if (replayOptions.outputFilePath.isEmpty()) {
+                replayOptions.outputFilePath = replayOptions.dataDirPath + QString("/replay-output.kmsc");
+            }
+        }
+    }
+
+#ifdef Q_OS_UNIX
+    setupQuitSignals(a.data());
+#endif
+
+    // The window (if any) goes before the core it shows
+    KegMeterCore core(parser.isSet(replayOption) ? &replayOptions : NULL, headless);
+    QScopedPointer<MainWindow> w;
+    if (!headless) {
+        w.reset(new MainWindow(&core));
+        w->show();
+        w->setGeometry(
+            QStyle::alignedRect(
+                Qt::LeftToRight,
+                Qt::AlignCenter,
+                w->size(),
+                qApp->desktop()->availableGeometry()
+            ));
+    }
+
+    // Once the event loop is up, i.e. (with a GUI) the window is on screen
+    QTimer::singleShot(0, &core, SLOT(logStartupStats()));
+
+    int exitCode = a->exec();
+
+    ReplayComm* replayComm = qobject_cast<ReplayComm*>(core.getComm());
+    if (exitCode == 0 && replayComm != NULL && !replayComm->isOutputAsExpected()) {
+        exitCode = 1;
+    }
+    return exitCode;
 }
@@ -2,8 +2,12 @@
 #include "ui_mainwindow.h"
 
 #include "kegmeter.h"
-#include "serialcomm.h"
-#include "appsettings.h"
+#include "kegmetermodel.h"
+#include "kegmeterbank.h"
+#include "kegmetercore.h"
+#include "abstractcomm.h"
+#include "kegmeterserver.h"
+#include "latencyhistogram.h"
 
 #include <cassert>
 #include <cmath>
@@ -14,33 +18,36 @@
 #include <QSerialPortInfo>
 #include <QLabel>
 #include <QScrollArea>
-#include <QScrollBar>
-#include <QTextStream>
-#include <QSettings>
-#include <QMessageBox>
 
-MainWindow::MainWindow(QWidget *parent) :
+MainWindow::MainWindow(KegMeterCore* core, QWidget *parent) :
     QMainWindow(parent),
-    ui(new Ui::MainWindow()) {
+    ui(new Ui::MainWindow()),
+    core(core),
+    numRefreshes(0) {
 
-    this->ui->setupUi(this);
+    assert(core != NULL);
 
-    this->comm = new SerialComm(this);
+    this->ui->setupUi(this);
+    this->ui->appLogView->setModel(this->core->getAppLogModel());
+    this->ui->serialLogView->setModel(this->core->getSerialLogModel());
 
     QHBoxLayout* mainLayout = new QHBoxLayout();
 
+    KegMeterBank* bank = this->core->getKegMeterBank();
+    int numKegMeters = bank->size();
+
     const int KEG_METERS_PER_COL = 3;
-    int numLoops = ceil(static_cast<float>(NUM_KEG_METERS) / static_cast<float>(KEG_METERS_PER_COL));
+    int numLoops = ceil(static_cast<float>(numKegMeters) / static_cast<float>(KEG_METERS_PER_COL));
     for (int i = 0; i < numLoops; i++) {
         QVBoxLayout* vLayout = new QVBoxLayout();
         for (int j = i*KEG_METERS_PER_COL; j < i*KEG_METERS_PER_COL+KEG_METERS_PER_COL; j++) {
 
-            if (j >= NUM_KEG_METERS) {
+            if (j >= numKegMeters) {
                 vLayout->addItem(new QSpacerItem(20, 40, QSizePolicy::Minimum, QSizePolicy::Expanding));
                 break;
             }
             else {
-                KegMeter* meter = new KegMeter(j+1, this->comm, this);
+                KegMeter* meter = new KegMeter(bank, j, this);
                 this->kegMeters.push_back(meter);
                 vLayout->addWidget(meter);
             }
@@ -48,8 +55,19 @@ MainWindow::MainWindow(QWidget *parent) :
         mainLayout->addLayout(vLayout);
     }
 
-    this->ui->centralWidget->setLayout(mainLayout);
-    this->setWindowTitle("Halo Keg Meter Control Panel");
+    // There can be more meters than fit on the screen, scroll through them
+    QWidget* metersWidget = new QWidget();
+    metersWidget->setLayout(mainLayout);
+    QScrollArea* metersScrollArea = new QScrollArea();
+    metersScrollArea->setWidget(metersWidget);
+    metersScrollArea->setWidgetResizable(true);
+    metersScrollArea->setFrameShape(QFrame::NoFrame);
+
+    QVBoxLayout* centralLayout = new QVBoxLayout();
+    centralLayout->setContentsMargins(0, 0, 0, 0);
+    centralLayout->addWidget(metersScrollArea);
+    this->ui->centralWidget->setLayout(centralLayout);
+    this->setWindowTitle(this->core->getName());
 
     this->connect(this->ui->serialInfoAction, SIGNAL(triggered()), this, SLOT(onSerialInfoActionTriggered()));
     this->connect(this->ui->serialSearchAndConnectAction, SIGNAL(triggered()),
@@ -58,12 +76,15 @@ MainWindow::MainWindow(QWidget *parent) :
     this->serialInfoDialog = new QDialog(this);
     this->serialInfoDialog->setFixedSize(375, 400);
     this->serialInfoDialog->setWindowTitle("Serial Port Info");
+
+    // The keg meter widgets only get repainted when the core refreshes, no matter how fast samples come in
+    this->connect(this->core, SIGNAL(refreshed()), this, SLOT(onCoreRefreshed()));
 }
 
 MainWindow::~MainWindow() {
-    delete this->comm;
-    this->comm = NULL;
+    this->core->disconnect(this);
 
+    // The views go before the models they show, which the core deletes
     int numKegMeters = this->kegMeters.size();
     for (int i = 0; i < numKegMeters; i++) {
         delete this->kegMeters[i];
@@ -77,18 +98,40 @@ MainWindow::~MainWindow() {
     this->ui = NULL;
 }
 
-void MainWindow::log(const QString& logStr, bool newLine) {
-    this->ui->appLogTextEdit->insertPlainText(logStr + (newLine ? tr("\n") : tr("")));
-    this->ui->appLogTextEdit->verticalScrollBar()->setValue(this->ui->appLogTextEdit->verticalScrollBar()->maximum());
-}
+void MainWindow::onCoreRefreshed() {
+    foreach (KegMeter* meter, this->kegMeters) {
+        meter->refreshView();
+    }
 
-void MainWindow::commLog(const QString& logStr) {
-    this->ui->serialLogTextEdit->insertPlainText(logStr);
-    this->ui->serialLogTextEdit->verticalScrollBar()->setValue(this->ui->serialLogTextEdit->verticalScrollBar()->maximum());   
+    // Roughly once a second, show how many widget updates the batching has saved so far. Every
+    // model update could have repainted both the load and the variance.
+    int refreshRateHz = this->core->getRefreshRateHz();
+    KegMeterServer* telemetryServer = this->core->getTelemetryServer();
+    this->numRefreshes++;
+    if (this->numRefreshes % refreshRateHz == 0) {
+        quint64 numModelUpdates = 0;
+        quint64 numWidgetUpdates = 0;
+        foreach (KegMeter* meter, this->kegMeters) {
+            numModelUpdates  += 2 * meter->getModel()->getNumUpdates();
+            numWidgetUpdates += meter->getNumWidgetUpdates();
+        }
+        QString statusStr = tr("UI refresh: %1 Hz, %2 of %3 meter repaints saved, %4 telemetry client(s) (%5 lagging)")
+            .arg(refreshRateHz).arg(numModelUpdates - numWidgetUpdates).arg(numModelUpdates)
+            .arg(telemetryServer->getNumConnections()).arg(telemetryServer->getNumLaggingConnections());
+
+        LatencyHistogram roundTripTimes;
+        telemetryServer->getRoundTripTimes(roundTripTimes);
+        if (roundTripTimes.getCount() > 0) {
+            statusStr += tr(", round-trip time p50 %1 ms, p99 %2 ms")
+                .arg(roundTripTimes.getValueAtPercentile(50) / 1000.0, 0, 'f', 1)
+                .arg(roundTripTimes.getValueAtPercentile(99) / 1000.0, 0, 'f', 1);
+        }
+        this->ui->statusBar->showMessage(statusStr);
+    }
 }
 
 void MainWindow::onSerialSearchAndConnectDialogActionTriggered() {
-    this->comm->executeSettingsDialog();
+    this->core->getComm()->executeSettingsDialog(this);
 }
 
 void MainWindow::onSerialInfoActionTriggered() {
@@ -3,38 +3,37 @@
 
 #include <QMainWindow>
 
-class AbstractComm;
+class KegMeterCore;
 class KegMeter;
 
 namespace Ui {
 class MainWindow;
 }
 
+/**
+ * GUI of the server, an optional client of the KegMeterCore that does the actual work. It shows a
+ * KegMeter for every meter of the core and refreshes them whenever the core does.
+ */
 class MainWindow : public QMainWindow {
     Q_OBJECT
 
 public:
-    explicit MainWindow(QWidget *parent = 0);
+    explicit MainWindow(KegMeterCore* core, QWidget *parent = 0);
     ~MainWindow();
 
-    QList<KegMeter*> getKegMeters() const { return this->kegMeters; }
-    int getNumKegMeters() const { return this->kegMeters.size(); }
-
-    void log(const QString& logStr, bool newLine = true);
-    void commLog(const QString& logStr);
-
 private slots:
     void onSerialSearchAndConnectDialogActionTriggered();
     void onSerialInfoActionTriggered();
+    void onCoreRefreshed();
 
 private:
     Ui::MainWindow* ui;
 
-    AbstractComm* comm;
+    KegMeterCore* core; // Not owned by this
     QDialog* serialInfoDialog;
 
-    static const int NUM_KEG_METERS = 8;
     QList<KegMeter*> kegMeters;
+    int numRefreshes;
 };
 
 #endif // KEGMETERCONTROLLER_MAINWINDOW_H
@@ -0,0 +1,358 @@
+#include "meterfilterbank.h"
+
+#include <assert.h>
+
+#if defined(__AVX__) || defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace {
+
+// The handful of lane-wise operations the batch filter needs, for every instruction set. Masks are
+// all ones in the lanes they're true for.
+
+struct ScalarLanes {
+    static const int COUNT = 1;
+    static const char* name() { return "none"; }
+
+    typedef float Vec;
+    typedef bool Mask;
+
+    static Vec load(const float* src) { return *src; }
+    static void store(float* dst, Vec v) { *dst = v; }
+    static Vec set(float value) { return value; }
+
+    static Vec add(Vec a, Vec b) { return a + b; }
+    static Vec sub(Vec a, Vec b) { return a - b; }
+    static Vec mul(Vec a, Vec b) { return a * b; }
+    static Vec div(Vec a, Vec b) { return a / b; }
+
+    static Mask loadMask(const uint32_t* src) { return *src != 0; }
+    static void storeMask(uint32_t* dst, Mask m) { *dst = m ? 0xFFFFFFFFu : 0; }
+    static Mask lessThan(Vec a, Vec b) { return a < b; }
+    static Mask lessOrEqual(Vec a, Vec b) { return a <= b; }
+    static Mask greaterOrEqual(Vec a, Vec b) { return a >= b; }
+    static Vec select(Mask m, Vec a, Vec b) { return m ? a : b; }
+};
+
+#if defined(__AVX__)
+
+struct AvxLanes {
+    static const int COUNT = 8;
+    static const char* name() { return "AVX"; }
+
+    typedef __m256 Vec;
+    typedef __m256 Mask;
+
+    static Vec load(const float* src) { return _mm256_loadu_ps(src); }
+    static void store(float* dst, Vec v) { _mm256_storeu_ps(dst, v); }
+    static Vec set(float value) { return _mm256_set1_ps(value); }
+
+    static Vec add(Vec a, Vec b) { return _mm256_add_ps(a, b); }
+    static Vec sub(Vec a, Vec b) { return _mm256_sub_ps(a, b); }
+    static Vec mul(Vec a, Vec b) { return _mm256_mul_ps(a, b); }
+    static Vec div(Vec a, Vec b) { return _mm256_div_ps(a, b); }
+
+    static Mask loadMask(const uint32_t* src) { return _mm256_castsi256_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(src))); }
+    static void storeMask(uint32_t* dst, Mask m) { _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst), _mm256_castps_si256(m)); }
+    static Mask lessThan(Vec a, Vec b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+    static Mask lessOrEqual(Vec a, Vec b) { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+    static Mask greaterOrEqual(Vec a, Vec b) { return _mm256_cmp_ps(a, b, _CMP_GE_OQ); }
+    static Vec select(Mask m, Vec a, Vec b) { return _mm256_blendv_ps(b, a, m); }
+};
+typedef AvxLanes NativeLanes;
+
+#elif defined(__SSE2__)
+
+struct Sse2Lanes {
+    static const int COUNT = 4;
+    static const char* name() { return "SSE2"; }
+
+    typedef __m128 Vec;
+    typedef __m128 Mask;
+
+    static Vec load(const float* src) { return _mm_loadu_ps(src); }
+    static void store(float* dst, Vec v) { _mm_storeu_ps(dst, v); }
+    static Vec set(float value) { return _mm_set1_ps(value); }
+
+    static Vec add(Vec a, Vec b) { return _mm_add_ps(a, b); }
+    static Vec sub(Vec a, Vec b) { return _mm_sub_ps(a, b); }
+    static Vec mul(Vec a, Vec b) { return _mm_mul_ps(a, b); }
+    static Vec div(Vec a, Vec b) { return _mm_div_ps(a, b); }
+
+    static Mask loadMask(const uint32_t* src) { return _mm_castsi128_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src))); }
+    static void storeMask(uint32_t* dst, Mask m) { _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), _mm_castps_si128(m)); }
+    static Mask lessThan(Vec a, Vec b) { return _mm_cmplt_ps(a, b); }
+    static Mask lessOrEqual(Vec a, Vec b) { return _mm_cmple_ps(a, b); }
+    static Mask greaterOrEqual(Vec a, Vec b) { return _mm_cmpge_ps(a, b); }
+    static Vec select(Mask m, Vec a, Vec b) { return _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b)); }
+};
+typedef Sse2Lanes NativeLanes;
+
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+
+// Only AArch64 NEON divides, 32-bit ARM gets the scalar fallback
+struct NeonLanes {
+    static const int COUNT = 4;
+    static const char* name() { return "NEON"; }
+
+    typedef float32x4_t Vec;
+    typedef uint32x4_t Mask;
+
+    static Vec load(const float* src) { return vld1q_f32(src); }
+    static void store(float* dst, Vec v) { vst1q_f32(dst, v); }
+    static Vec set(float value) { return vdupq_n_f32(value); }
+
+    static Vec add(Vec a, Vec b) { return vaddq_f32(a, b); }
+    static Vec sub(Vec a, Vec b) { return vsubq_f32(a, b); }
+    static Vec mul(Vec a, Vec b) { return vmulq_f32(a, b); }
+    static Vec div(Vec a, Vec b) { return vdivq_f32(a, b); }
+
+    static Mask loadMask(const uint32_t* src) { return vld1q_u32(src); }
+    static void storeMask(uint32_t* dst, Mask m) { vst1q_u32(dst, m); }
+    static Mask lessThan(Vec a, Vec b) { return vcltq_f32(a, b); }
+    static Mask lessOrEqual(Vec a, Vec b) { return vcleq_f32(a, b); }
+    static Mask greaterOrEqual(Vec a, Vec b) { return vcgeq_f32(a, b); }
+    static Vec select(Mask m, Vec a, Vec b) { return vbslq_f32(m, a, b); }
+};
+typedef NeonLanes NativeLanes;
+
+#else
+
+typedef ScalarLanes NativeLanes;
+
+#endif
+
+} // namespace
+
+MeterFilterBank::MeterFilterBank(int numMeters, float settledVariance, float steadyVariance, float loadedMass) :
+    numMeters(numMeters),
+    paddedNumMeters((numMeters + NativeLanes::COUNT - 1) / NativeLanes::COUNT * NativeLanes::COUNT),
+    settledVariance(settledVariance),
+    steadyVariance(steadyVariance),
+    loadedMass(loadedMass) {
+
+    assert(numMeters >= 0);
+
+    // Every array is padded, so the last lanes of a batch never go past the end. The padding lanes
+    // are never pending, they just go along for the ride.
+    this->offsets.assign(this->paddedNumMeters, 0.0f);
+    this->scales.assign(this->paddedNumMeters, 1.0f);
+    this->divisors.assign(this->paddedNumMeters, 1.0f);
+
+    this->windows.assign(this->paddedNumMeters * WINDOW_SIZE, 0.0f);
+    this->nextIdxs.assign(this->paddedNumMeters, 0);
+    this->numUpdatesSinceRecentre.assign(this->paddedNumMeters, 0);
+    this->full.assign(this->paddedNumMeters, 0);
+
+    this->means.assign(this->paddedNumMeters, 0.0f);
+    this->sumSqDiffs.assign(this->paddedNumMeters, 0.0f);
+    this->variances.assign(this->paddedNumMeters, 0.0f);
+    this->flags.assign(this->paddedNumMeters, 0);
+
+    this->pendingMasks.assign(this->paddedNumMeters, 0);
+    this->calibratedLoads.assign(this->paddedNumMeters, 0.0f);
+    this->oldLoads.assign(this->paddedNumMeters, 0.0f);
+
+    for (int i = 0; i < this->paddedNumMeters; i++) {
+        this->updateFlags(i);
+    }
+}
+
+const char* MeterFilterBank::getInstructionSetName() {
+    return NativeLanes::name();
+}
+
+int MeterFilterBank::getNumLanes() {
+    return NativeLanes::COUNT;
+}
+
+void MeterFilterBank::setCalibration(int meterIdx, float offset, float scale, float divisor) {
+    this->offsets[meterIdx] = offset;
+    this->scales[meterIdx] = scale;
+    this->divisors[meterIdx] = divisor;
+}
+
+void MeterFilterBank::fill(int meterIdx, float load) {
+    float* window = &this->windows[meterIdx * WINDOW_SIZE];
+    for (int i = 0; i < WINDOW_SIZE; i++) {
+        window[i] = load;
+    }
+    this->full[meterIdx] = 1;
+    this->nextIdxs[meterIdx] = 0;
+    this->numUpdatesSinceRecentre[meterIdx] = 0;
+
+    this->means[meterIdx] = load;
+    this->sumSqDiffs[meterIdx] = 0;
+    this->variances[meterIdx] = 0;
+    this->updateFlags(meterIdx);
+}
+
+void MeterFilterBank::push(int meterIdx, float rawLoad) {
+    float load = this->calibrate(meterIdx, rawLoad);
+    if (!this->full[meterIdx]) {
+        this->fill(meterIdx, load);
+        return;
+    }
+    this->pushCalibrated(meterIdx, load);
+}
+
+void MeterFilterBank::pushBatch(const float* rawLoads, const uint8_t* pending) {
+    const uint8_t* full = this->full.data();
+    const int* nextIdxs = this->nextIdxs.data();
+    float* windows = this->windows.data();
+    uint32_t* pendingMasks = this->pendingMasks.data();
+    float* loads = this->calibratedLoads.data();
+    float* oldLoads = this->oldLoads.data();
+
+    bool anyPending = false;
+    for (int i = 0; i < this->numMeters; i++) {
+        pendingMasks[i] = 0;
+        if (!pending[i]) {
+            continue;
+        }
+        if (!full[i]) {
+            this->push(i, rawLoads[i]);
+            continue;
+        }
+
+        // The oldest load of every window is somewhere else, so they're gathered up front
+        pendingMasks[i] = 0xFFFFFFFFu;
+        loads[i] = rawLoads[i];
+        oldLoads[i] = windows[i * WINDOW_SIZE + nextIdxs[i]];
+        anyPending = true;
+    }
+    if (!anyPending) {
+        return;
+    }
+
+    this->filterBatch<NativeLanes>();
+
+    for (int i = 0; i < this->numMeters; i++) {
+        if (pendingMasks[i] == 0) {
+            continue;
+        }
+        int nextIdx = this->nextIdxs[i];
+        windows[i * WINDOW_SIZE + nextIdx] = loads[i];
+        this->nextIdxs[i] = (nextIdx + 1 < WINDOW_SIZE) ? nextIdx + 1 : 0;
+        if (++this->numUpdatesSinceRecentre[i] >= RECENTRE_INTERVAL) {
+            this->recentre(i);
+            this->variances[i] = this->sumSqDiffs[i] / ((float)WINDOW_SIZE);
+            this->updateFlags(i);
+        }
+    }
+}
+
+/**
+ * The lane-wise part of pushBatch: calibrate the pending loads (in calibratedLoads), update the mean
+ * and variance of their windows with them, and test the thresholds. Lanes that aren't pending keep
+ * what they had.
+ */
+template <typename Lanes>
+void MeterFilterBank::filterBatch() {
+    typedef typename Lanes::Vec Vec;
+    typedef typename Lanes::Mask Mask;
+
+    const Vec windowSize = Lanes::set((float)WINDOW_SIZE);
+    const Vec zero = Lanes::set(0.0f);
+    const Vec settledVariance = Lanes::set(this->settledVariance);
+    const Vec steadyVariance = Lanes::set(this->steadyVariance);
+    const Vec loadedMass = Lanes::set(this->loadedMass);
+
+    // Flags are bytes, which may alias anything, so everything is read through locals
+    const uint32_t* pendingMasks = this->pendingMasks.data();
+    const float* offsets = this->offsets.data();
+    const float* scales = this->scales.data();
+    const float* divisors = this->divisors.data();
+    const float* oldLoads = this->oldLoads.data();
+    float* loads = this->calibratedLoads.data();
+    float* means = this->means.data();
+    float* sumSqDiffs = this->sumSqDiffs.data();
+    float* variances = this->variances.data();
+    uint8_t* flags = this->flags.data();
+
+    uint32_t settledMasks[Lanes::COUNT];
+    uint32_t steadyMasks[Lanes::COUNT];
+    uint32_t loadedMasks[Lanes::COUNT];
+
+    for (int i = 0; i < this->paddedNumMeters; i += Lanes::COUNT) {
+        Mask pending = Lanes::loadMask(&pendingMasks[i]);
+
+        Vec load = Lanes::div(Lanes::mul(Lanes::sub(Lanes::load(&loads[i]), Lanes::load(&offsets[i])),
+                                         Lanes::load(&scales[i])),
+                              Lanes::load(&divisors[i]));
+        Lanes::store(&loads[i], load);
+
+        // Same as LoadWindow::push
+        Vec oldLoad = Lanes::load(&oldLoads[i]);
+        Vec oldMean = Lanes::load(&means[i]);
+        Vec oldSumSqDiffs = Lanes::load(&sumSqDiffs[i]);
+        Vec mean = Lanes::add(oldMean, Lanes::div(Lanes::sub(load, oldLoad), windowSize));
+        Vec sumSqDiff = Lanes::add(oldSumSqDiffs, Lanes::mul(Lanes::sub(load, oldLoad),
+                                   Lanes::sub(Lanes::add(Lanes::sub(load, mean), oldLoad), oldMean)));
+        sumSqDiff = Lanes::select(Lanes::lessThan(sumSqDiff, zero), zero, sumSqDiff);
+
+        mean = Lanes::select(pending, mean, oldMean);
+        sumSqDiff = Lanes::select(pending, sumSqDiff, oldSumSqDiffs);
+        Vec variance = Lanes::div(sumSqDiff, windowSize);
+        Lanes::store(&means[i], mean);
+        Lanes::store(&sumSqDiffs[i], sumSqDiff);
+        Lanes::store(&variances[i], variance);
+
+        Lanes::storeMask(settledMasks, Lanes::lessOrEqual(variance, settledVariance));
+        Lanes::storeMask(steadyMasks, Lanes::lessOrEqual(variance, steadyVariance));
+        Lanes::storeMask(loadedMasks, Lanes::greaterOrEqual(mean, loadedMass));
+        for (int j = 0; j < Lanes::COUNT; j++) {
+            flags[i + j] = (settledMasks[j] & SettledFlag) | (steadyMasks[j] & SteadyFlag) | (loadedMasks[j] & LoadedFlag);
+        }
+    }
+}
+
+void MeterFilterBank::pushCalibrated(int meterIdx, float load) {
+    // Same as LoadWindow::push
+    float oldLoad = this->windows[meterIdx * WINDOW_SIZE + this->nextIdxs[meterIdx]];
+    float oldMean = this->means[meterIdx];
+    this->means[meterIdx] += (load - oldLoad) / ((float)WINDOW_SIZE);
+    this->sumSqDiffs[meterIdx] += (load - oldLoad) * (load - this->means[meterIdx] + oldLoad - oldMean);
+    if (this->sumSqDiffs[meterIdx] < 0) {
+        this->sumSqDiffs[meterIdx] = 0;
+    }
+
+    this->windows[meterIdx * WINDOW_SIZE + this->nextIdxs[meterIdx]] = load;
+    this->nextIdxs[meterIdx] = (this->nextIdxs[meterIdx] + 1) % WINDOW_SIZE;
+    if (++this->numUpdatesSinceRecentre[meterIdx] >= RECENTRE_INTERVAL) {
+        this->recentre(meterIdx);
+    }
+
+    this->variances[meterIdx] = this->sumSqDiffs[meterIdx] / ((float)WINDOW_SIZE);
+    this->updateFlags(meterIdx);
+}
+
+// Same as LoadWindow::recentre, for a full window
+void MeterFilterBank::recentre(int meterIdx) {
+    this->numUpdatesSinceRecentre[meterIdx] = 0;
+
+    const float* window = &this->windows[meterIdx * WINDOW_SIZE];
+    int startIdx = this->nextIdxs[meterIdx];
+    float sum = 0;
+    for (int i = 0; i < WINDOW_SIZE; i++) {
+        sum += window[(startIdx + i) % WINDOW_SIZE];
+    }
+    this->means[meterIdx] = sum / ((float)WINDOW_SIZE);
+
+    float sqDiffs = 0;
+    for (int i = 0; i < WINDOW_SIZE; i++) {
+        float diff = window[(startIdx + i) % WINDOW_SIZE] - this->means[meterIdx];
+        sqDiffs += diff * diff;
+    }
+    this->sumSqDiffs[meterIdx] = sqDiffs;
+}
+
+void MeterFilterBank::updateFlags(int meterIdx) {
+    float variance = this->variances[meterIdx];
+    this->flags[meterIdx] = (variance <= this->settledVariance ? SettledFlag : 0) |
+                            (variance <= this->steadyVariance ? SteadyFlag : 0) |
+                            (this->means[meterIdx] >= this->loadedMass ? LoadedFlag : 0);
+}
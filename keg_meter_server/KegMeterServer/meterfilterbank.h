@@ -0,0 +1,99 @@
+#ifndef KEGMETERCONTROLLER_METERFILTERBANK_H
+#define KEGMETERCONTROLLER_METERFILTERBANK_H
+
+#include <stdint.h>
+#include <vector>
+
+/**
+ * The load filtering of every keg meter of a KegMeterBank, kept as a structure of arrays so a batch
+ * of samples for different meters is filtered side by side in SIMD lanes (AVX, SSE2 or NEON on
+ * AArch64, whichever the build targets, otherwise one lane at a time).
+ *
+ * Every meter has a window of WINDOW_SIZE calibrated loads with its mean and variance, exactly as
+ * LoadWindow keeps them: the same Welford-style update as a sample comes in and the oldest one
+ * falls out, re-centred every RECENTRE_INTERVAL samples. Each float operation is the one LoadWindow
+ * does, in the same order, so the results are the same bit for bit whichever way a sample goes in.
+ * A meter's first sample fills its whole window.
+ *
+ * Raw loads are calibrated on the way in as (raw - offset) * scale / divisor, see setCalibration.
+ * After every update the mean and variance are tested against the thresholds the state machine of
+ * the meter cares about (see Flags).
+ *
+ * Plain C++ without Qt, so it can be checked against LoadWindow on its own (see meter_filter_bench).
+ */
+class MeterFilterBank {
+public:
+    static const int WINDOW_SIZE = 30;
+    static const int RECENTRE_INTERVAL = 8 * WINDOW_SIZE;
+
+    enum Flags {
+        SettledFlag = 0x1, // The variance is at most the settled variance
+        SteadyFlag  = 0x2, // The variance is at most the steady variance
+        LoadedFlag  = 0x4  // The mean is at least the loaded mass
+    };
+
+    MeterFilterBank(int numMeters, float settledVariance, float steadyVariance, float loadedMass);
+
+    int size() const { return this->numMeters; }
+
+    // The name of the SIMD instruction set the batches are filtered with, and how many lanes it has
+    static const char* getInstructionSetName();
+    static int getNumLanes();
+
+    void setCalibration(int meterIdx, float offset, float scale, float divisor);
+    float calibrate(int meterIdx, float rawLoad) const {
+        return (rawLoad - this->offsets[meterIdx]) * this->scales[meterIdx] / this->divisors[meterIdx];
+    }
+
+    // Replace every (calibrated) load in the window of the meter with the given one
+    void fill(int meterIdx, float load);
+
+    // Calibrate a raw load and add it to the window of a single meter
+    void push(int meterIdx, float rawLoad);
+
+    // Same for any number of meters at once: rawLoads has a load for every meter, only the ones
+    // with pending[meterIdx] set are used
+    void pushBatch(const float* rawLoads, const uint8_t* pending);
+
+    float getMean(int meterIdx) const { return this->means[meterIdx]; }
+    float getVariance(int meterIdx) const { return this->variances[meterIdx]; }
+    bool hasFlags(int meterIdx, uint8_t flags) const { return (this->flags[meterIdx] & flags) == flags; }
+
+private:
+    int numMeters;
+    int paddedNumMeters; // Rounded up to a whole number of lanes
+
+    float settledVariance;
+    float steadyVariance;
+    float loadedMass;
+
+    // Calibration
+    std::vector<float> offsets;
+    std::vector<float> scales;
+    std::vector<float> divisors;
+
+    // Windows, WINDOW_SIZE loads for each meter in a row
+    std::vector<float> windows;
+    std::vector<int> nextIdxs;
+    std::vector<int> numUpdatesSinceRecentre;
+    std::vector<uint8_t> full;
+
+    std::vector<float> means;
+    std::vector<float> sumSqDiffs;
+    std::vector<float> variances;
+    std::vector<uint8_t> flags;
+
+    // Scratch space of a batch
+    std::vector<uint32_t> pendingMasks;
+    std::vector<float> calibratedLoads;
+    std::vector<float> oldLoads;
+
+    void pushCalibrated(int meterIdx, float load);
+    void recentre(int meterIdx);
+    void updateFlags(int meterIdx);
+
+    template <typename Lanes>
+    void filterBatch();
+};
+
+#endif // KEGMETERCONTROLLER_METERFILTERBANK_H
@@ -0,0 +1,73 @@
+#include "processstats.h"
+
+#include <QFile>
+#include <QByteArray>
+#include <QList>
+#include <QElapsedTimer>
+
+#ifdef Q_OS_UNIX
+#include <unistd.h>
+#endif
+
+// Fallback clock for getUptimeMs, started before main
+static QElapsedTimer startClock;
+static bool startClockStarted = (startClock.start(), true);
+
+qint64 ProcessStats::getResidentMemory() {
+    return readStatusValue("VmRSS:");
+}
+
+qint64 ProcessStats::getPeakResidentMemory() {
+    return readStatusValue("VmHWM:");
+}
+
+qint64 ProcessStats::getUptimeMs() {
+#ifdef Q_OS_LINUX
+    // Field 22 of /proc/self/stat is the start time in clock ticks since boot. The command name
+    // (field 2) may contain spaces, so count from the closing paren that ends it.
+    QFile statFile("/proc/self/stat");
+    QFile uptimeFile("/proc/uptime");
+    if (statFile.open(QIODevice::ReadOnly) && uptimeFile.open(QIODevice::ReadOnly)) {
+        QByteArray stat = statFile.readAll();
+        QList<QByteArray> fields = stat.mid(stat.lastIndexOf(')') + 2).split(' ');
+        QList<QByteArray> uptime = uptimeFile.readAll().split(' ');
+        long ticksPerSec = sysconf(_SC_CLK_TCK);
+
+        static const int START_TIME_FIELD_IDX = 22 - 3;
+        bool startOk = false;
+        bool uptimeOk = false;
+        if (fields.size() > START_TIME_FIELD_IDX && !uptime.isEmpty() && ticksPerSec > 0) {
+            qint64 startTicks = fields[START_TIME_FIELD_IDX].toLongLong(&startOk);
+            double uptimeSecs = uptime[0].toDouble(&uptimeOk);
+            if (startOk && uptimeOk) {
+                return static_cast<qint64>(uptimeSecs * 1000.0) - startTicks * 1000 / ticksPerSec;
+            }
+        }
+    }
+#endif
+    Q_UNUSED(startClockStarted);
+    return startClock.elapsed();
+}
+
+qint64 ProcessStats::readStatusValue(const char* key) {
+    QFile statusFile("/proc/self/status");
+    if (!statusFile.open(QIODevice::ReadOnly)) {
+        return -1;
+    }
+
+    // Lines look like "VmRSS:     1234 kB"
+    while (!statusFile.atEnd()) {
+        QByteArray line = statusFile.readLine();
+        if (!line.startsWith(key)) {
+            continue;
+        }
+        QList<QByteArray> parts = line.mid(static_cast<int>(qstrlen(key))).simplified().split(' ');
+        bool ok = false;
+        qint64 value = parts[0].toLongLong(&ok);
+        if (!ok) {
+            return -1;
+        }
+        return (parts.size() > 1 && parts[1] == "kB") ? value * 1024 : value;
+    }
+    return -1;
+}
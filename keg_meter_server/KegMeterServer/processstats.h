@@ -0,0 +1,25 @@
+#ifndef KEGMETERCONTROLLER_PROCESSSTATS_H
+#define KEGMETERCONTROLLER_PROCESSSTATS_H
+
+#include <QtGlobal>
+
+/**
+ * What the server process costs the machine it runs on, so the headless and GUI modes can be
+ * compared on the target. The figures come from /proc, on other platforms they're unknown (-1).
+ */
+class ProcessStats {
+public:
+    // Resident memory right now and at its peak, in bytes
+    static qint64 getResidentMemory();
+    static qint64 getPeakResidentMemory();
+
+    // Time since the process was started, by the OS if it tells us, otherwise since static init
+    static qint64 getUptimeMs();
+
+private:
+    ProcessStats() {}
+
+    static qint64 readStatusValue(const char* key);
+};
+
+#endif // KEGMETERCONTROLLER_PROCESSSTATS_H
@@ -0,0 +1,239 @@
+#include "replaycomm.h"
+#include "kegmetercore.h"
+#include "kegmeterbank.h"
+
+#include <QCoreApplication>
+#include <QMessageBox>
+
+namespace {
+
+// Only what the app wrote counts, an expected output may just as well be a full capture
+bool readWrite(SerialCapture& capture, SerialCapture::Record& record) {
+    while (capture.read(record)) {
+        if (record.direction == SerialCapture::WriteDirection) {
+            return true;
+        }
+    }
+    return false;
+}
+
+QString writeString(const SerialCapture::Record& record) {
+    return QString("\"%1\" at %2 s").arg(QString::fromLatin1(record.data).trimmed()).arg(record.timeUs / 1000000.0, 0, 'f', 3);
+}
+
+}
+
+ReplayComm::ReplayComm(KegMeterCore* core, const ReplayOptions& options) :
+    AbstractComm(core),
+    options(options),
+    worker(new SerialWorker(&this->sampleQueue)),
+    hasPendingRecord(false),
+    outputSynced(false),
+    finished(false),
+    outputAsExpected(options.expectedOutputFilePath.isEmpty()), // Not until checked (see finish)
+    replayTimeUs(0),
+    numRecordsReplayed(0),
+    numBytesReplayed(0),
+    numSamplesDelivered(0),
+    numWritesCaptured(0) {
+
+    // The worker stays on this thread, so every sample is delivered before the next record is read
+    this->connect(this->worker, SIGNAL(dataReceived(const QByteArray&)), this, SLOT(onSerialDataReceived(const QByteArray&)));
+    this->connect(this->worker, SIGNAL(logMessage(const QString&)), this, SLOT(onWorkerLogMessage(const QString&)));
+    this->connect(&this->replayTimer, SIGNAL(timeout()), this, SLOT(onReplayTimer()));
+    this->replayTimer.setSingleShot(true);
+
+    this->replayClock.start();
+    if (!this->capture.openForReading(this->options.captureFilePath)) {
+        this->finish();
+        return;
+    }
+    if (!this->options.outputFilePath.isEmpty() &&
+        !this->output.openForWriting(this->options.outputFilePath, this->capture.getStartTime())) {
+        this->core->log(tr("Failed to capture the replay output: %1").arg(this->output.errorString()));
+    }
+
+    this->core->log(tr("Replaying %1 %2").arg(this->options.captureFilePath).arg(this->speedString()));
+    this->worker->startReplay();
+
+    // The meters don't exist yet, so wait for the event loop before feeding them anything
+    this->replayTimer.start(0);
+}
+
+ReplayComm::~ReplayComm() {
+    this->replayTimer.stop();
+
+    delete this->worker;
+    this->worker = NULL;
+}
+
+void ReplayComm::write(const QByteArray &data) {
+    if (!this->output.isOpen()) {
+        return;
+    }
+    if (this->output.write(this->replayTimeUs, SerialCapture::WriteDirection, data)) {
+        this->numWritesCaptured++;
+    }
+}
+
+void ReplayComm::executeSettingsDialog(QWidget* parent) {
+    // There's nothing to set up, show how far along the replay is instead
+    qint64 fileSize = qMax<qint64>(1, this->capture.getFileSize());
+    QString text = tr("Replaying %1 %2\n\n").arg(this->options.captureFilePath).arg(this->speedString());
+    text += this->finished ? tr("Finished") : tr("%1% done").arg(100.0 * this->capture.getFilePos() / fileSize, 0, 'f', 1);
+    text += tr(", %1 s of the capture, %2 bytes, %3 samples, %4 write(s) captured")
+        .arg(this->replayTimeUs / 1000000.0, 0, 'f', 1).arg(this->numBytesReplayed)
+        .arg(this->numSamplesDelivered).arg(this->numWritesCaptured);
+    QMessageBox::information(parent, tr("Serial Replay"), text);
+}
+
+qint64 ReplayComm::currentTimeMs() const {
+    return this->capture.getStartTime() + this->replayTimeUs / 1000;
+}
+
+void ReplayComm::onReplayTimer() {
+    if (this->finished) {
+        return;
+    }
+
+    bool asFastAsPossible = (this->options.speed <= 0);
+    qint64 targetTimeUs = static_cast<qint64>(this->replayClock.nsecsElapsed() / 1000 * this->options.speed);
+
+    // Never more than so many records in one go, so the rest of the app gets a turn as well
+    for (int i = 0; i < MAX_RECORDS_PER_TIMER; i++) {
+        if (!this->hasPendingRecord) {
+            if (!this->capture.read(this->pendingRecord)) {
+                this->finish();
+                return;
+            }
+            this->hasPendingRecord = true;
+        }
+
+        if (!asFastAsPossible && this->pendingRecord.timeUs > targetTimeUs) {
+            // Sleep until the record is due, but check back every so often in case of long gaps
+            double waitMs = (this->pendingRecord.timeUs - targetTimeUs) / this->options.speed / 1000.0;
+            this->replayTimer.start(static_cast<int>(qMin(waitMs, 1000.0)));
+            return;
+        }
+
+        this->hasPendingRecord = false;
+        this->replayRecord(this->pendingRecord);
+    }
+    this->replayTimer.start(0);
+}
+
+void ReplayComm::onSerialDataReceived(const QByteArray& data) {
+    this->core->commLog(data);
+}
+
+void ReplayComm::onWorkerLogMessage(const QString& message) {
+    this->core->log(message);
+}
+
+void ReplayComm::replayRecord(const SerialCapture::Record& record) {
+    // Times in a capture only ever go up, but don't let a bad one turn back the clock of the meters
+    this->replayTimeUs = qMax(this->replayTimeUs, record.timeUs);
+    this->numRecordsReplayed++;
+
+    if (!this->outputSynced && this->replayTimeUs >= OUTPUT_SYNC_DELAY_US) {
+        this->outputSynced = true;
+        this->core->getKegMeterBank()->outputSync();
+    }
+
+    // What the app wrote back then is in the capture too, but we only answer for ourselves
+    if (record.direction != SerialCapture::ReadDirection) {
+        return;
+    }
+    for (int offset = 0; offset < record.data.size(); offset += MAX_CHUNK_SIZE) {
+        this->worker->replayBytes(record.data.mid(offset, MAX_CHUNK_SIZE));
+        this->deliverSamples();
+    }
+    this->numBytesReplayed += record.data.size();
+}
+
+void ReplayComm::deliverSamples() {
+    LoadSample samples[MAX_SAMPLES_PER_DELIVERY];
+    int numSamples = 0;
+    do {
+        numSamples = this->sampleQueue.popBatch(samples, MAX_SAMPLES_PER_DELIVERY);
+        this->core->updateLoadMeasurements(samples, numSamples);
+        this->numSamplesDelivered += numSamples;
+    } while (numSamples == MAX_SAMPLES_PER_DELIVERY);
+}
+
+void ReplayComm::finish() {
+    this->finished = true;
+    if (!this->capture.errorString().isEmpty()) {
+        this->core->log(tr("Replay of %1 stopped early: %2").arg(this->options.captureFilePath).arg(this->capture.errorString()));
+    }
+    this->capture.close();
+    this->output.close();
+    if (!this->options.expectedOutputFilePath.isEmpty()) {
+        this->outputAsExpected = this->checkExpectedOutput();
+    }
+
+    double elapsedSecs = qMax<qint64>(1, this->replayClock.elapsed()) / 1000.0;
+    double replayedSecs = this->replayTimeUs / 1000000.0;
+    this->core->log(tr("Replay finished: %1 record(s), %2 bytes and %3 samples in %4 s, %5 s of capture (%6x real time), %7 write(s) captured")
+                    .arg(this->numRecordsReplayed).arg(this->numBytesReplayed).arg(this->numSamplesDelivered)
+                    .arg(elapsedSecs, 0, 'f', 2).arg(replayedSecs, 0, 'f', 1)
+                    .arg(replayedSecs / elapsedSecs, 0, 'f', 1).arg(this->numWritesCaptured));
+
+    if (this->options.quitWhenDone) {
+        QMetaObject::invokeMethod(QCoreApplication::instance(), "quit", Qt::QueuedConnection);
+    }
+}
+
+/**
+ * Compare what the app wrote during the replay with the expected output: the same writes, in the
+ * same order, at the same time into the capture.
+ */
+bool ReplayComm::checkExpectedOutput() {
+    SerialCapture actual;
+    SerialCapture expected;
+    if (!actual.openForReading(this->options.outputFilePath)) {
+        this->core->log(tr("Failed to check the replay output: %1").arg(actual.errorString()));
+        return false;
+    }
+    if (!expected.openForReading(this->options.expectedOutputFilePath)) {
+        this->core->log(tr("Failed to check the replay output: %1").arg(expected.errorString()));
+        return false;
+    }
+
+    quint64 numWrites = 0;
+    while (true) {
+        SerialCapture::Record actualRecord;
+        SerialCapture::Record expectedRecord;
+        bool hasActual = readWrite(actual, actualRecord);
+        bool hasExpected = readWrite(expected, expectedRecord);
+        if (!hasActual && !hasExpected) {
+            break;
+        }
+
+        if (!hasActual || !hasExpected || actualRecord.timeUs != expectedRecord.timeUs ||
+            actualRecord.data != expectedRecord.data) {
+            this->core->log(tr("Replay output differs from %1 at write %2: expected %3, got %4")
+                            .arg(this->options.expectedOutputFilePath).arg(numWrites + 1)
+                            .arg(hasExpected ? writeString(expectedRecord) : tr("nothing"))
+                            .arg(hasActual ? writeString(actualRecord) : tr("nothing")));
+            return false;
+        }
+        numWrites++;
+    }
+
+    if (!actual.errorString().isEmpty() || !expected.errorString().isEmpty()) {
+        this->core->log(tr("Failed to check the replay output: %1")
+                        .arg(actual.errorString().isEmpty() ? expected.errorString() : actual.errorString()));
+        return false;
+    }
+
+    this->core->log(tr("Replay output matches %1 (%2 write(s))").arg(this->options.expectedOutputFilePath).arg(numWrites));
+    return true;
+}
+
+QString ReplayComm::speedString() const {
+    if (this->options.speed <= 0) {
+        return tr("as fast as possible");
+    }
+    return tr("at %1x real time").arg(this->options.speed);
+}
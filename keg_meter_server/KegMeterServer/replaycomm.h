@@ -0,0 +1,94 @@
+#ifndef KEGMETERCONTROLLER_REPLAYCOMM_H
+#define KEGMETERCONTROLLER_REPLAYCOMM_H
+
+#include "abstractcomm.h"
+#include "serialworker.h"
+#include "serialcapture.h"
+
+#include <QElapsedTimer>
+#include <QTimer>
+
+struct ReplayOptions {
+    QString captureFilePath;
+    QString outputFilePath;         // Everything the app writes is captured here, if set
+    QString expectedOutputFilePath; // The output has to match this capture, if set (see isOutputAsExpected)
+    QString dataDirPath;            // Meter state and history of the replay, kept apart from the live ones
+    bool seedWithLiveState;         // Start out with the calibration of the live meters, or from scratch
+    double speed;                   // 1 is real time, 0 is as fast as possible
+    bool quitWhenDone;
+
+    ReplayOptions() : seedWithLiveState(true), speed(1.0), quitWhenDone(false) {}
+};
+
+/**
+ * Plays back a serial capture (see SerialCapture, and the "serial_capture_file" setting of
+ * SerialComm) instead of talking to the hardware. The recorded bytes go through the same decoding
+ * as live ones (see SerialWorker::replayBytes), and the samples are handed to the keg meters right
+ * away with the time they were recorded at (see currentTimeMs). So the same capture always ends up
+ * as the same history and pours, no matter how fast it's played back.
+ *
+ * Playback runs in real time, N times faster, or as fast as possible while still keeping the event
+ * loop (telemetry, refreshes) going. Whatever the app writes to the hardware is recorded to the
+ * output capture, with the time of the record that was being played back.
+ *
+ * That makes a replay a regression check as well: once it's finished, the output is compared write
+ * for write with the expected output, usually the output of an earlier replay of the same capture
+ * (from the same meter state, see ReplayOptions::seedWithLiveState).
+ */
+class ReplayComm : public AbstractComm {
+    Q_OBJECT
+public:
+    ReplayComm(KegMeterCore* core, const ReplayOptions& options);
+    ~ReplayComm();
+
+    bool isFinished() const { return this->finished; }
+    bool isOutputAsExpected() const { return this->outputAsExpected; }
+
+    void write(const QByteArray &data) override;
+    void executeSettingsDialog(QWidget* parent) override;
+    qint64 currentTimeMs() const override;
+
+private slots:
+    void onReplayTimer();
+    void onSerialDataReceived(const QByteArray& data);
+    void onWorkerLogMessage(const QString& message);
+
+private:
+    // Records are fed in chunks small enough that their samples always fit in the queue
+    static const int MAX_CHUNK_SIZE = 2048;
+    static const int MAX_RECORDS_PER_TIMER = 256;
+    static const int MAX_SAMPLES_PER_DELIVERY = 256;
+
+    // Same as SerialComm, the meters send their state to the hardware a while after connecting
+    static const qint64 OUTPUT_SYNC_DELAY_US = 2000000;
+
+    ReplayOptions options;
+
+    LoadSampleQueue sampleQueue;
+    SerialWorker* worker;
+
+    SerialCapture capture;
+    SerialCapture output;
+    SerialCapture::Record pendingRecord;
+    bool hasPendingRecord;
+    bool outputSynced;
+    bool finished;
+    bool outputAsExpected;
+
+    QTimer replayTimer;
+    QElapsedTimer replayClock;
+    qint64 replayTimeUs; // Position in the capture
+
+    quint64 numRecordsReplayed;
+    quint64 numBytesReplayed;
+    quint64 numSamplesDelivered;
+    quint64 numWritesCaptured;
+
+    void replayRecord(const SerialCapture::Record& record);
+    void deliverSamples();
+    void finish();
+    bool checkExpectedOutput();
+    QString speedString() const;
+};
+
+#endif // KEGMETERCONTROLLER_REPLAYCOMM_H
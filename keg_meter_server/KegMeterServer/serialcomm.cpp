@@ -1,84 +1,83 @@
 #include "serialcomm.h"
-#include "mainwindow.h"
-#include "kegmeter.h"
+#include "kegmetercore.h"
+#include "kegmeterbank.h"
 #include "appsettings.h"
 #include "serialsearchandconnectdialog.h"
 
-#include <QTextStream>
+#include <QFile>
 #include <QSettings>
 #include <QSerialPortInfo>
 
-SerialComm::SerialComm(MainWindow* mainWindow) :
-    AbstractComm(mainWindow),
-    serialPort(new QSerialPort()),
-    bytesWritten(0) {
+SerialComm::SerialComm(KegMeterCore* core) :
+    AbstractComm(core),
+    worker(new SerialWorker(&this->sampleQueue)),
+    portOpen(false),
+    baudRate(QSerialPort::Baud9600),
+    maxBaudRate(DEFAULT_MAX_BAUD_RATE),
+    serialConnDialog(NULL) {
 
-    this->serialPort->setBaudRate(QSerialPort::Baud9600);
-    this->serialPort->setParity(QSerialPort::NoParity);
-    this->serialPort->setStopBits(QSerialPort::OneStop);
-    this->serialPort->setDataBits(QSerialPort::Data8);
-    this->serialPort->setFlowControl(QSerialPort::NoFlowControl);
+    QSettings settings;
+    this->maxBaudRate = settings.value(AppSettings::MAX_BAUD_RATE, static_cast<int>(DEFAULT_MAX_BAUD_RATE)).toInt();
 
-    this->serialConnDialog = new SerialSearchAndConnectDialog(this, this->mainWindow);
+    // All serial I/O and package decoding happens on the I/O thread
+    this->worker->moveToThread(&this->ioThread);
+    this->connect(this->worker, SIGNAL(portClosed()), this, SLOT(onSerialPortClose()));
+    this->connect(this->worker, SIGNAL(dataReceived(const QByteArray&)), this, SLOT(onSerialDataReceived(const QByteArray&)));
+    this->connect(this->worker, SIGNAL(logMessage(const QString&)), this, SLOT(onWorkerLogMessage(const QString&)));
+    this->ioThread.start();
 
-    this->connect(this->serialPort, SIGNAL(error(QSerialPort::SerialPortError)),
-                  this, SLOT(onSerialPortError(QSerialPort::SerialPortError)));
-    this->connect(this->serialPort, SIGNAL(aboutToClose()), this, SLOT(onSerialPortClose()));
-    this->connect(this->serialPort, SIGNAL(readyRead()), this, SLOT(onSerialPortReadyRead()));
-    this->connect(this->serialPort, SIGNAL(bytesWritten(qint64)), this, SLOT(onSerialPortBytesWritten(qint64)));
+    QString captureFilePath = settings.value(AppSettings::SERIAL_CAPTURE_FILE).toString();
+    if (!captureFilePath.isEmpty()) {
+        QMetaObject::invokeMethod(this->worker, "startCapture", Qt::QueuedConnection, Q_ARG(QString, captureFilePath));
+    }
 
     this->connect(&this->delayedSendTimer, SIGNAL(timeout()), this, SLOT(onDelayedSendTimer()));
     this->connect(&this->trySerialTimer, SIGNAL(timeout()), this, SLOT(onTrySerialTimer()));
+    this->connect(&this->sampleRefreshTimer, SIGNAL(timeout()), this, SLOT(onSampleRefreshTimer()));
 
     this->trySerialTimer.setSingleShot(true);
     this->trySerialTimer.start(TRY_SERIAL_TIMEOUT_MS);
     this->delayedSendTimer.setSingleShot(true);
+    this->sampleRefreshTimer.start(SAMPLE_REFRESH_INTERVAL_MS);
 }
 
 SerialComm::~SerialComm() {
     this->trySerialTimer.stop();
+    this->sampleRefreshTimer.stop();
 
     delete this->serialConnDialog;
     this->serialConnDialog = NULL;
 
-    if (this->serialPort->isOpen()) {
-        this->serialPort->close();
-    }
-    delete this->serialPort;
-    this->serialPort = NULL;
+    this->worker->disconnect(this);
+    QMetaObject::invokeMethod(this->worker, "closePort", Qt::BlockingQueuedConnection);
+    this->ioThread.quit();
+    this->ioThread.wait();
+
+    delete this->worker;
+    this->worker = NULL;
 }
 
 void SerialComm::write(const QByteArray &data) {
-    if (!this->serialPort->isOpen()) {
+    if (!this->portOpen) {
         return;
     }
+    QMetaObject::invokeMethod(this->worker, "write", Qt::QueuedConnection, Q_ARG(QByteArray, data));
+}
 
-    this->commWriteData = data;
-
-    qint64 bytesWritten = this->serialPort->write(data);
-    if (bytesWritten == -1) {
-        this->mainWindow->log(tr("Failed to write the data to port %1, error: %2").arg(this->serialPort->portName()).arg(this->serialPort->errorString()));
-    }
-    else if (bytesWritten != data.size()) {
-       this->mainWindow->log(tr("Failed to write all the data to port %1, error: %2").arg(this->serialPort->portName()).arg(this->serialPort->errorString()));
-    }
-    else {
-        this->mainWindow->log(tr("Wrote serial data: ") + QString(data.toStdString().c_str()));
+void SerialComm::executeSettingsDialog(QWidget* parent) {
+    if (this->serialConnDialog == NULL) {
+        this->serialConnDialog = new SerialSearchAndConnectDialog(this, parent);
     }
 
-    this->serialPort->flush();
-}
-
-void SerialComm::executeSettingsDialog() {
     this->trySerialTimer.stop();
     this->serialConnDialog->exec();
-    if (!this->serialPort->isOpen()) {
+    if (!this->portOpen) {
         this->trySerialTimer.start(TRY_SERIAL_TIMEOUT_MS);
     }
 }
 
 void SerialComm::onTrySerialTimer() {
-    if (this->serialPort->isOpen()) {
+    if (this->portOpen || this->openConfiguredSerialPort()) {
         return;
     }
 
@@ -97,7 +96,7 @@ void SerialComm::onTrySerialTimer() {
                 }
             }
 
-        if (!this->serialPort->isOpen()) {
+        if (!this->portOpen) {
             // Try to find a port that makes sense...
             foreach (const QSerialPortInfo& port, ports) {
                 if (!port.isBusy() && port.isValid() &&
@@ -110,166 +109,96 @@ void SerialComm::onTrySerialTimer() {
         }
     }
 
-    if (!this->serialPort->isOpen() && !this->trySerialTimer.isActive()) {
+    if (!this->portOpen && !this->trySerialTimer.isActive()) {
         this->trySerialTimer.start(TRY_SERIAL_TIMEOUT_MS);
     }
 }
 
 void SerialComm::onDelayedSendTimer() {
-    auto kegMeters = this->mainWindow->getKegMeters();
-    foreach (auto* kegMeter, kegMeters) {
-        kegMeter->outputSync();
-    }
-}
-
-void SerialComm::onSerialPortError(const QSerialPort::SerialPortError&) {
-    QString errorMsg = this->serialPort->errorString();
-    if (!errorMsg.isEmpty()) {
-        this->mainWindow->log(errorMsg);
-    }
-    if (this->serialPort->isOpen()) {
-        this->serialPort->close();
-    }
+    this->core->getKegMeterBank()->outputSync();
 }
 
 void SerialComm::onSerialPortClose() {
-    // Disable all of the meter GUIs
-    auto kegMeters = this->mainWindow->getKegMeters();
-    foreach (auto* kegMeter, kegMeters) {
-        kegMeter->setEnabled(false);
-    }
+    this->portOpen = false;
+
+    // The meters won't hear from the hardware until it's back
+    this->core->getKegMeterBank()->setDisconnected();
 
     if (!this->trySerialTimer.isActive()) {
         this->trySerialTimer.start(TRY_SERIAL_TIMEOUT_MS);
     }
 }
 
-void SerialComm::onSerialPortBytesWritten(qint64 bytes) {
-    this->bytesWritten += bytes;
+void SerialComm::onSampleRefreshTimer() {
+    // Drain everything the I/O thread has decoded since the last refresh
+    LoadSample samples[MAX_SAMPLES_PER_REFRESH];
+    int numSamples = 0;
+    do {
+        numSamples = this->sampleQueue.popBatch(samples, MAX_SAMPLES_PER_REFRESH);
+        this->core->updateLoadMeasurements(samples, numSamples);
+    } while (numSamples == MAX_SAMPLES_PER_REFRESH);
 }
 
-void SerialComm::onSerialPortReadyRead() {
-    QByteArray readBytes = this->serialPort->readAll();
-    this->mainWindow->commLog(readBytes);
-
-    // We remember the full string coming in over serial, if an error is
-    // detected we resend the last serial message!
-    QString readStr = QString(readBytes.toStdString().c_str());
-    this->tempRememberBuf += readStr;
-    if (this->tempRememberBuf.contains("ERROR")) {
-        this->tempRememberBuf.clear();
-        this->write(this->commWriteData);
-    }
-    else if (this->tempRememberBuf.size() > 2048){
-        this->tempRememberBuf.clear();
-    }
-
-    this->commReadData.append(readBytes);
-
-    // Look through the read data for full packages
-    while (true) {
-        int startIdx = this->commReadData.indexOf('[');
-        int endIdx   = this->commReadData.indexOf(']');
-
-        if (startIdx == -1) {
-            // No package fragments were found at all
-            this->commReadData.clear();
-            break;
-        }
-        if (endIdx == -1) {
-            // Only part of a fragment was found, skim to the beginning and wait for the rest
-            this->commReadData.remove(0, startIdx);
-            break;
-        }
-
-        this->commReadData.remove(0, startIdx);
-        if (endIdx < startIdx) {
-            continue;
-        }
-
-        // We've removed everything up to the package in the serialReadData,
-        // remap start and end indexes
-        endIdx -= startIdx;
-        startIdx = 0;
-
-        // Make sure it's a valid package...
-        int pkgLen = endIdx;
-        if (pkgLen < 6) {
-            this->commReadData.remove(0,1);
-            continue;
-        }
-
-        QString pkgStr;
-        for (int i = 1; i < pkgLen; i++) {
-            pkgStr += this->commReadData.at(i);
-        }
-
-        QTextStream pkgTextStream(&pkgStr);
-
-        int meterIdx;
-        pkgTextStream >> meterIdx;
-        if (pkgTextStream.status() != QTextStream::Ok || meterIdx >= this->mainWindow->getNumKegMeters() || meterIdx < 0) {
-            this->commReadData.remove(0,1);
-            continue;
-        }
-
-        char temp;
-        pkgTextStream >> temp; // ' '
-        if (pkgTextStream.status() != QTextStream::Ok || temp != ' ') {
-            this->commReadData.remove(0,1);
-            continue;
-        }
-
-        bool exitLoop = false;
-        while (!exitLoop) {
+void SerialComm::onSerialDataReceived(const QByteArray& data) {
+    this->core->commLog(data);
+}
 
-            pkgTextStream >> temp;
-            if (pkgTextStream.status() != QTextStream::Ok) { exitLoop = true; break; }
+void SerialComm::onWorkerLogMessage(const QString& message) {
+    this->core->log(message);
+}
 
-            switch (temp) {
+void SerialComm::openSerialPort(const QSerialPortInfo& portInfo) {
+    this->openSerialPort(portInfo.portName());
+}
 
-            case 'M': {
-                pkgTextStream >> temp; // ' '
-                if (temp != ' ' || pkgTextStream.status() != QTextStream::Ok) { exitLoop = true; break; }
+void SerialComm::openSerialPort(const QString& portName) {
+    if (this->portOpen) {
+        return;
+    }
 
-                float measurement = 0;
-                pkgTextStream >> measurement;
+    bool success = false;
+    QMetaObject::invokeMethod(this->worker, "openPort", Qt::BlockingQueuedConnection,
+                              Q_RETURN_ARG(bool, success),
+                              Q_ARG(QString, portName),
+                              Q_ARG(qint32, this->baudRate),
+                              Q_ARG(qint32, this->maxBaudRate));
 
-                KegMeter* kegMeter = this->mainWindow->getKegMeters().at(meterIdx);
-                assert(kegMeter != NULL);
-                kegMeter->updateLoadMeasurement(measurement);
+    if (success) {
+        this->portOpen = true;
+        this->portName = portName;
+        this->core->log(tr("Connected to %1 @ %2 baud")
+                  .arg(this->portName)
+                  .arg(this->baudRate));
 
-                exitLoop = true;
-                break;
-            }
+        // Now that the serial port is open, offer the user the ability to restore any previous
+        // known state for the keg meters (what's sent is held back until the link is negotiated)
+        this->delayedSendTimer.start(2000);
+    }
+    else {
+        this->core->log(tr("Failed to connect to serial port %1").arg(portName));
+    }
+}
 
-            default:
-                exitLoop = true;
-                break;
+bool SerialComm::openConfiguredSerialPort() {
+    // Ports named in the settings go first, they may be links to pseudo-terminals (see
+    // arduino_pty_emulator) that QSerialPortInfo doesn't list
+    QSettings settings;
+    QStringList portNames = settings.value(AppSettings::SERIAL_PORT_NAMES).toStringList();
+    foreach (const QString& portName, portNames) {
+        if (QFile::exists(portName)) {
+            this->openSerialPort(portName);
+            if (this->portOpen) {
+                return true;
             }
         }
-
-        // Remove the package from the serialReadData -- we do this by just removing the start character
-        this->commReadData.remove(0,1);
     }
+    return false;
 }
 
-void SerialComm::openSerialPort(const QSerialPortInfo& portInfo) {
-    if (this->serialPort->isOpen()) {
+void SerialComm::closeSerialPort() {
+    if (!this->portOpen) {
         return;
     }
-
-    this->serialPort->setPort(portInfo);
-    if (this->serialPort->open(QIODevice::ReadWrite)) {
-        this->mainWindow->log(tr("Connected to %1 @ %2 baud")
-                  .arg(this->serialPort->portName())
-                  .arg(this->serialPort->baudRate()));
-
-        // Now that the serial port is open, offer the user the ability to restore any previous
-        // known state for the keg meters
-        this->delayedSendTimer.start(2000);
-    }
-    else {
-        this->mainWindow->log(tr("Failed to connect to serial port %1").arg(portInfo.portName()));
-    }
+    QMetaObject::invokeMethod(this->worker, "closePort", Qt::BlockingQueuedConnection);
+    this->onSerialPortClose();
 }
@@ -2,46 +2,75 @@
 #define KEGMETERCONTROLLER_SERIALCOMM_H
 
 #include "abstractcomm.h"
-#include <QSerialPort>
+#include "serialworker.h"
+
+#include <QThread>
 #include <QTimer>
 
+class QSerialPortInfo;
 class SerialSearchAndConnectDialog;
 
+/**
+ * Core-side handle to the serial connection. The port itself is owned by a SerialWorker that lives
+ * on a dedicated I/O thread, this object polls the decoded samples from it at a fixed refresh rate
+ * and hands them to the keg meters.
+ *
+ * The port is opened at the configured baud rate, the worker then upgrades the link to the fastest
+ * rate both ends support, up to the "max_baud_rate" setting. When the "serial_capture_file" setting
+ * is set, all of the traffic is recorded to that file for ReplayComm. Ports listed in the
+ * "serial_port_names" setting are tried before looking for an Arduino.
+ */
 class SerialComm : public AbstractComm {
     Q_OBJECT
 public:
-    SerialComm(MainWindow* mainWindow);
+    SerialComm(KegMeterCore* core);
     ~SerialComm();
 
-    QSerialPort* getSerialPort() const { return this->serialPort; }
+    bool isOpen() const { return this->portOpen; }
+    QString getPortName() const { return this->portName; }
+    qint32 getBaudRate() const { return this->baudRate; }
+    void setBaudRate(qint32 baudRate) { this->baudRate = baudRate; }
+
     void openSerialPort(const QSerialPortInfo& portInfo);
+    void openSerialPort(const QString& portName);
+    void closeSerialPort();
 
     void write(const QByteArray &data) override;
-    void executeSettingsDialog() override;
+    void executeSettingsDialog(QWidget* parent) override;
 
 public slots:
     void onTrySerialTimer();
 private slots:
     void onDelayedSendTimer();
-    void onSerialPortError(const QSerialPort::SerialPortError& error);
+    void onSampleRefreshTimer();
     void onSerialPortClose();
-    void onSerialPortReadyRead();
-    void onSerialPortBytesWritten(qint64 bytes);
+    void onSerialDataReceived(const QByteArray& data);
+    void onWorkerLogMessage(const QString& message);
 
 private:
-    QSerialPort* serialPort;
+    QThread ioThread;
+    SerialWorker* worker;
+    LoadSampleQueue sampleQueue;
+
+    bool portOpen;
+    QString portName;
+    qint32 baudRate;
 
-    // Cached read/write data
-    QByteArray commReadData;
-    QByteArray commWriteData;
-    qint64 bytesWritten;
-    QString tempRememberBuf;
+    static const qint32 DEFAULT_MAX_BAUD_RATE = 115200;
+    qint32 maxBaudRate;
 
     static const int TRY_SERIAL_TIMEOUT_MS = 1000;
     QTimer trySerialTimer;
     QTimer delayedSendTimer;
 
+    static const int SAMPLE_REFRESH_INTERVAL_MS = 33;
+    static const int MAX_SAMPLES_PER_REFRESH = 256;
+    QTimer sampleRefreshTimer;
+
+    // Only created once it's needed, there's no GUI in headless mode
     SerialSearchAndConnectDialog* serialConnDialog;
+
+    bool openConfiguredSerialPort();
 };
 
 #endif // KEGMETERCONTROLLER_SERIALCOMM_H
@@ -1,17 +1,16 @@
 #include "serialsearchandconnectdialog.h"
 #include "ui_SerialSearchAndConnectDialog.h"
-#include "mainwindow.h"
+#include "kegmetercore.h"
 #include "serialcomm.h"
 
 #include <QSerialPortInfo>
 
 #include <cassert>
 
-SerialSearchAndConnectDialog::SerialSearchAndConnectDialog(SerialComm* comm, MainWindow* mainWindow) :
-    QDialog(mainWindow),
+SerialSearchAndConnectDialog::SerialSearchAndConnectDialog(SerialComm* comm, QWidget* parent) :
+    QDialog(parent),
     ui(new Ui::SerialSearchAndConnectDialog()),
-    comm(comm),
-    mainWindow(mainWindow) {
+    comm(comm) {
 
     ui->setupUi(this);
 
@@ -31,18 +30,15 @@ SerialSearchAndConnectDialog::~SerialSearchAndConnectDialog() {
 }
 
 void SerialSearchAndConnectDialog::showEvent(QShowEvent*) {
-    QSerialPort* serialPort = this->comm->getSerialPort();
-    assert(serialPort != NULL);
-
     // Populate the ports...
     this->ui->portComboBox->clear();
     QList<QSerialPortInfo> portList = QSerialPortInfo::availablePorts();
     foreach(const QSerialPortInfo& portInfo, portList) {
         this->ui->portComboBox->addItem(portInfo.portName());
     }
-    this->ui->portComboBox->setCurrentText(serialPort->portName());
+    this->ui->portComboBox->setCurrentText(this->comm->getPortName());
 
-    this->ui->baudComboBox->setCurrentText(QString::number(serialPort->baudRate()));
+    this->ui->baudComboBox->setCurrentText(QString::number(this->comm->getBaudRate()));
 }
 
 void SerialSearchAndConnectDialog::onPortComboBoxCurrentIndexChanged(const QString&) {
@@ -52,24 +48,23 @@ void SerialSearchAndConnectDialog::onBaudComboBoxCurrentIndexChanged(const QStri
 }
 
 void SerialSearchAndConnectDialog::onReconnectButtonClicked() {
-    QSerialPort* serialPort = this->comm->getSerialPort();
     if (this->ui->manualRadio->isChecked()) {
-        serialPort->setBaudRate(this->ui->baudComboBox->currentText().toInt());
+        this->comm->setBaudRate(this->ui->baudComboBox->currentText().toInt());
 
         auto ports = QSerialPortInfo::availablePorts();
         foreach (const QSerialPortInfo& portInfo, ports) {
             if (portInfo.portName() == this->ui->portComboBox->currentText()) {
-                serialPort->close();
+                this->comm->closeSerialPort();
                 this->comm->openSerialPort(portInfo);
             }
         }
 
-        this->mainWindow->log(tr("Failed to find serial port."));
+        this->comm->getCore()->log(tr("Failed to find serial port."));
         return;
     }
 
     // Attempt to auto connect, again...
-    serialPort->close();
+    this->comm->closeSerialPort();
     this->comm->onTrySerialTimer();
 }
 
@@ -5,7 +5,6 @@
 #include <QAbstractButton>
 #include <QtSerialPort/QSerialPort>
 
-class MainWindow;
 class SerialComm;
 
 namespace Ui {
@@ -16,7 +15,7 @@ class SerialSearchAndConnectDialog : public QDialog {
     Q_OBJECT
 
 public:
-    SerialSearchAndConnectDialog(SerialComm* comm, MainWindow* mainWindow);
+    SerialSearchAndConnectDialog(SerialComm* comm, QWidget* parent = NULL);
     ~SerialSearchAndConnectDialog();
 
     void showEvent(QShowEvent* event);
@@ -30,7 +29,6 @@ private slots:
 private:
     Ui::SerialSearchAndConnectDialog *ui;
     SerialComm* comm;
-    MainWindow* mainWindow;
 };
 
 #endif // KEGMETERCONTROLLER_SERIALSEARCHANDCONNECTDIALOG_H
@@ -0,0 +1,366 @@
+#include "serialworker.h"
+#include "packetparser.h"
+
+#include <cassert>
+
+#include <QDateTime>
+
+SerialWorker::SerialWorker(LoadSampleQueue* sampleQueue) :
+    QObject(NULL),
+    serialPort(new QSerialPort(this)),
+    negotiator(new SerialNegotiator("[00 B %1]", "[00 S %1]", this)),
+    framer('[', ']'),
+    capture(NULL),
+    sampleQueue(sampleQueue),
+    numDroppedSamples(0),
+    hasBatchSequenceNum(false),
+    lastBatchSequenceNum(0),
+    numMissedBatches(0) {
+
+    assert(sampleQueue != NULL);
+
+    this->serialPort->setParity(QSerialPort::NoParity);
+    this->serialPort->setStopBits(QSerialPort::OneStop);
+    this->serialPort->setDataBits(QSerialPort::Data8);
+    this->serialPort->setFlowControl(QSerialPort::NoFlowControl);
+
+    this->connect(this->serialPort, SIGNAL(error(QSerialPort::SerialPortError)),
+                  this, SLOT(onSerialPortError(QSerialPort::SerialPortError)));
+    this->connect(this->serialPort, SIGNAL(readyRead()), this, SLOT(onSerialPortReadyRead()));
+
+    this->connect(this->negotiator, SIGNAL(logMessage(QString)), this, SIGNAL(logMessage(QString)));
+    this->connect(this->negotiator, SIGNAL(linkReset()), this, SLOT(onLinkReset()));
+    this->connect(this->negotiator, SIGNAL(negotiated()), this, SLOT(onNegotiated()));
+}
+
+SerialWorker::~SerialWorker() {
+    if (this->serialPort->isOpen()) {
+        this->serialPort->close();
+    }
+    this->stopCapture();
+}
+
+bool SerialWorker::openPort(const QString& portName, qint32 baudRate, qint32 maxBaudRate) {
+    if (this->serialPort->isOpen()) {
+        return false;
+    }
+
+    this->serialPort->setPortName(portName);
+    this->serialPort->setBaudRate(baudRate);
+    if (!this->serialPort->open(QIODevice::ReadWrite)) {
+        return false;
+    }
+
+    this->framer.clear();
+    this->binaryReader.clear();
+    this->errorCheckBuf.clear();
+    this->hasBatchSequenceNum = false;
+    this->heldBackWrites.clear();
+
+    this->negotiator->start(this->serialPort, maxBaudRate);
+    return true;
+}
+
+void SerialWorker::closePort() {
+    this->negotiator->stop();
+    this->heldBackWrites.clear();
+    if (this->serialPort->isOpen()) {
+        this->serialPort->close();
+    }
+}
+
+/**
+ * Record all of the traffic on the port to the given file, from now until stopCapture.
+ */
+bool SerialWorker::startCapture(const QString& filePath) {
+    this->stopCapture();
+    this->capture = new SerialCapture();
+    if (!this->capture->openForWriting(filePath, QDateTime::currentMSecsSinceEpoch())) {
+        emit logMessage(tr("Failed to start the serial capture: %1").arg(this->capture->errorString()));
+        this->stopCapture();
+        return false;
+    }
+    emit logMessage(tr("Capturing the serial traffic to %1").arg(filePath));
+    return true;
+}
+
+void SerialWorker::stopCapture() {
+    delete this->capture;
+    this->capture = NULL;
+}
+
+/**
+ * Get ready to decode recorded traffic, see replayBytes. The port must be closed.
+ */
+void SerialWorker::startReplay() {
+    assert(!this->serialPort->isOpen());
+
+    this->framer.clear();
+    this->binaryReader.clear();
+    this->errorCheckBuf.clear();
+    this->hasBatchSequenceNum = false;
+
+    this->negotiator->startPassive();
+}
+
+/**
+ * Decode bytes that were read from a port earlier, as if they just came in. Anything written in
+ * response goes nowhere.
+ */
+void SerialWorker::replayBytes(const QByteArray& data) {
+    this->processBytes(data);
+}
+
+void SerialWorker::write(const QByteArray& data) {
+    if (!this->serialPort->isOpen()) {
+        return;
+    }
+
+    // Nothing gets in the way of the negotiation, see SerialNegotiator
+    if (this->negotiator->getMode() == SerialNegotiator::NegotiatingMode) {
+        this->heldBackWrites.append(data);
+        return;
+    }
+
+    this->lastWriteData = data;
+    if (this->writeData(data)) {
+        emit logMessage(tr("Wrote serial data: ") + QString::fromLatin1(data));
+    }
+}
+
+bool SerialWorker::writeData(const QByteArray& data) {
+    qint64 bytesWritten = this->serialPort->write(data);
+    this->serialPort->flush();
+    if (this->capture != NULL && bytesWritten > 0) {
+        this->capture->write(SerialCapture::WriteDirection, data.left(bytesWritten));
+    }
+
+    if (bytesWritten == -1) {
+        emit logMessage(tr("Failed to write the data to port %1, error: %2").arg(this->serialPort->portName()).arg(this->serialPort->errorString()));
+        return false;
+    }
+    else if (bytesWritten != data.size()) {
+        emit logMessage(tr("Failed to write all the data to port %1, error: %2").arg(this->serialPort->portName()).arg(this->serialPort->errorString()));
+        return false;
+    }
+    return true;
+}
+
+void SerialWorker::onSerialPortError(QSerialPort::SerialPortError error) {
+    if (error == QSerialPort::NoError) {
+        return;
+    }
+
+    QString errorMsg = this->serialPort->errorString();
+    if (!errorMsg.isEmpty()) {
+        emit logMessage(errorMsg);
+    }
+    if (this->serialPort->isOpen()) {
+        this->negotiator->stop();
+        this->heldBackWrites.clear();
+        this->serialPort->close();
+        emit portClosed();
+    }
+}
+
+void SerialWorker::onSerialPortReadyRead() {
+    QByteArray readBytes = this->serialPort->readAll();
+    if (this->capture != NULL && !this->capture->write(SerialCapture::ReadDirection, readBytes) && !readBytes.isEmpty()) {
+        emit logMessage(tr("Serial capture stopped: %1").arg(this->capture->errorString()));
+        this->stopCapture();
+    }
+    this->processBytes(readBytes);
+}
+
+void SerialWorker::processBytes(const QByteArray& readBytes) {
+    this->negotiator->handleBytesRead(readBytes.size());
+
+    // We remember the full string coming in over serial, if an error is detected we resend the
+    // last serial message! Errors while negotiating are meant for the negotiator though.
+    this->errorCheckBuf.append(readBytes);
+    if (this->errorCheckBuf.contains("ERROR")) {
+        this->errorCheckBuf.clear();
+        if (!this->negotiator->handleErrorReply() && !this->lastWriteData.isEmpty()) {
+            this->write(this->lastWriteData);
+        }
+    }
+    else if (this->errorCheckBuf.size() > 2048) {
+        this->errorCheckBuf.clear();
+    }
+
+    switch (this->negotiator->getMode()) {
+    case SerialNegotiator::NegotiatingMode:
+        // Until the hardware answers it keeps talking ASCII, we only need to watch for its hello
+        emit dataReceived(readBytes);
+        this->readAscii(readBytes);
+        this->readBinary(readBytes);
+        break;
+    case SerialNegotiator::AsciiMode:
+        emit dataReceived(readBytes);
+        this->readAscii(readBytes);
+        break;
+    case SerialNegotiator::BinaryMode:
+        this->readBinary(readBytes);
+        break;
+    }
+}
+
+void SerialWorker::onNegotiated() {
+    QList<QByteArray> writes;
+    writes.swap(this->heldBackWrites);
+    foreach (const QByteArray& data, writes) {
+        this->write(data);
+    }
+}
+
+void SerialWorker::onLinkReset() {
+    this->framer.clear();
+    this->binaryReader.clear();
+    this->errorCheckBuf.clear();
+}
+
+void SerialWorker::readAscii(const QByteArray& readBytes) {
+    // Feed the framer, draining any complete packages whenever its ring buffer fills up
+    const char* readPtr = readBytes.constData();
+    int numBytesLeft = readBytes.size();
+    while (true) {
+        int numAppended = this->framer.append(readPtr, numBytesLeft);
+        readPtr += numAppended;
+        numBytesLeft -= numAppended;
+
+        PacketFramer::PacketView packet;
+        while (this->framer.nextPacket(packet)) {
+            this->processPacket(packet);
+        }
+
+        if (numBytesLeft <= 0) {
+            break;
+        }
+    }
+}
+
+void SerialWorker::readBinary(const QByteArray& readBytes) {
+    // Text the hardware prints in between frames and a readable version of every frame go to the
+    // serial log, the raw frames would only show up as garbage there
+    QByteArray logBytes;
+
+    const char* readPtr = readBytes.constData();
+    int numBytesLeft = readBytes.size();
+    BinaryFrameReader::Chunk chunk;
+    while (this->binaryReader.nextChunk(readPtr, numBytesLeft, chunk)) {
+        switch (chunk.type) {
+        case BinaryFrameReader::FrameChunk:
+            this->processFrame(chunk.frame, logBytes);
+            break;
+        case BinaryFrameReader::CorruptFrameChunk:
+            if (this->negotiator->getMode() == SerialNegotiator::BinaryMode) {
+                emit logMessage(tr("Discarded corrupt binary frame (%1 so far)").arg(this->binaryReader.getNumCorruptFrames()));
+                this->negotiator->handlePacket(true);
+            }
+            break;
+        case BinaryFrameReader::TextChunk:
+            if (this->negotiator->getMode() == SerialNegotiator::BinaryMode) {
+                logBytes.append(chunk.text, chunk.textSize);
+            }
+            break;
+        }
+    }
+
+    if (!logBytes.isEmpty()) {
+        emit dataReceived(logBytes);
+    }
+}
+
+void SerialWorker::processPacket(const PacketFramer::PacketView& packet) {
+    PacketParser::MeasurementPacket measurementPkg;
+    PacketParser::Result result = PacketParser::parseMeasurement(packet.data, packet.size, measurementPkg);
+    if (!result.isOk()) {
+        emit logMessage(tr("Discarded serial package: %1 at offset %2")
+                        .arg(PacketParser::errorString(result.error)).arg(result.offset));
+        this->negotiator->handlePacket(true);
+        return;
+    }
+    this->negotiator->handlePacket(false);
+    this->pushSample(measurementPkg.meterIdx, measurementPkg.measurement);
+}
+
+void SerialWorker::processFrame(const BinaryFrame::Frame& frame, QByteArray& logBytes) {
+    this->negotiator->handlePacket(false);
+    switch (frame.type) {
+    case BinaryFrame::HelloType:
+        this->negotiator->handleHello(frame);
+        if (this->negotiator->getMode() == SerialNegotiator::BinaryMode) {
+            this->framer.clear();
+        }
+        break;
+
+    case BinaryFrame::MeasurementType: {
+        float load = 0;
+        if (!BinaryFrame::decodeMeasurement(frame, load)) {
+            emit logMessage(tr("Discarded binary frame with a bad measurement payload"));
+            break;
+        }
+        logBytes.append(QString("[%1 M %2]\n").arg(frame.meterIdx, 2, 10, QChar('0')).arg(load, 0, 'f', 3).toLatin1());
+        this->pushSample(frame.meterIdx, load);
+        break;
+    }
+
+    case BinaryFrame::BatchType:
+        this->processBatch(frame, logBytes);
+        break;
+
+    default:
+        emit logMessage(tr("Discarded binary frame of unknown type %1").arg(frame.type));
+        break;
+    }
+}
+
+void SerialWorker::processBatch(const BinaryFrame::Frame& frame, QByteArray& logBytes) {
+    quint16 sequenceNum = 0;
+    quint32 deviceTimeMs = 0;
+    quint8 meterIdxs[BinaryFrame::MAX_BATCH_SIZE];
+    float loads[BinaryFrame::MAX_BATCH_SIZE];
+    int numMeters = 0;
+    if (!BinaryFrame::decodeBatch(frame, sequenceNum, deviceTimeMs, meterIdxs, loads, numMeters)) {
+        emit logMessage(tr("Discarded binary frame with a bad batch payload"));
+        return;
+    }
+
+    if (this->hasBatchSequenceNum) {
+        quint16 numMissed = static_cast<quint16>(sequenceNum - this->lastBatchSequenceNum - 1);
+        if (numMissed != 0) {
+            this->numMissedBatches += numMissed;
+            emit logMessage(tr("Missed %1 measurement batch(es) before #%2, %3 so far")
+                            .arg(numMissed).arg(sequenceNum).arg(this->numMissedBatches));
+        }
+    }
+    this->hasBatchSequenceNum = true;
+    this->lastBatchSequenceNum = sequenceNum;
+
+    // Every meter in the batch goes into the queue together, so the GUI picks them all up in the
+    // same refresh
+    QString logStr = QString("#%1 @%2ms").arg(sequenceNum).arg(deviceTimeMs);
+    for (int i = 0; i < numMeters; i++) {
+        this->pushSample(meterIdxs[i], loads[i]);
+        logStr += QString(" [%1 M %2]").arg(meterIdxs[i], 2, 10, QChar('0')).arg(loads[i], 0, 'f', 3);
+    }
+    logBytes.append(logStr.toLatin1());
+    logBytes.append('\n');
+}
+
+void SerialWorker::pushSample(int meterIdx, float load) {
+    if (meterIdx < 0) {
+        return;
+    }
+
+    LoadSample sample;
+    sample.meterIdx = meterIdx;
+    sample.load = load;
+    if (!this->sampleQueue->push(sample)) {
+        // The GUI isn't keeping up, only report every so often so we don't make it worse
+        this->numDroppedSamples++;
+        if ((this->numDroppedSamples & (this->numDroppedSamples - 1)) == 0) {
+            emit logMessage(tr("Sample queue full, %1 samples dropped so far").arg(this->numDroppedSamples));
+        }
+    }
+}
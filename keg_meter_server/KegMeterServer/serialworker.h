@@ -0,0 +1,97 @@
+#ifndef KEGMETERCONTROLLER_SERIALWORKER_H
+#define KEGMETERCONTROLLER_SERIALWORKER_H
+
+#include "packetframer.h"
+#include "binaryframereader.h"
+#include "serialnegotiator.h"
+#include "serialcapture.h"
+#include "spscqueue.h"
+
+#include <QObject>
+#include <QSerialPort>
+#include <QByteArray>
+#include <QList>
+#include <QString>
+
+// A single decoded load measurement for a meter
+struct LoadSample {
+    int meterIdx;
+    float load;
+};
+
+typedef SpscQueue<LoadSample, 4096> LoadSampleQueue;
+
+/**
+ * Owns the serial port and decodes incoming packages on the serial I/O thread. Decoded samples
+ * are pushed into a lock-free queue that the GUI thread drains at its own pace (see SerialComm),
+ * everything else is reported back through (queued) signals.
+ *
+ * Every time the port is opened the protocol and the speed of the link are negotiated with the
+ * hardware, see SerialNegotiator. Anything written in the meantime is held back until that's done.
+ *
+ * Everything read from and written to the port can be recorded to a capture file (see
+ * SerialCapture). Recorded bytes can be fed back in without a port (see replayBytes), they then go
+ * through the exact same decoding as bytes read from the port.
+ */
+class SerialWorker : public QObject {
+    Q_OBJECT
+public:
+    explicit SerialWorker(LoadSampleQueue* sampleQueue);
+    ~SerialWorker();
+
+public slots:
+    bool openPort(const QString& portName, qint32 baudRate, qint32 maxBaudRate);
+    void closePort();
+    void write(const QByteArray& data);
+
+    bool startCapture(const QString& filePath);
+    void stopCapture();
+
+    void startReplay();
+    void replayBytes(const QByteArray& data);
+
+signals:
+    void portClosed(); // Only emitted when the port closes on its own (i.e., due to an error)
+    void dataReceived(const QByteArray& data);
+    void logMessage(const QString& message);
+
+private slots:
+    void onSerialPortError(QSerialPort::SerialPortError error);
+    void onSerialPortReadyRead();
+    void onNegotiated();
+    void onLinkReset();
+
+private:
+    QSerialPort* serialPort;
+    SerialNegotiator* negotiator;
+    PacketFramer framer;
+    BinaryFrameReader binaryReader;
+
+    SerialCapture* capture; // NULL unless capturing
+
+    LoadSampleQueue* sampleQueue; // Not owned by this
+    quint64 numDroppedSamples;
+
+    // Batch frames are numbered so we can tell when some of them got lost along the way
+    bool hasBatchSequenceNum;
+    quint16 lastBatchSequenceNum;
+    quint64 numMissedBatches;
+
+    // Writes held back while negotiating
+    QList<QByteArray> heldBackWrites;
+
+    // We remember the last message written and resend it if an error comes back
+    QByteArray lastWriteData;
+    QByteArray errorCheckBuf;
+
+    bool writeData(const QByteArray& data);
+    void processBytes(const QByteArray& readBytes);
+    void readAscii(const QByteArray& readBytes);
+    void readBinary(const QByteArray& readBytes);
+    void processPacket(const PacketFramer::PacketView& packet);
+    void processFrame(const BinaryFrame::Frame& frame, QByteArray& logBytes);
+    void processBatch(const BinaryFrame::Frame& frame, QByteArray& logBytes);
+    void pushSample(int meterIdx, float load);
+};
+
+#endif // KEGMETERCONTROLLER_SERIALWORKER_H
@@ -0,0 +1,403 @@
+// Checks the load filtering of the keg meters. LoadWindow's incremental mean and variance are
+// compared with the exact two-pass result after every sample, over long runs of synthetic keg
+// loads, including right after it re-centres. MeterFilterBank is then checked against a LoadWindow
+// per meter: it has to come up with exactly the same means, variances and flags, whether the
+// samples go in one meter at a time or in batches.
+//
+// Last, the filtering alone is timed at 8, 64 and 256 meters, with the samples going in one meter
+// at a time (PerMeter) and in batches across all of the meters (Batched), laid out like Google
+// Benchmark's. The server's --benchmark times the same with everything else a sample goes through.
+//
+// Plain C++, no Qt. Exits with 1 if any check fails.
+
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <ctime>
+#include <random>
+#include <vector>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "loadwindow.h"
+#include "meterfilterbank.h"
+
+namespace {
+  const int WINDOW_SIZE = MeterFilterBank::WINDOW_SIZE;
+  typedef LoadWindow<WINDOW_SIZE> MeterLoadWindow;
+
+  // How far LoadWindow may be from the exact mean and variance, in float roundings of the largest
+  // load in the window (of its square for the variance, which is what the variance of loads that
+  // barely change is a small difference of). In between re-centres the error may grow by about a
+  // rounding per sample, re-centring has to bring it back to what the two-pass formula in float
+  // gets, which is about as far off as adding up the window.
+  const double MAX_MEAN_ERROR = MeterLoadWindow::RECENTRE_INTERVAL;
+  const double MAX_VARIANCE_ERROR = 4 * MeterLoadWindow::RECENTRE_INTERVAL;
+  const double MAX_RECENTRED_MEAN_ERROR = WINDOW_SIZE;
+  const double MAX_RECENTRED_VARIANCE_ERROR = WINDOW_SIZE;
+
+  // The thresholds the meters use (see KegMeterModel)
+  const float SETTLED_VARIANCE = 0.05f;
+  const float STEADY_VARIANCE = 0.5f;
+  const float LOADED_MASS = 9.0f;
+
+  struct Options {
+    int numSamples;
+    int numMeters;
+    unsigned int seed;
+
+    Options() : numSamples(2000000), numMeters(37), seed(1) {}
+  };
+
+  // A keg on a scale: it sits still, gets poured from now and then until it's empty and is swapped
+  // for a full one, with noise on top. Everything is shifted by baseLoad, a big one (like the raw
+  // readings of a load cell) is what makes an incremental variance drift.
+  class KegLoadGenerator {
+  public:
+    KegLoadGenerator(float baseLoad, float fullMass, float noise, unsigned int seed) :
+      baseLoad(baseLoad), fullMass(fullMass), mass(fullMass), pourRate(0), rng(seed), noiseDist(-noise, noise) {}
+
+    float next() {
+      if (this->pourRate > 0) {
+        this->mass -= this->pourRate;
+        if (this->rng() % 400 == 0) {
+          this->pourRate = 0;
+        }
+      }
+      else if (this->rng() % 2000 == 0) {
+        this->pourRate = 0.005f + 0.01f * (this->rng() % 100) / 100.0f;
+      }
+      if (this->mass < 0) {
+        this->mass = this->fullMass;
+        this->pourRate = 0;
+      }
+      return this->baseLoad + this->mass + this->noiseDist(this->rng);
+    }
+
+  private:
+    float baseLoad;
+    float fullMass;
+    float mass;
+    float pourRate;
+    std::mt19937 rng;
+    std::uniform_real_distribution<float> noiseDist;
+  };
+
+  // The same samples as a LoadWindow, oldest first, with their mean and variance worked out in
+  // double with the two-pass formula
+  class ExactWindow {
+  public:
+    void push(float value) {
+      this->values.push_back(value);
+      if (this->values.size() > static_cast<size_t>(WINDOW_SIZE)) {
+        this->values.erase(this->values.begin());
+      }
+    }
+
+    void fill(float value) { this->values.assign(WINDOW_SIZE, value); }
+
+    double getMean() const {
+      double sum = 0;
+      for (size_t i = 0; i < this->values.size(); i++) {
+        sum += this->values[i];
+      }
+      return sum / this->values.size();
+    }
+
+    double getVariance() const {
+      double mean = this->getMean();
+      double sqDiffs = 0;
+      for (size_t i = 0; i < this->values.size(); i++) {
+        sqDiffs += (this->values[i] - mean) * (this->values[i] - mean);
+      }
+      return sqDiffs / this->values.size();
+    }
+
+    double getMaxAbsValue() const {
+      double maxAbsValue = 0;
+      for (size_t i = 0; i < this->values.size(); i++) {
+        maxAbsValue = std::max(maxAbsValue, std::fabs(this->values[i]));
+      }
+      return maxAbsValue;
+    }
+
+  private:
+    std::vector<double> values;
+  };
+
+  // The largest errors over a run, in float roundings (see MAX_MEAN_ERROR)
+  struct WindowErrors {
+    double maxMeanError;
+    double maxVarianceError;
+    double maxRecentredMeanError;
+    double maxRecentredVarianceError;
+
+    WindowErrors() : maxMeanError(0), maxVarianceError(0), maxRecentredMeanError(0), maxRecentredVarianceError(0) {}
+  };
+
+  bool checkWindow(const MeterLoadWindow& window, const ExactWindow& exact, bool recentred, WindowErrors& errors) {
+    double rounding = FLT_EPSILON * std::max(exact.getMaxAbsValue(), 1.0);
+    double meanError = std::fabs(window.getMean() - exact.getMean()) / rounding;
+    double varianceError = std::fabs(window.getVariance() - exact.getVariance()) / (rounding * std::max(exact.getMaxAbsValue(), 1.0));
+
+    errors.maxMeanError = std::max(errors.maxMeanError, meanError);
+    errors.maxVarianceError = std::max(errors.maxVarianceError, varianceError);
+    if (recentred) {
+      errors.maxRecentredMeanError = std::max(errors.maxRecentredMeanError, meanError);
+      errors.maxRecentredVarianceError = std::max(errors.maxRecentredVarianceError, varianceError);
+      if (meanError > MAX_RECENTRED_MEAN_ERROR || varianceError > MAX_RECENTRED_VARIANCE_ERROR) {
+        return false;
+      }
+    }
+    return meanError <= MAX_MEAN_ERROR && varianceError <= MAX_VARIANCE_ERROR;
+  }
+
+  // Runs a LoadWindow over the loads of a keg next to the exact window: first filling up from
+  // empty, then sliding along, with the odd fill() like a meter does when it's calibrated
+  bool checkLoadWindow(const char* name, float baseLoad, float noise, const Options& options) {
+    KegLoadGenerator loads(baseLoad, 50.0f, noise, options.seed);
+    MeterLoadWindow window;
+    ExactWindow exact;
+    WindowErrors errors;
+    int numUpdatesSinceRecentre = 0;
+
+    for (int i = 0; i < options.numSamples; i++) {
+      float load = loads.next();
+      if (i > 0 && i % (MeterLoadWindow::RECENTRE_INTERVAL * 97 + 13) == 0) {
+        window.fill(load);
+        exact.fill(load);
+        numUpdatesSinceRecentre = 0;
+      }
+      else {
+        window.push(load);
+        exact.push(load);
+        numUpdatesSinceRecentre = (numUpdatesSinceRecentre + 1) % MeterLoadWindow::RECENTRE_INTERVAL;
+      }
+
+      if (!checkWindow(window, exact, numUpdatesSinceRecentre == 0, errors)) {
+        fprintf(stderr, "%s: sample %d: mean %.9g and variance %.9g, expected %.9g and %.9g\n", name, i,
+                window.getMean(), window.getVariance(), exact.getMean(), exact.getVariance());
+        return false;
+      }
+    }
+
+    printf("LoadWindow/%-18s max error mean %5.2f variance %5.2f, right after re-centring mean %5.2f variance %5.2f\n",
+           name, errors.maxMeanError, errors.maxVarianceError, errors.maxRecentredMeanError,
+           errors.maxRecentredVarianceError);
+    return true;
+  }
+
+  // The meter counts the filtering is timed at
+  const int BENCH_METER_COUNTS[] = { 8, 64, 256 };
+
+  struct BenchResult {
+    double wallNsPerSample;
+    double cpuNsPerSample;
+    std::vector<float> means;
+  };
+
+  bool sameFloat(float a, float b) {
+    return memcmp(&a, &b, sizeof(float)) == 0;
+  }
+
+  // Feeds the same raw loads to a MeterFilterBank and to a LoadWindow per meter (calibrated the
+  // same way), some meters at a time. Batches go in with pushBatch() or one push() per meter.
+  bool checkMeterFilterBank(const Options& options) {
+    std::mt19937 rng(options.seed);
+    MeterFilterBank bank(options.numMeters, SETTLED_VARIANCE, STEADY_VARIANCE, LOADED_MASS);
+    std::vector<MeterLoadWindow> windows(options.numMeters);
+    std::vector<KegLoadGenerator> loads;
+    for (int meterIdx = 0; meterIdx < options.numMeters; meterIdx++) {
+      // Raw load cell readings, calibrated into kg
+      float offset = 8000.0f + rng() % 4000;
+      float scale = 9.0f + (rng() % 200) / 100.0f;
+      float divisor = 1000.0f + rng() % 1000;
+      bank.setCalibration(meterIdx, offset, scale, divisor);
+      loads.push_back(KegLoadGenerator(offset, 50.0f * divisor / scale, 200.0f, options.seed + meterIdx));
+    }
+
+    std::vector<float> rawLoads(options.numMeters);
+    std::vector<uint8_t> pending(options.numMeters);
+    std::vector<uint8_t> started(options.numMeters, 0);
+    int numBatches = options.numSamples / options.numMeters;
+    for (int batchIdx = 0; batchIdx < numBatches; batchIdx++) {
+      // Mostly every meter at once, sometimes a few
+      int pendingOdds = (rng() % 4 == 0) ? 3 : 1;
+      bool asBatch = (rng() % 2 == 0);
+      for (int meterIdx = 0; meterIdx < options.numMeters; meterIdx++) {
+        rawLoads[meterIdx] = loads[meterIdx].next();
+        pending[meterIdx] = (rng() % pendingOdds == 0);
+        if (!pending[meterIdx]) {
+          continue;
+        }
+
+        float load = bank.calibrate(meterIdx, rawLoads[meterIdx]);
+        if (rng() % 5000 == 0) {
+          bank.fill(meterIdx, load);
+          windows[meterIdx].fill(load);
+          pending[meterIdx] = 0;
+        }
+        else if (!started[meterIdx]) {
+          windows[meterIdx].fill(load);
+        }
+        else {
+          windows[meterIdx].push(load);
+        }
+        started[meterIdx] = 1;
+
+        if (!asBatch && pending[meterIdx]) {
+          bank.push(meterIdx, rawLoads[meterIdx]);
+        }
+      }
+      if (asBatch) {
+        bank.pushBatch(rawLoads.data(), pending.data());
+      }
+
+      for (int meterIdx = 0; meterIdx < options.numMeters; meterIdx++) {
+        if (!started[meterIdx]) {
+          continue;
+        }
+
+        const MeterLoadWindow& window = windows[meterIdx];
+        if (!sameFloat(bank.getMean(meterIdx), window.getMean()) ||
+            !sameFloat(bank.getVariance(meterIdx), window.getVariance()) ||
+            bank.hasFlags(meterIdx, MeterFilterBank::SettledFlag) != (window.getVariance() <= SETTLED_VARIANCE) ||
+            bank.hasFlags(meterIdx, MeterFilterBank::SteadyFlag) != (window.getVariance() <= STEADY_VARIANCE) ||
+            bank.hasFlags(meterIdx, MeterFilterBank::LoadedFlag) != (window.getMean() >= LOADED_MASS)) {
+          fprintf(stderr, "MeterFilterBank: batch %d, meter %d: mean %.9g and variance %.9g, LoadWindow has %.9g and %.9g\n",
+                  batchIdx, meterIdx, bank.getMean(meterIdx), bank.getVariance(meterIdx), window.getMean(),
+                  window.getVariance());
+          return false;
+        }
+      }
+    }
+
+    printf("MeterFilterBank/%-13d same as LoadWindow bit for bit over %d batches (%s, %d lane(s))\n",
+           options.numMeters, numBatches, MeterFilterBank::getInstructionSetName(), MeterFilterBank::getNumLanes());
+    return true;
+  }
+
+  // Filters numSamples settled loads with a little noise, every meter getting a sample in every
+  // batch as the hardware sends them. Twice through, the first pass only warms things up.
+  void benchMeterFilterBank(int numMeters, bool batched, const Options& options, BenchResult& result) {
+    MeterFilterBank bank(numMeters, SETTLED_VARIANCE, STEADY_VARIANCE, LOADED_MASS);
+    std::mt19937 rng(options.seed);
+    std::uniform_real_distribution<float> noiseDist(-0.1f, 0.1f);
+    int numBatches = std::max(1, options.numSamples / numMeters);
+    std::vector<float> rawLoads(numBatches * numMeters);
+    for (size_t i = 0; i < rawLoads.size(); i++) {
+      rawLoads[i] = 20.0f + (i % numMeters) % 16 + noiseDist(rng);
+    }
+    std::vector<uint8_t> pending(numMeters, 1);
+
+    for (int pass = 0; pass < 2; pass++) {
+      std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+      std::clock_t startTicks = std::clock();
+      for (int batchIdx = 0; batchIdx < numBatches; batchIdx++) {
+        const float* batchLoads = rawLoads.data() + batchIdx * numMeters;
+        if (batched) {
+          bank.pushBatch(batchLoads, pending.data());
+        }
+        else {
+          for (int meterIdx = 0; meterIdx < numMeters; meterIdx++) {
+            bank.push(meterIdx, batchLoads[meterIdx]);
+          }
+        }
+      }
+      std::clock_t cpuTicks = std::clock() - startTicks;
+      double wallNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - startTime).count();
+
+      int numSamples = numBatches * numMeters;
+      result.wallNsPerSample = std::max(1.0, wallNs) / numSamples;
+      result.cpuNsPerSample = std::max(1.0, cpuTicks * (1e9 / CLOCKS_PER_SEC)) / numSamples;
+    }
+
+    result.means.clear();
+    for (int meterIdx = 0; meterIdx < numMeters; meterIdx++) {
+      result.means.push_back(bank.getMean(meterIdx));
+    }
+  }
+
+  void printBenchResult(const char* name, int numMeters, const BenchResult& result, int numSamples) {
+    char fullName[32];
+    snprintf(fullName, sizeof(fullName), "%s/%d", name, numMeters);
+    printf("%-16s %11.1f ns %11.1f ns %12d items_per_second=%.3fM/s\n", fullName, result.wallNsPerSample,
+           result.cpuNsPerSample, numSamples, 1e3 / result.cpuNsPerSample);
+  }
+
+  bool benchMeterFilterBanks(const Options& options) {
+    printf("\nLoad filtering only, batched with %s, %d lane(s)\n", MeterFilterBank::getInstructionSetName(),
+           MeterFilterBank::getNumLanes());
+    printf("------------------------------------------------------------\n");
+    printf("%-16s %14s %14s %12s\n", "Benchmark", "Time", "CPU", "Iterations");
+    printf("------------------------------------------------------------\n");
+
+    for (size_t i = 0; i < sizeof(BENCH_METER_COUNTS) / sizeof(BENCH_METER_COUNTS[0]); i++) {
+      int numMeters = BENCH_METER_COUNTS[i];
+      int numSamples = std::max(1, options.numSamples / numMeters) * numMeters;
+
+      BenchResult perMeterResult;
+      benchMeterFilterBank(numMeters, false, options, perMeterResult);
+      printBenchResult("PerMeter", numMeters, perMeterResult, numSamples);
+
+      BenchResult batchedResult;
+      benchMeterFilterBank(numMeters, true, options, batchedResult);
+      printBenchResult("Batched", numMeters, batchedResult, numSamples);
+
+      // Both ways have to come to the same thing
+      for (int meterIdx = 0; meterIdx < numMeters; meterIdx++) {
+        if (!sameFloat(perMeterResult.means[meterIdx], batchedResult.means[meterIdx])) {
+          fprintf(stderr, "MeterFilterBank: the batched filtering of %d meters came out different from filtering them one at a time\n",
+                  numMeters);
+          return false;
+        }
+      }
+    }
+    return true;
+  }
+
+  void printUsage(const char* appName) {
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  --samples <n>   Number of loads each check runs over (default: 2000000)\n"
+            "  --meters <n>    Number of meters of the MeterFilterBank check (default: 37)\n"
+            "  --seed <n>      Seed for the loads (default: 1)\n",
+            appName);
+  }
+}
+
+int main(int argc, char* argv[]) {
+  Options options;
+  for (int i = 1; i < argc; i++) {
+    bool hasValue = (i + 1 < argc);
+    if (strcmp(argv[i], "--samples") == 0 && hasValue) {
+      options.numSamples = atoi(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--meters") == 0 && hasValue) {
+      options.numMeters = atoi(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--seed") == 0 && hasValue) {
+      options.seed = strtoul(argv[++i], NULL, 10);
+    }
+    else {
+      printUsage(argv[0]);
+      return 1;
+    }
+  }
+
+  if (options.numSamples <= 0 || options.numMeters <= 0) {
+    printUsage(argv[0]);
+    return 1;
+  }
+
+  bool ok = true;
+  ok &= checkLoadWindow("Calibrated", 0.0f, 0.05f, options);
+  ok &= checkLoadWindow("Noisy", 0.0f, 2.0f, options);
+  ok &= checkLoadWindow("RawOffset", 10000.0f, 0.05f, options);
+  ok &= checkMeterFilterBank(options);
+  ok &= benchMeterFilterBanks(options);
+  return ok ? 0 : 1;
+}
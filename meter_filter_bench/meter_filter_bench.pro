@@ -0,0 +1,26 @@
+#-------------------------------------------------
+#
+# Checks the load filtering of the keg meters: LoadWindow against the exact mean and variance, and
+# the server's MeterFilterBank against LoadWindow, and times MeterFilterBank with the samples going
+# in a meter at a time and in batches. Plain C++, no Qt.
+#
+#-------------------------------------------------
+
+QT       -= core gui
+CONFIG   += console c++11
+CONFIG   -= qt app_bundle
+
+TARGET = meter_filter_bench
+TEMPLATE = app
+
+COMMON_DIR = $$PWD/../keg_meter_common
+SERVER_DIR = $$PWD/../keg_meter_server/KegMeterServer
+
+INCLUDEPATH += $$COMMON_DIR $$SERVER_DIR
+DEPENDPATH  += $$COMMON_DIR $$SERVER_DIR
+
+SOURCES += meter_filter_bench.cpp \
+    $$SERVER_DIR/meterfilterbank.cpp
+
+HEADERS  += $$COMMON_DIR/loadwindow.h \
+    $$SERVER_DIR/meterfilterbank.h
@@ -0,0 +1,323 @@
+// Replays labelled recordings of the load of a keg through the pour detection of the server and
+// checks the pours it finds against the labels.
+//
+// A recording is the calibrated load of a single meter as the server gets it, one
+// "<time in ms since the epoch>,<load in kg>" line per sample. Lines starting with '#' are
+// comments, and "# pour <start ms> <end ms> <litres>" comments are the labels, i.e. the pours that
+// really happened. The loads go through a MeterFilterBank and its window mean goes into a
+// PourDetector, the same way KegMeterModel does it while a keg is measuring.
+//
+// Every label has to be matched by exactly one detected pour, with the start and end (allowing for
+// the lag of the window) within MAX_TIME_ERROR_MS and about the same volume, and nothing else may be detected. The recordings in
+// recordings/ are synthetic (see --write-recordings): kegs poured from at tap speed, with the noise
+// of a load cell and the things that happen at a bar on top. They were written with libstdc++,
+// other standard libraries draw different noise from the same seeds.
+//
+// Plain C++, no Qt. Exits with 1 if any recording doesn't come out as labelled.
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "meterfilterbank.h"
+#include "pourdetector.h"
+
+namespace {
+  // The thresholds the meters use (see KegMeterModel), they don't matter to the pours
+  const float SETTLED_VARIANCE = 0.05f;
+  const float STEADY_VARIANCE = 0.5f;
+  const float LOADED_MASS = 9.0f;
+
+  // The detector sees the window mean, which only settles a whole window after the tap closes: 3 s
+  // at the 10 samples/s of the client sketch at its initial baud rate. Detected pours are expected
+  // to end that much after the labels say.
+  const int64_t SAMPLE_PERIOD_MS = 100;
+  const int64_t WINDOW_LAG_MS = MeterFilterBank::WINDOW_SIZE * SAMPLE_PERIOD_MS;
+  const int64_t MAX_TIME_ERROR_MS = 2000;
+  const float MAX_RELATIVE_LITRES_ERROR = 0.1f;
+  const float MAX_LITRES_ERROR = 0.03f;
+
+  // The synthetic recordings
+  const int64_t RECORDING_START_MS = 1700000000000LL;
+  const float FULL_CORNY_KEG_KG = 4.4f + 19.0f;
+  const float BEER_KG_PER_LITRE = 1.005f;
+  const float TAP_LITRES_PER_SEC = 0.1f;
+
+  struct Sample {
+    int64_t timeMs;
+    float load;
+  };
+
+  struct Pour {
+    int64_t startMs;
+    int64_t endMs;
+    float litres;
+  };
+
+  struct Recording {
+    std::vector<Sample> samples;
+    std::vector<Pour> labels;
+  };
+
+  bool readRecording(const char* path, Recording& recording) {
+    FILE* file = fopen(path, "r");
+    if (file == NULL) {
+      fprintf(stderr, "Failed to open recording %s\n", path);
+      return false;
+    }
+
+    char line[256];
+    int lineNum = 0;
+    bool ok = true;
+    while (ok && fgets(line, sizeof(line), file) != NULL) {
+      lineNum++;
+      long long startMs = 0;
+      long long endMs = 0;
+      long long timeMs = 0;
+      float value = 0;
+      if (line[0] == '#') {
+        if (sscanf(line, "# pour %lld %lld %f", &startMs, &endMs, &value) == 3) {
+          Pour pour = { startMs, endMs, value };
+          recording.labels.push_back(pour);
+        }
+      }
+      else if (sscanf(line, "%lld,%f", &timeMs, &value) == 2) {
+        Sample sample = { timeMs, value };
+        recording.samples.push_back(sample);
+      }
+      else if (strspn(line, " \t\r\n") != strlen(line)) {
+        fprintf(stderr, "%s:%d: not a sample or a comment\n", path, lineNum);
+        ok = false;
+      }
+    }
+    fclose(file);
+    return ok;
+  }
+
+  std::vector<Pour> detectPours(const Recording& recording) {
+    MeterFilterBank filters(1, SETTLED_VARIANCE, STEADY_VARIANCE, LOADED_MASS);
+    filters.setCalibration(0, 0, 1, 1);
+    PourDetector detector;
+
+    std::vector<Pour> pours;
+    for (size_t i = 0; i < recording.samples.size(); i++) {
+      const Sample& sample = recording.samples[i];
+      filters.push(0, sample.load);
+
+      PourDetector::Event event;
+      if (detector.update(sample.timeMs, filters.getMean(0), event)) {
+        Pour pour = { event.startMs, event.endMs, event.litres };
+        pours.push_back(pour);
+      }
+    }
+    return pours;
+  }
+
+  bool matches(const Pour& label, const Pour& pour) {
+    return llabs(pour.startMs - label.startMs) <= MAX_TIME_ERROR_MS &&
+           llabs(pour.endMs - (label.endMs + WINDOW_LAG_MS)) <= MAX_TIME_ERROR_MS &&
+           fabsf(pour.litres - label.litres) <= std::max(MAX_LITRES_ERROR, MAX_RELATIVE_LITRES_ERROR * label.litres);
+  }
+
+  bool checkRecording(const char* path) {
+    Recording recording;
+    if (!readRecording(path, recording)) {
+      return false;
+    }
+
+    if (recording.samples.empty()) {
+      fprintf(stderr, "%s: no samples\n", path);
+      return false;
+    }
+
+    // Times are reported in seconds into the recording
+    int64_t startMs = recording.samples.front().timeMs;
+    std::vector<Pour> pours = detectPours(recording);
+    std::vector<bool> matched(pours.size(), false);
+    int numMissed = 0;
+    for (size_t i = 0; i < recording.labels.size(); i++) {
+      const Pour& label = recording.labels[i];
+      bool found = false;
+      for (size_t j = 0; j < pours.size() && !found; j++) {
+        if (!matched[j] && matches(label, pours[j])) {
+          matched[j] = true;
+          found = true;
+        }
+      }
+      if (!found) {
+        fprintf(stderr, "%s: missed the %.2f L pour from %.1f to %.1f s\n", path, label.litres,
+                (label.startMs - startMs) / 1000.0, (label.endMs - startMs) / 1000.0);
+        numMissed++;
+      }
+    }
+
+    int numExtra = 0;
+    for (size_t j = 0; j < pours.size(); j++) {
+      if (!matched[j]) {
+        fprintf(stderr, "%s: detected a %.2f L pour from %.1f to %.1f s that isn't labelled\n", path,
+                pours[j].litres, (pours[j].startMs - startMs) / 1000.0, (pours[j].endMs - startMs) / 1000.0);
+        numExtra++;
+      }
+    }
+
+    printf("%-40s %8zu samples %4zu labelled %4zu detected  %s\n", path, recording.samples.size(),
+           recording.labels.size(), pours.size(), (numMissed == 0 && numExtra == 0) ? "ok" : "FAILED");
+    return numMissed == 0 && numExtra == 0;
+  }
+
+  // Writes a synthetic recording: the load of a keg sampled every SAMPLE_PERIOD_MS with gaussian
+  // noise, poured from at tap speed at the given times. Extra things that happen to the load on
+  // top (knocks, leaning on the keg, a creeping load cell) come from the disturb function.
+  class RecordingWriter {
+  public:
+    RecordingWriter(unsigned int seed, float initialLoad, float noise) :
+      rng(seed), noiseDist(0, noise), load(initialLoad) {}
+
+    void addPour(double startSecs, float litres) {
+      Pour pour;
+      pour.startMs = RECORDING_START_MS + static_cast<int64_t>(startSecs * 1000);
+      pour.endMs = pour.startMs + static_cast<int64_t>(litres / TAP_LITRES_PER_SEC * 1000);
+      pour.litres = litres;
+      this->pours.push_back(pour);
+    }
+
+    template <typename Disturbance>
+    bool write(const std::string& path, const char* description, double durationSecs, Disturbance disturb) {
+      FILE* file = fopen(path.c_str(), "w");
+      if (file == NULL) {
+        fprintf(stderr, "Failed to write recording %s\n", path.c_str());
+        return false;
+      }
+
+      fprintf(file, "# %s\n", description);
+      fprintf(file, "# Synthetic, written by pour_replay_check --write-recordings\n");
+      for (size_t i = 0; i < this->pours.size(); i++) {
+        fprintf(file, "# pour %lld %lld %.3f\n", (long long)this->pours[i].startMs,
+                (long long)this->pours[i].endMs, this->pours[i].litres);
+      }
+
+      int numSamples = static_cast<int>(durationSecs * 1000 / SAMPLE_PERIOD_MS);
+      for (int i = 0; i < numSamples; i++) {
+        int64_t timeMs = RECORDING_START_MS + i * SAMPLE_PERIOD_MS;
+        for (size_t j = 0; j < this->pours.size(); j++) {
+          if (timeMs > this->pours[j].startMs && timeMs <= this->pours[j].endMs) {
+            this->load -= TAP_LITRES_PER_SEC * BEER_KG_PER_LITRE * SAMPLE_PERIOD_MS / 1000.0f;
+          }
+        }
+
+        double secs = (timeMs - RECORDING_START_MS) / 1000.0;
+        fprintf(file, "%lld,%.4f\n", (long long)timeMs, this->load + this->noiseDist(this->rng) + disturb(secs, this->rng));
+      }
+      fclose(file);
+      printf("Wrote %s\n", path.c_str());
+      return true;
+    }
+
+  private:
+    std::mt19937 rng;
+    std::normal_distribution<float> noiseDist;
+    float load;
+    std::vector<Pour> pours;
+  };
+
+  float noDisturbance(double, std::mt19937&) {
+    return 0;
+  }
+
+  bool writeRecordings(const std::string& dir) {
+    bool ok = true;
+    {
+      RecordingWriter writer(1, FULL_CORNY_KEG_KG, 0.02f);
+      writer.addPour(60, 0.47f);
+      writer.addPour(150, 0.33f);
+      writer.addPour(240, 0.94f);
+      writer.addPour(330, 0.15f);
+      ok = writer.write(dir + "/pints.csv", "A pint, a half, a pitcher and a taster from a full corny keg",
+                        400, noDisturbance) && ok;
+    }
+    {
+      // Round after round, the tap only closes for a few seconds in between
+      RecordingWriter writer(2, 12.0f, 0.02f);
+      writer.addPour(60, 0.47f);
+      writer.addPour(72, 0.47f);
+      writer.addPour(84.5, 0.47f);
+      writer.addPour(160, 0.12f);
+      ok = writer.write(dir + "/rounds.csv", "Three pints back to back and then a taster from a half empty keg",
+                        220, noDisturbance) && ok;
+    }
+    {
+      // A load cell that creeps by 0.1 kg over ten minutes, on a noisy supply
+      RecordingWriter writer(3, FULL_CORNY_KEG_KG, 0.05f);
+      ok = writer.write(dir + "/idle.csv", "Ten minutes of nothing but noise and a creeping load cell", 600,
+                        [](double secs, std::mt19937&) { return static_cast<float>(-0.1 * secs / 600.0); }) && ok;
+    }
+    {
+      // Someone leaning on the keg for 6 s, a knock against it every 30 s or so and the keg lifted
+      // a little for 2 s (down and back up), before a real pour
+      RecordingWriter writer(4, FULL_CORNY_KEG_KG, 0.02f);
+      writer.addPour(200, 0.5f);
+      ok = writer.write(dir + "/bumps.csv", "Leaning on the keg, knocks and a lift that comes back, then a pint",
+                        260, [](double secs, std::mt19937& rng) {
+                          std::uniform_real_distribution<float> knockDist(0, 1);
+                          float disturbance = 0;
+                          if (secs >= 40 && secs < 46) {
+                            disturbance += 4.0f;
+                          }
+                          if (secs >= 100 && secs < 102) {
+                            disturbance -= 0.6f;
+                          }
+                          if (knockDist(rng) < 0.003f) {
+                            disturbance += 2.0f * (knockDist(rng) - 0.5f);
+                          }
+                          return disturbance;
+                        }) && ok;
+    }
+    {
+      // Drips off the tap are too small to be pours
+      RecordingWriter writer(5, FULL_CORNY_KEG_KG, 0.02f);
+      ok = writer.write(dir + "/drips.csv", "A tap that drips a few ml every half a minute, no pours", 300,
+                        [](double secs, std::mt19937&) {
+                          return static_cast<float>(-0.005 * BEER_KG_PER_LITRE * static_cast<int>(secs / 30));
+                        }) && ok;
+    }
+    return ok;
+  }
+
+  void printUsage(const char* appName) {
+    fprintf(stderr,
+            "Usage: %s <recording>...\n"
+            "       %s --write-recordings <dir>\n"
+            "  <recording>                Labelled recording to replay and check, e.g. recordings/*.csv\n"
+            "  --write-recordings <dir>   (Re)write the synthetic recordings into the directory\n",
+            appName, appName);
+  }
+}
+
+int main(int argc, char* argv[]) {
+  if (argc == 3 && strcmp(argv[1], "--write-recordings") == 0) {
+    return writeRecordings(argv[2]) ? 0 : 1;
+  }
+  if (argc < 2 || argv[1][0] == '-') {
+    printUsage(argv[0]);
+    return 1;
+  }
+
+  int numFailed = 0;
+  for (int i = 1; i < argc; i++) {
+    if (!checkRecording(argv[i])) {
+      numFailed++;
+    }
+  }
+  if (numFailed > 0) {
+    fprintf(stderr, "%d of %d recording(s) didn't come out as labelled\n", numFailed, argc - 1);
+    return 1;
+  }
+  printf("All %d recording(s) came out as labelled\n", argc - 1);
+  return 0;
+}
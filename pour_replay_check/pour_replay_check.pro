@@ -0,0 +1,28 @@
+#-------------------------------------------------
+#
+# Replays labelled recordings of keg loads (recordings/) through the server's load filtering and
+# pour detection, and checks the detected pours against the labels. Plain C++, no Qt.
+#
+#-------------------------------------------------
+
+QT       -= core gui
+CONFIG   += console c++11
+CONFIG   -= qt app_bundle
+
+TARGET = pour_replay_check
+TEMPLATE = app
+
+COMMON_DIR = $$PWD/../keg_meter_common
+SERVER_DIR = $$PWD/../keg_meter_server/KegMeterServer
+
+INCLUDEPATH += $$COMMON_DIR $$SERVER_DIR
+DEPENDPATH  += $$COMMON_DIR $$SERVER_DIR
+
+SOURCES += pour_replay_check.cpp \
+    $$COMMON_DIR/pourdetector.cpp \
+    $$SERVER_DIR/meterfilterbank.cpp
+
+HEADERS  += $$COMMON_DIR/pourdetector.h \
+    $$SERVER_DIR/meterfilterbank.h
+
+OTHER_FILES += recordings/*.csv
@@ -0,0 +1,661 @@
+// Fuzzes and benchmarks the decoding of the serial traffic from the keg meter sketches. The traffic
+// is either what was read from the hardware in serial captures (see SerialCapture), played over
+// and over until there's enough of it, or synthetic traffic of both sketches.
+//
+// The fuzzing cuts the traffic up and corrupts it every which way, and checks that PacketFramer
+// comes up with the same packages as a reference framer that follows the same rules in the most
+// obvious way. The benchmarks time PacketFramer against the framing SerialComm did before it, with
+// indexOf() and remove() on a QByteArray, for serial reads of a few bytes and for bursts (what
+// piles up while the GUI thread is busy). The packages are then decoded with PacketParser and
+// with the QTextStream decoding the server and controller SerialComm did before it, which have to
+// agree on every value. The results are laid out like Google Benchmark's.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <ctime>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <QByteArray>
+#include <QString>
+#include <QTextStream>
+
+#include "packetframer.h"
+#include "packetparser.h"
+#include "serialcapture.h"
+
+namespace {
+  typedef std::chrono::steady_clock Clock;
+
+  const char PKG_BEGIN_CHAR = '[';
+  const char PKG_END_CHAR = ']';
+
+  // The fuzzing inputs are pieces of the traffic of up to this many bytes, with up to this many
+  // corruptions each
+  const size_t MAX_FUZZ_INPUT_SIZE = 4 * PacketFramer::CAPACITY;
+  const int MAX_NUM_MUTATIONS = 8;
+
+  // A serial read of what arrived since the last one, and a burst that piled up during a stall
+  const int READ_CHUNK_SIZE = 64;
+  const int BURST_CHUNK_SIZE = PacketFramer::CAPACITY;
+
+  // The synthetic traffic has meter indices 0 to NUM_METERS - 1
+  const int NUM_METERS = 12;
+
+  // How far the decoded values may drift apart, summed over all the packages
+  const double MAX_RELATIVE_DECODE_ERROR = 1e-6;
+
+  struct Options {
+    std::vector<std::string> capturePaths;
+    double megabytes;
+    int numFuzzInputs;
+    unsigned int seed;
+
+    Options() : megabytes(16), numFuzzInputs(2000), seed(1) {}
+  };
+
+  // Measurements from the client sketch and status from the autonomous one, with the odd line of
+  // chatter in between like a real board sends
+  std::string makeSyntheticTraffic(size_t numBytes, std::mt19937& rng) {
+    std::uniform_int_distribution<int> meterDist(0, NUM_METERS - 1);
+    std::uniform_int_distribution<int> kindDist(0, 99);
+    std::uniform_real_distribution<float> loadDist(0, 60);
+
+    std::string traffic;
+    traffic.reserve(numBytes + 128);
+    char line[128];
+    while (traffic.size() < numBytes) {
+      int kind = kindDist(rng);
+      float load = loadDist(rng);
+      if (kind < 80) {
+        snprintf(line, sizeof(line), "[%02d M %07.3f]\r\n", meterDist(rng), load);
+      }
+      else if (kind < 98) {
+        snprintf(line, sizeof(line), "[%d{P:%.2f,F:%.2f,E:%.2f,L:%.2f,V:%.5f}]\r\n", meterDist(rng),
+                 load / 60, 60.0f, 4.4f, load, load / 1000);
+      }
+      else {
+        snprintf(line, sizeof(line), "Entering Measuring State\r\n");
+      }
+      traffic += line;
+    }
+    return traffic;
+  }
+
+  // Everything read from the hardware in the captures, one after the other
+  bool readCaptures(const std::vector<std::string>& paths, std::string& traffic) {
+    for (size_t i = 0; i < paths.size(); i++) {
+      SerialCapture capture;
+      if (!capture.openForReading(QString::fromStdString(paths[i]))) {
+        fprintf(stderr, "%s\n", capture.errorString().toLocal8Bit().constData());
+        return false;
+      }
+
+      SerialCapture::Record record;
+      while (capture.read(record)) {
+        if (record.direction == SerialCapture::ReadDirection) {
+          traffic.append(record.data.constData(), record.data.size());
+        }
+      }
+
+      // A capture that was cut short is still good up to there
+      if (!capture.errorString().isEmpty()) {
+        fprintf(stderr, "Warning: %s\n", capture.errorString().toLocal8Bit().constData());
+      }
+    }
+
+    if (traffic.empty()) {
+      fprintf(stderr, "Nothing was read from the hardware in the capture(s)\n");
+      return false;
+    }
+    return true;
+  }
+
+  /**
+   * PacketFramer's rules written out the obvious way: a start token always starts a new package
+   * (dropping the one that was coming in, if any), and a package that's still coming in when it
+   * gets to MAX_PACKET_SIZE bytes with its start token is dropped.
+   */
+  class ReferenceFramer {
+  public:
+    ReferenceFramer() : inPacket(false), numDroppedPackets(0) {}
+
+    void append(const char* bytes, size_t numBytes) {
+      for (size_t i = 0; i < numBytes; i++) {
+        char currByte = bytes[i];
+        if (currByte == PKG_BEGIN_CHAR) {
+          if (this->inPacket) {
+            this->numDroppedPackets++;
+          }
+          this->inPacket = true;
+          this->currPacket.clear();
+        }
+        else if (this->inPacket) {
+          if (currByte == PKG_END_CHAR) {
+            this->packets.push_back(this->currPacket);
+            this->inPacket = false;
+          }
+          else if (this->currPacket.size() + 2 >= static_cast<size_t>(PacketFramer::MAX_PACKET_SIZE)) {
+            this->inPacket = false;
+            this->numDroppedPackets++;
+          }
+          else {
+            this->currPacket += currByte;
+          }
+        }
+      }
+    }
+
+    const std::vector<std::string>& getPackets() const { return this->packets; }
+    uint64_t getNumDroppedPackets() const { return this->numDroppedPackets; }
+
+  private:
+    std::vector<std::string> packets;
+    std::string currPacket;
+    bool inPacket;
+    uint64_t numDroppedPackets;
+  };
+
+  // Everything that goes wrong on a serial line, and then some
+  void mutate(std::string& input, std::mt19937& rng) {
+    int numMutations = rng() % (MAX_NUM_MUTATIONS + 1);
+    for (int i = 0; i < numMutations; i++) {
+      size_t pos = input.empty() ? 0 : rng() % input.size();
+      switch (rng() % 5) {
+        case 0: // A garbled byte
+          if (!input.empty()) {
+            input[pos] = static_cast<char>(rng());
+          }
+          break;
+        case 1: // A stray token
+          input.insert(pos, 1, (rng() % 2 == 0) ? PKG_BEGIN_CHAR : PKG_END_CHAR);
+          break;
+        case 2: // Lost bytes
+          input.erase(pos, rng() % 64);
+          break;
+        case 3: { // A package that never ends
+          std::string garbage(1, PKG_BEGIN_CHAR);
+          size_t size = rng() % (2 * PacketFramer::MAX_PACKET_SIZE);
+          for (size_t j = 0; j < size; j++) {
+            garbage += static_cast<char>('a' + rng() % 26);
+          }
+          input.insert(pos, garbage);
+          break;
+        }
+        default: { // Repeated bytes
+          size_t size = std::min<size_t>(rng() % 256, input.size() - pos);
+          input.insert(pos, input.substr(pos, size));
+          break;
+        }
+      }
+    }
+  }
+
+  // Feeds a corrupted piece of the traffic to PacketFramer, cut up at random, and to the reference
+  // framer. Returns false if they don't come up with the same thing.
+  bool fuzzOnce(const std::string& traffic, std::mt19937& rng, uint64_t& numBytes, uint64_t& numPackets, uint64_t& numDropped) {
+    size_t size = std::min<size_t>(traffic.size(), 1 + rng() % MAX_FUZZ_INPUT_SIZE);
+    size_t offset = rng() % (traffic.size() - size + 1);
+    std::string input = traffic.substr(offset, size);
+    mutate(input, rng);
+
+    ReferenceFramer reference;
+    reference.append(input.data(), input.size());
+    const std::vector<std::string>& expected = reference.getPackets();
+
+    PacketFramer framer(PKG_BEGIN_CHAR, PKG_END_CHAR);
+    size_t pos = 0;
+    size_t numFramed = 0;
+    while (pos < input.size()) {
+      // Mostly serial read sized, sometimes more than fits into the framer at once
+      size_t maxChunkSize = (rng() % 8 == 0) ? 2 * PacketFramer::CAPACITY : READ_CHUNK_SIZE;
+      int chunkSize = static_cast<int>(std::min<size_t>(input.size() - pos, 1 + rng() % maxChunkSize));
+      pos += framer.append(input.data() + pos, chunkSize);
+
+      PacketFramer::PacketView packet;
+      while (framer.nextPacket(packet)) {
+        std::string framed(packet.data, packet.size);
+        if (numFramed >= expected.size() || framed != expected[numFramed]) {
+          fprintf(stderr, "Package %zu came out as \"%s\", expected \"%s\"\n", numFramed, framed.c_str(),
+                  numFramed < expected.size() ? expected[numFramed].c_str() : "(none)");
+          return false;
+        }
+        numFramed++;
+      }
+    }
+
+    if (numFramed != expected.size() || framer.getNumDroppedPackets() != reference.getNumDroppedPackets()) {
+      fprintf(stderr, "Framed %zu package(s) and dropped %llu, expected %zu and %llu\n", numFramed,
+              (unsigned long long)framer.getNumDroppedPackets(), expected.size(),
+              (unsigned long long)reference.getNumDroppedPackets());
+      return false;
+    }
+
+    numBytes += input.size();
+    numPackets += numFramed;
+    numDropped += framer.getNumDroppedPackets();
+    return true;
+  }
+
+  // All the packages in the traffic, read chunkSize bytes at a time
+  uint64_t frameAll(const std::string& traffic, int chunkSize, uint64_t& checksum) {
+    PacketFramer framer(PKG_BEGIN_CHAR, PKG_END_CHAR);
+    uint64_t numPackets = 0;
+    size_t pos = 0;
+    while (pos < traffic.size()) {
+      int size = static_cast<int>(std::min<size_t>(chunkSize, traffic.size() - pos));
+      pos += framer.append(traffic.data() + pos, size);
+
+      PacketFramer::PacketView packet;
+      while (framer.nextPacket(packet)) {
+        checksum += packet.size + static_cast<unsigned char>(packet.data[0]);
+        numPackets++;
+      }
+    }
+    return numPackets;
+  }
+
+  // The same, the way SerialComm::onSerialPortReadyRead() did it before PacketFramer: everything
+  // that's come in sits in a QByteArray that's searched from the start for every package, shifted
+  // down a byte at a time, and every package is copied out into a QString
+  uint64_t frameAllLegacy(const std::string& traffic, int chunkSize, uint64_t& checksum) {
+    QByteArray readData;
+    uint64_t numPackets = 0;
+    size_t pos = 0;
+    while (pos < traffic.size()) {
+      int size = static_cast<int>(std::min<size_t>(chunkSize, traffic.size() - pos));
+      readData.append(traffic.data() + pos, size);
+      pos += size;
+
+      while (true) {
+        int startIdx = readData.indexOf(PKG_BEGIN_CHAR);
+        int endIdx   = readData.indexOf(PKG_END_CHAR);
+        if (startIdx == -1) {
+          readData.clear();
+          break;
+        }
+        if (endIdx == -1) {
+          readData.remove(0, startIdx);
+          break;
+        }
+
+        readData.remove(0, startIdx);
+        if (endIdx < startIdx) {
+          continue;
+        }
+        endIdx -= startIdx;
+        if (endIdx < 6) {
+          readData.remove(0, 1);
+          continue;
+        }
+
+        QString pkgStr;
+        for (int i = 1; i < endIdx; i++) {
+          pkgStr += readData.at(i);
+        }
+        if (!pkgStr.isEmpty()) {
+          checksum += pkgStr.size() + static_cast<unsigned char>(pkgStr.at(0).toLatin1());
+        }
+        numPackets++;
+
+        readData.remove(0, 1);
+      }
+    }
+    return numPackets;
+  }
+
+  typedef uint64_t (*FrameFunction)(const std::string& traffic, int chunkSize, uint64_t& checksum);
+
+  // Twice through, the first time to warm up. Returns false if it came up with different packages
+  // than expected (when there are any expectations yet).
+  bool runBenchmark(const char* name, FrameFunction frame, const std::string& traffic, int chunkSize,
+                    uint64_t& numPackets, uint64_t& checksum) {
+    double wallNs = 0;
+    double cpuNs = 0;
+    uint64_t passChecksum = 0;
+    uint64_t passNumPackets = 0;
+    for (int pass = 0; pass < 2; pass++) {
+      passChecksum = 0;
+      Clock::time_point startTime = Clock::now();
+      std::clock_t startTicks = std::clock();
+      passNumPackets = frame(traffic, chunkSize, passChecksum);
+      cpuNs = (std::clock() - startTicks) * (1e9 / CLOCKS_PER_SEC);
+      wallNs = std::chrono::duration<double, std::nano>(Clock::now() - startTime).count();
+    }
+
+    double nsPerPacket = std::max(1.0, cpuNs) / std::max<uint64_t>(1, passNumPackets);
+    printf("%-24s %11.1f ns %11.1f ns %12llu items_per_second=%.3fM/s bytes_per_second=%.1fM/s\n",
+           name, wallNs / std::max<uint64_t>(1, passNumPackets), nsPerPacket,
+           (unsigned long long)passNumPackets, 1e3 / nsPerPacket,
+           traffic.size() * 1e3 / std::max(1.0, cpuNs));
+    fflush(stdout);
+
+    if (numPackets != 0 && (passNumPackets != numPackets || passChecksum != checksum)) {
+      fprintf(stderr, "%s framed %llu package(s), expected %llu\n", name,
+              (unsigned long long)passNumPackets, (unsigned long long)numPackets);
+      return false;
+    }
+    numPackets = passNumPackets;
+    checksum = passChecksum;
+    return true;
+  }
+
+  // Splits the packages in the traffic into the client sketch's measurements and the autonomous
+  // sketch's status
+  void collectPackages(const std::string& traffic, std::vector<std::string>& measurements,
+                       std::vector<std::string>& statuses) {
+    PacketFramer framer(PKG_BEGIN_CHAR, PKG_END_CHAR);
+    size_t pos = 0;
+    while (pos < traffic.size()) {
+      int size = static_cast<int>(std::min<size_t>(READ_CHUNK_SIZE, traffic.size() - pos));
+      pos += framer.append(traffic.data() + pos, size);
+
+      PacketFramer::PacketView packet;
+      while (framer.nextPacket(packet)) {
+        std::string package(packet.data, packet.size);
+        if (package.find('{') != std::string::npos) {
+          statuses.push_back(package);
+        }
+        else {
+          measurements.push_back(package);
+        }
+      }
+    }
+  }
+
+  // Measurement packages decoded with PacketParser, the sum of all the loads goes into valueSum
+  uint64_t parseMeasurements(const std::vector<std::string>& packages, double& valueSum) {
+    uint64_t numDecoded = 0;
+    for (size_t i = 0; i < packages.size(); i++) {
+      PacketParser::MeasurementPacket packet;
+      PacketParser::Result result = PacketParser::parseMeasurement(packages[i].data(), static_cast<int>(packages[i].size()), packet);
+      if (!result.isOk() || packet.meterIdx < 0 || packet.meterIdx >= NUM_METERS) {
+        continue;
+      }
+      valueSum += packet.measurement;
+      numDecoded++;
+    }
+    return numDecoded;
+  }
+
+  // The same, the way the server's SerialComm::onSerialPortReadyRead() did it before PacketParser
+  uint64_t parseMeasurementsLegacy(const std::vector<std::string>& packages, double& valueSum) {
+    uint64_t numDecoded = 0;
+    for (size_t i = 0; i < packages.size(); i++) {
+      QString pkgStr;
+      for (size_t j = 0; j < packages[i].size(); j++) {
+        pkgStr += packages[i][j];
+      }
+
+      QTextStream pkgTextStream(&pkgStr);
+
+      int meterIdx;
+      pkgTextStream >> meterIdx;
+      if (pkgTextStream.status() != QTextStream::Ok || meterIdx >= NUM_METERS || meterIdx < 0) {
+        continue;
+      }
+
+      char temp;
+      pkgTextStream >> temp; // ' '
+      if (pkgTextStream.status() != QTextStream::Ok || temp != ' ') {
+        continue;
+      }
+
+      pkgTextStream >> temp;
+      if (pkgTextStream.status() != QTextStream::Ok || temp != 'M') {
+        continue;
+      }
+      pkgTextStream >> temp; // ' '
+      if (temp != ' ' || pkgTextStream.status() != QTextStream::Ok) {
+        continue;
+      }
+
+      float measurement = 0;
+      pkgTextStream >> measurement;
+      valueSum += measurement;
+      numDecoded++;
+    }
+    return numDecoded;
+  }
+
+  // Status packages decoded with PacketParser, the sum of all the fields goes into valueSum
+  uint64_t parseStatuses(const std::vector<std::string>& packages, double& valueSum) {
+    uint64_t numDecoded = 0;
+    for (size_t i = 0; i < packages.size(); i++) {
+      PacketParser::StatusPacket packet;
+      PacketParser::Result result = PacketParser::parseStatus(packages[i].data(), static_cast<int>(packages[i].size()), packet);
+      if (!result.isOk() || packet.meterIdx < 0 || packet.meterIdx >= NUM_METERS) {
+        continue;
+      }
+      for (int field = 0; field < PacketParser::NUM_STATUS_FIELDS; field++) {
+        if (packet.hasField(static_cast<PacketParser::StatusField>(field))) {
+          valueSum += packet.values[field];
+        }
+      }
+      numDecoded++;
+    }
+    return numDecoded;
+  }
+
+  // The same, the way the controller's SerialComm::onSerialPortReadyRead() did it before
+  // PacketParser
+  uint64_t parseStatusesLegacy(const std::vector<std::string>& packages, double& valueSum) {
+    uint64_t numDecoded = 0;
+    for (size_t i = 0; i < packages.size(); i++) {
+      QString pkgStr;
+      for (size_t j = 0; j < packages[i].size(); j++) {
+        pkgStr += packages[i][j];
+      }
+
+      QTextStream pkgTextStream(&pkgStr);
+
+      int id;
+      pkgTextStream >> id;
+      if (pkgTextStream.status() != QTextStream::Ok || id >= NUM_METERS || id < 0) {
+        continue;
+      }
+
+      char temp;
+      pkgTextStream >> temp; // '{'
+      if (pkgTextStream.status() != QTextStream::Ok || temp != '{') {
+        continue;
+      }
+
+      double packageSum = 0;
+      bool exitLoop = false;
+      bool success = false;
+      while (!exitLoop && !success) {
+        pkgTextStream >> temp;
+        if (pkgTextStream.status() != QTextStream::Ok) { exitLoop = true; break; }
+
+        switch (temp) {
+          case 'P':
+          case 'F':
+          case 'E':
+          case 'L':
+          case 'V': {
+            pkgTextStream >> temp; // ':'
+            if (temp != ':' || pkgTextStream.status() != QTextStream::Ok) { exitLoop = true; break; }
+            float value = 0;
+            pkgTextStream >> value;
+            packageSum += value;
+            break;
+          }
+
+          case ',':
+            break;
+
+          case '}':
+            success = true;
+            exitLoop = true;
+            break;
+
+          default:
+            exitLoop = true;
+            break;
+        }
+      }
+
+      if (success) {
+        valueSum += packageSum;
+        numDecoded++;
+      }
+    }
+    return numDecoded;
+  }
+
+  typedef uint64_t (*ParseFunction)(const std::vector<std::string>& packages, double& valueSum);
+
+  // Twice through like runBenchmark(), numDecoded and valueSum are what the timed pass decoded
+  void runParseBenchmark(const char* name, ParseFunction parse, const std::vector<std::string>& packages,
+                         uint64_t& numDecoded, double& valueSum) {
+    double wallNs = 0;
+    double cpuNs = 0;
+    for (int pass = 0; pass < 2; pass++) {
+      valueSum = 0;
+      Clock::time_point startTime = Clock::now();
+      std::clock_t startTicks = std::clock();
+      numDecoded = parse(packages, valueSum);
+      cpuNs = (std::clock() - startTicks) * (1e9 / CLOCKS_PER_SEC);
+      wallNs = std::chrono::duration<double, std::nano>(Clock::now() - startTime).count();
+    }
+
+    uint64_t numPackages = std::max<uint64_t>(1, packages.size());
+    double nsPerPackage = std::max(1.0, cpuNs) / numPackages;
+    printf("%-24s %11.1f ns %11.1f ns %12llu items_per_second=%.3fM/s\n",
+           name, wallNs / numPackages, nsPerPackage, (unsigned long long)packages.size(), 1e3 / nsPerPackage);
+    fflush(stdout);
+  }
+
+  // Decodes the packages both ways and checks they agree
+  bool comparePackageDecoding(const char* kind, ParseFunction parse, ParseFunction parseLegacy,
+                              const std::vector<std::string>& packages) {
+    char name[64];
+    uint64_t numDecoded = 0;
+    double valueSum = 0;
+    snprintf(name, sizeof(name), "Parser/%s", kind);
+    runParseBenchmark(name, parse, packages, numDecoded, valueSum);
+
+    uint64_t legacyNumDecoded = 0;
+    double legacyValueSum = 0;
+    snprintf(name, sizeof(name), "TextStream/%s", kind);
+    runParseBenchmark(name, parseLegacy, packages, legacyNumDecoded, legacyValueSum);
+
+    double maxError = MAX_RELATIVE_DECODE_ERROR * std::max(1.0, std::fabs(legacyValueSum));
+    if (numDecoded != legacyNumDecoded || std::fabs(valueSum - legacyValueSum) > maxError) {
+      fprintf(stderr, "%s: PacketParser decoded %llu package(s) summing to %f, QTextStream %llu summing to %f\n",
+              kind, (unsigned long long)numDecoded, valueSum, (unsigned long long)legacyNumDecoded, legacyValueSum);
+      return false;
+    }
+    return true;
+  }
+
+  void printUsage(const char* appName) {
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  --capture <file>    Use what was read from the hardware in this serial capture, can be\n"
+            "                      given more than once (default: synthetic traffic)\n"
+            "  --megabytes <n>     Play the traffic over and over until there's this much (default: 16)\n"
+            "  --fuzz-inputs <n>   Number of corrupted pieces of the traffic to fuzz with (default: 2000)\n"
+            "  --seed <n>          Seed for the synthetic traffic and the fuzzing (default: 1)\n",
+            appName);
+  }
+}
+
+int main(int argc, char* argv[]) {
+  Options options;
+  for (int i = 1; i < argc; i++) {
+    bool hasValue = (i + 1 < argc);
+    if (strcmp(argv[i], "--capture") == 0 && hasValue) {
+      options.capturePaths.push_back(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--megabytes") == 0 && hasValue) {
+      options.megabytes = atof(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--fuzz-inputs") == 0 && hasValue) {
+      options.numFuzzInputs = atoi(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--seed") == 0 && hasValue) {
+      options.seed = strtoul(argv[++i], NULL, 10);
+    }
+    else {
+      printUsage(argv[0]);
+      return 1;
+    }
+  }
+
+  if (options.megabytes <= 0 || options.numFuzzInputs < 0) {
+    printUsage(argv[0]);
+    return 1;
+  }
+
+  std::mt19937 rng(options.seed);
+  size_t numBytes = static_cast<size_t>(options.megabytes * 1024 * 1024);
+  std::string traffic;
+  if (options.capturePaths.empty()) {
+    traffic = makeSyntheticTraffic(numBytes, rng);
+  }
+  else {
+    std::string capturedTraffic;
+    if (!readCaptures(options.capturePaths, capturedTraffic)) {
+      return 1;
+    }
+    while (traffic.size() < numBytes) {
+      traffic += capturedTraffic;
+    }
+  }
+  printf("Serial traffic: %.1f MB, %s\n", traffic.size() / (1024.0 * 1024.0),
+         options.capturePaths.empty() ? "synthetic" : "played back from the capture(s)");
+
+  uint64_t numFuzzBytes = 0;
+  uint64_t numFuzzPackets = 0;
+  uint64_t numFuzzDropped = 0;
+  for (int i = 0; i < options.numFuzzInputs; i++) {
+    if (!fuzzOnce(traffic, rng, numFuzzBytes, numFuzzPackets, numFuzzDropped)) {
+      fprintf(stderr, "Fuzzing input %d (seed %u) came out different from the reference framer\n", i, options.seed);
+      return 1;
+    }
+  }
+  printf("Fuzzed with %d corrupted input(s), %llu bytes: %llu package(s) framed, %llu dropped, all as expected\n",
+         options.numFuzzInputs, (unsigned long long)numFuzzBytes, (unsigned long long)numFuzzPackets,
+         (unsigned long long)numFuzzDropped);
+
+  std::string separator(68, '-');
+  printf("%s\n%-24s %14s %14s %12s\n%s\n", separator.c_str(), "Benchmark", "Time", "CPU", "Iterations", separator.c_str());
+
+  const int chunkSizes[] = { READ_CHUNK_SIZE, BURST_CHUNK_SIZE };
+  for (size_t i = 0; i < sizeof(chunkSizes) / sizeof(chunkSizes[0]); i++) {
+    char name[64];
+    uint64_t numPackets = 0;
+    uint64_t checksum = 0;
+
+    snprintf(name, sizeof(name), "Framer/%d", chunkSizes[i]);
+    if (!runBenchmark(name, frameAll, traffic, chunkSizes[i], numPackets, checksum)) {
+      return 1;
+    }
+
+    // The old framing doesn't drop overlong packages, it only agrees on well-formed traffic
+    snprintf(name, sizeof(name), "Legacy/%d", chunkSizes[i]);
+    uint64_t legacyNumPackets = 0;
+    uint64_t legacyChecksum = 0;
+    runBenchmark(name, frameAllLegacy, traffic, chunkSizes[i], legacyNumPackets, legacyChecksum);
+  }
+
+  std::vector<std::string> measurements;
+  std::vector<std::string> statuses;
+  collectPackages(traffic, measurements, statuses);
+  bool decodingAgrees = true;
+  if (!measurements.empty()) {
+    decodingAgrees &= comparePackageDecoding("Measurement", parseMeasurements, parseMeasurementsLegacy, measurements);
+  }
+  if (!statuses.empty()) {
+    decodingAgrees &= comparePackageDecoding("Status", parseStatuses, parseStatusesLegacy, statuses);
+  }
+  return decodingAgrees ? 0 : 1;
+}
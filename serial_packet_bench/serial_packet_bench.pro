@@ -0,0 +1,28 @@
+#-------------------------------------------------
+#
+# Fuzzes and benchmarks the framing and decoding of the serial traffic from the keg meter sketches,
+# over recorded captures (see SerialCapture) or synthetic traffic, without a GUI or any hardware.
+#
+#-------------------------------------------------
+
+QT       += core
+QT       -= gui
+CONFIG   += console c++11
+CONFIG   -= app_bundle
+
+TARGET = serial_packet_bench
+TEMPLATE = app
+
+COMMON_DIR = $$PWD/../keg_meter_common
+
+INCLUDEPATH += $$COMMON_DIR
+DEPENDPATH  += $$COMMON_DIR
+
+SOURCES += serial_packet_bench.cpp \
+    $$COMMON_DIR/packetframer.cpp \
+    $$COMMON_DIR/packetparser.cpp \
+    $$COMMON_DIR/serialcapture.cpp
+
+HEADERS  += $$COMMON_DIR/packetframer.h \
+    $$COMMON_DIR/packetparser.h \
+    $$COMMON_DIR/serialcapture.h
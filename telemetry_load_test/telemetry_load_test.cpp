@@ -0,0 +1,346 @@
+// Load tests the telemetry server of KegMeterServer (see TelemetryProtocol). A swarm of clients
+// connects to it, over loopback unless told otherwise, and every one of them behaves like a
+// dashboard: it greets, subscribes to all the meters, acknowledges every version it gets and
+// answers the server's pings.
+//
+// Every client also pings the server on its own and keeps the round-trip times, and takes the age
+// of every snapshot and delta on arrival from its server timestamp (which only means something
+// when both ends share a clock, i.e. over loopback, and has millisecond resolution). At the end
+// the fan-out throughput and the latency percentiles of every client and of all of them together
+// are printed. The exit code is 1 when a client didn't make it through the whole run or never got
+// any state.
+//
+// The server needs something to fan out, e.g. run it headless on a replay (--replay with
+// --replay-speed 0) or on the pty emulator.
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <QByteArray>
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QString>
+#include <QTcpSocket>
+#include <QTimer>
+#include <QVector>
+
+#include "latencyhistogram.h"
+#include "telemetryprotocol.h"
+
+namespace {
+  const quint16 DEFAULT_PORT = 47474; // As KegMeterServer
+
+  // Like KegMeterConnection, a client that sends more than this without a complete message is
+  // talking nonsense
+  const int MAX_BUFFER_SIZE = 1024000;
+
+  struct Options {
+    QString host;
+    quint16 port;
+    int numClients;
+    double durationSecs;
+    int pingIntervalMs;
+
+    Options() : host("127.0.0.1"), port(DEFAULT_PORT), numClients(32), durationSecs(30), pingIntervalMs(100) {}
+  };
+
+  struct LoadClient {
+    int idx;
+    QTcpSocket* socket;
+    QByteArray buffer;
+
+    bool ready; // Got the server's greeting and subscribed
+    bool failed;
+    QString failure;
+
+    quint64 numMessages;
+    quint64 numStates; // Snapshots and deltas
+    quint64 numPours;
+    quint64 numBytes;
+
+    quint32 pingToken;
+    QElapsedTimer heartbeatClock;
+    LatencyHistogram roundTripTimes; // In microseconds
+    LatencyHistogram stateAges;      // In microseconds, but only good to the millisecond
+
+    LoadClient(int idx) : idx(idx), socket(new QTcpSocket()), ready(false), failed(false), numMessages(0),
+                          numStates(0), numPours(0), numBytes(0), pingToken(0) {}
+    ~LoadClient() {
+      this->socket->disconnect();
+      delete this->socket;
+    }
+  };
+
+  void fail(LoadClient& client, const QString& reason) {
+    if (!client.failed) {
+      client.failed = true;
+      client.failure = reason;
+    }
+    client.socket->abort();
+  }
+
+  void recordState(LoadClient& client, quint32 version, qint64 timeMs) {
+    client.numStates++;
+    client.socket->write(TelemetryProtocol::encodeAck(version));
+
+    qint64 ageMs = QDateTime::currentMSecsSinceEpoch() - timeMs;
+    client.stateAges.record(ageMs > 0 ? ageMs * 1000 : 0);
+  }
+
+  bool processMessage(LoadClient& client, TelemetryProtocol::MessageType type, const QByteArray& payload) {
+    client.numMessages++;
+
+    if (!client.ready) {
+      quint16 version = 0;
+      QString name;
+      quint16 numMeters = 0;
+      if (type != TelemetryProtocol::GreetingMessage || !TelemetryProtocol::decodeGreeting(payload, version, name, numMeters)) {
+        return false;
+      }
+
+      // No meters in particular means all of them
+      client.ready = true;
+      client.socket->write(TelemetryProtocol::encodeSubscribe(QVector<quint16>()));
+      return true;
+    }
+
+    switch (type) {
+    case TelemetryProtocol::SnapshotMessage: {
+      quint32 version = 0;
+      qint64 timeMs = 0;
+      QVector<TelemetryProtocol::MeterState> states;
+      if (!TelemetryProtocol::decodeSnapshot(payload, version, timeMs, states)) {
+        return false;
+      }
+      recordState(client, version, timeMs);
+      return true;
+    }
+
+    case TelemetryProtocol::DeltaMessage: {
+      quint32 baseVersion = 0;
+      quint32 version = 0;
+      qint64 timeMs = 0;
+      QVector<TelemetryProtocol::MeterDelta> deltas;
+      if (!TelemetryProtocol::decodeDelta(payload, baseVersion, version, timeMs, deltas)) {
+        return false;
+      }
+      recordState(client, version, timeMs);
+      return true;
+    }
+
+    case TelemetryProtocol::PourMessage: {
+      TelemetryProtocol::Pour pour;
+      if (!TelemetryProtocol::decodePour(payload, pour)) {
+        return false;
+      }
+      client.numPours++;
+      return true;
+    }
+
+    case TelemetryProtocol::PingMessage: {
+      quint32 token = 0;
+      qint64 timeUs = 0;
+      if (!TelemetryProtocol::decodeHeartbeat(payload, token, timeUs)) {
+        return false;
+      }
+      client.socket->write(TelemetryProtocol::encodePong(token, timeUs));
+      return true;
+    }
+
+    case TelemetryProtocol::PongMessage: {
+      quint32 token = 0;
+      qint64 timeUs = 0;
+      if (!TelemetryProtocol::decodeHeartbeat(payload, token, timeUs)) {
+        return false;
+      }
+      qint64 roundTripTime = client.heartbeatClock.nsecsElapsed() / 1000 - timeUs;
+      if (token <= client.pingToken && timeUs >= 0 && roundTripTime >= 0) {
+        client.roundTripTimes.record(roundTripTime);
+      }
+      return true;
+    }
+
+    default:
+      return false;
+    }
+  }
+
+  void onReadyRead(LoadClient& client) {
+    QByteArray data = client.socket->readAll();
+    client.numBytes += data.size();
+    client.buffer.append(data);
+    if (client.buffer.size() > MAX_BUFFER_SIZE) {
+      fail(client, "the server sent too much data without a complete message");
+      return;
+    }
+
+    int readOffset = 0;
+    TelemetryProtocol::MessageType type;
+    QByteArray payload;
+    while (true) {
+      TelemetryProtocol::ReadResult result = TelemetryProtocol::readMessage(client.buffer, readOffset, type, payload);
+      if (result == TelemetryProtocol::NeedMoreData) {
+        break;
+      }
+      if (result == TelemetryProtocol::InvalidMessage || !processMessage(client, type, payload)) {
+        fail(client, "invalid message from the server");
+        return;
+      }
+    }
+    client.buffer.remove(0, readOffset);
+  }
+
+  void sendPings(std::vector<std::unique_ptr<LoadClient> >& clients) {
+    for (size_t i = 0; i < clients.size(); i++) {
+      LoadClient& client = *clients[i];
+      if (client.ready && client.socket->state() == QAbstractSocket::ConnectedState) {
+        client.socket->write(TelemetryProtocol::encodePing(++client.pingToken, client.heartbeatClock.nsecsElapsed() / 1000));
+      }
+    }
+  }
+
+  void printRow(const char* name, double messagesPerSec, double bytesPerSec,
+                const LatencyHistogram& roundTripTimes, const LatencyHistogram& stateAges) {
+    printf("%-14s %12.1f %12.0f %9.2f %9.2f %9.2f %9.0f %9.0f\n", name, messagesPerSec, bytesPerSec,
+           roundTripTimes.getValueAtPercentile(50) / 1000.0, roundTripTimes.getValueAtPercentile(99) / 1000.0,
+           roundTripTimes.getMax() / 1000.0, stateAges.getValueAtPercentile(50) / 1000.0,
+           stateAges.getValueAtPercentile(99) / 1000.0);
+  }
+
+  void printUsage(const char* appName) {
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  --host <address>      Address of the telemetry server (default: 127.0.0.1)\n"
+            "  --port <n>            Port of the telemetry server (default: %d)\n"
+            "  --clients <n>         Number of clients (default: 32)\n"
+            "  --duration <s>        How long to run for (default: 30)\n"
+            "  --ping-interval <ms>  How often every client pings the server (default: 100)\n",
+            appName, DEFAULT_PORT);
+  }
+}
+
+int main(int argc, char* argv[]) {
+  Options options;
+  for (int i = 1; i < argc; i++) {
+    bool hasValue = (i + 1 < argc);
+    if (strcmp(argv[i], "--host") == 0 && hasValue) {
+      options.host = argv[++i];
+    }
+    else if (strcmp(argv[i], "--port") == 0 && hasValue) {
+      options.port = static_cast<quint16>(atoi(argv[++i]));
+    }
+    else if (strcmp(argv[i], "--clients") == 0 && hasValue) {
+      options.numClients = atoi(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--duration") == 0 && hasValue) {
+      options.durationSecs = atof(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--ping-interval") == 0 && hasValue) {
+      options.pingIntervalMs = atoi(argv[++i]);
+    }
+    else {
+      printUsage(argv[0]);
+      return 1;
+    }
+  }
+
+  if (options.port == 0 || options.numClients <= 0 || options.durationSecs <= 0 || options.pingIntervalMs <= 0) {
+    printUsage(argv[0]);
+    return 1;
+  }
+
+  QCoreApplication app(argc, argv);
+
+  std::vector<std::unique_ptr<LoadClient> > clients;
+  for (int i = 0; i < options.numClients; i++) {
+    clients.push_back(std::unique_ptr<LoadClient>(new LoadClient(i)));
+    LoadClient* client = clients.back().get();
+
+    QObject::connect(client->socket, &QTcpSocket::connected, [client]() {
+      client->heartbeatClock.start();
+      client->socket->write(TelemetryProtocol::encodeGreeting(QString("load-test-%1").arg(client->idx), 0));
+    });
+    QObject::connect(client->socket, &QTcpSocket::readyRead, [client]() {
+      onReadyRead(*client);
+    });
+    QObject::connect(client->socket, &QTcpSocket::disconnected, [client]() {
+      if (!client->failed) {
+        client->failed = true;
+        client->failure = "the server disconnected";
+      }
+    });
+    client->socket->connectToHost(options.host, options.port);
+  }
+
+  QTimer pingTimer;
+  QObject::connect(&pingTimer, &QTimer::timeout, [&clients]() {
+    sendPings(clients);
+  });
+  pingTimer.start(options.pingIntervalMs);
+
+  printf("Telemetry load test: %d client(s) on %s:%d for %.0f s\n", options.numClients,
+         options.host.toLatin1().constData(), options.port, options.durationSecs);
+
+  QElapsedTimer runClock;
+  runClock.start();
+  QTimer::singleShot(static_cast<int>(options.durationSecs * 1000), &app, SLOT(quit()));
+  app.exec();
+  double elapsedSecs = runClock.nsecsElapsed() / 1e9;
+
+  std::string separator(92, '-');
+  printf("%s\n%-14s %12s %12s %9s %9s %9s %9s %9s\n%-14s %12s %12s %29s %19s\n%s\n", separator.c_str(),
+         "Client", "Messages/s", "Bytes/s", "RTT p50", "RTT p99", "RTT max", "Age p50", "Age p99",
+         "", "", "", "(ms)", "(ms)", separator.c_str());
+
+  quint64 numMessages = 0;
+  quint64 numStates = 0;
+  quint64 numPours = 0;
+  quint64 numBytes = 0;
+  int numFailed = 0;
+  LatencyHistogram roundTripTimes;
+  LatencyHistogram stateAges;
+  for (size_t i = 0; i < clients.size(); i++) {
+    LoadClient& client = *clients[i];
+    if (!client.failed && !client.ready) {
+      fail(client, "never got a greeting from the server");
+    }
+    else if (!client.failed && client.numStates == 0) {
+      fail(client, "never got any state from the server");
+    }
+    if (client.failed) {
+      numFailed++;
+    }
+
+    char name[32];
+    snprintf(name, sizeof(name), "load-test-%d", client.idx);
+    printRow(name, client.numMessages / elapsedSecs, client.numBytes / elapsedSecs,
+             client.roundTripTimes, client.stateAges);
+
+    numMessages += client.numMessages;
+    numStates += client.numStates;
+    numPours += client.numPours;
+    numBytes += client.numBytes;
+    roundTripTimes.add(client.roundTripTimes);
+    stateAges.add(client.stateAges);
+  }
+  printf("%s\n", separator.c_str());
+  printRow("All", numMessages / elapsedSecs, numBytes / elapsedSecs, roundTripTimes, stateAges);
+
+  printf("\nFanned out %llu message(s) in %.1f s (%llu snapshot(s) and delta(s), %llu pour(s)), "
+         "%.0f messages/s and %.2f MB/s in all\n",
+         (unsigned long long)numMessages, elapsedSecs, (unsigned long long)numStates, (unsigned long long)numPours,
+         numMessages / elapsedSecs, numBytes / (elapsedSecs * 1024 * 1024));
+
+  for (size_t i = 0; i < clients.size(); i++) {
+    if (clients[i]->failed) {
+      fprintf(stderr, "load-test-%d failed: %s\n", clients[i]->idx, clients[i]->failure.toLocal8Bit().constData());
+    }
+  }
+  return numFailed > 0 ? 1 : 0;
+}
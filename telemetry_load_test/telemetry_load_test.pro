@@ -0,0 +1,25 @@
+#-------------------------------------------------
+#
+# Load tests the telemetry server of KegMeterServer with a swarm of clients over loopback, and
+# reports the fan-out throughput and the latency every client sees.
+#
+#-------------------------------------------------
+
+QT       += core network
+QT       -= gui
+CONFIG   += console c++11
+CONFIG   -= app_bundle
+
+TARGET = telemetry_load_test
+TEMPLATE = app
+
+COMMON_DIR = $$PWD/../keg_meter_common
+
+INCLUDEPATH += $$COMMON_DIR
+DEPENDPATH  += $$COMMON_DIR
+
+SOURCES += telemetry_load_test.cpp \
+    $$COMMON_DIR/telemetryprotocol.cpp
+
+HEADERS  += $$COMMON_DIR/latencyhistogram.h \
+    $$COMMON_DIR/telemetryprotocol.h